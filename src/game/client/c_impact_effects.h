@@ -56,15 +56,8 @@ public:
 		Vector	saveVelocity = pParticle->m_vecVelocity;
 
 		//Decellerate
-		static float dtime;
-		static float decay;
-
-		if ( dtime != timeDelta )
-		{
-			dtime = timeDelta;
-			float expected = 0.5;
-			decay = exp( log( 0.0001f ) * dtime / expected );
-		}
+		float expected = 0.5;
+		float decay = exp( log( 0.0001f ) * timeDelta / expected );
 
 		pParticle->m_vecVelocity = pParticle->m_vecVelocity * decay;
 
@@ -25,6 +25,7 @@
 #include "materialsystem/imaterialsystemhardwareconfig.h"
 #include "tier1/callqueue.h"
 #include "tier1/memstack.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -98,11 +99,26 @@ static ConVar rope_solid_maxwidth( "rope_solid_maxwidth", "1" );
 static ConVar rope_solid_minalpha( "rope_solid_minalpha", "0.0" );
 static ConVar rope_solid_maxalpha( "rope_solid_maxalpha", "1" );
 
+static ConVar rope_batch_sim( "rope_batch_sim", "1", 0, "Simulate the ropes that don't collide with the world on the job pool, after the client thinks." );
+static ConVar rope_batch_sim_min( "rope_batch_sim_min", "4", 0, "Fewer ropes than this in a frame are simulated on the main thread." );
+static ConVar rope_lod( "rope_lod", "1", 0, "Simulate offscreen and distant ropes at a lower rate." );
+static ConVar rope_lod_dist( "rope_lod_dist", "2000", 0, "Ropes past this distance from the view simulate every rope_lod_far_interval seconds." );
+static ConVar rope_lod_far_interval( "rope_lod_far_interval", "0.05", 0, "How often, in seconds, ropes past rope_lod_dist simulate." );
+static ConVar rope_lod_offscreen_interval( "rope_lod_offscreen_interval", "0.2", 0, "Ropes that weren't drawn last frame simulate this often." );
+static ConVar rope_lod_maxtime( "rope_lod_maxtime", "0.04", 0, "Most time a reduced rate rope advances in one update. The rest is dropped, so they move slower than full rate ropes." );
+static ConVar rope_showstats( "rope_showstats", "0", 0, "Show the number of ropes simulated each frame and the time it took." );
+
 
 static CCycleCount	g_RopeCollideTicks;
 static CCycleCount	g_RopeDrawTicks;
 static CCycleCount	g_RopeSimulateTicks;
 static int			g_nRopePointsSimulated;
+static int			g_nRopesSimulated;
+static int			g_nRopesBatched;
+static int			g_nRopesLODSkipped;
+
+// Ropes ClientThink queued for C_RopeKeyframe::SimulateBatch.
+static CUtlVector<C_RopeKeyframe*> g_RopeSimBatch;
 
 // Active ropes.
 CUtlLinkedList<C_RopeKeyframe*, int> g_Ropes;
@@ -847,6 +863,9 @@ void Rope_ResetCounters()
 	g_RopeDrawTicks.Init();
 	g_RopeSimulateTicks.Init();
 	g_nRopePointsSimulated = 0;
+	g_nRopesSimulated = 0;
+	g_nRopesBatched = 0;
+	g_nRopesLODSkipped = 0;
 }
 
 
@@ -887,25 +906,10 @@ void C_RopeKeyframe::CPhysicsDelegate::GetNodeForces( CSimplePhysics::CNode *pNo
 		pAccel->Init( ROPE_GRAVITY );
 	}
 
+	// The wind is worked out once per frame in UpdateWindAccel.
 	if( !m_pKeyframe->m_LinksTouchingSomething[iNode] && m_pKeyframe->m_bApplyWind)
 	{
-		Vector vecWindVel;
-		GetWindspeedAtTime(gpGlobals->curtime, vecWindVel);
-		if ( vecWindVel.LengthSqr() > 0 )
-		{
-			Vector vecWindAccel;
-			VectorMA( *pAccel, WIND_FORCE_FACTOR, vecWindVel, *pAccel );
-		}
-		else
-		{
-			if (m_pKeyframe->m_flCurrentGustTimer < m_pKeyframe->m_flCurrentGustLifetime )
-			{
-				float div = m_pKeyframe->m_flCurrentGustTimer / m_pKeyframe->m_flCurrentGustLifetime;
-				float scale = 1 - cos( div * M_PI );
-
-				*pAccel += m_pKeyframe->m_vWindDir * scale;
-			}
-		}
+		*pAccel += m_pKeyframe->m_vWindAccel;
 	}
 
 	// HACK.. shake the rope around.
@@ -1041,6 +1045,7 @@ C_RopeKeyframe::C_RopeKeyframe()
 	m_bEndPointAttachmentPositionsDirty = true;
 	m_bEndPointAttachmentAnglesDirty = true;
 	m_PhysicsDelegate.m_pKeyframe = this;
+	m_bPhysicsHooked = false;
 	m_pMaterial = NULL;
 	m_bPhysicsInitted = false;
 	m_RopeFlags = 0;
@@ -1049,6 +1054,8 @@ C_RopeKeyframe::C_RopeKeyframe()
 	m_iStartAttachment = m_iEndAttachment = 0;
 	m_vColorMod.Init( 1, 1, 1 );
 	m_nLinksTouchingSomething = 0;
+	m_bApplyWind = false;
+	m_vWindAccel.Init();
 	m_Subdiv = 255; // default to using the cvar
 	
 	m_fLockedPoints = 0;
@@ -1059,6 +1066,10 @@ C_RopeKeyframe::C_RopeKeyframe()
 	m_TextureScale = 4;	// 4:1
 	m_flImpulse.Init();
 
+	m_flSimTimeAccum = 0;
+	m_flBatchSimTime = 0;
+	m_nLastDrawnFrame = 0;
+
 	g_Ropes.AddToTail( this );
 }
 
@@ -1067,6 +1078,7 @@ C_RopeKeyframe::~C_RopeKeyframe()
 {
 	s_RopeManager.RemoveRopeFromQueuedRenderCaches( this );	
 	g_Ropes.FindAndRemove( this );
+	g_RopeSimBatch.FindAndRemove( this );
 
 	if ( m_pBackMaterial )
 	{
@@ -1242,6 +1254,7 @@ C_BaseEntity* C_RopeKeyframe::GetEndEntity() const
 CSimplePhysics::IHelper* C_RopeKeyframe::HookPhysics( CSimplePhysics::IHelper *pHook )
 {
 	m_RopePhysics.SetDelegate( pHook );
+	m_bPhysicsHooked = ( pHook != &m_PhysicsDelegate );
 	return &m_PhysicsDelegate;
 }
 
@@ -1357,6 +1370,134 @@ void C_RopeKeyframe::RunRopeSimulation( float flSeconds )
 	}
 }
 
+void C_RopeKeyframe::RunBatchedRopeSimulation( C_RopeKeyframe *&pRope )
+{
+	pRope->RunRopeSimulation( pRope->m_flBatchSimTime );
+}
+
+void C_RopeKeyframe::SimulateBatch()
+{
+	int nCount = g_RopeSimBatch.Count();
+	if ( nCount )
+	{
+		VPROF_BUDGET( "C_RopeKeyframe::SimulateBatch", VPROF_BUDGETGROUP_ROPES );
+
+		{
+			CTimeAdder adder( &g_RopeSimulateTicks );
+
+			if ( nCount >= rope_batch_sim_min.GetInt() && g_pThreadPool && g_pThreadPool->NumThreads() )
+			{
+				ParallelProcess( "C_RopeKeyframe::SimulateBatch", g_RopeSimBatch.Base(), nCount, &RunBatchedRopeSimulation );
+			}
+			else
+			{
+				for ( int i = 0; i < nCount; i++ )
+				{
+					RunBatchedRopeSimulation( g_RopeSimBatch[i] );
+				}
+			}
+		}
+
+		// Bounds go through the leaf system, which is main thread only.
+		for ( int i = 0; i < nCount; i++ )
+		{
+			C_RopeKeyframe *pRope = g_RopeSimBatch[i];
+			pRope->UpdateBBox();
+			g_nRopePointsSimulated += pRope->m_RopePhysics.NumNodes();
+		}
+
+		g_nRopesSimulated += nCount;
+		g_nRopesBatched += nCount;
+		g_RopeSimBatch.RemoveAll();
+	}
+
+	if ( rope_showstats.GetBool() )
+	{
+		engine->Con_NPrintf( 0, "Ropes: %d active, %d simulated (%d batched), %d skipped by lod, %d points",
+			g_Ropes.Count(), g_nRopesSimulated, g_nRopesBatched, g_nRopesLODSkipped, g_nRopePointsSimulated );
+		engine->Con_NPrintf( 1, "Rope simulate: %.3fms, collide: %.3fms",
+			g_RopeSimulateTicks.GetMillisecondsF(), g_RopeCollideTicks.GetMillisecondsF() );
+	}
+}
+
+bool C_RopeKeyframe::CanBatchSimulate()
+{
+	// Someone else's constraints may not be safe to run off the main thread.
+	if ( m_bPhysicsHooked )
+		return false;
+
+	// World traces stay on the main thread.
+	if( ((m_RopeFlags & ROPE_COLLIDE) && rope_collide.GetInt()) || (rope_collide.GetInt() == 2) )
+		return false;
+
+	// RandomVector isn't thread safe.
+	if ( rope_shake.GetInt() )
+		return false;
+
+	return true;
+}
+
+float C_RopeKeyframe::GetSimulationInterval()
+{
+	if ( !rope_lod.GetBool() || m_bNewDataThisFrame )
+		return 0;
+
+	// DrawModel runs after the client thinks, so a visible rope was drawn last frame.
+	if ( gpGlobals->framecount - m_nLastDrawnFrame > 1 )
+		return rope_lod_offscreen_interval.GetFloat();
+
+	float flDist = CalcDistanceToLineSegment( MainViewOrigin(), m_RopePhysics.GetFirstNode()->m_vPos, m_RopePhysics.GetLastNode()->m_vPos );
+	if ( flDist > rope_lod_dist.GetFloat() )
+		return rope_lod_far_interval.GetFloat();
+
+	return 0;
+}
+
+void C_RopeKeyframe::UpdateWindAccel()
+{
+	m_vWindAccel.Init();
+
+	if ( !m_bApplyWind )
+		return;
+
+	Vector vecWindVel;
+	GetWindspeedAtTime(gpGlobals->curtime, vecWindVel);
+	if ( vecWindVel.LengthSqr() > 0 )
+	{
+		m_vWindAccel = vecWindVel * WIND_FORCE_FACTOR;
+	}
+	else
+	{
+		if (m_flCurrentGustTimer < m_flCurrentGustLifetime )
+		{
+			float div = m_flCurrentGustTimer / m_flCurrentGustLifetime;
+			float scale = 1 - cos( div * M_PI );
+
+			m_vWindAccel = m_vWindDir * scale;
+		}
+	}
+}
+
+void C_RopeKeyframe::UpdateWindGust( float flSeconds )
+{
+	m_flCurrentGustTimer += flSeconds;
+	m_flTimeToNextGust -= flSeconds;
+	if( m_flTimeToNextGust <= 0 )
+	{
+		m_vWindDir = RandomVector( -1, 1 );
+		VectorNormalize( m_vWindDir );
+
+		static float basicScale = 50;
+		m_vWindDir *= basicScale;
+		m_vWindDir *= RandomFloat( -1.0f, 1.0f );
+		
+		m_flCurrentGustTimer = 0;
+		m_flCurrentGustLifetime = RandomFloat( 2.0f, 3.0f );
+
+		m_flTimeToNextGust = RandomFloat( 3.0f, 4.0f );
+	}
+}
+
 Vector C_RopeKeyframe::ConstrainNode( const Vector &vNormal, const Vector &vNodePosition, const Vector &vMidpiont, float fNormalLength )
 {
 	// Get triangle edges formed
@@ -1406,37 +1547,56 @@ void C_RopeKeyframe::ClientThink()
 	if( !InitRopePhysics() ) // init if not already
 		return;
 
-	if( !DetectRestingState( m_bApplyWind ) )
+	if( DetectRestingState( m_bApplyWind ) )
 	{
-		// Update the simulation.
-		CTimeAdder adder( &g_RopeSimulateTicks );
-		
-		RunRopeSimulation( gpGlobals->frametime );
+		m_flSimTimeAccum = 0;
+		return;
+	}
 
-		g_nRopePointsSimulated += m_RopePhysics.NumNodes();
+	// Offscreen and distant ropes don't update every frame, and drop some of the time they skipped.
+	m_flSimTimeAccum += gpGlobals->frametime;
 
-		m_bNewDataThisFrame = false;
+	float flInterval = GetSimulationInterval();
+	if ( m_flSimTimeAccum < flInterval )
+	{
+		++g_nRopesLODSkipped;
+		return;
+	}
 
-		// Setup a new wind gust?
-		m_flCurrentGustTimer += gpGlobals->frametime;
-		m_flTimeToNextGust -= gpGlobals->frametime;
-		if( m_flTimeToNextGust <= 0 )
-		{
-			m_vWindDir = RandomVector( -1, 1 );
-			VectorNormalize( m_vWindDir );
+	float flElapsed = m_flSimTimeAccum;
+	float flSimTime = ( flInterval > 0 ) ? MIN( flElapsed, rope_lod_maxtime.GetFloat() ) : flElapsed;
+	m_flSimTimeAccum = 0;
 
-			static float basicScale = 50;
-			m_vWindDir *= basicScale;
-			m_vWindDir *= RandomFloat( -1.0f, 1.0f );
-			
-			m_flCurrentGustTimer = 0;
-			m_flCurrentGustLifetime = RandomFloat( 2.0f, 3.0f );
+	m_bNewDataThisFrame = false;
 
-			m_flTimeToNextGust = RandomFloat( 3.0f, 4.0f );
-		}
+	UpdateWindAccel();
+
+	// Setup a new wind gust?
+	UpdateWindGust( flElapsed );
 
-		UpdateBBox();
+	if ( rope_batch_sim.GetBool() && CanBatchSimulate() )
+	{
+		// The job can't compute the endpoint attachments, so cache them now.
+		Vector vPos;
+		QAngle angle;
+		GetEndPointAttachment( 0, vPos, angle );
+
+		m_flBatchSimTime = flSimTime;
+		g_RopeSimBatch.AddToTail( this );
+		return;
+	}
+
+	{
+		// Update the simulation.
+		CTimeAdder adder( &g_RopeSimulateTicks );
+		
+		RunRopeSimulation( flSimTime );
 	}
+
+	g_nRopePointsSimulated += m_RopePhysics.NumNodes();
+	++g_nRopesSimulated;
+
+	UpdateBBox();
 }
 
 
@@ -1465,6 +1625,8 @@ int C_RopeKeyframe::DrawModel( int flags )
 
 	ConstrainNodesBetweenEndpoints();
 
+	m_nLastDrawnFrame = gpGlobals->framecount;
+
 	RopeManager()->AddToRenderCache( this );
 	return 1;
 }
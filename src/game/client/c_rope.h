@@ -121,6 +121,9 @@ public:
 
 	void			BuildRope( RopeSegData_t *pRopeSegment, const Vector &vCurrentViewForward, const Vector &vCurrentViewOrigin, BuildRopeQueuedData_t *pQueuedData, bool bQueued );
 
+	// Simulates the ropes ClientThink queued up this frame on the job pool.
+	static void		SimulateBatch();
+
 // C_BaseEntity overrides.
 public:
 
@@ -141,6 +144,11 @@ private:
 	void			FinishInit( const char *pMaterialName );
 
 	void			RunRopeSimulation( float flSeconds );
+	static void		RunBatchedRopeSimulation( C_RopeKeyframe *&pRope );
+	bool			CanBatchSimulate();
+	float			GetSimulationInterval();
+	void			UpdateWindAccel();
+	void			UpdateWindGust( float flSeconds );
 	Vector			ConstrainNode( const Vector &vNormal, const Vector &vNodePosition, const Vector &vMidpiont, float fNormalLength );
 	void			ConstrainNodesBetweenEndpoints( void );
 
@@ -166,6 +174,7 @@ private:
 	CBitVec<ROPE_MAX_SEGMENTS>		m_LinksTouchingSomething;
 	int								m_nLinksTouchingSomething;
 	bool							m_bApplyWind;
+	Vector							m_vWindAccel;		// Wind force for this frame, the same for every node.
 	int								m_fPrevLockedPoints;	// Which points are locked down.
 	int								m_iForcePointMoveCounter;
 
@@ -200,6 +209,12 @@ private:
 	float				m_Width;
 
 	CPhysicsDelegate	m_PhysicsDelegate;
+	bool				m_bPhysicsHooked;	// Someone else's delegate is in charge, so it can't run on the job pool.
+
+	// Simulation LOD.
+	float			m_flSimTimeAccum;	// Time passed since the rope last simulated.
+	float			m_flBatchSimTime;	// Time the queued batch simulation will advance.
+	int				m_nLastDrawnFrame;
 
 	IMaterial		*m_pMaterial;
 	IMaterial		*m_pBackMaterial;			// Optional translucent background material for the rope to help reduce aliasing.
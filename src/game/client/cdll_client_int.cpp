@@ -2558,6 +2558,9 @@ void OnRenderStart()
 	SimulateEntities();
 	PhysicsSimulate();
 
+	// Ropes queued their simulation in their client think.
+	C_RopeKeyframe::SimulateBatch();
+
 	C_BaseAnimating::ThreadedBoneSetup();
 	
 #ifdef OF_CLIENT_DLL
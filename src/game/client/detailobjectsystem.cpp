@@ -36,6 +36,7 @@
 #endif
 
 #include "materialsystem/imaterialsystemhardwareconfig.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -56,6 +57,10 @@ ConVar cl_detail_avoid_radius( "cl_detail_avoid_radius", "0", FCVAR_ARCHIVE, "ra
 ConVar cl_detail_avoid_force( "cl_detail_avoid_force", "0", FCVAR_ARCHIVE, "force with which to avoid players ( in units, percentage of the width of the detail sprite )" );
 ConVar cl_detail_avoid_recover_speed( "cl_detail_avoid_recover_speed", "0", FCVAR_ARCHIVE, "how fast to recover position after avoiding players" );
 #endif
+ConVar cl_detail_threaded_sort( "cl_detail_threaded_sort", "1", 0, "Sort the detail sprites of each leaf on the thread pool" );
+ConVar cl_detail_threaded_sort_min( "cl_detail_threaded_sort_min", "4", 0, "Fewest leaves to sort before cl_detail_threaded_sort uses the thread pool" );
+ConVar cl_detail_sort_reuse_dist( "cl_detail_sort_reuse_dist", "4", 0, "Reuse the sorted fast detail sprites of a leaf while the view stays within this many units of where they were sorted, and the move is under cl_detail_sort_reuse_angle as seen from the nearest sprite. 0 to sort every view" );
+ConVar cl_detail_sort_reuse_angle( "cl_detail_sort_reuse_angle", "2", 0, "How many degrees the view can turn before the reused fast detail sprites of a leaf are sorted again" );
 
 // Per detail instance information
 struct DetailModelAdvInfo_t
@@ -338,10 +343,22 @@ class CFastDetailLeafSpriteList : public CClientLeafSubSystemData
 	int m_nNumPendingSprites;
 	int m_nStartSpriteIndex;
 
+	// the view the sprites were last built out and sorted for
+	int m_nNumSortedSprites;
+	int m_nSortGeneration;
+	Vector m_vecSortOrigin;
+	Vector m_vecSortForward;
+	float m_flSortNearestDist;								// to the nearest sprite that was built out
+
 	CFastDetailLeafSpriteList( void )
 	{
 		m_nNumPendingSprites = 0;
 		m_nStartSpriteIndex = 0;
+		m_nNumSortedSprites = 0;
+		m_nSortGeneration = -1;
+		m_vecSortOrigin.Init();
+		m_vecSortForward.Init();
+		m_flSortNearestDist = 0.0f;
 	}
 
 };
@@ -410,6 +427,9 @@ public:
 	DetailPropLightstylesLump_t& DetailLighting( int i ) { return m_DetailLighting[i]; }
 	DetailPropSpriteDict_t& DetailSpriteDict( int i ) { return m_DetailSpriteDict[i]; }
 
+	// Times building and sorting the fast sprites around the view, and filling a mesh with them in memory
+	void BenchmarkFastSprites( int nFrames );
+
 private:
 	struct DetailModelDict_t
 	{
@@ -428,11 +448,32 @@ private:
 		float m_flDistance;
 	};
 
+	struct LeafSort_t
+	{
+		int m_nLeaf;
+		int m_nCount;
+	};
+
 	int BuildOutSortedSprites( CFastDetailLeafSpriteList *pData,
 							   Vector const &viewOrigin,
 							   Vector const &viewForward,
-							   Vector const &viewRight,
-							   Vector const &viewUp );
+							   SortInfo_t *pSortInfo,
+							   FastSpriteQuadBuildoutBufferX4_t *pQuadBuffer ) const;
+
+	// Every leaf has its own part of m_pFastSortInfo and m_pBuildoutBuffer, at the same spot as its sprites in m_pFastSpriteData
+	SortInfo_t *GetFastSortInfo( CFastDetailLeafSpriteList const *pData ) const;
+	FastSpriteQuadBuildoutBufferX4_t *GetFastBuildoutBuffer( CFastDetailLeafSpriteList const *pData ) const;
+
+	// Builds out and sorts the fast sprites of the leaves whose last sort can't be reused for this view
+	bool IsFastSpriteSortValid( CFastDetailLeafSpriteList const *pData, Vector const &viewOrigin, Vector const &viewForward ) const;
+	void SortFastSpritesInLeaf( CFastDetailLeafSpriteList *&pData );
+	void SortFastSpritesInLeaves( Vector const &viewOrigin, Vector const &viewForward, int nLeafCount, LeafIndex_t const *pLeafList );
+
+	// Sorts the old style sprites of each leaf into its own part of m_pSortInfo
+	void SortSpritesInLeaf( LeafSort_t &leaf );
+
+	bool ShouldSortInParallel( int nCount ) const;
+	void ComputeFadeDistances();
 
 	void RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList );
 
@@ -486,6 +527,15 @@ private:
 	SortInfo_t *m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *m_pBuildoutBuffer;
 
+	// The view the leaves are being sorted for
+	Vector m_vecSortOrigin;
+	Vector m_vecSortForward;
+	CUtlVector<CFastDetailLeafSpriteList *> m_FastLeavesToSort;
+	CUtlVector<LeafSort_t> m_LeavesToSort;
+
+	// Fast sprite sorts from an older generation were faded with other distances
+	int m_nFastSortGeneration;
+
 	float m_flDefaultFadeStart;
 	float m_flDefaultFadeEnd;
 
@@ -1402,6 +1452,10 @@ CDetailObjectSystem::CDetailObjectSystem() : m_DetailSpriteDict( 0, 32 ), m_Deta
 	m_pSortInfo = NULL;
 	m_pFastSortInfo = NULL;
 	m_pBuildoutBuffer = NULL;
+	m_nFastSortGeneration = 0;
+	m_flCurMaxSqDist = 0.0f;
+	m_flCurFadeSqDist = 0.0f;
+	m_flCurFalloffFactor = 0.0f;
 }
 
 void CDetailObjectSystem::FreeSortBuffers( void )
@@ -1764,19 +1818,21 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 
 	FreeSortBuffers();
 
+	// The sort buffers have room for every leaf at once, so leaves can be sorted in parallel
+	// and the fast sprites can keep their sorts from one view to the next
 	if ( nMaxOldInLeaf )
 	{
 		m_pSortInfo = reinterpret_cast<SortInfo_t *> (
-			MemAlloc_AllocAligned( (3 + nMaxOldInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+			MemAlloc_AllocAligned( (3 + nNumOldStyleObjects ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
 	}
 	if ( nMaxFastInLeaf )
 	{
 		m_pFastSortInfo = reinterpret_cast<SortInfo_t *> (
-			MemAlloc_AllocAligned( (3 + nMaxFastInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+			MemAlloc_AllocAligned( (3 + nNumFastSpritesToAllocate ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
 
 		m_pBuildoutBuffer = reinterpret_cast<FastSpriteQuadBuildoutBufferX4_t *> (
 			MemAlloc_AllocAligned( 
-				( 1 + nMaxFastInLeaf / 4 ) * sizeof( FastSpriteQuadBuildoutBufferX4_t ),
+				( 1 + nNumFastSpritesToAllocate / 4 ) * sizeof( FastSpriteQuadBuildoutBufferX4_t ),
 				sizeof( fltx4 ) ) );
 	}
 
@@ -2147,6 +2203,14 @@ int CDetailObjectSystem::SortSpritesBackToFront( int nLeaf, const Vector &viewOr
 }
 
 
+void CDetailObjectSystem::SortSpritesInLeaf( LeafSort_t &leaf )
+{
+	int nFirstDetailObject, nDetailObjectCount;
+	ClientLeafSystem()->GetDetailObjectsInLeaf( leaf.m_nLeaf, nFirstDetailObject, nDetailObjectCount );
+	leaf.m_nCount = SortSpritesBackToFront( leaf.m_nLeaf, m_vecSortOrigin, m_vecSortForward, m_pSortInfo + nFirstDetailObject );
+}
+
+
 #define MAGIC_NUMBER (1<<23)
 #ifdef VALVE_BIG_ENDIAN
 #define MANTISSA_LSB_OFFSET 3
@@ -2159,17 +2223,62 @@ static fltx4 Four_255s={ 255.0, 255.0, 255.0, 255.0 };
 static ALIGN16 int32 And255Mask[4] ALIGN16_POST = {0xff,0xff,0xff,0xff};
 #define PIXMASK ( * ( reinterpret_cast< fltx4 *>( &And255Mask ) ) )
 
+//-----------------------------------------------------------------------------
+// Adds one built out fast sprite to a mesh
+//-----------------------------------------------------------------------------
+template< class MESHBUILDER >
+static FORCEINLINE void AddFastSpriteQuad( MESHBUILDER &meshBuilder, FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer, int nIndex )
+{
+	int nSIMDIdx = nIndex >> 2;
+	int nSubIdx = nIndex & 3;
+
+	FastSpriteQuadBuildoutBufferNonSIMDView_t const *pquad = pQuadBuffer+nSIMDIdx;
+
+	// voodoo - since everything is in 4s, offset structure pointer by a couple of floats to handle sub-index
+	pquad = (FastSpriteQuadBuildoutBufferNonSIMDView_t const *) ( ( (intp) ( pquad ) )+ ( nSubIdx << 2 ) );
+	uint8 const *pColorsCasted = reinterpret_cast<uint8 const *> ( pquad->m_Alpha );
+
+	uint8 color[4];
+	color[0] = pquad->m_RGBColor[0][0];
+	color[1] = pquad->m_RGBColor[0][1];
+	color[2] = pquad->m_RGBColor[0][2];
+	color[3] = pColorsCasted[MANTISSA_LSB_OFFSET];
+
+	DetailPropSpriteDict_t *pDict = pquad->m_pSpriteDefs[0];
+
+	meshBuilder.Position3f( pquad->m_flX0[0], pquad->m_flY0[0], pquad->m_flZ0[0] );
+	meshBuilder.Color4ubv( color );
+	meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexLR.y );
+	meshBuilder.AdvanceVertex();
+
+	meshBuilder.Position3f( pquad->m_flX1[0], pquad->m_flY1[0], pquad->m_flZ1[0] );
+	meshBuilder.Color4ubv( color );
+	meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexUL.y );
+	meshBuilder.AdvanceVertex();
+
+	meshBuilder.Position3f( pquad->m_flX2[0], pquad->m_flY2[0], pquad->m_flZ2[0] );
+	meshBuilder.Color4ubv( color );
+	meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexUL.y );
+	meshBuilder.AdvanceVertex();
+
+	meshBuilder.Position3f( pquad->m_flX3[0], pquad->m_flY3[0], pquad->m_flZ3[0] );
+	meshBuilder.Color4ubv( color );
+	meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexLR.y );
+	meshBuilder.AdvanceVertex();
+}
+
+
 int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData,
 												Vector const &viewOrigin,
 												Vector const &viewForward,
-												Vector const &viewRight,
-												Vector const &viewUp )
+												SortInfo_t *pSortInfo,
+												FastSpriteQuadBuildoutBufferX4_t *pQuadBuffer ) const
 {
 	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can
 	int nSIMDSprites = pData->m_nNumSIMDSprites;
 	FastSpriteX4_t const *pSprites = pData->m_pSprites;
-	SortInfo_t *pOut = m_pFastSortInfo;
-	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = m_pBuildoutBuffer;
+	SortInfo_t *pOut = pSortInfo;
+	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = pQuadBuffer;
 	int curidx = 0;
 	int nLastBfMask = 0;
 
@@ -2248,7 +2357,7 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 	} while( --nSIMDSprites );
 
 	// adjust count for tail
-	int nCount = pOut - m_pFastSortInfo;
+	int nCount = pOut - pSortInfo;
 	if ( nLastBfMask != 0xf )						// if last not skipped
 		nCount -= ( 0 - pData->m_nNumSprites ) & 3;
 
@@ -2256,17 +2365,109 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		std::make_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
-		std::sort_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+		std::make_heap( pSortInfo, pSortInfo + nCount, SortLessFunc ); 
+		std::sort_heap( pSortInfo, pSortInfo + nCount, SortLessFunc ); 
 	}
 	return nCount;
 }
 
 
+CDetailObjectSystem::SortInfo_t *CDetailObjectSystem::GetFastSortInfo( CFastDetailLeafSpriteList const *pData ) const
+{
+	return m_pFastSortInfo + 4 * ( pData->m_pSprites - m_pFastSpriteData );
+}
+
+FastSpriteQuadBuildoutBufferX4_t *CDetailObjectSystem::GetFastBuildoutBuffer( CFastDetailLeafSpriteList const *pData ) const
+{
+	return m_pBuildoutBuffer + ( pData->m_pSprites - m_pFastSpriteData );
+}
+
+
+//-----------------------------------------------------------------------------
+// The sprites of a leaf face the view and fade with its distance, so a kept sort
+// is off by the angle the view moved as seen from each sprite. The last sort is
+// kept only while that angle stays within cl_detail_sort_reuse_angle for the
+// nearest sprite, which leaves close by get sorted again after any move.
+//-----------------------------------------------------------------------------
+bool CDetailObjectSystem::IsFastSpriteSortValid( CFastDetailLeafSpriteList const *pData, Vector const &viewOrigin, Vector const &viewForward ) const
+{
+	if ( pData->m_nSortGeneration != m_nFastSortGeneration )
+		return false;
+
+	float flReuseDist = cl_detail_sort_reuse_dist.GetFloat();
+	if ( flReuseDist <= 0.0f )
+		return false;
+
+	float flReuseAngle = DEG2RAD( cl_detail_sort_reuse_angle.GetFloat() );
+	flReuseDist = MIN( flReuseDist, pData->m_flSortNearestDist * tan( flReuseAngle ) );
+
+	if ( pData->m_vecSortOrigin.DistToSqr( viewOrigin ) > flReuseDist * flReuseDist )
+		return false;
+
+	return DotProduct( pData->m_vecSortForward, viewForward ) >= cos( flReuseAngle );
+}
+
+
+void CDetailObjectSystem::SortFastSpritesInLeaf( CFastDetailLeafSpriteList *&pData )
+{
+	SortInfo_t *pSortInfo = GetFastSortInfo( pData );
+	pData->m_nNumSortedSprites = BuildOutSortedSprites( pData, m_vecSortOrigin, m_vecSortForward, pSortInfo, GetFastBuildoutBuffer( pData ) );
+
+	// sorted back to front, so the nearest one is last
+	pData->m_flSortNearestDist = pData->m_nNumSortedSprites ? FastSqrt( pSortInfo[pData->m_nNumSortedSprites - 1].m_flDistance ) : 0.0f;
+	pData->m_vecSortOrigin = m_vecSortOrigin;
+	pData->m_vecSortForward = m_vecSortForward;
+	pData->m_nSortGeneration = m_nFastSortGeneration;
+}
+
+
+bool CDetailObjectSystem::ShouldSortInParallel( int nCount ) const
+{
+	return cl_detail_threaded_sort.GetBool() && ( nCount >= cl_detail_threaded_sort_min.GetInt() ) &&
+		g_pThreadPool && ( g_pThreadPool->NumThreads() > 0 );
+}
+
+
+void CDetailObjectSystem::SortFastSpritesInLeaves( Vector const &viewOrigin, Vector const &viewForward, int nLeafCount, LeafIndex_t const *pLeafList )
+{
+	VPROF_BUDGET( "CDetailObjectSystem::SortFastSpritesInLeaves", VPROF_BUDGETGROUP_DETAILPROP_RENDERING );
+
+	m_FastLeavesToSort.RemoveAll();
+	for ( int i = 0; i < nLeafCount; ++i )
+	{
+		CFastDetailLeafSpriteList *pData = reinterpret_cast<CFastDetailLeafSpriteList *> (
+			ClientLeafSystem()->GetSubSystemDataInLeaf( pLeafList[i], CLSUBSYSTEM_DETAILOBJECTS ) );
+
+		if ( pData && !IsFastSpriteSortValid( pData, viewOrigin, viewForward ) )
+		{
+			m_FastLeavesToSort.AddToTail( pData );
+		}
+	}
+
+	int nCount = m_FastLeavesToSort.Count();
+	if ( nCount == 0 )
+		return;
+
+	m_vecSortOrigin = viewOrigin;
+	m_vecSortForward = viewForward;
+
+	if ( ShouldSortInParallel( nCount ) )
+	{
+		ParallelProcess( "CDetailObjectSystem::SortFastSpritesInLeaf", m_FastLeavesToSort.Base(), nCount, this, &CDetailObjectSystem::SortFastSpritesInLeaf );
+	}
+	else
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			SortFastSpritesInLeaf( m_FastLeavesToSort[i] );
+		}
+	}
+}
+
+
 void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList )
 {
 	// Here, we must draw all detail objects back-to-front
-	// FIXME: Cache off a sorted list so we don't have to re-sort every frame
 
 	// Count the total # of detail quads we possibly could render
 	int nMaxInLeaf;
@@ -2277,6 +2478,8 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 	if  ( r_DrawDetailProps.GetInt() == 0 )
 		return;
 
+	// Build out and sort the leaves before locking the mesh, so the workers can do it
+	SortFastSpritesInLeaves( viewOrigin, viewForward, nLeafCount, pLeafList );
 
 	CMatRenderContextPtr pRenderContext( materials );
 	pRenderContext->MatrixMode( MATERIAL_MODEL );
@@ -2308,9 +2511,7 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 
 	meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
 
-
-
-	// Sort detail sprites in each leaf independently; then render them
+	// Stuff the sorted sprites of each leaf into the vb
 	for ( int i = 0; i < nLeafCount; ++i )
 	{
 		int nLeaf = pLeafList[i];
@@ -2322,12 +2523,10 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 		{
 			Assert( pData->m_nNumSprites );					// ptr with no sprites?
 
-			int nCount = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
-
-			// part 3 - stuff the sorted sprites into the vb
-			SortInfo_t const *pDraw = m_pFastSortInfo;
+			int nCount = pData->m_nNumSortedSprites;
+			SortInfo_t const *pDraw = GetFastSortInfo( pData );
 			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
-				( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) m_pBuildoutBuffer;
+				( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) GetFastBuildoutBuffer( pData );
 
 			COMPILE_TIME_ASSERT( sizeof( FastSpriteQuadBuildoutBufferNonSIMDView_t ) ==
 								 sizeof( FastSpriteQuadBuildoutBufferX4_t ) );
@@ -2346,43 +2545,7 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 				nQuadsRemaining -= nToDraw;
 				while( nToDraw-- )
 				{
-					// draw the sucker
-					int nSIMDIdx = pDraw->m_nIndex >> 2;
-					int nSubIdx = pDraw->m_nIndex & 3;
-
-					FastSpriteQuadBuildoutBufferNonSIMDView_t const *pquad = pQuadBuffer+nSIMDIdx;
-
-					// voodoo - since everything is in 4s, offset structure pointer by a couple of floats to handle sub-index
-					pquad = (FastSpriteQuadBuildoutBufferNonSIMDView_t const *) ( ( (int) ( pquad ) )+ ( nSubIdx << 2 ) );
-					uint8 const *pColorsCasted = reinterpret_cast<uint8 const *> ( pquad->m_Alpha );
-
-					uint8 color[4];
-					color[0] = pquad->m_RGBColor[0][0];
-					color[1] = pquad->m_RGBColor[0][1];
-					color[2] = pquad->m_RGBColor[0][2];
-					color[3] = pColorsCasted[MANTISSA_LSB_OFFSET];
-
-					DetailPropSpriteDict_t *pDict = pquad->m_pSpriteDefs[0];
-
-					meshBuilder.Position3f( pquad->m_flX0[0], pquad->m_flY0[0], pquad->m_flZ0[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexLR.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX1[0], pquad->m_flY1[0], pquad->m_flZ1[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexUL.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX2[0], pquad->m_flY2[0], pquad->m_flZ2[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexUL.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX3[0], pquad->m_flY3[0], pquad->m_flZ3[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexLR.y );
-					meshBuilder.AdvanceVertex();
+					AddFastSpriteQuad( meshBuilder, pQuadBuffer, pDraw->m_nIndex );
 					pDraw++;
 				}
 			}
@@ -2416,6 +2579,28 @@ void CDetailObjectSystem::RenderTranslucentDetailObjects( const Vector &viewOrig
 	if ( nQuadCount == 0 )
 		return;
 
+	// Sort detail sprites in each leaf independently, before locking the mesh so the workers can do it
+	m_vecSortOrigin = viewOrigin;
+	m_vecSortForward = viewForward;
+	m_LeavesToSort.SetCount( nLeafCount );
+	for ( int i = 0; i < nLeafCount; ++i )
+	{
+		m_LeavesToSort[i].m_nLeaf = pLeafList[i];
+		m_LeavesToSort[i].m_nCount = 0;
+	}
+
+	if ( ShouldSortInParallel( nLeafCount ) )
+	{
+		ParallelProcess( "CDetailObjectSystem::SortSpritesInLeaf", m_LeavesToSort.Base(), nLeafCount, this, &CDetailObjectSystem::SortSpritesInLeaf );
+	}
+	else
+	{
+		for ( int i = 0; i < nLeafCount; ++i )
+		{
+			SortSpritesInLeaf( m_LeavesToSort[i] );
+		}
+	}
+
 	CMatRenderContextPtr pRenderContext( materials );
 	pRenderContext->MatrixMode( MATERIAL_MODEL );
 	pRenderContext->PushMatrix();
@@ -2457,9 +2642,8 @@ void CDetailObjectSystem::RenderTranslucentDetailObjects( const Vector &viewOrig
 		int nFirstDetailObject, nDetailObjectCount;
 		ClientLeafSystem()->GetDetailObjectsInLeaf( nLeaf, nFirstDetailObject, nDetailObjectCount );
 
-		// Sort detail sprites in each leaf independently; then render them
-		SortInfo_t *pSortInfo = m_pSortInfo;
-		int nCount = SortSpritesBackToFront( nLeaf, viewOrigin, viewForward, pSortInfo );
+		SortInfo_t *pSortInfo = m_pSortInfo + nFirstDetailObject;
+		int nCount = m_LeavesToSort[i].m_nCount;
 
 		for ( int j = 0; j < nCount; ++j )
 		{
@@ -2506,7 +2690,13 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 	if ( m_nSortedFastLeaf != nLeaf )
 	{
 		m_nSortedFastLeaf = nLeaf;
-		pData->m_nNumPendingSprites = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
+		if ( !IsFastSpriteSortValid( pData, viewOrigin, viewForward ) )
+		{
+			m_vecSortOrigin = viewOrigin;
+			m_vecSortForward = viewForward;
+			SortFastSpritesInLeaf( pData );
+		}
+		pData->m_nNumPendingSprites = pData->m_nNumSortedSprites;
 		pData->m_nStartSpriteIndex = 0;
 	}
 	if ( pData->m_nNumPendingSprites == 0 )
@@ -2520,7 +2710,8 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 		flMinDistance = vecDelta.LengthSqr();
 	}
 		
-	if ( m_pFastSortInfo[pData->m_nStartSpriteIndex].m_flDistance < flMinDistance )
+	SortInfo_t const *pSortInfo = GetFastSortInfo( pData );
+	if ( pSortInfo[pData->m_nStartSpriteIndex].m_flDistance < flMinDistance )
 		return;
 
 	int nCount = pData->m_nNumPendingSprites;
@@ -2559,10 +2750,10 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 		
 	meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
 
-	SortInfo_t const *pDraw = m_pFastSortInfo + pData->m_nStartSpriteIndex;
+	SortInfo_t const *pDraw = pSortInfo + pData->m_nStartSpriteIndex;
 
 	FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
-		( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) m_pBuildoutBuffer;
+		( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) GetFastBuildoutBuffer( pData );
 	
 	while( nCount && ( pDraw->m_flDistance >= flMinDistance ) )
 	{
@@ -2578,48 +2769,12 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 		nQuadsRemaining -= nToDraw;
 		while( nToDraw-- )
 		{
-			// draw the sucker
-			int nSIMDIdx = pDraw->m_nIndex >> 2;
-			int nSubIdx = pDraw->m_nIndex & 3;
-
-			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pquad = pQuadBuffer+nSIMDIdx;
-
-			// voodoo - since everything is in 4s, offset structure pointer by a couple of floats to handle sub-index
-			pquad = (FastSpriteQuadBuildoutBufferNonSIMDView_t const *) ( ( (int) ( pquad ) )+ ( nSubIdx << 2 ) );
-			uint8 const *pColorsCasted = reinterpret_cast<uint8 const *> ( pquad->m_Alpha );
-
-			uint8 color[4];
-			color[0] = pquad->m_RGBColor[0][0];
-			color[1] = pquad->m_RGBColor[0][1];
-			color[2] = pquad->m_RGBColor[0][2];
-			color[3] = pColorsCasted[MANTISSA_LSB_OFFSET];
-
-			DetailPropSpriteDict_t *pDict = pquad->m_pSpriteDefs[0];
-
-			meshBuilder.Position3f( pquad->m_flX0[0], pquad->m_flY0[0], pquad->m_flZ0[0] );
-			meshBuilder.Color4ubv( color );
-			meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexLR.y );
-			meshBuilder.AdvanceVertex();
-
-			meshBuilder.Position3f( pquad->m_flX1[0], pquad->m_flY1[0], pquad->m_flZ1[0] );
-			meshBuilder.Color4ubv( color );
-			meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexUL.y );
-			meshBuilder.AdvanceVertex();
-
-			meshBuilder.Position3f( pquad->m_flX2[0], pquad->m_flY2[0], pquad->m_flZ2[0] );
-			meshBuilder.Color4ubv( color );
-			meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexUL.y );
-			meshBuilder.AdvanceVertex();
-
-			meshBuilder.Position3f( pquad->m_flX3[0], pquad->m_flY3[0], pquad->m_flZ3[0] );
-			meshBuilder.Color4ubv( color );
-			meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexLR.y );
-			meshBuilder.AdvanceVertex();
+			AddFastSpriteQuad( meshBuilder, pQuadBuffer, pDraw->m_nIndex );
 			pDraw++;
 		}
 	}
 	pData->m_nNumPendingSprites = nCount;
-	pData->m_nStartSpriteIndex = pDraw - m_pFastSortInfo;
+	pData->m_nStartSpriteIndex = pDraw - pSortInfo;
 
 	meshBuilder.End();
 	pMesh->Draw();
@@ -2809,6 +2964,19 @@ void CDetailObjectSystem::BuildDetailObjectRenderLists( const Vector &vViewOrigi
 		}
 	}
 
+	ComputeFadeDistances();
+
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+	pQuery->EnumerateLeavesInSphere( CurrentViewOrigin(), 
+									 cl_detaildist.GetFloat(), this, (int)&ctx );
+}
+
+
+//-----------------------------------------------------------------------------
+// Compute factors to optimize rendering of the detail models
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::ComputeFadeDistances()
+{
 	float factor = 1.0f;
 	C_BasePlayer *local = C_BasePlayer::GetLocalPlayer();
 	if ( local )
@@ -2816,27 +2984,143 @@ void CDetailObjectSystem::BuildDetailObjectRenderLists( const Vector &vViewOrigi
 		factor = local->GetFOVDistanceAdjustFactor();
 	}
 
-	// Compute factors to optimize rendering of the detail models
-	m_flCurMaxSqDist = cl_detaildist.GetFloat() * cl_detaildist.GetFloat();
-	m_flCurFadeSqDist = cl_detaildist.GetFloat() - cl_detailfade.GetFloat();
+	float flMaxSqDist = cl_detaildist.GetFloat() * cl_detaildist.GetFloat();
+	float flFadeSqDist = cl_detaildist.GetFloat() - cl_detailfade.GetFloat();
 
-	m_flCurMaxSqDist /= factor;
-	m_flCurFadeSqDist /= factor;
+	flMaxSqDist /= factor;
+	flFadeSqDist /= factor;
 
-	if ( m_flCurFadeSqDist > 0)
+	if ( flFadeSqDist > 0)
 	{
-		m_flCurFadeSqDist *= m_flCurFadeSqDist;
+		flFadeSqDist *= flFadeSqDist;
 	}
 	else 
 	{
-		m_flCurFadeSqDist = 0;
+		flFadeSqDist = 0;
+	}
+	flFadeSqDist = MIN( flFadeSqDist, flMaxSqDist -1  );
+
+	if ( flMaxSqDist != m_flCurMaxSqDist || flFadeSqDist != m_flCurFadeSqDist )
+	{
+		// The fast sprites that were sorted were also culled and faded with the old distances
+		++m_nFastSortGeneration;
 	}
-	m_flCurFadeSqDist = MIN( m_flCurFadeSqDist, m_flCurMaxSqDist -1  );
+
+	m_flCurMaxSqDist = flMaxSqDist;
+	m_flCurFadeSqDist = flFadeSqDist;
 	m_flCurFalloffFactor = 255.0f / ( m_flCurMaxSqDist - m_flCurFadeSqDist );
+}
 
 
-	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInSphere( CurrentViewOrigin(), 
-									 cl_detaildist.GetFloat(), this, (int)&ctx );
+//-----------------------------------------------------------------------------
+// Stands in for CMeshBuilder in cl_detail_sprite_benchmark, so filling the
+// mesh can be timed without a device
+//-----------------------------------------------------------------------------
+class CDetailSpriteBenchmarkMeshBuilder
+{
+public:
+	struct Vertex_t
+	{
+		Vector		m_Position;
+		uint8		m_Color[4];
+		Vector2D	m_TexCoord;
+	};
+
+	void Begin( int nMaxVertexCount )
+	{
+		m_Vertices.EnsureCount( nMaxVertexCount );
+		m_pCurrVertex = m_Vertices.Base();
+	}
+
+	int VertexCount() const { return m_pCurrVertex - m_Vertices.Base(); }
+
+	void Position3f( float x, float y, float z )		{ m_pCurrVertex->m_Position.Init( x, y, z ); }
+	void Color4ubv( unsigned char const *rgba )		{ memcpy( m_pCurrVertex->m_Color, rgba, sizeof( m_pCurrVertex->m_Color ) ); }
+	void TexCoord2f( int nStage, float s, float t )	{ m_pCurrVertex->m_TexCoord.Init( s, t ); }
+	void AdvanceVertex()								{ ++m_pCurrVertex; }
+
+private:
+	CUtlVector<Vertex_t> m_Vertices;
+	Vertex_t *m_pCurrVertex;
+};
+
+class CDetailLeafCollector : public ISpatialLeafEnumerator
+{
+public:
+	bool EnumerateLeaf( int leaf, int context )
+	{
+		m_Leaves.AddToTail( leaf );
+		return true;
+	}
+
+	CUtlVector<LeafIndex_t> m_Leaves;
+};
+
+
+void CDetailObjectSystem::BenchmarkFastSprites( int nFrames )
+{
+	if ( !m_pFastSpriteData )
+	{
+		Msg( "This map has no fast detail sprites\n" );
+		return;
+	}
+
+	// The same leaves BuildDetailObjectRenderLists visits around the view
+	CDetailLeafCollector collector;
+	engine->GetBSPTreeQuery()->EnumerateLeavesInSphere( MainViewOrigin(), cl_detaildist.GetFloat(), &collector, 0 );
+
+	int nMaxInLeaf;
+	int nSpriteCount = CountFastSpritesInLeafList( collector.m_Leaves.Count(), collector.m_Leaves.Base(), &nMaxInLeaf );
+	if ( nSpriteCount == 0 )
+	{
+		Msg( "No fast detail sprites around the view\n" );
+		return;
+	}
+
+	ComputeFadeDistances();
+
+	CDetailSpriteBenchmarkMeshBuilder meshBuilder;
+	double flSortTime = 0.0;
+	double flBuildTime = 0.0;
+	int nQuadCount = 0;
+	for ( int i = 0; i < nFrames; ++i )
+	{
+		// Sort every leaf again, like a moving view does
+		++m_nFastSortGeneration;
+
+		double flStart = Plat_FloatTime();
+		SortFastSpritesInLeaves( MainViewOrigin(), MainViewForward(), collector.m_Leaves.Count(), collector.m_Leaves.Base() );
+		double flSorted = Plat_FloatTime();
+
+		meshBuilder.Begin( nSpriteCount * 4 );
+		FOR_EACH_VEC( collector.m_Leaves, j )
+		{
+			CFastDetailLeafSpriteList *pData = reinterpret_cast<CFastDetailLeafSpriteList *> (
+				ClientLeafSystem()->GetSubSystemDataInLeaf( collector.m_Leaves[j], CLSUBSYSTEM_DETAILOBJECTS ) );
+			if ( !pData )
+				continue;
+
+			SortInfo_t const *pDraw = GetFastSortInfo( pData );
+			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
+				( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) GetFastBuildoutBuffer( pData );
+			for ( int k = 0; k < pData->m_nNumSortedSprites; ++k )
+			{
+				AddFastSpriteQuad( meshBuilder, pQuadBuffer, pDraw[k].m_nIndex );
+			}
+		}
+		nQuadCount = meshBuilder.VertexCount() / 4;
+
+		flSortTime += flSorted - flStart;
+		flBuildTime += Plat_FloatTime() - flSorted;
+	}
+
+	Msg( "%d leaves, %d sprites, %d quads in front of the view, %d frames: %.3f ms sorting, %.3f ms filling the mesh per frame (cl_detail_threaded_sort %d)\n",
+		collector.m_Leaves.Count(), nSpriteCount, nQuadCount, nFrames,
+		1000.0 * flSortTime / nFrames, 1000.0 * flBuildTime / nFrames, cl_detail_threaded_sort.GetInt() );
 }
 
+CON_COMMAND_F( cl_detail_sprite_benchmark, "Times sorting the fast detail sprites around the view and filling a mesh with them, without drawing. Usage: cl_detail_sprite_benchmark [frames]", FCVAR_CHEAT )
+{
+	int nFrames = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 10000 ) : 100;
+	s_DetailObjectSystem.BenchmarkFastSprites( nFrames );
+}
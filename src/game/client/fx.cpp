@@ -693,6 +693,9 @@ public:
 		m_flLastParticleSpawnTime = gpGlobals->curtime + m_flSpawnRate;
 	}
 
+	// Spawning reads the entity's attachment
+	virtual bool CanSimulateInParallel() const { return false; }
+
 	virtual void SimulateParticles( CParticleSimulateIterator *pIterator )
 	{
 		Particle *pParticle = pIterator->GetFirst();
@@ -50,14 +50,7 @@ public:
 		if ( !( pParticle->m_iFlags & SIMPLE_PARTICLE_FLAG_NO_VEL_DECAY ) )
 		{
 			//Decelerate
-			static float dtime;
-			static float decay;
-
-			if ( dtime != timeDelta )
-			{
-				decay = ExponentialDecay( 0.1, 0.4f, dtime );
-				dtime = timeDelta;
-			}
+			float decay = ExponentialDecay( 0.1, 0.4f, timeDelta );
 
 			pParticle->m_vecVelocity *= decay;
 			pParticle->m_vecVelocity[2] -= ( m_flGravity * timeDelta );
@@ -75,15 +75,8 @@ public:
 
 		//Decellerate
 		//pParticle->m_vecVelocity += pParticle->m_vecVelocity * ( timeDelta * -20.0f );
-		static float dtime;
-		static float decay;
-
-		if ( dtime != timeDelta )
-		{
-			dtime = timeDelta;
-			float expected = 0.5;
-			decay = exp( log( 0.0001f ) * dtime / expected );
-		}
+		float expected = 0.5;
+		float decay = exp( log( 0.0001f ) * timeDelta / expected );
 
 		pParticle->m_vecVelocity = pParticle->m_vecVelocity * decay;
 
@@ -849,15 +842,8 @@ public:
 
 		//Decellerate
 		//pParticle->m_vecVelocity += pParticle->m_vecVelocity * ( timeDelta * -20.0f );
-		static float dtime;
-		static float decay;
-
-		if ( dtime != timeDelta )
-		{
-			dtime = timeDelta;
-			float expected = 0.5;
-			decay = exp( log( 0.0001f ) * dtime / expected );
-		}
+		float expected = 0.5;
+		float decay = exp( log( 0.0001f ) * timeDelta / expected );
 
 		pParticle->m_vecVelocity = pParticle->m_vecVelocity * decay;
 
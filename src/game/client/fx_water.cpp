@@ -518,15 +518,8 @@ float CSplashParticle::UpdateRoll( SimpleParticle *pParticle, float timeDelta )
 void CSplashParticle::UpdateVelocity( SimpleParticle *pParticle, float timeDelta )
 {
 	//Decellerate
-	static float dtime;
-	static float decay;
-
-	if ( dtime != timeDelta )
-	{
-		dtime = timeDelta;
-		float expected = 3.0f;
-		decay = exp( log( 0.0001f ) * dtime / expected );
-	}
+	float expected = 3.0f;
+	float decay = exp( log( 0.0001f ) * timeDelta / expected );
 
 	pParticle->m_vecVelocity *= decay;
 	pParticle->m_vecVelocity[2] -= ( 800.0f * timeDelta );
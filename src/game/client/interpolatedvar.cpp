@@ -6,6 +6,7 @@
 
 #include "cbase.h"
 #include "interpolatedvar.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,3 +29,64 @@ float g_flLastPacketTimestamp = 0;
 
 ConVar cl_extrapolate_amount( "cl_extrapolate_amount", "0.25", FCVAR_CHEAT, "Set how many seconds the client will extrapolate entities for." );
 
+ConVar cl_interp_simd( "cl_interp_simd", "1", 0, "Interpolate float and vector variables four floats at a time." );
+
+
+void Lerp_SIMD( float *pOut, float t, const float *pFrom, const float *pTo, int nCount )
+{
+	fltx4 t4 = ReplicateX4( t );
+
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		fltx4 from = LoadUnalignedSIMD( pFrom + i );
+		fltx4 to = LoadUnalignedSIMD( pTo + i );
+		StoreUnalignedSIMD( pOut + i, AddSIMD( from, MulSIMD( SubSIMD( to, from ), t4 ) ) );
+	}
+
+	for ( ; i < nCount; i++ )
+	{
+		pOut[i] = pFrom[i] + ( pTo[i] - pFrom[i] ) * t;
+	}
+}
+
+
+void Lerp_Hermite_SIMD( float *pOut, float t, const float *p0, const float *p1, const float *p2, int nCount )
+{
+	float tSqr = t*t;
+	float tCube = t*tSqr;
+
+	float w1 = 2*tCube-3*tSqr+1;
+	float w2 = -2*tCube+3*tSqr;
+	float wd1 = tCube-2*tSqr+t;
+	float wd2 = tCube-tSqr;
+
+	fltx4 w1_4 = ReplicateX4( w1 );
+	fltx4 w2_4 = ReplicateX4( w2 );
+	fltx4 wd1_4 = ReplicateX4( wd1 );
+	fltx4 wd2_4 = ReplicateX4( wd2 );
+
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		fltx4 v0 = LoadUnalignedSIMD( p0 + i );
+		fltx4 v1 = LoadUnalignedSIMD( p1 + i );
+		fltx4 v2 = LoadUnalignedSIMD( p2 + i );
+
+		fltx4 out = MulSIMD( v1, w1_4 );
+		out = AddSIMD( out, MulSIMD( v2, w2_4 ) );
+		out = AddSIMD( out, MulSIMD( SubSIMD( v1, v0 ), wd1_4 ) );
+		out = AddSIMD( out, MulSIMD( SubSIMD( v2, v1 ), wd2_4 ) );
+		StoreUnalignedSIMD( pOut + i, out );
+	}
+
+	// Not Lerp_Hermite<float>, some games specialize it
+	for ( ; i < nCount; i++ )
+	{
+		float out = p1[i] * w1;
+		out += p2[i] * w2;
+		out += ( p1[i] - p0[i] ) * wd1;
+		out += ( p2[i] - p1[i] ) * wd2;
+		pOut[i] = out;
+	}
+}
@@ -145,6 +145,34 @@ inline QAngle ExtrapolateInterpolatedVarType( const QAngle &oldVal, const QAngle
 }
 
 
+extern ConVar cl_interp_simd;
+
+// How many floats each element of a type is when Lerp_SIMD and Lerp_Hermite_SIMD
+// can treat an array of them as a flat float array, 0 if they can't.
+template< class T >
+struct InterpolatedVarFloats
+{
+	enum { LERP = 0, HERMITE = 0 };
+};
+
+template<>
+struct InterpolatedVarFloats<float>
+{
+#ifdef OF_CLIENT_DLL
+	// Lerp_Hermite<float> clamps the deltas in this game
+	enum { LERP = 1, HERMITE = 0 };
+#else
+	enum { LERP = 1, HERMITE = 1 };
+#endif
+};
+
+template<>
+struct InterpolatedVarFloats<Vector>
+{
+	enum { LERP = 3, HERMITE = 3 };
+};
+
+
 // -------------------------------------------------------------------------------------------------------------- //
 // IInterpolatedVar interface.
 // -------------------------------------------------------------------------------------------------------------- //
@@ -262,6 +290,19 @@ struct CInterpolatedVarEntryBase
 		count = 0;
 	}
 
+	// Use caller owned memory for a temporary entry instead of allocating it
+	void InitScratch( Type *pScratch, int maxCount )
+	{
+		Assert( !value );
+		value = pScratch;
+		count = maxCount;
+	}
+	void ReleaseScratch()
+	{
+		value = NULL;
+		count = 0;
+	}
+
 	float		changetime;
 	int			count;
 	Type *		value;
@@ -297,6 +338,12 @@ struct CInterpolatedVarEntryBase<Type, false>
 
 	void DeleteEntry() {}
 
+	void InitScratch( Type *pScratch, int maxCount )
+	{
+		Assert(maxCount==1);
+	}
+	void ReleaseScratch() {}
+
 	float		changetime;
 	Type		value;
 };
@@ -572,6 +619,7 @@ protected:
 	float								m_InterpolationAmount;
 	const char *						m_pDebugName;
 	bool								m_bDebug : 1;
+	bool								m_bAnyLooping : 1;	// any of m_bLooping is set
 };
 
 
@@ -587,6 +635,7 @@ inline CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarArrayBase( con
 	m_LastNetworkedValue = NULL;
 	m_bLooping = NULL;
 	m_bDebug = false;
+	m_bAnyLooping = false;
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -1180,6 +1229,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy( IInterpolatedVar *p
 		m_LastNetworkedValue[i] = pSrc->m_LastNetworkedValue[i];
 		m_bLooping[i] = pSrc->m_bLooping[i];
 	}
+	m_bAnyLooping = pSrc->m_bAnyLooping;
 
 	m_LastNetworkedTime = pSrc->m_LastNetworkedTime;
 
@@ -1273,6 +1323,12 @@ inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetLooping( bool looping,
 {
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
 	m_bLooping[ iArrayIndex ] = looping;
+
+	m_bAnyLooping = false;
+	for ( int i = 0; i < m_nMaxCount; i++ )
+	{
+		m_bAnyLooping |= ( m_bLooping[i] != 0 );
+	}
 }
 
 template< typename Type, bool IS_ARRAY >
@@ -1293,6 +1349,7 @@ inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetMaxCount( int newmax )
 		m_LastNetworkedValue = new Type[m_nMaxCount];
 		memset( m_bLooping, 0, sizeof(byte) * m_nMaxCount);
 		memset( m_LastNetworkedValue, 0, sizeof(Type) * m_nMaxCount);
+		m_bAnyLooping = false;
 
 		Reset();
 	}
@@ -1325,6 +1382,13 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate( Type *out,
 
 	Assert( frac >= 0.0f && frac <= 1.0f );
 
+	if ( InterpolatedVarFloats<Type>::LERP && !m_bAnyLooping && cl_interp_simd.GetBool() )
+	{
+		// Lerp_Clamp doesn't do anything for floats and vectors
+		Lerp_SIMD( (float *)out, frac, (const float *)start->GetValue(), (const float *)end->GetValue(), m_nMaxCount * InterpolatedVarFloats<Type>::LERP );
+		return;
+	}
+
 	// Note that QAngle has a specialization that will do quaternion interpolation here...
 	for ( int i = 0; i < m_nMaxCount; i++ )
 	{
@@ -1388,6 +1452,13 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup2_Hermite(
 		// Fixed interval into past
 		fixup.changetime = start->changetime - dt1;
 
+		if ( InterpolatedVarFloats<Type>::HERMITE && !m_bAnyLooping && cl_interp_simd.GetBool() )
+		{
+			Lerp_SIMD( (float *)fixup.GetValue(), 1-frac, (const float *)prev->GetValue(), (const float *)start->GetValue(), m_nMaxCount * InterpolatedVarFloats<Type>::HERMITE );
+			prev = &fixup;
+			return;
+		}
+
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
 			if ( m_bLooping[i] )
@@ -1433,10 +1504,18 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 	// After interpolation, we will clamp the values.
 	CDisableRangeChecks disableRangeChecks; 
 
+	// The fixup is only needed for this call, so don't allocate array entries on the heap
 	CInterpolatedVarEntry fixup;
-	fixup.Init(m_nMaxCount);
+	fixup.InitScratch( (Type *)stackalloc( m_nMaxCount * sizeof(Type) ), m_nMaxCount );
 	TimeFixup_Hermite( fixup, prev, start, end );
 
+	if ( InterpolatedVarFloats<Type>::HERMITE && !m_bAnyLooping && cl_interp_simd.GetBool() )
+	{
+		Lerp_Hermite_SIMD( (float *)out, frac, (const float *)prev->GetValue(), (const float *)start->GetValue(), (const float *)end->GetValue(), m_nMaxCount * InterpolatedVarFloats<Type>::HERMITE );
+		fixup.ReleaseScratch();
+		return;
+	}
+
 	for( int i = 0; i < m_nMaxCount; i++ )
 	{
 		// Note that QAngle has a specialization that will do quaternion interpolation here...
@@ -1455,6 +1534,8 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 		// skyrocket it off into la-la land).
 		Lerp_Clamp( out[i] );
 	}
+
+	fixup.ReleaseScratch();
 }
 
 template< typename Type, bool IS_ARRAY >
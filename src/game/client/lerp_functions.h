@@ -182,6 +182,12 @@ inline float LoopingLerp_Hermite( float t, float p0, float p1, float p2 )
 }
 
 
+// Lerp and Lerp_Hermite on runs of floats, four at a time. They do the same operations
+// in the same order as the templates above, so the results are the same.
+void Lerp_SIMD( float *pOut, float t, const float *pFrom, const float *pTo, int nCount );
+void Lerp_Hermite_SIMD( float *pOut, float t, const float *p0, const float *p1, const float *p2, int nCount );
+
+
 // NOTE: C_AnimationLayer has its own versions of these functions in animationlayer.h.
 
 
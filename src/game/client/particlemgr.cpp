@@ -30,6 +30,8 @@
 #include "rtime.h"
 #endif
 #include "tier0/icommandline.h"
+#include "fx_explosion.h"
+#include "tempentity.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -1086,7 +1088,7 @@ bool CParticleMgr::Init(unsigned long count, IMaterialSystem *pMaterials)
 #if defined( TF_CLIENT_DLL ) || defined ( OF_CLIENT_DLL )
 	if ( IsX360() )
 	{
-		//m_pThreadPool[0] = CreateThreadPool();
+		m_pThreadPool[0] = CreateThreadPool();
 		m_pThreadPool[1] = CreateThreadPool();
 
 		ThreadPoolStartParams_t startParams;
@@ -1097,13 +1099,28 @@ bool CParticleMgr::Init(unsigned long count, IMaterialSystem *pMaterials)
 		startParams.iAffinityTable[0] = XBOX_PROCESSOR_1;
 		startParams.iAffinityTable[1] = XBOX_PROCESSOR_3;
 		startParams.iAffinityTable[2] = XBOX_PROCESSOR_5;
-		//m_pThreadPool[0]->Start( startParams );
+		m_pThreadPool[0]->Start( startParams );
 
 		startParams.nThreads = 2;
 		startParams.iAffinityTable[1] = CommandLine()->FindParm( "-swapcores" ) ? XBOX_PROCESSOR_5 : XBOX_PROCESSOR_3;
 		m_pThreadPool[1]->Start( startParams );
 	}
+	else
 #endif
+	if ( !CommandLine()->FindParm( "-noparticlethreads" ) )
+	{
+		// A pool of our own so the simulation doesn't wait on other client jobs. By default
+		// the pool sizes itself to the machine, -particlethreads overrides that.
+		m_pThreadPool[0] = CreateThreadPool();
+
+		ThreadPoolStartParams_t startParams;
+		startParams.nThreads = CommandLine()->ParmValue( "-particlethreads", -1 );
+		if ( !m_pThreadPool[0]->Start( startParams ) || m_pThreadPool[0]->NumThreads() == 0 )
+		{
+			DestroyThreadPool( m_pThreadPool[0] );
+			m_pThreadPool[0] = NULL;
+		}
+	}
 
 	return true;
 }
@@ -1539,6 +1556,12 @@ void EndSimulateParticles( void )
 static ConVar r_threaded_particles( "r_threaded_particles", "1" );
 
 static float s_flThreadedPSystemTimeStep;
+static float s_flThreadedEffectTimeStep;
+
+static void ProcessEffect( CParticleEffectBinding *&pEffect )
+{
+	pEffect->SimulateParticles( s_flThreadedEffectTimeStep );
+}
 
 static void ProcessPSystem( ParticleSimListEntry_t& pSimListEntry )
 {
@@ -1758,6 +1781,18 @@ bool CParticleMgr::EarlyRetireParticleSystems( int nCount, ParticleSimListEntry_
 }
 
 static ConVar particle_sim_alt_cores( "particle_sim_alt_cores", "2" );
+static ConVar cl_particle_sim_pool( "cl_particle_sim_pool", "1", 0, "Simulate particles on the particle manager's own thread pool instead of the shared one." );
+
+IThreadPool *CParticleMgr::GetSimulationThreadPool()
+{
+	if ( IsX360() )
+	{
+		int nAltCore = MIN( particle_sim_alt_cores.GetInt(), 2 );
+		return ( nAltCore > 0 ) ? m_pThreadPool[nAltCore-1] : NULL;
+	}
+
+	return cl_particle_sim_pool.GetBool() ? m_pThreadPool[0] : NULL;
+}
 
 void CParticleMgr::BuildParticleSimList( CUtlVector< ParticleSimListEntry_t > &list )
 {
@@ -1874,21 +1909,9 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 		}
 		else
 		{
-			int nAltCore = IsX360() && particle_sim_alt_cores.GetInt();
-			if ( !m_pThreadPool[1] || nAltCore == 0 )
-			{
-				ParallelProcess( "CParticleMgr::UpdateNewEffects", particlesToSimulate.Base(), nCount, ProcessPSystem );
-			}
-			else
-			{
-				if ( nAltCore > 2 )
-				{
-					nAltCore = 2;
-				}
-				CParallelProcessor<ParticleSimListEntry_t, CFuncJobItemProcessor<ParticleSimListEntry_t> > processor( "CParticleMgr::UpdateNewEffects" );
-				processor.m_ItemProcessor.Init( ProcessPSystem, NULL, NULL );
-				processor.Run( particlesToSimulate.Base(), nCount, INT_MAX, m_pThreadPool[nAltCore-1] );
-			}
+			CParallelProcessor<ParticleSimListEntry_t, CFuncJobItemProcessor<ParticleSimListEntry_t> > processor( "CParticleMgr::UpdateNewEffects" );
+			processor.m_ItemProcessor.Init( ProcessPSystem, NULL, NULL );
+			processor.Run( particlesToSimulate.Base(), nCount, INT_MAX, GetSimulationThreadPool() );
 		}
 	}
 
@@ -1943,6 +1966,8 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 	if( flTimeDelta > 0.1f )
 		flTimeDelta = 0.1f;
 
+	CUtlVector<CParticleEffectBinding*> effectsToSimulate;
+
 	FOR_EACH_LL( m_Effects, iEffect )
 	{
 		CParticleEffectBinding *pEffect = m_Effects[iEffect];
@@ -1971,14 +1996,42 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 		pEffect->m_pSim->Update( flTimeDelta );
 
 		if ( pEffect->GetFirstFrameFlag() )
+		{
 			pEffect->SetFirstFrameFlag( false );
+		}
+		else if ( r_threaded_particles.GetBool() && pEffect->m_pSim->CanSimulateInParallel() )
+		{
+			// Simulated with the others below, then put in the leaf system.
+			effectsToSimulate.AddToTail( pEffect );
+			continue;
+		}
 		else
+		{
 			pEffect->SimulateParticles( flTimeDelta );
+		}
 
 		// Update its position in the leaf system if its bbox changed.
 		pEffect->DetectChanges();
 	}
 
+	int nCount = effectsToSimulate.Count();
+	if ( nCount )
+	{
+		VPROF_BUDGET( "CParticleMgr::UpdateAllEffects simulate", VPROF_BUDGETGROUP_PARTICLE_SIMULATION );
+
+		s_flThreadedEffectTimeStep = flTimeDelta;
+
+		CParallelProcessor<CParticleEffectBinding*, CFuncJobItemProcessor<CParticleEffectBinding*> > processor( "CParticleMgr::UpdateAllEffects" );
+		processor.m_ItemProcessor.Init( ProcessEffect, NULL, NULL );
+		processor.Run( effectsToSimulate.Base(), nCount, INT_MAX, GetSimulationThreadPool() );
+
+		// The leaf system is main thread only.
+		for ( int i = 0; i < nCount; i++ )
+		{
+			effectsToSimulate[i]->DetectChanges();
+		}
+	}
+
 	if ( g_bMeasureParticlePerformance )					// use fixed time step
 	{
 		for( float dt=0.0f; dt <= flTimeDelta ; dt+= 0.01f )
@@ -2019,6 +2072,66 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Spawns a batch of effects in front of the view and times their simulation
+// without drawing them, to compare r_threaded_particles and cl_particle_sim_pool
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( cl_particle_sim_benchmark, "Times the particle simulation of a batch of explosions, or of a particle system, without drawing. Usage: cl_particle_sim_benchmark <count> [frames] [particle system]", FCVAR_CHEAT )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: cl_particle_sim_benchmark <count> [frames] [particle system]\n" );
+		return;
+	}
+
+	int nCount = clamp( atoi( args[1] ), 1, 1024 );
+	int nFrames = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 10000 ) : 100;
+	const char *pSystemName = ( args.ArgC() > 3 ) ? args[3] : NULL;
+
+	CUtlVector< CSmartPtr<CNewParticleEffect> > newEffects;
+	Vector vecCenter = MainViewOrigin() + MainViewForward() * 256.0f;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		Vector vecPos = vecCenter + RandomVector( -128.0f, 128.0f );
+		if ( !pSystemName )
+		{
+			BaseExplosionEffect().Create( vecPos, 1.0f, 1.0f, TE_EXPLFLAG_NOSOUND | TE_EXPLFLAG_NODLIGHTS );
+			continue;
+		}
+
+		CSmartPtr<CNewParticleEffect> pEffect = CNewParticleEffect::Create( NULL, pSystemName );
+		if ( !pEffect.IsValid() || !pEffect->IsValid() )
+		{
+			Warning( "cl_particle_sim_benchmark: unknown particle system '%s'\n", pSystemName );
+			break;
+		}
+		pEffect->SetControlPoint( 0, vecPos );
+		newEffects.AddToTail( pEffect );
+	}
+
+	const float flFrameTime = 1.0f / 60.0f;
+	double flWorst = 0.0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nFrames; i++ )
+	{
+		double flFrameStart = Plat_FloatTime();
+		ParticleMgr()->Simulate( flFrameTime );
+		flWorst = MAX( flWorst, Plat_FloatTime() - flFrameStart );
+	}
+	double flTotal = Plat_FloatTime() - flStart;
+
+	FOR_EACH_VEC( newEffects, i )
+	{
+		newEffects[i]->StopEmission( false, true );
+		newEffects[i]->SetRemoveFlag();
+	}
+
+	Msg( "cl_particle_sim_benchmark: %d %s, %d frames, %.3f ms average, %.3f ms worst (r_threaded_particles %d, cl_particle_sim_pool %d)\n",
+		nCount, pSystemName ? pSystemName : "explosions", nFrames,
+		flTotal * 1000.0 / nFrames, flWorst * 1000.0,
+		r_threaded_particles.GetInt(), cl_particle_sim_pool.GetInt() );
+}
+
 CParticleSubTextureGroup* CParticleMgr::FindOrAddSubTextureGroup( IMaterial *pPageMaterial )
 {
 	for ( int i=0; i < m_SubTextureGroups.Count(); i++ )
@@ -276,6 +276,10 @@ public:
 	virtual void	SetShouldSimulate( bool bSim ) = 0;
 	virtual void	SimulateParticles( CParticleSimulateIterator *pIterator ) = 0;
 
+	// Return true if SimulateParticles only touches this effect's particles and members, so
+	// the particle manager can simulate it on a job thread at the same time as other effects.
+	virtual bool	CanSimulateInParallel() const { return false; }
+
 	// Render the particles.
 	virtual void	RenderParticles( CParticleRenderIterator *pIterator ) = 0;
 
@@ -716,6 +720,9 @@ private:
 
 	void UpdateNewEffects( float flTimeDelta );				// update new particle effects
 
+	// The pool the simulation jobs go to, NULL for the shared one.
+	IThreadPool *GetSimulationThreadPool();
+
 	CParticleSubTextureGroup* FindOrAddSubTextureGroup( IMaterial *pPageMaterial );
 
 	int ComputeParticleDefScreenArea( int nInfoCount, RetireInfo_t *pInfo, float *pTotalArea, CParticleSystemDefinition* pDef, 
@@ -729,7 +736,7 @@ private:
 
 private:
 
-	int m_nCurrentParticlesAllocated;
+	CInterlockedInt m_nCurrentParticlesAllocated;			// particles are freed on the simulation jobs
 
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
@@ -171,6 +171,7 @@ public:
 
 	virtual void	SimulateParticles( CParticleSimulateIterator *pIterator );
 	virtual void	RenderParticles( CParticleRenderIterator *pIterator );
+	virtual bool	CanSimulateInParallel() const { return true; }
 
 	void			SetNearClip( float nearClipMin, float nearClipMax );
 
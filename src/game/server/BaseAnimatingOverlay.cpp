@@ -15,6 +15,8 @@
 
 #include "saverestore_utlvector.h"
 #include "dt_utlvector_send.h"
+#include "datacache/imdlcache.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1164,3 +1166,120 @@ bool CBaseAnimatingOverlay::HasActiveLayer( void )
 }
 
 //-----------------------------------------------------------------------------
+// Purpose: Same pose as GetSkeleton(), without touching the IK context
+//-----------------------------------------------------------------------------
+static void BuildAnimationStack( CBaseAnimatingOverlay *pAnimating, CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], int boneMask )
+{
+	IBoneSetup boneSetup( pStudioHdr, boneMask, pAnimating->GetPoseParameterArray() );
+	boneSetup.InitPose( pos, q );
+
+	boneSetup.AccumulatePose( pos, q, pAnimating->GetSequence(), pAnimating->GetCycle(), 1.0, gpGlobals->curtime, NULL );
+
+	// the layers, in order
+	int nLayers = pAnimating->GetNumAnimOverlays();
+	for ( int nOrder = 0; nOrder < nLayers; nOrder++ )
+	{
+		for ( int i = 0; i < nLayers; i++ )
+		{
+			CAnimationLayer *pLayer = pAnimating->GetAnimOverlay( i );
+			if ( pLayer->m_nOrder == nOrder && pLayer->m_flWeight > 0 && pLayer->IsActive() )
+			{
+				boneSetup.AccumulatePose( pos, q, pLayer->m_nSequence, pLayer->m_flCycle, pLayer->m_flWeight, gpGlobals->curtime, NULL );
+				break;
+			}
+		}
+	}
+
+	boneSetup.CalcAutoplaySequences( pos, q, gpGlobals->curtime, NULL );
+	boneSetup.CalcBoneAdj( pos, q, pAnimating->GetEncodedControllerArray() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times the animation stack of every live player with and without
+//			anim_simd_blend, and checks both build the same bone matrices
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( anim_simd_blend_benchmark, "Time the players' animation blending with and without anim_simd_blend and compare the bones. Arguments: [iterations] [tolerance]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+	float flTolerance = ( args.ArgC() > 2 ) ? atof( args[2] ) : 0.001f;
+
+	ConVarRef anim_simd_blend( "anim_simd_blend" );
+	bool bWasEnabled = anim_simd_blend.GetBool();
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	Vector pos[MAXSTUDIOBONES];
+	Quaternion q[MAXSTUDIOBONES];
+	matrix3x4_t bones[2][MAXSTUDIOBONES];
+
+	double flTotalTime[2] = { 0.0, 0.0 };
+	int nPlayers = 0;
+	int nMismatches = 0;
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer || !pPlayer->IsAlive() )
+			continue;
+
+		CStudioHdr *pStudioHdr = pPlayer->GetModelPtr();
+		if ( !pStudioHdr || !pStudioHdr->SequencesAvailable() )
+			continue;
+
+		double flTime[2];
+		for ( int nMode = 0; nMode < 2; nMode++ )
+		{
+			anim_simd_blend.SetValue( nMode );
+
+			CFastTimer timer;
+			timer.Start();
+			for ( int n = 0; n < nIterations; n++ )
+			{
+				BuildAnimationStack( pPlayer, pStudioHdr, pos, q, BONE_USED_BY_ANYTHING );
+			}
+			timer.End();
+			flTime[nMode] = timer.GetDuration().GetMillisecondsF();
+			flTotalTime[nMode] += flTime[nMode];
+
+			Studio_BuildMatrices( pStudioHdr, pPlayer->GetAbsAngles(), pPlayer->GetAbsOrigin(), pos, q, -1, pPlayer->GetModelScale(), bones[nMode], BONE_USED_BY_ANYTHING );
+		}
+
+		float flMaxError = 0.0f;
+		for ( int b = 0; b < pStudioHdr->numbones(); b++ )
+		{
+			const float *pOld = bones[0][b].Base();
+			const float *pNew = bones[1][b].Base();
+			for ( int k = 0; k < 12; k++ )
+			{
+				flMaxError = MAX( flMaxError, fabs( pOld[k] - pNew[k] ) );
+			}
+		}
+
+		bool bMismatch = flMaxError > flTolerance;
+		if ( bMismatch )
+		{
+			++nMismatches;
+		}
+
+		Msg( "%-24s %-40s %3d bones %3d layers: %8.3f ms -> %8.3f ms (%.2fx), max error %g%s\n",
+			pPlayer->GetPlayerName(), STRING( pPlayer->GetModelName() ), pStudioHdr->numbones(), pPlayer->GetNumAnimOverlays(),
+			flTime[0], flTime[1], flTime[1] > 0.0 ? flTime[0] / flTime[1] : 0.0, flMaxError, bMismatch ? "  MISMATCH" : "" );
+		++nPlayers;
+	}
+
+	anim_simd_blend.SetValue( bWasEnabled );
+
+	if ( !nPlayers )
+	{
+		Msg( "No live players to benchmark\n" );
+		return;
+	}
+
+	Msg( "%d players, %d iterations: %.3f ms -> %.3f ms (%.2fx), %d over the %g tolerance\n",
+		nPlayers, nIterations, flTotalTime[0], flTotalTime[1], flTotalTime[1] > 0.0 ? flTotalTime[0] / flTotalTime[1] : 0.0, nMismatches, flTolerance );
+}
+
+//-----------------------------------------------------------------------------
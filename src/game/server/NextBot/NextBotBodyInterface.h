@@ -128,6 +128,13 @@ public:
 
 	virtual unsigned int GetSolidMask( void ) const;					// return the bot's collision mask (hack until we get a general hull trace abstraction here or in the locomotion interface)
 	virtual unsigned int GetCollisionGroup( void ) const;
+
+private:
+	// per bot, so the vision checks of several bots can run on worker threads at once
+	mutable Vector m_eyePosition;		// for use with GetEyePosition() ONLY
+	mutable Vector m_viewDirection;		// for use with GetViewVector() ONLY
+	mutable Vector m_currentHullMins;	// for use with GetHullMins() ONLY
+	mutable Vector m_currentHullMaxs;	// for use with GetHullMaxs() ONLY
 };
 
 
@@ -284,13 +291,11 @@ inline float IBody::GetCrouchHullHeight( void ) const
  */
 inline const Vector &IBody::GetHullMins( void ) const
 {
-	static Vector hullMins;
-
-	hullMins.x = -GetHullWidth()/2.0f;
-	hullMins.y = hullMins.x;
-	hullMins.z = 0.0f;
+	m_currentHullMins.x = -GetHullWidth()/2.0f;
+	m_currentHullMins.y = m_currentHullMins.x;
+	m_currentHullMins.z = 0.0f;
 
-	return hullMins;
+	return m_currentHullMins;
 }
 
 
@@ -300,13 +305,11 @@ inline const Vector &IBody::GetHullMins( void ) const
  */
 inline const Vector &IBody::GetHullMaxs( void ) const
 {
-	static Vector hullMaxs;
-
-	hullMaxs.x = GetHullWidth()/2.0f;
-	hullMaxs.y = hullMaxs.x;
-	hullMaxs.z = GetHullHeight();
+	m_currentHullMaxs.x = GetHullWidth()/2.0f;
+	m_currentHullMaxs.y = m_currentHullMaxs.x;
+	m_currentHullMaxs.z = GetHullHeight();
 
-	return hullMaxs;
+	return m_currentHullMaxs;
 }
 
 
@@ -14,6 +14,11 @@
 #endif
 
 #include "SharedFunctorUtils.h"
+#include "NextBotVisionInterface.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/fasttimer.h"
+#include "KeyValues.h"
 //#include "../../common/blackbox_helper.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -25,6 +30,12 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_event_queue( "nb_event_queue", "1", FCVAR_CHEAT, "Queue the sound, spoke concept and weapon fired events and deliver them to the bots in one pass at the start of the next NextBot update. Killed events are delivered right away. Events from other threads are always queued." );
+ConVar nb_event_hearing_range( "nb_event_hearing_range", "3000", FCVAR_CHEAT, "Bots farther than this from a sound, a spoken concept or a weapon firing don't get the event. 0 sends them to every bot." );
+ConVar nb_event_queue_debug( "nb_event_queue_debug", "0", FCVAR_CHEAT, "Print the NextBot events delivered each tick and what they cost" );
+ConVar nb_update_parallel( "nb_update_parallel", "0", FCVAR_CHEAT, "Do the vision checks of the bots that update this tick in parallel, before the entities think. 2 also redoes them serially and reports any difference." );
+
+extern ConVar nb_blind;
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -234,6 +245,19 @@ void CC_WarpSelectedHere( const CCommand &args )
 static ConCommand WarpSelectedHere( "nb_warp_selected_here", CC_WarpSelectedHere, "Teleport the selected bot to your cursor position", FCVAR_CHEAT );
 
 
+//---------------------------------------------------------------------------------------------
+static void CC_EventStats( const CCommand &args )
+{
+	TheNextBots().PrintEventStats();
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		TheNextBots().ResetEventStats();
+	}
+}
+static ConCommand ShowEventStats( "nb_event_stats", CC_EventStats, "Print how many events the NextBots got and what delivering them cost. 'nb_event_stats reset' also starts over.", FCVAR_CHEAT );
+
+
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
 NextBotManager::NextBotManager( void )
@@ -242,11 +266,18 @@ NextBotManager::NextBotManager( void )
 	m_selectedBot = NULL;
 	
 	m_iUpdateTickrate = 0;
+
+	m_eventQueue = new CTSQueue< NextBotEvent * >;
+	m_nextPendingEvent = 0;
+	V_memset( &m_eventStatsTick, 0, sizeof( m_eventStatsTick ) );
+	ResetEventStats();
 }
 
 //---------------------------------------------------------------------------------------------
 NextBotManager::~NextBotManager()
 {
+	DiscardQueuedEvents();
+	delete m_eventQueue;
 }
 
 
@@ -270,6 +301,9 @@ void NextBotManager::Reset( void )
 	}
 
 	m_selectedBot = NULL;
+
+	// don't deliver what happened before the reset
+	DiscardQueuedEvents();
 }
 
 
@@ -307,12 +341,25 @@ static int g_nBlockedSlides;
 
 void NextBotManager::Update( void )
 {
+	DeliverQueuedEvents();
+
 	// do lightweight upkeep every tick
 	for( int u=m_botList.Head(); u != m_botList.InvalidIndex(); u = m_botList.Next( u ) )
 	{
 		m_botList[ u ]->Upkeep();
 	}
 
+	ScheduleUpdates();
+
+	if ( nb_update_parallel.GetBool() && !nb_blind.GetBool() )
+	{
+		UpdateVisionInParallel();
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::ScheduleUpdates( void )
+{
 	// schedule full updates
 	if ( m_botList.Count() )
 	{
@@ -412,6 +459,85 @@ void NextBotManager::Update( void )
 	}
 }
 
+//---------------------------------------------------------------------------------------------
+static void ComputeVisionUpdate( IVision *&vision )
+{
+	vision->ComputeParallelUpdate();
+}
+
+static void PreComputeVisionUpdates()
+{
+	mdlcache->BeginLock();
+}
+
+static void PostComputeVisionUpdates()
+{
+	mdlcache->EndLock();
+}
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Two phase update: the vision checks of every bot that will likely update this tick are done
+ * here in parallel, against the world as it is before any entity thinks. The bots' own updates
+ * still run one at a time from their thinks, and that is where everything that changes the
+ * world happens (buttons, locomotion, events, spawns), using these results.
+ */
+void NextBotManager::UpdateVisionInParallel( void )
+{
+	VPROF_BUDGET( "NextBotManager::UpdateVisionInParallel", "NextBot" );
+
+	CUtlVector< IVision * > visions;
+	for( int i=m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		INextBot *bot = m_botList[i];
+		IVision *vision = bot->GetVisionInterface();
+		if ( vision && IsUpdateLikely( bot ) )
+		{
+			vision->PrepareParallelUpdate();
+			visions.AddToTail( vision );
+		}
+	}
+
+	if ( !visions.Count() )
+		return;
+
+	ParallelProcess( "NextBotManager::UpdateVisionInParallel", visions.Base(), visions.Count(), &ComputeVisionUpdate, &PreComputeVisionUpdates, &PostComputeVisionUpdates );
+
+	if ( nb_update_parallel.GetInt() >= 2 )
+	{
+		int nMismatches = 0;
+		for( int i=0; i<visions.Count(); ++i )
+		{
+			nMismatches += visions[i]->CheckParallelUpdate();
+		}
+
+		if ( nMismatches )
+		{
+			Warning( "Tick %8d: %d of the parallel vision checks of %d bots differ from serial\n", gpGlobals->tickcount, nMismatches, visions.Count() );
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Return true if ShouldUpdate() is likely to let the bot update this tick
+ */
+bool NextBotManager::IsUpdateLikely( INextBot *bot ) const
+{
+	if ( IsDead( bot ) )
+	{
+		return false;
+	}
+
+	if ( m_iUpdateTickrate < 1 || bot->IsFlaggedForUpdate() )
+	{
+		return true;
+	}
+
+	int nTicksSlid = ( gpGlobals->tickcount - bot->GetTickLastUpdate() ) - m_iUpdateTickrate;
+	return ( nTicksSlid >= nb_update_maxslide.GetInt() );
+}
+
 //---------------------------------------------------------------------------------------------
 bool NextBotManager::ShouldUpdate( INextBot *bot )
 {
@@ -526,152 +652,375 @@ void NextBotManager::UnRegister( INextBot *bot )
 //--------------------------------------------------------------------------------------------------------
 void NextBotManager::OnBeginChangeLevel( void )
 {
+	DiscardQueuedEvents();
 }
 
 
 //----------------------------------------------------------------------------------------------------------
-class NextBotKilledNotifyScan
+/**
+ * A game event for the bots. The entities it refers to are held by handle and everything else
+ * the caller owns is copied when it is queued, so it can be delivered after the fact.
+ */
+struct NextBotEvent
 {
-public:
-	NextBotKilledNotifyScan( CBaseCombatCharacter *victim, const CTakeDamageInfo &info )
+	enum EventType
 	{
-		m_victim = victim;
-		m_info = info;
+		KILLED,
+		SOUND,
+		SPOKE_CONCEPT,
+		WEAPON_FIRED,
+	};
+
+	NextBotEvent( EventType type, CBaseEntity *subject, CBaseEntity *weapon = NULL )
+	{
+		this->type = type;
+		this->subject = subject;
+		this->weapon = weapon;
+		hasSubject = ( subject != NULL );
+		hasWeapon = ( weapon != NULL );
+		hasPos = false;
+		keys = NULL;
+		concept = NULL;
+		response = NULL;
+		ownsData = false;
 	}
 
-	bool operator() ( INextBot *bot )
+	~NextBotEvent()
 	{
-		if ( bot->GetEntity()->IsAlive() && !bot->IsSelf( m_victim ) )
+		if ( ownsData )
 		{
-			bot->OnOtherKilled( m_victim, m_info );
+			if ( keys )
+			{
+				keys->deleteThis();
+			}
+			delete response;
 		}
-		return true;
 	}
 
-	CBaseCombatCharacter *m_victim;
-	CTakeDamageInfo m_info;
+	NextBotEvent *Clone( void ) const
+	{
+		NextBotEvent *copy = new NextBotEvent( *this );
+		copy->keys = keys ? keys->MakeCopy() : NULL;
+		copy->response = response ? new AI_Response( *response ) : NULL;
+		copy->conceptCopy = concept;
+		copy->concept = concept ? copy->conceptCopy.Get() : NULL;
+		copy->ownsData = true;
+		return copy;
+	}
+
+	EventType type;
+	EHANDLE subject;				// the victim, the sound source, the speaker or who fired
+	EHANDLE weapon;
+	bool hasSubject;				// to tell a NULL entity from one removed since
+	bool hasWeapon;
+	bool hasPos;
+	Vector pos;						// where the event can be heard from
+	CTakeDamageInfo info;
+	KeyValues *keys;
+	AIConcept_t concept;
+	CUtlString conceptCopy;
+	AI_Response *response;
+	bool ownsData;					// keys and response are copies, free them with the event
 };
 
 
 //---------------------------------------------------------------------------------------------
 /**
- * When an actor is killed.  Propagate to all NextBots.
+ * Deliver the event to the bots right away on the main thread, or queue a copy of it for
+ * DeliverQueuedEvents() if nb_event_queue is on or we are on another thread.
+ * Deaths are always delivered right away on the main thread, since the victim is often
+ * removed before the next update and the event would be dropped with it. The events
+ * queued before the death are delivered first, so the bots still hear them in order.
  */
-void NextBotManager::OnKilled( CBaseCombatCharacter *victim, const CTakeDamageInfo &info )
+void NextBotManager::QueueEvent( const NextBotEvent &event )
 {
-	NextBotKilledNotifyScan notify( victim, info );
-	TheNextBots().ForEachBot( notify );
+	if ( m_botList.Count() == 0 )
+	{
+		return;
+	}
+
+	bool isQueued = ( nb_event_queue.GetBool() && event.type != NextBotEvent::KILLED );
+	if ( isQueued || !ThreadInMainThread() )
+	{
+		m_eventQueue->PushItem( event.Clone() );
+	}
+	else
+	{
+		DeliverPendingEvents();
+		DeliverEvent( event );
+	}
 }
 
 
-//----------------------------------------------------------------------------------------------------------
-class NextBotSoundNotifyScan
+//---------------------------------------------------------------------------------------------
+/**
+ * Send the event to every living bot within nb_event_hearing_range of it
+ */
+void NextBotManager::DeliverEvent( const NextBotEvent &event )
 {
-public:
-	NextBotSoundNotifyScan( CBaseEntity *source, const Vector &pos, KeyValues *keys ) : m_source( source ), m_pos( pos ), m_keys( keys )
+	CFastTimer timer;
+	timer.Start();
+
+	CBaseEntity *subject = event.subject;
+	CBaseEntity *weapon = event.weapon;
+	if ( ( event.hasSubject && !subject ) || ( event.hasWeapon && !weapon ) )
 	{
+		// removed before we got to it
+		++m_eventStatsTick.dropped;
+		return;
 	}
 
-	bool operator() ( INextBot *bot )
+	++m_eventStatsTick.events;
+
+	// everyone finds out about a death, no matter how far
+	float range = nb_event_hearing_range.GetFloat();
+	bool isCulled = ( event.type != NextBotEvent::KILLED && event.hasPos && range > 0.0f );
+	float rangeSq = range * range;
+
+	for( int i=m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
 	{
-		if ( bot->GetEntity()->IsAlive() && !bot->IsSelf( m_source ) )
+		INextBot *bot = m_botList[i];
+		CBaseCombatCharacter *me = bot->GetEntity();
+		if ( !me->IsAlive() )
 		{
-			bot->OnSound( m_source, m_pos, m_keys );
+			continue;
 		}
-		return true;
+
+		if ( isCulled && ( me->GetAbsOrigin() - event.pos ).LengthSqr() > rangeSq )
+		{
+			++m_eventStatsTick.culled;
+			continue;
+		}
+
+		switch( event.type )
+		{
+		case NextBotEvent::KILLED:
+			if ( bot->IsSelf( subject ) )
+			{
+				continue;
+			}
+			bot->OnOtherKilled( static_cast< CBaseCombatCharacter * >( subject ), event.info );
+			break;
+
+		case NextBotEvent::SOUND:
+			if ( bot->IsSelf( subject ) )
+			{
+				continue;
+			}
+			bot->OnSound( subject, event.pos, event.keys );
+			break;
+
+		case NextBotEvent::SPOKE_CONCEPT:
+			bot->OnSpokeConcept( static_cast< CBaseCombatCharacter * >( subject ), event.concept, event.response );
+			break;
+
+		case NextBotEvent::WEAPON_FIRED:
+			bot->OnWeaponFired( static_cast< CBaseCombatCharacter * >( subject ), static_cast< CBaseCombatWeapon * >( weapon ) );
+			break;
+		}
+
+		++m_eventStatsTick.deliveries;
 	}
 
-	CBaseEntity *m_source;
-	const Vector &m_pos;
-	KeyValues *m_keys;
-};
+	switch( event.type )
+	{
+	case NextBotEvent::SOUND:
+		if ( subject && IsDebugging( NEXTBOT_HEARING ) )
+		{
+			int r,g,b;
+			switch( subject->GetTeamNumber() )
+			{
+				case FIRST_GAME_TEAM:		r = 0;   g = 255; b = 0; break;
+				case (FIRST_GAME_TEAM+1):	r = 255; g = 0;   b = 0; break;
+				default:					r = 255; g = 255; b = 0; break;
+			}
+			NDebugOverlay::Circle( event.pos, Vector( 1, 0, 0 ), Vector( 0, -1, 0 ), 5.0f, r, g, b, 255, true, 3.0f );
+		}
+		break;
+
+	case NextBotEvent::SPOKE_CONCEPT:
+		if ( IsDebugging( NEXTBOT_HEARING ) )
+		{
+			// const char *who = response->GetCriteria()->GetValue( response->GetCriteria()->FindCriterionIndex( "Who" ) );
+
+			// TODO: Need concept.GetStringConcept()
+			DevMsg( "%3.2f: OnSpokeConcept( %s, %s )\n", gpGlobals->curtime, subject ? subject->GetDebugName() : "NULL", "concept.GetStringConcept()" );
+		}
+		break;
+
+	case NextBotEvent::WEAPON_FIRED:
+		if ( IsDebugging( NEXTBOT_EVENTS ) )
+		{
+			DevMsg( "%3.2f: OnWeaponFired( %s, %s )\n", gpGlobals->curtime, subject ? subject->GetDebugName() : "NULL", weapon ? static_cast< CBaseCombatWeapon * >( weapon )->GetName() : "NULL" );
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	timer.End();
+	m_eventStatsTick.time += timer.GetDuration().GetSeconds();
+}
 
 
 //---------------------------------------------------------------------------------------------
 /**
- * When an entity emits a sound
+ * Deliver the events queued since the last update, in the order they happened.
+ * Events the bots cause while responding to these wait for the next update, unless
+ * a death delivered before then takes them along.
  */
-void NextBotManager::OnSound( CBaseEntity *source, const Vector &pos, KeyValues *keys )
+void NextBotManager::DeliverQueuedEvents( void )
+{
+	VPROF_BUDGET( "NextBotManager::DeliverQueuedEvents", "NextBot" );
+
+	DeliverPendingEvents();
+
+	EndEventStatsTick();
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Deliver what is queued right now, after the rest of any batch already being delivered.
+ * A bot responding to an event can kill someone, which comes back in here to deliver
+ * everything before the death, so the batch is kept in members rather than on the stack.
+ */
+void NextBotManager::DeliverPendingEvents( void )
 {
-	NextBotSoundNotifyScan notify( source, pos, keys );
-	TheNextBots().ForEachBot( notify );
+	NextBotEvent *event;
+	while ( m_eventQueue->PopItem( &event ) )
+	{
+		m_pendingEvents.AddToTail( event );
+	}
 
-	if ( source && IsDebugging( NEXTBOT_HEARING ) )
+	while ( m_nextPendingEvent < m_pendingEvents.Count() )
 	{
-		int r,g,b;
-		switch( source->GetTeamNumber() )
-		{
-			case FIRST_GAME_TEAM:		r = 0;   g = 255; b = 0; break;
-			case (FIRST_GAME_TEAM+1):	r = 255; g = 0;   b = 0; break;
-			default:					r = 255; g = 255; b = 0; break;
-		}
-		NDebugOverlay::Circle( pos, Vector( 1, 0, 0 ), Vector( 0, -1, 0 ), 5.0f, r, g, b, 255, true, 3.0f );
+		event = m_pendingEvents[ m_nextPendingEvent++ ];
+		DeliverEvent( *event );
+		delete event;
 	}
+
+	m_pendingEvents.RemoveAll();
+	m_nextPendingEvent = 0;
 }
 
 
-//----------------------------------------------------------------------------------------------------------
-class NextBotResponseNotifyScan
+//---------------------------------------------------------------------------------------------
+void NextBotManager::DiscardQueuedEvents( void )
 {
-public:
-	NextBotResponseNotifyScan( CBaseCombatCharacter *who, AIConcept_t concept, AI_Response *response ) : m_who( who ), m_concept( concept ), m_response( response )
+	NextBotEvent *event;
+	while ( m_eventQueue->PopItem( &event ) )
 	{
+		delete event;
 	}
 
-	bool operator() ( INextBot *bot )
+	for ( int i = m_nextPendingEvent; i < m_pendingEvents.Count(); ++i )
 	{
-		if ( bot->GetEntity()->IsAlive() )
+		delete m_pendingEvents[i];
+	}
+	m_pendingEvents.RemoveAll();
+	m_nextPendingEvent = 0;
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::EndEventStatsTick( void )
+{
+	EventStats &tick = m_eventStatsTick;
+	if ( tick.events || tick.dropped )
+	{
+		if ( nb_event_queue_debug.GetBool() )
 		{
-			bot->OnSpokeConcept( m_who, m_concept, m_response );
+			Msg( "Tick %8d: %3d events to %3d bots, %4d deliveries, %4d culled, %d dropped, %.3fms\n", gpGlobals->tickcount, tick.events, m_botList.Count(), tick.deliveries, tick.culled, tick.dropped, tick.time * 1000.0 );
 		}
-		return true;
+
+		m_eventStatsTotal.events += tick.events;
+		m_eventStatsTotal.deliveries += tick.deliveries;
+		m_eventStatsTotal.culled += tick.culled;
+		m_eventStatsTotal.dropped += tick.dropped;
+		m_eventStatsTotal.time += tick.time;
+
+		m_eventStatsMax.events = MAX( m_eventStatsMax.events, tick.events );
+		m_eventStatsMax.deliveries = MAX( m_eventStatsMax.deliveries, tick.deliveries );
+		m_eventStatsMax.culled = MAX( m_eventStatsMax.culled, tick.culled );
+		m_eventStatsMax.dropped = MAX( m_eventStatsMax.dropped, tick.dropped );
+		m_eventStatsMax.time = MAX( m_eventStatsMax.time, tick.time );
+
+		++m_eventStatsTicks;
 	}
 
-	CBaseCombatCharacter *m_who;
-	AIConcept_t m_concept;
-	AI_Response *m_response;
-};
+	V_memset( &tick, 0, sizeof( tick ) );
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::ResetEventStats( void )
+{
+	V_memset( &m_eventStatsTotal, 0, sizeof( m_eventStatsTotal ) );
+	V_memset( &m_eventStatsMax, 0, sizeof( m_eventStatsMax ) );
+	m_eventStatsTicks = 0;
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::PrintEventStats( void ) const
+{
+	const EventStats &total = m_eventStatsTotal;
+	const EventStats &most = m_eventStatsMax;
+	int ticks = MAX( m_eventStatsTicks, 1 );
+
+	Msg( "NextBot events over %d ticks that had any (%s, hearing range %.0f):\n", m_eventStatsTicks, nb_event_queue.GetBool() ? "queued" : "immediate", nb_event_hearing_range.GetFloat() );
+	Msg( "  events     %7d total, %7.1f per tick, %5d max\n", total.events, (float)total.events / ticks, most.events );
+	Msg( "  deliveries %7d total, %7.1f per tick, %5d max\n", total.deliveries, (float)total.deliveries / ticks, most.deliveries );
+	Msg( "  culled     %7d total, %7.1f per tick, %5d max\n", total.culled, (float)total.culled / ticks, most.culled );
+	Msg( "  dropped    %7d total, %7.1f per tick, %5d max\n", total.dropped, (float)total.dropped / ticks, most.dropped );
+	Msg( "  time       %7.2fms total, %5.3fms per tick, %5.3fms max\n", total.time * 1000.0, total.time * 1000.0 / ticks, most.time * 1000.0 );
+}
 
 
 //---------------------------------------------------------------------------------------------
 /**
- * When an Actor speaks a concept
+ * When an actor is killed.  Propagate to all NextBots.
  */
-void NextBotManager::OnSpokeConcept( CBaseCombatCharacter *who, AIConcept_t concept, AI_Response *response )
+void NextBotManager::OnKilled( CBaseCombatCharacter *victim, const CTakeDamageInfo &info )
 {
-	NextBotResponseNotifyScan notify( who, concept, response );
-	TheNextBots().ForEachBot( notify );
+	NextBotEvent event( NextBotEvent::KILLED, victim );
+	event.info = info;
+	QueueEvent( event );
+}
 
-	if ( IsDebugging( NEXTBOT_HEARING ) )
-	{
-		// const char *who = response->GetCriteria()->GetValue( response->GetCriteria()->FindCriterionIndex( "Who" ) );
 
-		// TODO: Need concept.GetStringConcept()
-		DevMsg( "%3.2f: OnSpokeConcept( %s, %s )\n", gpGlobals->curtime, who->GetDebugName(), "concept.GetStringConcept()" );
-	}
+//---------------------------------------------------------------------------------------------
+/**
+ * When an entity emits a sound
+ */
+void NextBotManager::OnSound( CBaseEntity *source, const Vector &pos, KeyValues *keys )
+{
+	NextBotEvent event( NextBotEvent::SOUND, source );
+	event.hasPos = true;
+	event.pos = pos;
+	event.keys = keys;
+	QueueEvent( event );
 }
 
 
-//----------------------------------------------------------------------------------------------------------
-class NextBotWeaponFiredNotifyScan
+//---------------------------------------------------------------------------------------------
+/**
+ * When an Actor speaks a concept
+ */
+void NextBotManager::OnSpokeConcept( CBaseCombatCharacter *who, AIConcept_t concept, AI_Response *response )
 {
-public:
-	NextBotWeaponFiredNotifyScan( CBaseCombatCharacter *who, CBaseCombatWeapon *weapon ) : m_who( who ), m_weapon( weapon )
+	NextBotEvent event( NextBotEvent::SPOKE_CONCEPT, who );
+	if ( who )
 	{
+		event.hasPos = true;
+		event.pos = who->EyePosition();
 	}
-
-	bool operator() ( INextBot *bot )
-	{
-		if ( bot->GetEntity()->IsAlive() )
-		{
-			bot->OnWeaponFired( m_who, m_weapon );
-		}
-		return true;
-	}
-
-	CBaseCombatCharacter *m_who;
-	CBaseCombatWeapon *m_weapon;
-};
+	event.concept = concept;
+	event.response = response;
+	QueueEvent( event );
+}
 
 
 //---------------------------------------------------------------------------------------------
@@ -680,13 +1029,13 @@ public:
  */
 void NextBotManager::OnWeaponFired( CBaseCombatCharacter *whoFired, CBaseCombatWeapon *weapon )
 {
-	NextBotWeaponFiredNotifyScan notify( whoFired, weapon );
-	TheNextBots().ForEachBot( notify );
-
-	if ( IsDebugging( NEXTBOT_EVENTS ) )
+	NextBotEvent event( NextBotEvent::WEAPON_FIRED, whoFired, weapon );
+	if ( whoFired )
 	{
-		DevMsg( "%3.2f: OnWeaponFired( %s, %s )\n", gpGlobals->curtime, whoFired->GetDebugName(), weapon->GetName() );
+		event.hasPos = true;
+		event.pos = whoFired->WorldSpaceCenter();
 	}
+	QueueEvent( event );
 }
 
 
@@ -6,6 +6,9 @@
 #define _NEXT_BOT_MANAGER_H_
 
 #include "NextBotInterface.h"
+#include "tier0/tslist.h"
+
+struct NextBotEvent;
 
 //----------------------------------------------------------------------------------------------------------------
 /**
@@ -19,8 +22,11 @@ public:
 
 	void Reset( void );								// reset to initial state
 	virtual void Update( void );
+	void ScheduleUpdates( void );					// pick the bots that do a full update this tick
+	void UpdateVisionInParallel( void );			// vision checks of the bots picked, see nb_update_parallel
 
 	bool ShouldUpdate( INextBot *bot );
+	bool IsUpdateLikely( INextBot *bot ) const;
 	void NotifyBeginUpdate( INextBot *bot );
 	void NotifyEndUpdate( INextBot *bot );
 
@@ -108,6 +114,15 @@ public:
 	virtual void OnSpokeConcept( CBaseCombatCharacter *who, AIConcept_t concept, AI_Response *response );	// when an Actor speaks a concept
 	virtual void OnWeaponFired( CBaseCombatCharacter *whoFired, CBaseCombatWeapon *weapon );		// when someone fires a weapon
 
+	/**
+	 * With nb_event_queue on, the events above are queued from any thread and delivered
+	 * to the bots in one pass, at the start of the next Update()
+	 */
+	void DeliverQueuedEvents( void );
+	void DiscardQueuedEvents( void );
+	void PrintEventStats( void ) const;
+	void ResetEventStats( void );
+
 	/**
 	 * Debugging
 	 */
@@ -138,6 +153,20 @@ protected:
 	int Register( INextBot *bot );
 	void UnRegister( INextBot *bot );
 
+	struct EventStats
+	{
+		int events;									// events delivered
+		int deliveries;								// bot event handlers called
+		int culled;									// bots out of range of the event
+		int dropped;								// events whose entities were gone by delivery
+		double time;								// seconds spent delivering
+	};
+
+	void QueueEvent( const NextBotEvent &event );	// deliver the event now, or queue a copy of it
+	void DeliverEvent( const NextBotEvent &event );	// send the event to the bots in range of it
+	void DeliverPendingEvents( void );				// take everything queued so far and deliver it in order
+	void EndEventStatsTick( void );
+
 	CUtlLinkedList< INextBot * > m_botList;				// list of all active NextBots
 
 	int m_iUpdateTickrate;
@@ -155,6 +184,15 @@ protected:
 	CUtlVector< DebugFilter > m_debugFilterList;
 
 	INextBot *m_selectedBot;						// selected bot for further debug operations
+
+	CTSQueue< NextBotEvent * > *m_eventQueue;		// lock free, any thread can push events
+	CUtlVector< NextBotEvent * > m_pendingEvents;	// taken off the queue, being delivered
+	int m_nextPendingEvent;
+
+	EventStats m_eventStatsTick;					// since the last Update()
+	EventStats m_eventStatsTotal;
+	EventStats m_eventStatsMax;						// the most of each in a single tick
+	int m_eventStatsTicks;							// ticks that had events
 };
 
 inline int NextBotManager::GetNextBotCount( void ) const
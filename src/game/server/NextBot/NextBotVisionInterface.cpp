@@ -46,6 +46,10 @@ void IVision::Reset( void )
 	m_lastVisionUpdateTimestamp = 0.0f;
 	m_primaryThreat = NULL;
 
+	m_parallelVisible.RemoveAll();
+	m_parallelInSight.RemoveAll();
+	m_parallelUpdateTick = -1;
+
 	m_FOV = GetDefaultFieldOfView();
 	m_cosHalfFOV = cos( 0.5f * m_FOV * M_PI / 180.0f );
 	
@@ -368,18 +372,43 @@ void IVision::UpdateKnownEntities( void )
 {
 	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
 
-	// construct set of potentially visible objects
-	CUtlVector< CBaseEntity * > potentiallyVisible;
-	CollectPotentiallyVisibleEntities( &potentiallyVisible );
-
 	// collect set of visible and recognized entities at this moment
 	CollectVisible visibleNow( this );
-	for (int i=0; i < potentiallyVisible.Count(); ++i)
+
+	if ( m_parallelUpdateTick == gpGlobals->tickcount )
+	{
+		VPROF_BUDGET( "IVision::UpdateKnownEntities( apply parallel )", "NextBot" );
+
+		// the sight checks were done before the entities started thinking this tick,
+		// what's left is what CollectVisible checks that can change or has side effects
+		for ( int i=0; i < m_parallelVisible.Count(); ++i )
+		{
+			CBaseEntity *entity = m_parallelVisible[i];
+
+			if ( m_parallelInSight[i] &&
+				 !IsIgnored( entity ) &&
+				 entity->IsAlive() &&
+				 IsVisibleEntityNoticed( entity ) )
+			{
+				visibleNow.m_recognized.AddToTail( entity );
+			}
+		}
+
+		m_parallelUpdateTick = -1;
+	}
+	else
 	{
-		VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+		// construct set of potentially visible objects
+		CUtlVector< CBaseEntity * > potentiallyVisible;
+		CollectPotentiallyVisibleEntities( &potentiallyVisible );
 
-		if (visibleNow( potentiallyVisible[i] ) == false)
-			break;
+		for (int i=0; i < potentiallyVisible.Count(); ++i)
+		{
+			VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+
+			if (visibleNow( potentiallyVisible[i] ) == false)
+				break;
+		}
 	}
 
 	// update known set with new data
@@ -569,6 +598,22 @@ bool IVision::IsAbleToSee( CBaseEntity *subject, FieldOfViewCheckType checkFOV,
 {
 	VPROF_BUDGET( "IVision::IsAbleToSee", "NextBotExpensive" );
 
+	if ( !IsInSight( subject, checkFOV, visibleSpot ) )
+	{
+		return false;
+	}
+
+	return IsVisibleEntityNoticed( subject );
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Everything IsAbleToSee() checks except whether the subject is noticed.
+ * This doesn't change any state, so it's safe to run for several bots at once.
+ */
+bool IVision::IsInSight( CBaseEntity *subject, FieldOfViewCheckType checkFOV, Vector *visibleSpot ) const
+{
 	if ( GetBot()->IsRangeGreaterThan( subject, GetMaxVisionRange() ) )
 	{
 		return false;
@@ -602,12 +647,89 @@ bool IVision::IsAbleToSee( CBaseEntity *subject, FieldOfViewCheckType checkFOV,
 	}
 
 	// do actual line-of-sight trace
-	if ( !IsLineOfSightClearToEntity( subject, visibleSpot ) )
+	return IsLineOfSightClearToEntity( subject, visibleSpot );
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Collect the entities the next Update() will look at. Main thread only.
+ */
+void IVision::PrepareParallelUpdate( void )
+{
+	VPROF_BUDGET( "IVision::PrepareParallelUpdate", "NextBot" );
+
+	CUtlVector< CBaseEntity * > potentiallyVisible;
+	CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+	m_parallelVisible.RemoveAll();
+
+	CBaseCombatCharacter *me = GetBot()->GetEntity();
+	for ( int i=0; i < potentiallyVisible.Count(); ++i )
 	{
-		return false;
+		CBaseEntity *entity = potentiallyVisible[i];
+
+		// the same filtering as CollectVisible, minus the sight check
+		if ( entity && !IsIgnored( entity ) && entity->IsAlive() && entity != me )
+		{
+			// bring the transforms the sight checks read up to date here, so the
+			// worker threads don't
+			entity->WorldSpaceCenter();
+			entity->EyePosition();
+
+			m_parallelVisible.AddToTail( entity );
+		}
 	}
 
-	return IsVisibleEntityNoticed( subject );
+	me->EyePosition();
+
+	m_parallelInSight.SetCount( m_parallelVisible.Count() );
+	m_parallelUpdateTick = gpGlobals->tickcount;
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Do the sight checks for the entities PrepareParallelUpdate() collected.
+ * Runs on a worker thread, and only touches this bot's own vision and body state,
+ * so bodies must not hand back shared scratch vectors from GetEyePosition() and the like.
+ */
+void IVision::ComputeParallelUpdate( void )
+{
+	for ( int i=0; i < m_parallelVisible.Count(); ++i )
+	{
+		m_parallelInSight[i] = IsInSight( m_parallelVisible[i], IVision::USE_FOV );
+	}
+}
+
+
+//------------------------------------------------------------------------------------------
+int IVision::CheckParallelUpdate( void )
+{
+	int nMismatches = 0;
+
+	for ( int i=0; i < m_parallelVisible.Count(); ++i )
+	{
+		CBaseEntity *entity = m_parallelVisible[i];
+
+		bool bInSight = IsInSight( entity, IVision::USE_FOV );
+		if ( bInSight != m_parallelInSight[i] )
+		{
+			Warning( "%3.2f: %s parallel sight check of %s(#%d) was %d, serial %d\n",
+					 gpGlobals->curtime,
+					 GetBot()->GetDebugIdentifier(),
+					 entity->GetClassname(),
+					 entity->entindex(),
+					 m_parallelInSight[i] ? 1 : 0,
+					 bInSight ? 1 : 0 );
+
+			// go with the serial result
+			m_parallelInSight[i] = bInSight;
+			++nMismatches;
+		}
+	}
+
+	return nMismatches;
 }
 
 
@@ -108,6 +108,22 @@ public:
 	virtual bool IsLookingAt( const Vector &pos, float cosTolerance = 0.95f ) const;					// are we looking at the given position
 	virtual bool IsLookingAt( const CBaseCombatCharacter *actor, float cosTolerance = 0.95f ) const;	// are we looking at the given actor
 
+	//-- parallel update (nb_update_parallel) ---------------------------------------------------
+
+	/**
+	 * The sight checks of the next Update() can be done ahead of time, while nothing else runs.
+	 * PrepareParallelUpdate() collects the potentially visible entities on the main thread,
+	 * ComputeParallelUpdate() checks which of them are in sight and may run on a worker thread,
+	 * and Update() later this tick only has to apply the results. Everything with side effects
+	 * (noticing, the known set, OnSight/OnLostSight) still happens in Update().
+	 */
+	void PrepareParallelUpdate( void );
+	void ComputeParallelUpdate( void );
+	int CheckParallelUpdate( void );							// redo the sight checks serially, return the number that came out different
+
+protected:
+	bool IsInSight( CBaseEntity *subject, FieldOfViewCheckType checkFOV, Vector *visibleSpot = NULL ) const;	// IsAbleToSee() without IsVisibleEntityNoticed()
+
 private:
 	CountdownTimer m_scanTimer;			// for throttling update rate
 	
@@ -121,6 +137,10 @@ private:
 
 	float m_lastVisionUpdateTimestamp;
 	IntervalTimer m_notVisibleTimer[ MAX_TEAMS ];		// for tracking interval since last saw a member of the given team
+
+	CUtlVector< CBaseEntity * > m_parallelVisible;		// candidates collected by PrepareParallelUpdate()
+	CUtlVector< bool > m_parallelInSight;				// results of ComputeParallelUpdate(), one per candidate
+	int m_parallelUpdateTick;							// tick the above are for
 };
 
 inline void IVision::CollectKnownEntities( CUtlVector< CKnownEntity > *knownVector )
@@ -194,6 +194,7 @@ BEGIN_DATADESC( CBaseAnimating )
 
 	DEFINE_FIELD( m_flModelScale, FIELD_FLOAT ),
 	DEFINE_FIELD( m_flDissolveStartTime, FIELD_TIME ),
+	DEFINE_FIELD( m_bGlowEnabled, FIELD_BOOLEAN ),
 
  // DEFINE_FIELD( m_boneCacheHandle, memhandle_t ),
 
@@ -2704,6 +2705,51 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns the bone cache if it is current and has all the bones in
+//			boneMask, like GetBoneCache() checks, without setting up the bones
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::GetBoneCacheIfValid( int boneMask )
+{
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+	if ( pcache && pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime )
+		return pcache;
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills the bone cache with bones that were set up earlier
+//-----------------------------------------------------------------------------
+void CBaseAnimating::SetBoneCache( const matrix3x4_t *pBoneToWorld, int boneMask, float flTimeValid )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	if ( !pStudioHdr )
+		return;
+
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+	if ( pcache && pcache->m_boneMask != boneMask )
+	{
+		Studio_DestroyBoneCache( m_boneCacheHandle );
+		m_boneCacheHandle = 0;
+		pcache = NULL;
+	}
+
+	if ( pcache )
+	{
+		pcache->UpdateBones( pBoneToWorld, pStudioHdr->numbones(), flTimeValid );
+		return;
+	}
+
+	bonecacheparams_t params;
+	params.pStudioHdr = pStudioHdr;
+	params.pBoneToWorld = const_cast<matrix3x4_t *>( pBoneToWorld );
+	params.curtime = flTimeValid;
+	params.boneMask = boneMask;
+
+	m_boneCacheHandle = Studio_CreateBoneCache( params );
+}
+
 void CBaseAnimating::InvalidateBoneCache( void )
 {
 	Studio_InvalidateBoneCache( m_boneCacheHandle );
@@ -256,6 +256,8 @@ public:
 	virtual bool TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	class CBoneCache *GetBoneCache( void );
+	class CBoneCache *GetBoneCacheIfValid( int boneMask );	// without setting up the bones
+	void SetBoneCache( const matrix3x4_t *pBoneToWorld, int boneMask, float flTimeValid );
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
 	virtual int DrawDebugTextOverlays( void );
@@ -59,6 +59,7 @@
 #include <ctype.h>
 #include "datacache/imdlcache.h"
 #include "ModelSoundsCache.h"
+#include "precacheprefetch.h"
 #include "env_debughistory.h"
 #include "tier1/utlstring.h"
 #include "utlhashtable.h"
@@ -4664,6 +4665,8 @@ void CBaseEntity::SetSize( const Vector &vecMin, const Vector &vecMax )
 
 CStudioHdr *ModelSoundsCache_LoadModel( const char *filename )
 {
+	PrecachePrefetch_CountModelSoundsRebuild();
+
 	// Load the file
 	int idx = engine->PrecacheModel( filename, true );
 	if ( idx != -1 )
@@ -4856,6 +4859,14 @@ void CBaseEntity::PrecacheModelComponents( int nModelIndex )
 	if ( IsPC() )
 	{
 		const char *name = modelinfo->GetModelName( pModel );
+
+		// Saves Get() a stat if the prefetch already did it
+		long nFileSize;
+		if ( PrecachePrefetch_GetModelFileSize( name, nFileSize ) )
+		{
+			g_ModelSoundsCache.SetDiskFileInfo( name, nFileSize );
+		}
+
 		if ( !g_ModelSoundsCache.EntryExists( name ) )
 		{
 			char extension[ 8 ];
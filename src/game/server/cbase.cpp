@@ -573,8 +573,13 @@ class CEventsSaveDataOps : public ISaveRestoreOps
 
 	virtual void MakeEmpty( const SaveRestoreFieldInfo_t &fieldInfo )
 	{
-		// Don't no how to. This is okay, since objects of this type
-		// are always born clean before restore, and not reused
+		// Objects restored in place (round snapshots) may still have actions from before
+		CBaseEntityOutput *ev = (CBaseEntityOutput*)fieldInfo.pField;
+		const int fieldSize = fieldInfo.pTypeDesc->fieldSize;
+		for ( int i = 0; i < fieldSize; i++, ev++ )
+		{
+			ev->DeleteAllElements();
+		}
 	}
 
 	virtual bool Parse( const SaveRestoreFieldInfo_t &fieldInfo, char const* szValue )
@@ -12,6 +12,7 @@
 #include "collisionutils.h"
 #include "UtlSortVector.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 #include "mapentities.h"
 #include "client.h"
 #include "ai_initutils.h"
@@ -127,26 +128,57 @@ void AimTarget_ForceRepopulateList()
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+//
+// The entities that only think are also kept in a timing wheel by the tick of
+// their next think, so a tick only visits the entities that simulate or are due
+// instead of scanning the whole list. Level 0 has a slot per tick for the next
+// 256 ticks, levels 1 and 2 have a slot per 256 and per 16384 ticks, and thinks
+// further out than that wait in an overflow slot. Whenever a level wraps, the
+// next slot of the level above is spread back over the levels below it.
 struct simthinkentry_t
 {
 	unsigned short	entEntry;
 	unsigned short	unused0;
 	int				nextThinkTick;
 };
+
+#define SIMTHINK_WHEEL0_BITS	8
+#define SIMTHINK_WHEELN_BITS	6
+#define SIMTHINK_WHEEL0_SIZE	( 1 << SIMTHINK_WHEEL0_BITS )
+#define SIMTHINK_WHEELN_SIZE	( 1 << SIMTHINK_WHEELN_BITS )
+#define SIMTHINK_WHEEL1_FIRST	SIMTHINK_WHEEL0_SIZE
+#define SIMTHINK_WHEEL2_FIRST	( SIMTHINK_WHEEL1_FIRST + SIMTHINK_WHEELN_SIZE )
+#define SIMTHINK_OVERFLOW_SLOT	( SIMTHINK_WHEEL2_FIRST + SIMTHINK_WHEELN_SIZE )
+#define SIMTHINK_WHEEL_SLOTS	( SIMTHINK_OVERFLOW_SLOT + 1 )
+#define SIMTHINK_WHEEL1_SHIFT	SIMTHINK_WHEEL0_BITS
+#define SIMTHINK_WHEEL2_SHIFT	( SIMTHINK_WHEEL0_BITS + SIMTHINK_WHEELN_BITS )
+#define SIMTHINK_WHEEL_SPAN		( 1 << ( SIMTHINK_WHEEL0_BITS + 2 * SIMTHINK_WHEELN_BITS ) )
+
+ConVar sv_simthink_wheel( "sv_simthink_wheel", "1", 0, "Only visit the entities that simulate or are due to think each tick, instead of scanning every thinking entity" );
+
 class CSimThinkManager : public IEntityListener
 {
 public:
 	CSimThinkManager()
 	{
 		Clear();
+		ResetStats();
 	}
 	void Clear()
 	{
 		m_simThinkList.Purge();
+		m_dueList.Purge();
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_dueIndex[i] = 0xFFFF;
+			m_wheelSlot[i] = -1;
 		}
+		for ( int i = 0; i < SIMTHINK_WHEEL_SLOTS; i++ )
+		{
+			m_wheelHead[i] = 0xFFFF;
+		}
+		m_wheelTick = 0;
 	}
 	void LevelInitPreEntity()
 	{
@@ -183,6 +215,8 @@ public:
 			{
 				m_entinfoIndex[m_simThinkList[listHandle].entEntry] = listHandle;
 			}
+
+			Unschedule( index );
 		}
 	}
 	int ListCount()
@@ -192,6 +226,27 @@ public:
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		CFastTimer timer;
+		timer.Start();
+
+		int out = sv_simthink_wheel.GetBool() ? WheelCopy( pList, listMax ) : ScanCopy( pList, listMax );
+
+		timer.End();
+		if ( m_statTick != gpGlobals->tickcount )
+		{
+			m_statTick = gpGlobals->tickcount;
+			m_statTicks++;
+		}
+		m_statCopied += out;
+		m_statTime += timer.GetDuration();
+		return out;
+	}
+
+	int ScanCopy( CBaseEntity *pList[], int listMax )
+	{
+		// keep the wheel current, it's cheap when nothing is due
+		AdvanceWheel();
+
 		int count = MIN(listMax, ListCount());
 		int out = 0;
 		for ( int i = 0; i < count; i++ )
@@ -211,9 +266,28 @@ public:
 			}
 		}
 
+		m_statVisited += count;
 		return out;
 	}
 
+	int WheelCopy( CBaseEntity *pList[], int listMax )
+	{
+		AdvanceWheel();
+
+		int count = MIN(listMax, m_dueList.Count());
+		for ( int i = 0; i < count; i++ )
+		{
+			int entinfoIndex = m_dueList[i];
+			Assert( m_simThinkList[m_entinfoIndex[entinfoIndex]].nextThinkTick <= gpGlobals->tickcount );
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
+			pList[i] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert( gEntList.IsEntityPtr( pList[i] ) );
+		}
+
+		m_statVisited += count;
+		return count;
+	}
+
 	void EntityChanged( CBaseEntity *pEntity )
 	{
 		// might change after deletion, don't put back into the list
@@ -257,12 +331,216 @@ public:
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
 			}
+
+			Schedule( index, m_simThinkList[m_entinfoIndex[index]].nextThinkTick );
+		}
+	}
+
+	void ResetStats()
+	{
+		m_statTick = -1;
+		m_statTicks = 0;
+		m_statVisited = 0;
+		m_statCopied = 0;
+		m_statCascaded = 0;
+		m_statTime.Init();
+	}
+
+	void PrintStats()
+	{
+		int wheelCount[4] = { 0, 0, 0, 0 };
+		for ( int i = 0; i < SIMTHINK_WHEEL_SLOTS; i++ )
+		{
+			int level = ( i < SIMTHINK_WHEEL1_FIRST ) ? 0 : ( i < SIMTHINK_WHEEL2_FIRST ) ? 1 : ( i < SIMTHINK_OVERFLOW_SLOT ) ? 2 : 3;
+			for ( int index = m_wheelHead[i]; index != 0xFFFF; index = m_wheelNext[index] )
+			{
+				wheelCount[level]++;
+			}
+		}
+
+		Msg( "%d simulating/thinking entities, %d due or simulating, %d waiting (%d / %d / %d / %d by wheel level)\n",
+			m_simThinkList.Count(), m_dueList.Count(), wheelCount[0] + wheelCount[1] + wheelCount[2] + wheelCount[3],
+			wheelCount[0], wheelCount[1], wheelCount[2], wheelCount[3] );
+
+		if ( m_statTicks )
+		{
+			Msg( "Over %d ticks (%s): %.1f entities visited, %.1f copied, %.1f moved between wheel levels, %.2f us per tick\n",
+				m_statTicks, sv_simthink_wheel.GetBool() ? "wheel" : "scan",
+				(float)m_statVisited / m_statTicks, (float)m_statCopied / m_statTicks, (float)m_statCascaded / m_statTicks,
+				m_statTime.GetMicrosecondsF() / m_statTicks );
 		}
 	}
 
 private:
+	void Schedule( int index, int nextThinkTick )
+	{
+		// still due, keep its place
+		if ( m_dueIndex[index] != 0xFFFF && nextThinkTick <= m_wheelTick )
+		{
+			m_wheelThinkTick[index] = nextThinkTick;
+			return;
+		}
+
+		Unschedule( index );
+
+		m_wheelThinkTick[index] = nextThinkTick;
+		if ( nextThinkTick <= m_wheelTick )
+		{
+			// simulating, or due
+			m_dueIndex[index] = m_dueList.AddToTail( (unsigned short)index );
+		}
+		else
+		{
+			LinkToWheel( index, GetWheelSlot( nextThinkTick ) );
+		}
+	}
+
+	void Unschedule( int index )
+	{
+		int dueHandle = m_dueIndex[index];
+		if ( dueHandle != 0xFFFF )
+		{
+			m_dueList.FastRemove( dueHandle );
+			m_dueIndex[index] = 0xFFFF;
+			if ( dueHandle < m_dueList.Count() )
+			{
+				m_dueIndex[m_dueList[dueHandle]] = dueHandle;
+			}
+		}
+		else if ( m_wheelSlot[index] >= 0 )
+		{
+			UnlinkFromWheel( index );
+		}
+	}
+
+	// Relative to the next tick the wheel will run
+	int GetWheelSlot( int thinkTick )
+	{
+		int delta = thinkTick - ( m_wheelTick + 1 );
+		Assert( delta >= 0 );
+		if ( delta < SIMTHINK_WHEEL0_SIZE )
+			return thinkTick & ( SIMTHINK_WHEEL0_SIZE - 1 );
+		if ( delta < ( 1 << SIMTHINK_WHEEL2_SHIFT ) )
+			return SIMTHINK_WHEEL1_FIRST + ( ( thinkTick >> SIMTHINK_WHEEL1_SHIFT ) & ( SIMTHINK_WHEELN_SIZE - 1 ) );
+		if ( delta < SIMTHINK_WHEEL_SPAN )
+			return SIMTHINK_WHEEL2_FIRST + ( ( thinkTick >> SIMTHINK_WHEEL2_SHIFT ) & ( SIMTHINK_WHEELN_SIZE - 1 ) );
+		return SIMTHINK_OVERFLOW_SLOT;
+	}
+
+	void LinkToWheel( int index, int slot )
+	{
+		m_wheelSlot[index] = slot;
+		m_wheelPrev[index] = 0xFFFF;
+		m_wheelNext[index] = m_wheelHead[slot];
+		if ( m_wheelHead[slot] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelHead[slot]] = (unsigned short)index;
+		}
+		m_wheelHead[slot] = (unsigned short)index;
+	}
+
+	void UnlinkFromWheel( int index )
+	{
+		int slot = m_wheelSlot[index];
+		if ( m_wheelPrev[index] != 0xFFFF )
+		{
+			m_wheelNext[m_wheelPrev[index]] = m_wheelNext[index];
+		}
+		else
+		{
+			m_wheelHead[slot] = m_wheelNext[index];
+		}
+		if ( m_wheelNext[index] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelNext[index]] = m_wheelPrev[index];
+		}
+		m_wheelSlot[index] = -1;
+	}
+
+	// Takes everything out of the slot and schedules it again against the current tick
+	void RescheduleSlot( int slot )
+	{
+		int index = m_wheelHead[slot];
+		m_wheelHead[slot] = 0xFFFF;
+		while ( index != 0xFFFF )
+		{
+			int next = m_wheelNext[index];
+			m_wheelSlot[index] = -1;
+			Schedule( index, m_wheelThinkTick[index] );
+			m_statCascaded++;
+			index = next;
+		}
+	}
+
+	void AdvanceWheel()
+	{
+		int tick = gpGlobals->tickcount;
+		if ( tick == m_wheelTick )
+			return;
+
+		if ( tick < m_wheelTick || tick - m_wheelTick > SIMTHINK_WHEEL0_SIZE )
+		{
+			// new level or a long stall, not worth stepping through
+			m_wheelTick = tick;
+			for ( int i = 0; i < SIMTHINK_WHEEL_SLOTS; i++ )
+			{
+				RescheduleSlot( i );
+			}
+			for ( int i = m_dueList.Count() - 1; i >= 0; i-- )
+			{
+				int index = m_dueList[i];
+				if ( m_wheelThinkTick[index] > m_wheelTick )
+				{
+					Schedule( index, m_wheelThinkTick[index] );
+				}
+			}
+			return;
+		}
+
+		while ( m_wheelTick < tick )
+		{
+			int runTick = m_wheelTick + 1;
+			int slot0 = runTick & ( SIMTHINK_WHEEL0_SIZE - 1 );
+			if ( !slot0 )
+			{
+				// level 0 wrapped, pull the next 256 ticks down from level 1 (and so on)
+				int slot1 = ( runTick >> SIMTHINK_WHEEL1_SHIFT ) & ( SIMTHINK_WHEELN_SIZE - 1 );
+				RescheduleSlot( SIMTHINK_WHEEL1_FIRST + slot1 );
+				if ( !slot1 )
+				{
+					int slot2 = ( runTick >> SIMTHINK_WHEEL2_SHIFT ) & ( SIMTHINK_WHEELN_SIZE - 1 );
+					RescheduleSlot( SIMTHINK_WHEEL2_FIRST + slot2 );
+					if ( !slot2 )
+					{
+						RescheduleSlot( SIMTHINK_OVERFLOW_SLOT );
+					}
+				}
+			}
+
+			m_wheelTick = runTick;
+			RescheduleSlot( slot0 );
+		}
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	// Entities that simulate or are due to think, and the wheel with the rest
+	CUtlVector<unsigned short>	m_dueList;
+	unsigned short	m_dueIndex[NUM_ENT_ENTRIES];
+	int				m_wheelThinkTick[NUM_ENT_ENTRIES];
+	short			m_wheelSlot[NUM_ENT_ENTRIES];
+	unsigned short	m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short	m_wheelPrev[NUM_ENT_ENTRIES];
+	unsigned short	m_wheelHead[SIMTHINK_WHEEL_SLOTS];
+	int				m_wheelTick;	// the last tick the wheel ran
+
+	int				m_statTick;
+	int				m_statTicks;
+	int				m_statVisited;
+	int				m_statCopied;
+	int				m_statCascaded;
+	CCycleCount		m_statTime;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -1637,3 +1915,16 @@ CON_COMMAND(report_simthinklist, "Lists all simulating/thinking entities")
 	list.ReportEntityList();
 }
 
+CON_COMMAND(report_simthink_wheel, "Shows how many simulating/thinking entities each tick visits. Pass 'reset' to clear the counters.")
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_SimThinkManager.ResetStats();
+		return;
+	}
+
+	g_SimThinkManager.PrintStats();
+}
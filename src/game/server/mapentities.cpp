@@ -32,6 +32,13 @@ struct HierarchicalSpawnMapData_t
 static CStringRegistry *g_pClassnameSpawnPriority = NULL;
 extern edict_t *g_pForceAttachEdict;
 
+ConVar sv_mapentities_pretokenized( "sv_mapentities_pretokenized", "1", 0, "Tokenize the entity lump once per map and respawn map entities from that on round restart." );
+
+// Interned strings are packed into blocks of this size.
+#define MAPENTITY_STRING_BLOCK_SIZE		( 64 * 1024 )
+
+CMapEntityLump g_MapEntityLump;
+
 // creates an entity by string name, but does not spawn it
 CBaseEntity *CreateEntityByName( const char *className, int iForceEdictIndex )
 {
@@ -325,33 +332,62 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pMapData = serverenginetools->GetEntityData( pMapData );
 	}
 
+	bool bTokenized = false;
+	if ( sv_mapentities_pretokenized.GetBool() )
+	{
+		VPROF( "MapEntity_ParseAllEntities_Tokenize" );
+		bTokenized = g_MapEntityLump.Tokenize( pMapData );
+	}
+
 	//  Loop through all entities in the map data, creating each.
-	for ( ; true; pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
+	for ( int iEntity = 0; true; iEntity++ )
 	{
-		//
-		// Parse the opening brace.
-		//
-		char token[MAPKEY_MAXLENGTH];
-		pMapData = MapEntity_ParseToken( pMapData, token );
+		CBaseEntity *pEntity;
+		const char *pCurMapData;
 
-		//
-		// Check to see if we've finished or not.
-		//
-		if (!pMapData)
-			break;
+		if ( bTokenized )
+		{
+			if ( iEntity >= g_MapEntityLump.EntityCount() )
+				break;
 
-		if (token[0] != '{')
+			//
+			// Create the entity straight from the tokens.
+			//
+			pCurMapData = g_MapEntityLump.GetEntityData( iEntity );
+			pMapData = MapEntity_ParseEntity(pEntity, pCurMapData, g_MapEntityLump.GetEntityTokens( iEntity ), pFilter);
+		}
+		else
 		{
-			Error( "found %s when expecting {", token);
-			continue;
+			if ( iEntity > 0 )
+			{
+				pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer);
+			}
+
+			//
+			// Parse the opening brace.
+			//
+			char token[MAPKEY_MAXLENGTH];
+			pMapData = MapEntity_ParseToken( pMapData, token );
+
+			//
+			// Check to see if we've finished or not.
+			//
+			if (!pMapData)
+				break;
+
+			if (token[0] != '{')
+			{
+				Error( "found %s when expecting {", token);
+				continue;
+			}
+
+			//
+			// Parse the entity and add it to the spawn list.
+			//
+			pCurMapData = pMapData;
+			pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
 		}
 
-		//
-		// Parse the entity and add it to the spawn list.
-		//
-		CBaseEntity *pEntity;
-		const char *pCurMapData = pMapData;
-		pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
 		if (pEntity == NULL)
 			continue;
 
@@ -547,7 +583,15 @@ void MapEntity_PrecacheEntity( const char *pEntData, int &nStringSize )
 //-----------------------------------------------------------------------------
 const char *MapEntity_ParseEntity(CBaseEntity *&pEntity, const char *pEntData, IMapEntityFilter *pFilter)
 {
-	CEntityMapData entData( (char*)pEntData );
+	return MapEntity_ParseEntity( pEntity, pEntData, NULL, pFilter );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same, but takes the keys from pTokens if it's set.
+//-----------------------------------------------------------------------------
+const char *MapEntity_ParseEntity(CBaseEntity *&pEntity, const char *pEntData, const MapEntityTokens_t *pTokens, IMapEntityFilter *pFilter)
+{
+	CEntityMapData entData( (char*)pEntData, pTokens );
 	char className[MAPKEY_MAXLENGTH];
 	
 	if (!entData.ExtractValue("classname", className))
@@ -599,3 +643,138 @@ const char *MapEntity_ParseEntity(CBaseEntity *&pEntity, const char *pEntData, I
 }
 
 
+
+
+//-----------------------------------------------------------------------------
+// CMapEntityLump
+//-----------------------------------------------------------------------------
+CMapEntityLump::CMapEntityLump() : CAutoGameSystem( "CMapEntityLump" ), m_Strings( 0, 0, StringLessThan )
+{
+	m_pMapData = NULL;
+	m_nMapDataLength = 0;
+	m_nStringBlockUsed = MAPENTITY_STRING_BLOCK_SIZE;
+}
+
+CMapEntityLump::~CMapEntityLump()
+{
+	Purge();
+}
+
+void CMapEntityLump::Purge()
+{
+	m_pMapData = NULL;
+	m_nMapDataLength = 0;
+	m_Entities.Purge();
+	m_KeyValues.Purge();
+	m_Strings.Purge();
+
+	for ( int i = 0; i < m_StringBlocks.Count(); i++ )
+	{
+		delete [] m_StringBlocks[i];
+	}
+	m_StringBlocks.Purge();
+	m_nStringBlockUsed = MAPENTITY_STRING_BLOCK_SIZE;
+}
+
+const char *CMapEntityLump::Intern( const char *pString )
+{
+	int i = m_Strings.Find( pString );
+	if ( i != m_Strings.InvalidIndex() )
+		return m_Strings[i];
+
+	int nLength = Q_strlen( pString ) + 1;
+	if ( m_nStringBlockUsed + nLength > MAPENTITY_STRING_BLOCK_SIZE )
+	{
+		// Tokens are at most MAPKEY_MAXLENGTH, so they always fit in a fresh block.
+		m_StringBlocks.AddToTail( new char[MAPENTITY_STRING_BLOCK_SIZE] );
+		m_nStringBlockUsed = 0;
+	}
+
+	char *pCopy = m_StringBlocks.Tail() + m_nStringBlockUsed;
+	m_nStringBlockUsed += nLength;
+	memcpy( pCopy, pString, nLength );
+
+	m_Strings.Insert( pCopy );
+	return pCopy;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Walks the text the same way MapEntity_ParseAllEntities does and keeps
+//			every entity's key/value tokens.
+//-----------------------------------------------------------------------------
+bool CMapEntityLump::Tokenize( const char *pMapData )
+{
+	if ( !pMapData )
+		return false;
+
+	int nLength = Q_strlen( pMapData );
+	if ( pMapData == m_pMapData && nLength == m_nMapDataLength )
+		return true;
+
+	Purge();
+
+	char token[MAPKEY_MAXLENGTH];
+	const char *pData = pMapData;
+	while ( true )
+	{
+		pData = MapEntity_ParseToken( pData, token );
+		if ( !pData )
+			break;
+
+		if ( token[0] != '{' )
+		{
+			Purge();
+			return false;
+		}
+
+		Entity_t &entity = m_Entities[ m_Entities.AddToTail() ];
+		entity.m_pData = pData;
+		entity.m_iFirstKeyValue = m_KeyValues.Count();
+
+		// Keys and values up to the closing brace. CEntityMapData::GetNextKey leaves
+		// its position just after the last value, so that's where the entity ends.
+		const char *pEnd = pData;
+		while ( true )
+		{
+			const char *pKey = MapEntity_ParseToken( pEnd, token );
+			if ( !pKey )
+			{
+				Purge();
+				return false;
+			}
+
+			if ( token[0] == '}' )
+				break;
+
+			MapEntityKeyValue_t &kv = m_KeyValues[ m_KeyValues.AddToTail() ];
+			kv.m_pKey = Intern( token );
+
+			const char *pValue = MapEntity_ParseToken( pKey, token );
+			if ( !pValue || token[0] == '}' )
+			{
+				Purge();
+				return false;
+			}
+
+			kv.m_pValue = Intern( token );
+			pEnd = pValue;
+		}
+
+		entity.m_Tokens.m_nKeyValues = m_KeyValues.Count() - entity.m_iFirstKeyValue;
+		entity.m_Tokens.m_pDataEnd = pEnd;
+
+		pData = MapEntity_SkipToNextEntity( pEnd, token );
+	}
+
+	// Now that m_KeyValues is done growing
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		m_Entities[i].m_Tokens.m_pKeyValues = m_KeyValues.Base() + m_Entities[i].m_iFirstKeyValue;
+	}
+
+	m_pMapData = pMapData;
+	m_nMapDataLength = nLength;
+
+	DevMsg( "Tokenized entity lump: %d entities, %d keys, %d unique strings\n", m_Entities.Count(), m_KeyValues.Count(), m_Strings.Count() );
+	return true;
+}
@@ -12,6 +12,8 @@
 #endif
 
 #include "mapentities_shared.h"
+#include "igamesystem.h"
+#include "tier1/utlrbtree.h"
 
 // This class provides hooks into the map-entity loading process that allows CS to do some tricks
 // when restarting the round. The main trick it tries to do is recreate all 
@@ -28,9 +30,60 @@ public:
 void MapEntity_ParseAllEntities( const char *pMapData, IMapEntityFilter *pFilter=NULL, bool bActivateEntities=false );
 
 const char *MapEntity_ParseEntity( CBaseEntity *&pEntity, const char *pEntData, IMapEntityFilter *pFilter );
+const char *MapEntity_ParseEntity( CBaseEntity *&pEntity, const char *pEntData, const MapEntityTokens_t *pTokens, IMapEntityFilter *pFilter );
 void MapEntity_PrecacheEntity( const char *pEntData, int &nStringSize );
 
 
+//-----------------------------------------------------------------------------
+// The map's entity lump, tokenized once so restarting a round can respawn the
+// map entities without running the whole lump through MapEntity_ParseToken
+// again. Keys and values are interned, and the entity boundaries are kept so
+// templates still get their text.
+//-----------------------------------------------------------------------------
+class CMapEntityLump : public CAutoGameSystem
+{
+public:
+	CMapEntityLump();
+	~CMapEntityLump();
+
+	// Tokenizes pMapData unless it's the lump that's already tokenized. Returns false if
+	// the text doesn't tokenize cleanly, in which case it should be parsed the old way.
+	bool	Tokenize( const char *pMapData );
+	void	Purge();
+
+	int		EntityCount() const { return m_Entities.Count(); }
+
+	// The entity's text, just after its opening brace.
+	const char *GetEntityData( int iEntity ) const { return m_Entities[iEntity].m_pData; }
+	const MapEntityTokens_t *GetEntityTokens( int iEntity ) const { return &m_Entities[iEntity].m_Tokens; }
+
+	virtual void LevelShutdownPostEntity() { Purge(); }
+
+private:
+	struct Entity_t
+	{
+		const char			*m_pData;
+		int					m_iFirstKeyValue;
+		MapEntityTokens_t	m_Tokens;
+	};
+
+	const char	*Intern( const char *pString );
+
+	const char	*m_pMapData;
+	int			m_nMapDataLength;
+
+	CUtlVector<Entity_t>			m_Entities;
+	CUtlVector<MapEntityKeyValue_t>	m_KeyValues;
+
+	// Interned strings
+	CUtlRBTree<const char *, int>	m_Strings;
+	CUtlVector<char *>				m_StringBlocks;
+	int								m_nStringBlockUsed;
+};
+
+extern CMapEntityLump g_MapEntityLump;
+
+
 //-----------------------------------------------------------------------------
 // Hierarchical spawn 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,280 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records player movement and replays it to check that changes to
+//			the movement code don't change its results.
+//
+//			movement_record <file> records every usercmd the calling player runs
+//			until movement_record_stop: the movement state and CMoveData going
+//			into ProcessMovement and what came out of it.
+//
+//			movement_replay <file> runs each recorded command on the calling
+//			player twice, once with sv_movement_tracelist off and once with it
+//			on, starting from the recorded state both times, and reports every
+//			command where the two results aren't bit for bit identical. It also
+//			counts the commands that still match the recording, which only holds
+//			on the same map with the entities in the same places.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "player.h"
+#include "usercmd.h"
+#include "gamemovement.h"
+#include "player_command.h"
+#include "movement_replay.h"
+#include "filesystem.h"
+#include "tier1/utlbuffer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern IGameMovement *g_pGameMovement;
+
+#define MOVEMENT_RECORD_ID			MAKEID( 'M', 'V', 'R', 'P' )
+#define MOVEMENT_RECORD_VERSION		1
+
+struct MovementRecord_t
+{
+	float		m_flFrameTime;
+	float		m_flCurTime;
+	int			m_nCommandNumber;
+	int			m_nRandomSeed;
+
+	CGameMovement::MovementState_t	m_StateIn;
+	CMoveData						m_MoveIn;
+
+	CGameMovement::MovementState_t	m_StateOut;
+	CMoveData						m_MoveOut;
+};
+
+static CHandle<CBasePlayer>			s_hRecordPlayer;
+static char							s_szRecordFile[MAX_PATH];
+static CUtlVector<MovementRecord_t>	s_Records;
+static bool							s_bReplaying = false;
+
+static CGameMovement *GetGameMovement()
+{
+	return static_cast<CGameMovement *>( g_pGameMovement );
+}
+
+static bool MoveResultsMatch( const CMoveData &moveA, const CGameMovement::MovementState_t &stateA,
+							  const CMoveData &moveB, const CGameMovement::MovementState_t &stateB )
+{
+	return !memcmp( &moveA.GetAbsOrigin(), &moveB.GetAbsOrigin(), sizeof( Vector ) ) &&
+		!memcmp( &moveA.m_vecVelocity, &moveB.m_vecVelocity, sizeof( Vector ) ) &&
+		!memcmp( &moveA.m_outWishVel, &moveB.m_outWishVel, sizeof( Vector ) ) &&
+		!memcmp( &moveA.m_outJumpVel, &moveB.m_outJumpVel, sizeof( Vector ) ) &&
+		!memcmp( &moveA.m_outStepHeight, &moveB.m_outStepHeight, sizeof( float ) ) &&
+		!memcmp( &stateA, &stateB, sizeof( stateA ) );
+}
+
+//-----------------------------------------------------------------------------
+// Recording
+//-----------------------------------------------------------------------------
+void MovementRecord_PreMove( CBasePlayer *pPlayer, CUserCmd *ucmd, CMoveData *pMove )
+{
+	if ( s_bReplaying || !s_hRecordPlayer || s_hRecordPlayer.Get() != pPlayer )
+		return;
+
+	MovementRecord_t &rec = s_Records[ s_Records.AddToTail() ];
+	memset( &rec, 0, sizeof( rec ) );
+
+	rec.m_flFrameTime = gpGlobals->frametime;
+	rec.m_flCurTime = gpGlobals->curtime;
+	rec.m_nCommandNumber = ucmd->command_number;
+	rec.m_nRandomSeed = ucmd->random_seed;
+	GetGameMovement()->SaveMovementState( pPlayer, rec.m_StateIn );
+	rec.m_MoveIn = *pMove;
+}
+
+void MovementRecord_PostMove( CBasePlayer *pPlayer, CMoveData *pMove )
+{
+	if ( s_bReplaying || !s_hRecordPlayer || s_hRecordPlayer.Get() != pPlayer || !s_Records.Count() )
+		return;
+
+	MovementRecord_t &rec = s_Records.Tail();
+	GetGameMovement()->SaveMovementState( pPlayer, rec.m_StateOut );
+	rec.m_MoveOut = *pMove;
+}
+
+static void MovementRecord_Stop()
+{
+	if ( !s_szRecordFile[0] )
+		return;
+
+	CUtlBuffer buf;
+	buf.PutInt( MOVEMENT_RECORD_ID );
+	buf.PutInt( MOVEMENT_RECORD_VERSION );
+	buf.PutInt( sizeof( MovementRecord_t ) );
+	buf.PutString( STRING( gpGlobals->mapname ) );
+	buf.PutInt( s_Records.Count() );
+	buf.Put( s_Records.Base(), s_Records.Count() * sizeof( MovementRecord_t ) );
+
+	if ( g_pFullFileSystem->WriteFile( s_szRecordFile, "MOD", buf ) )
+	{
+		Msg( "movement_record: wrote %d commands to %s\n", s_Records.Count(), s_szRecordFile );
+	}
+	else
+	{
+		Warning( "movement_record: couldn't write %s\n", s_szRecordFile );
+	}
+
+	s_hRecordPlayer = NULL;
+	s_szRecordFile[0] = 0;
+	s_Records.Purge();
+}
+
+CON_COMMAND_F( movement_record, "Record the movement of the calling player to a file for movement_replay.", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: movement_record <file>\n" );
+		return;
+	}
+
+	MovementRecord_Stop();
+
+	s_hRecordPlayer = pPlayer;
+	Q_strncpy( s_szRecordFile, args[1], sizeof( s_szRecordFile ) );
+	Msg( "movement_record: recording %s to %s\n", pPlayer->GetPlayerName(), s_szRecordFile );
+}
+
+CON_COMMAND_F( movement_record_stop, "Stop recording movement and write the file.", FCVAR_CHEAT )
+{
+	MovementRecord_Stop();
+}
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+static void ReplayMove( CBasePlayer *pPlayer, const MovementRecord_t &rec, int nTraceList,
+						CMoveData &moveOut, CGameMovement::MovementState_t &stateOut )
+{
+	CGameMovement *pGameMovement = GetGameMovement();
+
+	pGameMovement->RestoreMovementState( pPlayer, rec.m_StateIn );
+
+	moveOut = rec.m_MoveIn;
+	moveOut.m_nPlayerHandle = pPlayer;
+
+	CUserCmd cmd;
+	cmd.command_number = rec.m_nCommandNumber;
+	cmd.random_seed = rec.m_nRandomSeed;
+
+	gpGlobals->frametime = rec.m_flFrameTime;
+	gpGlobals->curtime = rec.m_flCurTime;
+
+	pGameMovement->SetMovementTraceListOverride( nTraceList );
+	PlayerMove()->RunRecordedMovement( pPlayer, &cmd, &moveOut );
+	pGameMovement->SetMovementTraceListOverride( -1 );
+
+	pGameMovement->SaveMovementState( pPlayer, stateOut );
+}
+
+CON_COMMAND_F( movement_replay, "Replay a movement_record file with and without sv_movement_tracelist and compare the results.", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: movement_replay <file>\n" );
+		return;
+	}
+
+	CUtlBuffer buf;
+	if ( !g_pFullFileSystem->ReadFile( args[1], "MOD", buf ) )
+	{
+		Warning( "movement_replay: couldn't read %s\n", args[1] );
+		return;
+	}
+
+	char szMapName[MAX_PATH];
+	int nId = buf.GetInt();
+	int nVersion = buf.GetInt();
+	int nRecordSize = buf.GetInt();
+	buf.GetString( szMapName );
+	int nRecords = buf.GetInt();
+
+	if ( nId != MOVEMENT_RECORD_ID || nVersion != MOVEMENT_RECORD_VERSION || nRecordSize != sizeof( MovementRecord_t ) ||
+		 nRecords < 0 || buf.GetBytesRemaining() < nRecords * (int)sizeof( MovementRecord_t ) )
+	{
+		Warning( "movement_replay: %s isn't a movement_record file from this build\n", args[1] );
+		return;
+	}
+
+	if ( Q_stricmp( szMapName, STRING( gpGlobals->mapname ) ) )
+	{
+		Warning( "movement_replay: %s was recorded on %s, results won't match the recording\n", args[1], szMapName );
+	}
+
+	CUtlVector<MovementRecord_t> records;
+	records.SetCount( nRecords );
+	buf.Get( records.Base(), nRecords * sizeof( MovementRecord_t ) );
+
+	CGameMovement *pGameMovement = GetGameMovement();
+
+	// Put everything back the way it was afterwards.
+	CGameMovement::MovementState_t liveState;
+	pGameMovement->SaveMovementState( pPlayer, liveState );
+	float flFrameTime = gpGlobals->frametime;
+	float flCurTime = gpGlobals->curtime;
+
+	s_bReplaying = true;
+	pGameMovement->ResetMovementTraceListStats();
+
+	int nMismatches = 0;
+	int nMatchRecording = 0;
+	double flFullTime = 0.0;
+	double flListTime = 0.0;
+
+	for ( int i = 0; i < nRecords; i++ )
+	{
+		const MovementRecord_t &rec = records[i];
+
+		CMoveData moveFull, moveList;
+		CGameMovement::MovementState_t stateFull, stateList;
+
+		double flStart = Plat_FloatTime();
+		ReplayMove( pPlayer, rec, 0, moveFull, stateFull );
+		double flMid = Plat_FloatTime();
+		ReplayMove( pPlayer, rec, 1, moveList, stateList );
+		double flEnd = Plat_FloatTime();
+
+		flFullTime += flMid - flStart;
+		flListTime += flEnd - flMid;
+
+		if ( !MoveResultsMatch( moveFull, stateFull, moveList, stateList ) )
+		{
+			if ( nMismatches < 20 )
+			{
+				Warning( "  command %d: (%f %f %f) without trace list, (%f %f %f) with\n", rec.m_nCommandNumber,
+					VectorExpand( moveFull.GetAbsOrigin() ), VectorExpand( moveList.GetAbsOrigin() ) );
+			}
+			nMismatches++;
+		}
+
+		if ( MoveResultsMatch( moveFull, stateFull, rec.m_MoveOut, rec.m_StateOut ) )
+		{
+			nMatchRecording++;
+		}
+	}
+
+	int nListTraces, nFullTraces;
+	pGameMovement->GetMovementTraceListStats( nListTraces, nFullTraces );
+
+	s_bReplaying = false;
+
+	pGameMovement->RestoreMovementState( pPlayer, liveState );
+	gpGlobals->frametime = flFrameTime;
+	gpGlobals->curtime = flCurTime;
+
+	Msg( "movement_replay: %d commands, %d differ with the trace list, %d match the recording\n", nRecords, nMismatches, nMatchRecording );
+	Msg( "movement_replay: %.2f ms without trace list, %.2f ms with (%d traces from the list, %d fell back)\n",
+		flFullTime * 1000.0, flListTime * 1000.0, nListTraces, nFullTraces );
+}
@@ -0,0 +1,22 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records player movement and replays it to check that changes to
+//			the movement code don't change its results. See movement_replay.cpp.
+//
+//=============================================================================//
+
+#ifndef MOVEMENT_REPLAY_H
+#define MOVEMENT_REPLAY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CBasePlayer;
+class CUserCmd;
+class CMoveData;
+
+// Called by CPlayerMove::RunCommand around ProcessMovement. Cheap when nothing is being recorded.
+void MovementRecord_PreMove( CBasePlayer *pPlayer, CUserCmd *ucmd, CMoveData *pMove );
+void MovementRecord_PostMove( CBasePlayer *pPlayer, CMoveData *pMove );
+
+#endif // MOVEMENT_REPLAY_H
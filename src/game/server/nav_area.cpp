@@ -34,6 +34,7 @@
 #include "functorutils.h"
 #include "team.h"
 #include "nav_entities.h"
+#include "nav_vis_cache.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -5439,7 +5440,8 @@ CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool
 
 //--------------------------------------------------------------------------------------------------------
 /**
- * Return a list of the delta between our visibility list and the given adjacent area
+ * Return a list of the delta between our visibility list and the given adjacent area.
+ * Both lists must be sorted by area ID (see CNavMesh::EndVisibilityComputations()), the delta is too.
  */
 const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNavArea *other ) const
 {
@@ -5456,54 +5458,50 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 		return delta;
 	}
 
-	// add any visible areas in my list that are not in 'others' list into the delta
-	int i, j;
-	for( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
+	const CAreaBindInfoArray &mine = m_potentiallyVisibleAreas;
+	const CAreaBindInfoArray &theirs = other->m_potentiallyVisibleAreas;
+
+	// walk both sorted lists together
+	int i = 0, j = 0;
+	while( i < mine.Count() || j < theirs.Count() )
 	{
-		if ( m_potentiallyVisibleAreas[i].area )
+		if ( i < mine.Count() && !mine[i].area )
 		{
-			// is my visible area also in adjacent area's vis list
-			for( j=0; j<other->m_potentiallyVisibleAreas.Count(); ++j )
-			{
-				if ( m_potentiallyVisibleAreas[i].area == other->m_potentiallyVisibleAreas[j].area &&
-					 m_potentiallyVisibleAreas[i].attributes == other->m_potentiallyVisibleAreas[j].attributes )
-				{
-					// mutually identically visible
-					break;
-				}
-			}
+			++i;
+			continue;
+		}
 
-			if ( j == other->m_potentiallyVisibleAreas.Count() )
-			{
-				// my vis area not in adjacent area's vis list or has different visibility attributes - add to delta
-				delta.AddToTail( m_potentiallyVisibleAreas[i] );
-			}
+		if ( j < theirs.Count() && !theirs[j].area )
+		{
+			++j;
+			continue;
 		}
-	}
 
-	// add explicit NOT_VISIBLE references to areas in 'others' list that are NOT in mine
-	for( j=0; j<other->m_potentiallyVisibleAreas.Count(); ++j )
-	{
-		if ( other->m_potentiallyVisibleAreas[j].area )
+		if ( j == theirs.Count() || ( i < mine.Count() && mine[i].area->GetID() < theirs[j].area->GetID() ) )
 		{
-			for( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
-			{
-				if ( m_potentiallyVisibleAreas[i].area == other->m_potentiallyVisibleAreas[j].area )
-				{
-					// area in both lists - already handled in delta above
-					break;
-				}
-			}
+			// my vis area not in adjacent area's vis list - add to delta
+			delta.AddToTail( mine[i] );
+			++i;
+		}
+		else if ( i == mine.Count() || theirs[j].area->GetID() < mine[i].area->GetID() )
+		{
+			// 'other' has area in their list that we don't - mark it explicitly NOT_VISIBLE
+			AreaBindInfo info;
+			info.area = theirs[j].area;
+			info.attributes = NOT_VISIBLE;
 
-			if ( i == m_potentiallyVisibleAreas.Count() )
+			delta.AddToTail( info );
+			++j;
+		}
+		else
+		{
+			// area in both lists - only goes in the delta if the visibility attributes differ
+			if ( mine[i].attributes != theirs[j].attributes )
 			{
-				// 'other' has area in their list that we don't - mark it explicitly NOT_VISIBLE
-				AreaBindInfo info;
-				info.area = other->m_potentiallyVisibleAreas[j].area;
-				info.attributes = NOT_VISIBLE;
-
-				delta.AddToTail( info );
+				delta.AddToTail( mine[i] );
 			}
+			++i;
+			++j;
 		}
 	}
 
@@ -5511,6 +5509,29 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+static int CompareAreaBindInfoID( const CNavArea::AreaBindInfo *lhs, const CNavArea::AreaBindInfo *rhs )
+{
+	unsigned int lhsID = lhs->area ? lhs->area->GetID() : 0;
+	unsigned int rhsID = rhs->area ? rhs->area->GetID() : 0;
+
+	if ( lhsID < rhsID )
+		return -1;
+
+	return ( lhsID > rhsID ) ? 1 : 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Sort our visibility list by area ID, for ComputeVisibilityDelta()
+ */
+void CNavArea::SortPotentiallyVisibleAreas()
+{
+	m_potentiallyVisibleAreas.Sort( CompareAreaBindInfoID );
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 void CNavArea::ResetPotentiallyVisibleAreas()
 {
@@ -5526,11 +5547,10 @@ void CNavArea::ResetPotentiallyVisibleAreas()
  */
 
 CNavArea *g_pCurVisArea;
-CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
 
-void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
+void CNavArea::ComputeVisToArea( AreaVisPair &pair )
 {
-	CNavArea *area = assert_cast< CNavArea * >( pOtherArea );
+	CNavArea *area = pair.area;
 	VisibilityType visThisToOther = ( area == g_pCurVisArea ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
 	VisibilityType visOtherToThis = NOT_VISIBLE;
 
@@ -5556,20 +5576,8 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 		}
 	}
 
-	CNavArea::AreaBindInfo info;
-	if ( visThisToOther != NOT_VISIBLE )
-	{
-		info.area = area;
-		info.attributes = visThisToOther;
-		g_ComputedVis.PushItem( info );
-	}
-
-	if ( visOtherToThis != NOT_VISIBLE )
-	{
-		info.area = g_pCurVisArea;
-		info.attributes = visOtherToThis;
-		area->m_potentiallyVisibleAreas.AddToTail( info );
-	}
+	pair.visThisToOther = visThisToOther;
+	pair.visOtherToThis = visOtherToThis;
 }
 
 
@@ -5607,15 +5615,60 @@ void CNavArea::ComputeVisibilityToMesh( void )
 		}
 	}
 
-	SetupPVS();
+	// Then take what the cache has from the last analysis, and only trace the rest
+	CUtlVector< AreaVisPair > pairs( 0, collector.m_area.Count() );
+	CUtlVector< AreaVisPair > computePairs;
+	FOR_EACH_VEC( collector.m_area, it )
+	{
+		AreaVisPair pair;
+		pair.area = (CNavArea *)collector.m_area[it];
+
+		if ( pair.area != this && TheNavVisCache.Find( this, pair.area, &pair.visThisToOther, &pair.visOtherToThis ) )
+		{
+			pairs.AddToTail( pair );
+		}
+		else
+		{
+			computePairs.AddToTail( pair );
+		}
+	}
+
+	if ( computePairs.Count() )
+	{
+		SetupPVS();
 
-	g_pCurVisArea = this;
-	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea );
+		g_pCurVisArea = this;
+		ParallelProcess( "CNavArea::ComputeVisibilityToMesh", computePairs.Base(), computePairs.Count(), &ComputeVisToArea );
 
-	m_potentiallyVisibleAreas.EnsureCapacity( g_ComputedVis.Count() );
-	while ( g_ComputedVis.Count() )
+		FOR_EACH_VEC( computePairs, it )
+		{
+			const AreaVisPair &pair = computePairs[it];
+			if ( pair.area != this )
+			{
+				TheNavVisCache.Add( this, pair.area, pair.visThisToOther, pair.visOtherToThis );
+			}
+			pairs.AddToTail( pair );
+		}
+	}
+
+	FOR_EACH_VEC( pairs, it )
 	{
-		g_ComputedVis.PopItem( &m_potentiallyVisibleAreas[ m_potentiallyVisibleAreas.AddToTail() ] );
+		const AreaVisPair &pair = pairs[it];
+		AreaBindInfo info;
+
+		if ( pair.visThisToOther != NOT_VISIBLE )
+		{
+			info.area = pair.area;
+			info.attributes = pair.visThisToOther;
+			m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		if ( pair.visOtherToThis != NOT_VISIBLE )
+		{
+			info.area = this;
+			info.attributes = pair.visOtherToThis;
+			pair.area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
 	}
 
 	FOR_EACH_VEC( collector.m_area, it )
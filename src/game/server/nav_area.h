@@ -747,7 +747,14 @@ private:
 	//- visibility --------------------------------------------------------------------------------------
 	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
 	void ResetPotentiallyVisibleAreas();
-	static void ComputeVisToArea( CNavArea *&pOtherArea );
+	void SortPotentiallyVisibleAreas();
+	struct AreaVisPair							// visibility between the area being computed and another area
+	{
+		CNavArea *area;
+		unsigned char visThisToOther;			// VisibilityType
+		unsigned char visOtherToThis;
+	};
+	static void ComputeVisToArea( AreaVisPair &pair );
 
 #ifndef _X360
 	typedef CUtlVectorConservative<AreaBindInfo> CAreaBindInfoArray; // shaves 8 bytes off structure caused by need to support editing
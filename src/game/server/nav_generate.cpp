@@ -14,6 +14,7 @@
 #include "nav_mesh.h"
 #include "nav_node.h"
 #include "nav_pathfind.h"
+#include "nav_vis_cache.h"
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
@@ -3799,6 +3800,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 				area->ComputeVisibilityToMesh();
 
+				// save what was computed so far now and then, so an interrupted analysis can resume
+				TheNavVisCache.Checkpoint();
+
 				// don't go over our time allotment
 				if ( Plat_FloatTime() - startTime > maxTime )
 				{
@@ -13,6 +13,7 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_vis_cache.h"
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
@@ -3232,6 +3233,8 @@ void CNavMesh::BeginVisibilityComputations( void )
 		CNavArea *area = TheNavAreas[ it ];
 		area->ResetPotentiallyVisibleAreas();
 	}
+
+	TheNavVisCache.Begin();
 }
 
 
@@ -3243,6 +3246,14 @@ void CNavMesh::EndVisibilityComputations( void )
 {
 	g_pNavVisPairHash->RemoveAll();
 
+	TheNavVisCache.End();
+
+	// ComputeVisibilityDelta() walks the lists in area ID order
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		TheNavAreas[ it ]->SortPotentiallyVisibleAreas();
+	}
+
 	int avgVisLength = 0;
 	int maxVisLength = 0;
 	int minVisLength = 999999999;
@@ -0,0 +1,351 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_vis_cache.cpp
+// Persistent cache of the area pair visibility nav_analyze computes
+
+#include "cbase.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "nav_mesh.h"
+#include "nav_vis_cache.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+#define NAV_VIS_CACHE_ID		(('C'<<24)+('V'<<16)+('V'<<8)+'N')
+#define NAV_VIS_CACHE_VERSION	2
+#define NAV_VIS_CACHE_DIR		"cache"
+
+ConVar nav_vis_cache( "nav_vis_cache", "1", FCVAR_CHEAT, "Reuse the area visibility nav_analyze computed last time for the areas that didn't change" );
+ConVar nav_vis_cache_checkpoint_interval( "nav_vis_cache_checkpoint_interval", "60", FCVAR_CHEAT, "How often, in seconds, nav_analyze saves the area visibility cache while computing mesh visibility" );
+
+extern ConVar nav_max_view_distance;
+extern ConVar nav_potentially_visible_dot_tolerance;
+
+CNavVisCache TheNavVisCache;
+
+
+//--------------------------------------------------------------------------------------------------------
+CNavVisCache::CNavVisCache( void )
+{
+	m_isActive = false;
+	m_lastSaveTime = 0.0;
+	m_loadedCount = 0;
+	m_hitCount = 0;
+	m_missCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CNavVisCache::IsEnabled( void ) const
+{
+	return m_isActive && nav_vis_cache.GetBool();
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Hash of everything about the area that ComputeVisibility() looks at, and of its ID so
+ * that overlapping areas with the same extents don't share their pairs
+ */
+uint64 CNavVisCache::GetAreaHash( const CNavArea *area ) const
+{
+	UtlHashHandle_t h = m_areaHash.Find( area->GetID() );
+	if ( h != m_areaHash.InvalidHandle() )
+	{
+		return m_areaHash.Element( h );
+	}
+
+	struct
+	{
+		Vector corners[ NUM_CORNERS ];
+		unsigned int id;
+	} areaKey;
+
+	for( int i=0; i<NUM_CORNERS; ++i )
+	{
+		areaKey.corners[i] = area->GetCorner( (NavCornerType)i );
+	}
+	areaKey.id = area->GetID();
+
+	return MurmurHash64( &areaKey, sizeof( areaKey ), NAV_VIS_CACHE_VERSION );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CNavVisCache::MakeKey( const CNavArea *area, const CNavArea *other, PairKey *key ) const
+{
+	uint64 areaHash = GetAreaHash( area );
+	uint64 otherHash = GetAreaHash( other );
+
+	// the IDs keep the orientation of the pair fixed if the hashes ever collide
+	if ( areaHash < otherHash || ( areaHash == otherHash && area->GetID() < other->GetID() ) )
+	{
+		key->lo = areaHash;
+		key->hi = otherHash;
+		return true;
+	}
+
+	key->lo = otherHash;
+	key->hi = areaHash;
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::GetFilename( char *filename, int size ) const
+{
+	char mapName[ MAX_PATH ];
+	Q_FileBase( STRING( gpGlobals->mapname ), mapName, sizeof( mapName ) );
+	Q_snprintf( filename, size, "%s/%s_navvis.cache", NAV_VIS_CACHE_DIR, mapName );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * The bsp the visibility was computed against
+ */
+void CNavVisCache::GetMapStamp( unsigned int *bspSize, long *bspTime ) const
+{
+	char bspFilename[ MAX_PATH ];
+	Q_snprintf( bspFilename, sizeof( bspFilename ), "maps/%s.bsp", STRING( gpGlobals->mapname ) );
+
+	*bspSize = filesystem->Size( bspFilename, "GAME" );
+	*bspTime = filesystem->GetFileTime( bspFilename, "GAME" );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::Begin( void )
+{
+	m_pairs.RemoveAll();
+	m_areaHash.RemoveAll();
+	m_isActive = true;
+	m_lastSaveTime = Plat_FloatTime();
+	m_loadedCount = 0;
+	m_hitCount = 0;
+	m_missCount = 0;
+
+	if ( !nav_vis_cache.GetBool() )
+	{
+		return;
+	}
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		m_areaHash.Insert( area->GetID(), GetAreaHash( area ) );
+	}
+
+	if ( Load() )
+	{
+		Msg( "Loaded %d cached area visibility pairs\n", m_loadedCount );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::End( void )
+{
+	if ( !IsEnabled() )
+	{
+		m_isActive = false;
+		return;
+	}
+
+	// only keep the pairs this mesh still has
+	Save( true );
+
+	int total = m_hitCount + m_missCount;
+	Msg( "Area visibility cache: %d of %d pairs reused (%d%%), %d computed\n", m_hitCount, total, total ? 100 * m_hitCount / total : 0, m_missCount );
+
+	m_pairs.Purge();
+	m_areaHash.Purge();
+	m_isActive = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::Checkpoint( void )
+{
+	if ( !IsEnabled() )
+	{
+		return;
+	}
+
+	if ( Plat_FloatTime() - m_lastSaveTime < nav_vis_cache_checkpoint_interval.GetFloat() )
+	{
+		return;
+	}
+
+	// the areas that weren't visited yet may still want their old pairs
+	Save( false );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CNavVisCache::Find( const CNavArea *area, const CNavArea *other, unsigned char *visAreaToOther, unsigned char *visOtherToArea )
+{
+	if ( !IsEnabled() )
+	{
+		return false;
+	}
+
+	PairKey key;
+	bool isAreaLo = MakeKey( area, other, &key );
+
+	UtlHashHandle_t h = m_pairs.Find( key );
+	if ( h == m_pairs.InvalidHandle() )
+	{
+		++m_missCount;
+		return false;
+	}
+
+	PairVis &vis = m_pairs.Element( h );
+	vis.used = true;
+
+	*visAreaToOther = isAreaLo ? vis.loToHi : vis.hiToLo;
+	*visOtherToArea = isAreaLo ? vis.hiToLo : vis.loToHi;
+
+	++m_hitCount;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::Add( const CNavArea *area, const CNavArea *other, unsigned char visAreaToOther, unsigned char visOtherToArea )
+{
+	if ( !IsEnabled() )
+	{
+		return;
+	}
+
+	PairKey key;
+	bool isAreaLo = MakeKey( area, other, &key );
+
+	PairVis vis;
+	vis.loToHi = isAreaLo ? visAreaToOther : visOtherToArea;
+	vis.hiToLo = isAreaLo ? visOtherToArea : visAreaToOther;
+	vis.used = true;
+
+	UtlHashHandle_t h = m_pairs.Insert( key, vis );
+	m_pairs.Element( h ) = vis;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CNavVisCache::Load( void )
+{
+	char filename[ MAX_PATH ];
+	GetFilename( filename, sizeof( filename ) );
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
+	if ( !filesystem->ReadFile( filename, "MOD", fileBuffer ) )
+	{
+		return false;
+	}
+
+	if ( fileBuffer.GetInt() != NAV_VIS_CACHE_ID || fileBuffer.GetInt() != NAV_VIS_CACHE_VERSION )
+	{
+		return false;
+	}
+
+	unsigned int bspSize;
+	long bspTime;
+	GetMapStamp( &bspSize, &bspTime );
+
+	unsigned int savedBspSize = fileBuffer.GetUnsignedInt();
+	long savedBspTime = (long)fileBuffer.GetInt64();
+	float savedViewDistance = fileBuffer.GetFloat();
+	float savedDotTolerance = fileBuffer.GetFloat();
+
+	if ( savedBspSize != bspSize || savedBspTime != bspTime )
+	{
+		Msg( "The bsp changed, not using the area visibility cache\n" );
+		return false;
+	}
+
+	if ( savedViewDistance != nav_max_view_distance.GetFloat() || savedDotTolerance != nav_potentially_visible_dot_tolerance.GetFloat() )
+	{
+		Msg( "The visibility settings changed, not using the area visibility cache\n" );
+		return false;
+	}
+
+	int count = fileBuffer.GetInt();
+	for( int i=0; i<count && fileBuffer.IsValid(); ++i )
+	{
+		PairKey key;
+		key.lo = (uint64)fileBuffer.GetInt64();
+		key.hi = (uint64)fileBuffer.GetInt64();
+
+		PairVis vis;
+		vis.loToHi = fileBuffer.GetUnsignedChar();
+		vis.hiToLo = fileBuffer.GetUnsignedChar();
+		vis.used = false;
+
+		if ( fileBuffer.IsValid() )
+		{
+			m_pairs.Insert( key, vis );
+		}
+	}
+
+	m_loadedCount = m_pairs.Count();
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavVisCache::Save( bool onlyUsed )
+{
+	unsigned int bspSize;
+	long bspTime;
+	GetMapStamp( &bspSize, &bspTime );
+
+	int count = 0;
+	FOR_EACH_HASHTABLE( m_pairs, it )
+	{
+		if ( !onlyUsed || m_pairs.Element( it ).used )
+		{
+			++count;
+		}
+	}
+
+	CUtlBuffer fileBuffer( 4096, 18 * count + 64 );
+	fileBuffer.PutInt( NAV_VIS_CACHE_ID );
+	fileBuffer.PutInt( NAV_VIS_CACHE_VERSION );
+	fileBuffer.PutUnsignedInt( bspSize );
+	fileBuffer.PutInt64( bspTime );
+	fileBuffer.PutFloat( nav_max_view_distance.GetFloat() );
+	fileBuffer.PutFloat( nav_potentially_visible_dot_tolerance.GetFloat() );
+	fileBuffer.PutInt( count );
+
+	FOR_EACH_HASHTABLE( m_pairs, it )
+	{
+		const PairVis &vis = m_pairs.Element( it );
+		if ( !onlyUsed || vis.used )
+		{
+			const PairKey &key = m_pairs.Key( it );
+			fileBuffer.PutInt64( (int64)key.lo );
+			fileBuffer.PutInt64( (int64)key.hi );
+			fileBuffer.PutUnsignedChar( vis.loToHi );
+			fileBuffer.PutUnsignedChar( vis.hiToLo );
+		}
+	}
+
+	char filename[ MAX_PATH ];
+	GetFilename( filename, sizeof( filename ) );
+
+	filesystem->CreateDirHierarchy( NAV_VIS_CACHE_DIR, "MOD" );
+	if ( !filesystem->WriteFile( filename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save area visibility cache '%s'\n", filename );
+	}
+
+	m_lastSaveTime = Plat_FloatTime();
+}
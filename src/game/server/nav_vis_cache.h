@@ -0,0 +1,87 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_vis_cache.h
+// Persistent cache of the area pair visibility nav_analyze computes
+
+#ifndef _NAV_VIS_CACHE_H_
+#define _NAV_VIS_CACHE_H_
+
+#include "utlhashtable.h"
+#include "tier1/generichash.h"
+
+class CNavArea;
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * The visibility between two areas only depends on the world and on the geometry of the two areas,
+ * so the results of CNavArea::ComputeVisibilityToMesh() are kept per map, keyed by a hash of each
+ * area's corners and ID. The next nav_analyze of the map only traces the pairs that involve an area that
+ * was added or changed since, and an analysis that was interrupted picks up the pairs it already
+ * did. The cache is thrown away when the bsp or the visibility settings change.
+ */
+class CNavVisCache
+{
+public:
+	CNavVisCache( void );
+
+	void Begin( void );								// load the cache for the current map, at the start of the visibility computations
+	void End( void );								// save the cache and free it
+	void Checkpoint( void );						// save the cache now and then, so an interrupted analysis doesn't lose it
+
+	/**
+	 * Return the visibility between the two areas, as computed from 'area', if the cache has it
+	 */
+	bool Find( const CNavArea *area, const CNavArea *other, unsigned char *visAreaToOther, unsigned char *visOtherToArea );
+	void Add( const CNavArea *area, const CNavArea *other, unsigned char visAreaToOther, unsigned char visOtherToArea );
+
+private:
+	struct PairKey
+	{
+		uint64 lo;									// the smaller area hash
+		uint64 hi;
+	};
+
+	struct PairVis
+	{
+		unsigned char loToHi;
+		unsigned char hiToLo;
+		bool used;									// looked up or added during this analysis
+	};
+
+	struct PairKeyHash
+	{
+		unsigned int operator()( const PairKey &key ) const { return Hash16( &key ); }
+	};
+
+	struct PairKeyEqual
+	{
+		bool operator()( const PairKey &lhs, const PairKey &rhs ) const { return lhs.lo == rhs.lo && lhs.hi == rhs.hi; }
+	};
+
+	bool IsEnabled( void ) const;
+	uint64 GetAreaHash( const CNavArea *area ) const;
+	bool MakeKey( const CNavArea *area, const CNavArea *other, PairKey *key ) const;	// return true if 'area' is the 'lo' one
+	void GetFilename( char *filename, int size ) const;
+	void GetMapStamp( unsigned int *bspSize, long *bspTime ) const;
+	bool Load( void );
+	void Save( bool onlyUsed );
+
+	CUtlHashtable< PairKey, PairVis, PairKeyHash, PairKeyEqual > m_pairs;
+	CUtlHashtable< unsigned int, uint64 > m_areaHash;	// by area ID
+
+	bool m_isActive;
+	double m_lastSaveTime;
+	int m_loadedCount;
+	int m_hitCount;
+	int m_missCount;
+};
+
+extern CNavVisCache TheNavVisCache;
+
+#endif // _NAV_VIS_CACHE_H_
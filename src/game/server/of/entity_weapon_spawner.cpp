@@ -45,6 +45,13 @@ DEFINE_KEYFIELD(szPickupSound, FIELD_STRING, "pickup_sound"),
 DEFINE_KEYFIELD(m_bDisableSpin, FIELD_BOOLEAN, "disable_spin"),
 DEFINE_KEYFIELD(m_bDisableShowOutline, FIELD_BOOLEAN, "disable_glow"),
 DEFINE_KEYFIELD(m_iIndex, FIELD_INTEGER, "Index"),
+DEFINE_FIELD(m_bSuperWeapon, FIELD_BOOLEAN),
+DEFINE_FIELD(m_flRespawnTick, FIELD_TIME),
+DEFINE_ARRAY(m_iszWeaponName, FIELD_CHARACTER, 128),
+DEFINE_AUTO_ARRAY(m_iszWeaponModel, FIELD_CHARACTER),
+DEFINE_AUTO_ARRAY(m_iszWeaponModelOLD, FIELD_CHARACTER),
+DEFINE_AUTO_ARRAY(m_iszPickupSound, FIELD_CHARACTER),
+DEFINE_FIELD(bWarningTriggered, FIELD_BOOLEAN),
 DEFINE_INPUTFUNC( FIELD_STRING, "SetWeaponModel", InputSetWeaponModel ),
 DEFINE_INPUTFUNC( FIELD_STRING, "SetWeaponName", InputSetWeaponName ),
 DEFINE_THINKFUNC( AnnouncerThink ),
@@ -323,6 +330,15 @@ CBaseEntity* CWeaponSpawner::Respawn( void )
 	return ret;
 }
 
+void CWeaponSpawner::OnRestore( void )
+{
+	BaseClass::OnRestore();
+
+	// The weapon info isn't saved, look it up again
+	WEAPON_FILE_INFO_HANDLE	hWpnInfo = LookupWeaponInfoSlot( m_iszWeaponName.Get() );
+	pWeaponInfo = dynamic_cast<CTFWeaponInfo*>( GetFileWeaponInfoFromHandle( hWpnInfo ) );
+}
+
 void CWeaponSpawner::Materialize( void )
 {
 	BaseClass::Materialize();
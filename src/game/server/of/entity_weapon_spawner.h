@@ -29,6 +29,7 @@ public:
 
 	void	Spawn( void );
 	virtual CBaseEntity* Respawn( void );
+	virtual void OnRestore( void );
 	void	Precache( void );
 	bool	MyTouch( CBasePlayer *pPlayer );
 	void	SetWeaponModel( void );
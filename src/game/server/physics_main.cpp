@@ -33,6 +33,7 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "thinkprofiler.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -941,6 +942,7 @@ void CBaseEntity::PhysicsDispatchThink( BASEPTR thinkFunc )
 	if ( thinkFunc )
 	{
 		MDLCACHE_CRITICAL_SECTION();
+		CThinkProfileScope profile( this, thinkFunc );
 		(this->*thinkFunc)();
 	}
 
@@ -1954,6 +1956,8 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 			"Physics_SimulateEntity" : 
 			EntityFactoryDictionary()->GetCannonicalName( pEntity->GetClassname() ) );
 
+	CThinkProfileScope profile( pEntity );
+
 	if ( pEntity->edict() )
 	{
 #if !defined( NO_ENTITY_PREDICTION )
@@ -13,6 +13,7 @@
 #include "player_command.h"
 #include "movehelper_server.h"
 #include "iservervehicle.h"
+#include "movement_replay.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -84,6 +85,26 @@ void CPlayerMove::FinishCommand( CBasePlayer *player )
 	CBaseEntity::SetPredictionPlayer( NULL );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Runs ProcessMovement on its own, with the state around it set up the
+//			way RunCommand would. Used by movement_replay.
+//-----------------------------------------------------------------------------
+void CPlayerMove::RunRecordedMovement( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move )
+{
+	StartCommand( player, ucmd );
+	MoveHelperServer()->SetHost( player );
+
+	g_pGameMovement->StartTrackPredictionErrors( player );
+	g_pGameMovement->ProcessMovement( player, move );
+	g_pGameMovement->FinishTrackPredictionErrors( player );
+
+	// Throw away the touches, replay shouldn't set off triggers.
+	MoveHelperServer()->ResetTouchList();
+	MoveHelperServer()->SetHost( NULL );
+
+	FinishCommand( player );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Checks if the player is standing on a moving entity and adjusts velocity and 
 //  basevelocity appropriately
@@ -434,7 +455,9 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	{
 		VPROF( "g_pGameMovement->ProcessMovement()" );
 		Assert( g_pGameMovement );
+		MovementRecord_PreMove( player, ucmd, g_pMoveData );
 		g_pGameMovement->ProcessMovement( player, g_pMoveData );
+		MovementRecord_PostMove( player, g_pMoveData );
 	}
 	else
 	{
@@ -34,6 +34,9 @@ public:
 	// Run a movement command from the player
 	void			RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
 
+	// Runs just the movement part of a command, for movement_replay
+	void			RunRecordedMovement( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move );
+
 protected:
 	// Prepare for running movement
 	virtual void	SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
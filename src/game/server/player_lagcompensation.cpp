@@ -12,6 +12,8 @@
 #include "inetchannelinfo.h"
 #include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "bone_setup.h"
+#include "checksum_crc.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -35,6 +37,8 @@ ConVar sv_maxunlag( "sv_maxunlag", "1.0", FCVAR_CHEAT, "Maximum lag compensation
 ConVar sv_lagflushbonecache( "sv_lagflushbonecache", "1", FCVAR_CHEAT, "Flushes entity bone cache on lag compensation" );
 ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show lag compensated hitboxes whenever a player is lag compensated." );
 
+ConVar sv_lagcompensation_bonecache( "sv_lagcompensation_bonecache", "1", FCVAR_CHEAT, "Reuses the hitbox bones of a backtracked pose when the same pose is backtracked to again" );
+
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_CHEAT, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
 //-----------------------------------------------------------------------------
@@ -44,6 +48,7 @@ ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_CHEAT, "Disallow backt
 #ifdef OF_DLL
 #define MAX_POSE_PARAMETERS (CBaseAnimating::NUM_POSEPAREMETERS)
 #endif
+#define MAX_HITBOX_BONE_RECORDS 8
 
 struct LayerRecord
 {
@@ -121,6 +126,77 @@ public:
 };
 
 
+// Hitbox bones set up for a backtracked pose
+struct HitboxBoneRecord
+{
+	float					m_flSimulationTime;
+	CRC32_t					m_nAnimHash;
+	int						m_nBoneMask;
+	CUtlVector<matrix3x4_t>	m_Bones;
+};
+
+// The bone cache of a player before it got backtracked, and the pose it got backtracked to
+struct BoneCacheRestore
+{
+	bool					m_bSaved;
+	CRC32_t					m_nAnimHash;
+	int						m_nBoneMask;
+	float					m_flTimeValid;
+	CUtlVector<matrix3x4_t>	m_Bones;
+
+	bool					m_bStore;			// the backtracked pose wasn't cached, store its bones once they're set up
+	float					m_flBacktrackTime;
+	CRC32_t					m_nBacktrackHash;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Hash of everything SetupBones looks at for the player
+//-----------------------------------------------------------------------------
+static CRC32_t HashAnimationState( CBasePlayer *pPlayer )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	int modelIndex = pPlayer->GetModelIndex();
+	float modelScale = pPlayer->GetModelScale();
+	CRC32_ProcessBuffer( &crc, &modelIndex, sizeof( modelIndex ) );
+	CRC32_ProcessBuffer( &crc, &modelScale, sizeof( modelScale ) );
+	CRC32_ProcessBuffer( &crc, &pPlayer->GetAbsOrigin(), sizeof( Vector ) );
+	CRC32_ProcessBuffer( &crc, &pPlayer->GetAbsAngles(), sizeof( QAngle ) );
+
+	int sequence = pPlayer->GetSequence();
+	float cycle = pPlayer->GetCycle();
+	CRC32_ProcessBuffer( &crc, &sequence, sizeof( sequence ) );
+	CRC32_ProcessBuffer( &crc, &cycle, sizeof( cycle ) );
+
+	int layerCount = pPlayer->GetNumAnimOverlays();
+	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+	{
+		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay( layerIndex );
+		if ( currentLayer )
+		{
+			LayerRecord layer;
+			layer.m_sequence = currentLayer->m_nSequence;
+			layer.m_cycle = currentLayer->m_flCycle;
+			layer.m_weight = currentLayer->IsActive() ? currentLayer->m_flWeight.Get() : 0.0f;
+			layer.m_order = currentLayer->m_nOrder;
+			CRC32_ProcessBuffer( &crc, &layer, sizeof( layer ) );
+		}
+	}
+
+	CStudioHdr *hdr = pPlayer->GetModelPtr();
+	if ( hdr )
+	{
+		int poseParameterCount = MIN( hdr->GetNumPoseParameters(), (int)CBaseAnimating::NUM_POSEPAREMETERS );
+		int controllerCount = MIN( hdr->numbonecontrollers(), (int)CBaseAnimating::NUM_BONECTRLS );
+		CRC32_ProcessBuffer( &crc, pPlayer->GetPoseParameterArray(), poseParameterCount * sizeof( float ) );
+		CRC32_ProcessBuffer( &crc, pPlayer->GetEncodedControllerArray(), controllerCount * sizeof( float ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
 //
 // Try to take the player from his current origin to vWantedPos.
 // If it can't get there, leave the player where he is.
@@ -178,6 +254,7 @@ public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
 	{
 		m_isCurrentlyDoingCompensation = false;
+		ResetBoneCacheStats();
 	}
 
 	// IServerSystem stuff
@@ -202,13 +279,26 @@ public:
 
 	bool			IsCurrentlyDoingLagCompensation() const override { return m_isCurrentlyDoingCompensation; }
 
+	void			PrintBoneCacheStats();
+	void			ResetBoneCacheStats();
+
 private:
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
 
+	// Hitbox bones of the backtracked poses
+	bool			CanCacheBones( CBasePlayer *pPlayer ) const;
+	void			SaveBoneCache( CBasePlayer *pPlayer );
+	void			ApplyCachedBones( CBasePlayer *pPlayer, float flBacktrackTime );
+	void			StoreBacktrackedBones( CBasePlayer *pPlayer );
+	void			RestoreBoneCache( CBasePlayer *pPlayer );
+
 	void ClearHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
+		{
 			m_PlayerTrack[i].Purge();
+			m_HitboxBones[i].Purge();
+		}
 	}
 
 	// keep a list of lag records for each player
@@ -221,6 +311,13 @@ private:
 	LagRecord				m_RestoreData[ MAX_PLAYERS ];	// player data before we moved him back
 	LagRecord				m_ChangeData[ MAX_PLAYERS ];	// player data where we moved him back
 
+	CUtlVector< HitboxBoneRecord >	m_HitboxBones[ MAX_PLAYERS ];	// oldest first
+	BoneCacheRestore		m_BoneCacheRestore[ MAX_PLAYERS ];
+
+	int						m_nBoneCacheHits;
+	int						m_nBoneCacheMisses;
+	int						m_nBoneCacheStores;
+
 	CBasePlayer				*m_pCurrentPlayer;	// The player we are doing lag compensation for
 
 	float					m_flTeleportDistanceSqr;
@@ -256,6 +353,7 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
 		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CUtlVector< HitboxBoneRecord > *hitboxBones = &m_HitboxBones[i-1];
 
 		if ( !pPlayer )
 		{
@@ -264,9 +362,16 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 				track->RemoveAll();
 			}
 
+			hitboxBones->Purge();
 			continue;
 		}
 
+		// the bones of poses we can't backtrack to anymore
+		while ( hitboxBones->Count() > 0 && hitboxBones->Head().m_flSimulationTime < flDeadtime )
+		{
+			hitboxBones->Remove( 0 );
+		}
+
 		Assert( track->Count() < 1000 ); // insanity check
 
 		// remove tail records that are too old
@@ -602,6 +707,12 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	LagRecord *restore = &m_RestoreData[ pl_index ];
 	LagRecord *change  = &m_ChangeData[ pl_index ];
 
+	bool cacheBones = sv_lagflushbonecache.GetBool() && CanCacheBones( pPlayer );
+	if ( cacheBones && !m_RestorePlayer.Get( pl_index ) )
+	{
+		SaveBoneCache( pPlayer );
+	}
+
 	QAngle angdiff = pPlayer->GetLocalAngles() - ang;
 	Vector orgdiff = pPlayer->GetLocalOrigin() - org;
 
@@ -738,6 +849,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	{
 		for( int paramIndex = 0; paramIndex < hdr->GetNumPoseParameters(); paramIndex++ )
 		{
+			restore->m_poseParameters[paramIndex] = pPlayer->GetPoseParameter( paramIndex );
+
 			float poseParameter = record->m_poseParameters[paramIndex];
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
@@ -757,8 +870,14 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if ( !flags )
 		return; // we didn't change anything
 
-	if ( sv_lagflushbonecache.GetBool() )
+	if ( cacheBones )
+	{
+		ApplyCachedBones( pPlayer, frac > 0.0f ? flTargetTime : record->m_flSimulationTime );
+	}
+	else if ( sv_lagflushbonecache.GetBool() )
+	{
 		pPlayer->InvalidateBoneCache();
+	}
 
 	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", flTargetTime );
 	pPlayer->DrawServerHitboxes( 10 );
@@ -808,6 +927,9 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		LagRecord *restore = &m_RestoreData[ pl_index ];
 		LagRecord *change  = &m_ChangeData[ pl_index ];
 
+		// keep the bones the hit tests set up for the backtracked pose
+		StoreBacktrackedBones( pPlayer );
+
 		bool restoreSimulationTime = false;
 
 		if ( restore->m_fFlags & LC_SIZE_CHANGED )
@@ -873,15 +995,181 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 					currentLayer->m_flWeight = restore->m_layerRecords[layerIndex].m_weight;
 				}
 			}
+
+#ifdef OF_DLL
+			CStudioHdr *hdr = pPlayer->GetModelPtr();
+			if ( hdr )
+			{
+				for( int paramIndex = 0; paramIndex < hdr->GetNumPoseParameters(); paramIndex++ )
+				{
+					pPlayer->SetPoseParameter( paramIndex, restore->m_poseParameters[paramIndex] );
+				}
+			}
+#endif
 		}
 
 		if ( restoreSimulationTime )
 		{
 			pPlayer->SetSimulationTime( restore->m_flSimulationTime );
 		}
+
+		// don't leave the backtracked bones in the cache
+		RestoreBoneCache( pPlayer );
 	}
 
 	m_isCurrentlyDoingCompensation = false;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The bones only depend on the animation state if the player isn't
+//			attached to anything
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::CanCacheBones( CBasePlayer *pPlayer ) const
+{
+	return sv_lagcompensation_bonecache.GetBool() && pPlayer->GetModelPtr() && !pPlayer->GetMoveParent();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Remember the bones of the current pose before backtracking the player
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::SaveBoneCache( CBasePlayer *pPlayer )
+{
+	BoneCacheRestore &saved = m_BoneCacheRestore[ pPlayer->entindex() - 1 ];
+	saved.m_bSaved = false;
+	saved.m_bStore = false;
+
+	CBoneCache *pcache = pPlayer->GetBoneCacheIfValid( BONE_USED_BY_HITBOX );
+	if ( !pcache )
+		return;
+
+	saved.m_bSaved = true;
+	saved.m_nAnimHash = HashAnimationState( pPlayer );
+	saved.m_nBoneMask = pcache->m_boneMask;
+	saved.m_flTimeValid = pcache->m_timeValid;
+	saved.m_Bones.SetCount( pPlayer->GetModelPtr()->numbones() );
+	pcache->ReadCachedBones( saved.m_Bones.Base() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Put the bones of the backtracked pose in the cache, if we have them
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::ApplyCachedBones( CBasePlayer *pPlayer, float flBacktrackTime )
+{
+	int pl_index = pPlayer->entindex() - 1;
+	BoneCacheRestore &saved = m_BoneCacheRestore[ pl_index ];
+	CRC32_t hash = HashAnimationState( pPlayer );
+
+	CUtlVector< HitboxBoneRecord > &hitboxBones = m_HitboxBones[ pl_index ];
+	FOR_EACH_VEC( hitboxBones, i )
+	{
+		const HitboxBoneRecord &bones = hitboxBones[i];
+		if ( bones.m_flSimulationTime == flBacktrackTime && bones.m_nAnimHash == hash &&
+			 bones.m_Bones.Count() == pPlayer->GetModelPtr()->numbones() )
+		{
+			pPlayer->SetBoneCache( bones.m_Bones.Base(), bones.m_nBoneMask, gpGlobals->curtime );
+			saved.m_bStore = false;
+			++m_nBoneCacheHits;
+			return;
+		}
+	}
+
+	pPlayer->InvalidateBoneCache();
+	saved.m_bStore = true;
+	saved.m_flBacktrackTime = flBacktrackTime;
+	saved.m_nBacktrackHash = hash;
+	++m_nBoneCacheMisses;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keep the bones set up for a backtracked pose that wasn't cached
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::StoreBacktrackedBones( CBasePlayer *pPlayer )
+{
+	int pl_index = pPlayer->entindex() - 1;
+	BoneCacheRestore &saved = m_BoneCacheRestore[ pl_index ];
+	if ( !saved.m_bStore )
+		return;
+
+	saved.m_bStore = false;
+
+	if ( !CanCacheBones( pPlayer ) )
+		return;
+
+	// nothing traced against the player, or the pose changed since
+	CBoneCache *pcache = pPlayer->GetBoneCacheIfValid( BONE_USED_BY_HITBOX );
+	if ( !pcache || HashAnimationState( pPlayer ) != saved.m_nBacktrackHash )
+		return;
+
+	CUtlVector< HitboxBoneRecord > &hitboxBones = m_HitboxBones[ pl_index ];
+	if ( hitboxBones.Count() >= MAX_HITBOX_BONE_RECORDS )
+	{
+		hitboxBones.Remove( 0 );
+	}
+
+	HitboxBoneRecord &bones = hitboxBones[ hitboxBones.AddToTail() ];
+	bones.m_flSimulationTime = saved.m_flBacktrackTime;
+	bones.m_nAnimHash = saved.m_nBacktrackHash;
+	bones.m_nBoneMask = pcache->m_boneMask;
+	bones.m_Bones.SetCount( pPlayer->GetModelPtr()->numbones() );
+	pcache->ReadCachedBones( bones.m_Bones.Base() );
+	++m_nBoneCacheStores;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Put back the bones the player had before it was backtracked
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RestoreBoneCache( CBasePlayer *pPlayer )
+{
+	if ( !sv_lagflushbonecache.GetBool() )
+		return;
+
+	BoneCacheRestore &saved = m_BoneCacheRestore[ pPlayer->entindex() - 1 ];
+	if ( saved.m_bSaved && CanCacheBones( pPlayer ) && saved.m_Bones.Count() == pPlayer->GetModelPtr()->numbones() &&
+		 HashAnimationState( pPlayer ) == saved.m_nAnimHash )
+	{
+		pPlayer->SetBoneCache( saved.m_Bones.Base(), saved.m_nBoneMask, saved.m_flTimeValid );
+	}
+	else
+	{
+		pPlayer->InvalidateBoneCache();
+	}
+
+	saved.m_bSaved = false;
+}
+
+void CLagCompensationManager::PrintBoneCacheStats()
+{
+	int lookups = m_nBoneCacheHits + m_nBoneCacheMisses;
+	Msg( "Lag compensation bone cache: %d of %d backtracked poses reused (%d%%), %d stored\n",
+		m_nBoneCacheHits, lookups, lookups ? 100 * m_nBoneCacheHits / lookups : 0, m_nBoneCacheStores );
+
+	int records = 0;
+	for ( int i=0; i<MAX_PLAYERS; i++ )
+	{
+		records += m_HitboxBones[i].Count();
+	}
+	Msg( "  %d poses cached\n", records );
+}
+
+void CLagCompensationManager::ResetBoneCacheStats()
+{
+	m_nBoneCacheHits = 0;
+	m_nBoneCacheMisses = 0;
+	m_nBoneCacheStores = 0;
+}
+
+CON_COMMAND_F( sv_lagcompensation_bonecache_stats, "Shows how often lag compensation reused the bones of a backtracked pose. Pass 'reset' to clear the counters.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_LagCompensationManager.ResetBoneCacheStats();
+		return;
+	}
+
+	g_LagCompensationManager.PrintBoneCacheStats();
+}
+
 
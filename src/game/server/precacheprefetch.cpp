@@ -0,0 +1,498 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Load-time prefetch of the models and scenes a level used last time.
+//			See precacheprefetch.h.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "precacheprefetch.h"
+#include "sceneentity.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "utldict.h"
+#include "vstdlib/jobthread.h"
+#include "networkstringtabledefs.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define PREFETCH_CACHE_ID		(('F'<<24)+('P'<<16)+('C'<<8)+'P')
+#define PREFETCH_CACHE_VERSION	1
+#define PREFETCH_CACHE_DIR		"cache"
+
+// At most this many worker jobs, the work is mostly waiting on the disk
+#define PREFETCH_MAX_JOBS		4
+
+extern INetworkStringTable *g_pStringTableClientSideChoreoScenes;
+void FreeSceneFileMemory( void *buffer );
+
+ConVar sv_precache_prefetch( "sv_precache_prefetch", "1", 0, "Read ahead and precache the models and scenes the map used last time while it loads." );
+
+class CPrecachePrefetch : public CAutoGameSystem
+{
+public:
+	CPrecachePrefetch() : CAutoGameSystem( "CPrecachePrefetch" )
+	{
+		m_bLoaded = false;
+		ClearStats();
+	}
+
+	virtual void LevelInitPreEntity();
+	virtual void LevelInitPostEntity();
+	virtual void LevelShutdownPreEntity();
+
+	int		TakeSceneFile( const char *pszFilename, void **ppBuffer );
+	bool	GetModelFileSize( const char *pszFilename, long &nFileSize );
+
+	void	CountModelSoundsRebuild();
+	void	CountSceneLoad();
+	void	PrintStats();
+
+private:
+	enum
+	{
+		PREFETCH_PENDING = 0,
+		PREFETCH_BUSY,
+		PREFETCH_DONE,
+	};
+
+	struct PrefetchItem_t
+	{
+		CUtlString		m_Filename;
+		bool			m_bScene;
+		CInterlockedInt	m_nState;
+
+		// Scenes
+		void			*m_pBuffer;
+		int				m_nBufferSize;
+
+		// Models
+		long			m_nFileSize;
+	};
+
+	void	ClearStats();
+	void	Purge();
+	void	GetCacheFilename( char *pszOut, int nOutSize );
+	static void GetItemKey( const char *pszFilename, bool bScene, char *pszOut, int nOutSize );
+	bool	LoadList();
+	void	SaveList();
+	int		FindItem( const char *pszFilename, bool bScene );
+	void	AddItem( const char *pszFilename, bool bScene );
+
+	void	ProcessItems();
+	void	ProcessItem( PrefetchItem_t &item );
+	PrefetchItem_t *ClaimItem( int iItem );
+	void	WaitForJobs();
+
+	CUtlVector<PrefetchItem_t>	m_Items;
+	CUtlDict<int, int>			m_ItemsByName;
+	CInterlockedInt				m_iNextItem;
+	CUtlVector<CJob *>			m_Jobs;
+	double						m_flStartTime;
+	bool						m_bLoaded;
+
+	// Stats
+	int		m_nModelsPrecached;
+	int		m_nScenesPrecached;
+	int		m_nScenesUsed;
+	int		m_nLoadModelRebuilds;
+	int		m_nLoadSceneLoads;
+	int		m_nLateModelRebuilds;
+	int		m_nLateSceneLoads;
+};
+
+static CPrecachePrefetch g_PrecachePrefetch;
+
+void CPrecachePrefetch::ClearStats()
+{
+	m_nModelsPrecached = 0;
+	m_nScenesPrecached = 0;
+	m_nScenesUsed = 0;
+	m_nLoadModelRebuilds = 0;
+	m_nLoadSceneLoads = 0;
+	m_nLateModelRebuilds = 0;
+	m_nLateSceneLoads = 0;
+}
+
+void CPrecachePrefetch::GetCacheFilename( char *pszOut, int nOutSize )
+{
+	char szMapName[MAX_PATH];
+	Q_FileBase( STRING( gpGlobals->mapname ), szMapName, sizeof( szMapName ) );
+	Q_snprintf( pszOut, nOutSize, "%s/%s_prefetch.cache", PREFETCH_CACHE_DIR, szMapName );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Scenes are looked up by the name CSceneEntity::LoadScene reads them
+//			as, which isn't always how they were precached
+//-----------------------------------------------------------------------------
+void CPrecachePrefetch::GetItemKey( const char *pszFilename, bool bScene, char *pszOut, int nOutSize )
+{
+	Q_strncpy( pszOut, pszFilename, nOutSize );
+	if ( bScene )
+	{
+		Q_SetExtension( pszOut, ".vcd", nOutSize );
+	}
+	Q_FixSlashes( pszOut );
+}
+
+int CPrecachePrefetch::FindItem( const char *pszFilename, bool bScene )
+{
+	char szKey[MAX_PATH];
+	GetItemKey( pszFilename, bScene, szKey, sizeof( szKey ) );
+
+	int i = m_ItemsByName.Find( szKey );
+	if ( i == m_ItemsByName.InvalidIndex() )
+		return -1;
+
+	int iItem = m_ItemsByName[i];
+	return m_Items[iItem].m_bScene == bScene ? iItem : -1;
+}
+
+void CPrecachePrefetch::AddItem( const char *pszFilename, bool bScene )
+{
+	char szKey[MAX_PATH];
+	GetItemKey( pszFilename, bScene, szKey, sizeof( szKey ) );
+
+	if ( m_ItemsByName.Find( szKey ) != m_ItemsByName.InvalidIndex() )
+		return;
+
+	int iItem = m_Items.AddToTail();
+	PrefetchItem_t &item = m_Items[iItem];
+	item.m_Filename = pszFilename;
+	item.m_bScene = bScene;
+	item.m_nState = PREFETCH_PENDING;
+	item.m_pBuffer = NULL;
+	item.m_nBufferSize = 0;
+	item.m_nFileSize = 0;
+
+	m_ItemsByName.Insert( szKey, iItem );
+}
+
+bool CPrecachePrefetch::LoadList()
+{
+	char szCacheFile[MAX_PATH];
+	GetCacheFilename( szCacheFile, sizeof( szCacheFile ) );
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( szCacheFile, "MOD", buf ) )
+		return false;
+
+	if ( buf.GetInt() != PREFETCH_CACHE_ID || buf.GetInt() != PREFETCH_CACHE_VERSION )
+		return false;
+
+	int nItems = buf.GetInt();
+	for ( int i = 0; i < nItems && buf.IsValid(); i++ )
+	{
+		bool bScene = buf.GetChar() != 0;
+
+		char szFilename[MAX_PATH];
+		buf.GetString( szFilename );
+		if ( buf.IsValid() && szFilename[0] )
+		{
+			AddItem( szFilename, bScene );
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes out what ended up in this level's precache tables
+//-----------------------------------------------------------------------------
+void CPrecachePrefetch::SaveList()
+{
+	CUtlVector<const char *> models;
+	for ( int i = 1; ; i++ )
+	{
+		const model_t *pModel = modelinfo->GetModel( i );
+		if ( !pModel )
+			break;
+
+		// Brush models come with the map
+		if ( modelinfo->GetModelType( pModel ) != mod_studio )
+			continue;
+
+		models.AddToTail( modelinfo->GetModelName( pModel ) );
+	}
+
+	int nScenes = g_pStringTableClientSideChoreoScenes ? g_pStringTableClientSideChoreoScenes->GetNumStrings() : 0;
+
+	CUtlBuffer buf;
+	buf.PutInt( PREFETCH_CACHE_ID );
+	buf.PutInt( PREFETCH_CACHE_VERSION );
+	buf.PutInt( models.Count() + nScenes );
+	for ( int i = 0; i < models.Count(); i++ )
+	{
+		buf.PutChar( 0 );
+		buf.PutString( models[i] );
+	}
+	for ( int i = 0; i < nScenes; i++ )
+	{
+		buf.PutChar( 1 );
+		buf.PutString( g_pStringTableClientSideChoreoScenes->GetString( i ) );
+	}
+
+	char szCacheFile[MAX_PATH];
+	GetCacheFilename( szCacheFile, sizeof( szCacheFile ) );
+
+	filesystem->CreateDirHierarchy( PREFETCH_CACHE_DIR, "MOD" );
+	if ( !filesystem->WriteFile( szCacheFile, "MOD", buf ) )
+	{
+		DevWarning( "Couldn't write precache prefetch list %s\n", szCacheFile );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs on the worker threads, and on the main thread for items it
+//			needs before a worker got to them
+//-----------------------------------------------------------------------------
+void CPrecachePrefetch::ProcessItem( PrefetchItem_t &item )
+{
+	if ( item.m_bScene )
+	{
+		// Same read CSceneEntity::LoadScene does, scenes in the scene image don't have a file
+		char szLoadFile[MAX_PATH];
+		GetItemKey( item.m_Filename, true, szLoadFile, sizeof( szLoadFile ) );
+		item.m_nBufferSize = filesystem->ReadFileEx( szLoadFile, "MOD", &item.m_pBuffer, true );
+		if ( !item.m_nBufferSize )
+		{
+			item.m_pBuffer = NULL;
+		}
+	}
+	else
+	{
+		// Same as CUtlCachedFileData with UTL_CACHED_FILE_USE_FILESIZE
+		item.m_nFileSize = filesystem->Size( item.m_Filename, "GAME" );
+		if ( item.m_nFileSize == -1 )
+		{
+			item.m_nFileSize = 0;
+		}
+	}
+}
+
+void CPrecachePrefetch::ProcessItems()
+{
+	for ( ;; )
+	{
+		int iItem = m_iNextItem++;
+		if ( iItem >= m_Items.Count() )
+			break;
+
+		PrefetchItem_t &item = m_Items[iItem];
+		if ( item.m_nState.AssignIf( PREFETCH_PENDING, PREFETCH_BUSY ) )
+		{
+			ProcessItem( item );
+			item.m_nState = PREFETCH_DONE;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes sure an item is done, doing it here if no worker has started on it
+//-----------------------------------------------------------------------------
+CPrecachePrefetch::PrefetchItem_t *CPrecachePrefetch::ClaimItem( int iItem )
+{
+	PrefetchItem_t &item = m_Items[iItem];
+	if ( item.m_nState.AssignIf( PREFETCH_PENDING, PREFETCH_BUSY ) )
+	{
+		ProcessItem( item );
+		item.m_nState = PREFETCH_DONE;
+	}
+	else
+	{
+		while ( item.m_nState != PREFETCH_DONE )
+		{
+			ThreadPause();
+		}
+	}
+
+	return &item;
+}
+
+void CPrecachePrefetch::WaitForJobs()
+{
+	for ( int i = 0; i < m_Jobs.Count(); i++ )
+	{
+		m_Jobs[i]->WaitForFinishAndRelease();
+	}
+	m_Jobs.Purge();
+}
+
+void CPrecachePrefetch::Purge()
+{
+	WaitForJobs();
+
+	for ( int i = 0; i < m_Items.Count(); i++ )
+	{
+		if ( m_Items[i].m_pBuffer )
+		{
+			FreeSceneFileMemory( m_Items[i].m_pBuffer );
+		}
+	}
+
+	m_Items.Purge();
+	m_ItemsByName.Purge();
+	m_iNextItem = 0;
+}
+
+void CPrecachePrefetch::LevelInitPreEntity()
+{
+	Purge();
+	ClearStats();
+	m_bLoaded = false;
+
+	if ( !sv_precache_prefetch.GetBool() || !LoadList() || !m_Items.Count() )
+		return;
+
+	m_flStartTime = Plat_FloatTime();
+
+	// The items are only claimed from here on, the list doesn't change until the next Purge
+	int nJobs = g_pThreadPool ? min( g_pThreadPool->NumThreads(), PREFETCH_MAX_JOBS ) : 0;
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		m_Jobs.AddToTail( ThreadExecute( this, &CPrecachePrefetch::ProcessItems ) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Last chance to precache, brings forward whatever the entities didn't
+//-----------------------------------------------------------------------------
+void CPrecachePrefetch::LevelInitPostEntity()
+{
+	if ( m_Items.Count() )
+	{
+		for ( int i = 0; i < m_Items.Count(); i++ )
+		{
+			// Files that went missing since last time are skipped, as are scenes in the
+			// scene image, those don't need reading or parsing
+			PrefetchItem_t *pItem = ClaimItem( i );
+			const char *pszFilename = pItem->m_Filename;
+			if ( pItem->m_bScene )
+			{
+				if ( pItem->m_pBuffer && g_pStringTableClientSideChoreoScenes->FindStringIndex( pszFilename ) == INVALID_STRING_INDEX )
+				{
+					PrecacheInstancedScene( pszFilename );
+					m_nScenesPrecached++;
+				}
+			}
+			else
+			{
+				if ( pItem->m_nFileSize && !engine->IsModelPrecached( pszFilename ) )
+				{
+					CBaseEntity::PrecacheModel( pszFilename );
+					m_nModelsPrecached++;
+				}
+			}
+		}
+
+		WaitForJobs();
+
+		DevMsg( "Precache prefetch: %d files in %.1fms, precached %d models and %d scenes ahead of use\n",
+			m_Items.Count(), ( Plat_FloatTime() - m_flStartTime ) * 1000.0, m_nModelsPrecached, m_nScenesPrecached );
+
+		// Everything that was going to be used has been
+		Purge();
+	}
+
+	m_bLoaded = true;
+}
+
+void CPrecachePrefetch::LevelShutdownPreEntity()
+{
+	Purge();
+
+	if ( m_bLoaded )
+	{
+		PrintStats();
+		SaveList();
+	}
+
+	m_bLoaded = false;
+}
+
+int CPrecachePrefetch::TakeSceneFile( const char *pszFilename, void **ppBuffer )
+{
+	int iItem = FindItem( pszFilename, true );
+	if ( iItem == -1 )
+		return 0;
+
+	PrefetchItem_t *pItem = ClaimItem( iItem );
+	if ( !pItem->m_pBuffer )
+		return 0;
+
+	*ppBuffer = pItem->m_pBuffer;
+	pItem->m_pBuffer = NULL;
+	m_nScenesUsed++;
+	return pItem->m_nBufferSize;
+}
+
+bool CPrecachePrefetch::GetModelFileSize( const char *pszFilename, long &nFileSize )
+{
+	int iItem = FindItem( pszFilename, false );
+	if ( iItem == -1 )
+		return false;
+
+	nFileSize = ClaimItem( iItem )->m_nFileSize;
+	return true;
+}
+
+void CPrecachePrefetch::CountModelSoundsRebuild()
+{
+	if ( CBaseEntity::IsPrecacheAllowed() )
+	{
+		m_nLoadModelRebuilds++;
+	}
+	else
+	{
+		m_nLateModelRebuilds++;
+	}
+}
+
+void CPrecachePrefetch::CountSceneLoad()
+{
+	if ( CBaseEntity::IsPrecacheAllowed() )
+	{
+		m_nLoadSceneLoads++;
+	}
+	else
+	{
+		m_nLateSceneLoads++;
+	}
+}
+
+void CPrecachePrefetch::PrintStats()
+{
+	Msg( "Precache prefetch: %d models and %d scenes precached ahead of use, %d scene files read ahead\n",
+		m_nModelsPrecached, m_nScenesPrecached, m_nScenesUsed );
+	Msg( "  during load:  %d model sounds cache rebuilds, %d scene loads from disk\n", m_nLoadModelRebuilds, m_nLoadSceneLoads );
+	Msg( "  after load:   %d model sounds cache rebuilds, %d scene loads from disk\n", m_nLateModelRebuilds, m_nLateSceneLoads );
+}
+
+int PrecachePrefetch_TakeSceneFile( const char *pszFilename, void **ppBuffer )
+{
+	return g_PrecachePrefetch.TakeSceneFile( pszFilename, ppBuffer );
+}
+
+bool PrecachePrefetch_GetModelFileSize( const char *pszFilename, long &nFileSize )
+{
+	return g_PrecachePrefetch.GetModelFileSize( pszFilename, nFileSize );
+}
+
+void PrecachePrefetch_CountModelSoundsRebuild()
+{
+	g_PrecachePrefetch.CountModelSoundsRebuild();
+}
+
+void PrecachePrefetch_CountSceneLoad()
+{
+	g_PrecachePrefetch.CountSceneLoad();
+}
+
+CON_COMMAND( sv_precache_prefetch_stats, "Shows how many model sounds cache rebuilds and scene loads happened during and after map load." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_PrecachePrefetch.PrintStats();
+}
@@ -0,0 +1,35 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Load-time prefetch of the models and scenes a level used last time.
+//
+//			When a level shuts down, the models and scenes that ended up in its
+//			precache tables (including anything precached late, like the first
+//			taunt or a dropped weapon) are written out per map. The next time
+//			the map loads, worker threads read those scene files and stat those
+//			models while the entities spawn, and anything the entities didn't
+//			precache themselves is precached in LevelInitPostEntity. That moves
+//			the model sounds cache rebuilds and scene parses that used to happen
+//			on first use into the map load.
+//
+//=============================================================================//
+
+#ifndef PRECACHEPREFETCH_H
+#define PRECACHEPREFETCH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Hands over a scene file that was read ahead of time. Returns the size, or 0 if
+// the file wasn't prefetched. The buffer is null terminated and freed like one
+// from ReadFileEx.
+int PrecachePrefetch_TakeSceneFile( const char *pszFilename, void **ppBuffer );
+
+// Gets the disk file size of a model that was stat'ed ahead of time, in the
+// form the model sounds cache keeps it. Returns false if it wasn't prefetched.
+bool PrecachePrefetch_GetModelFileSize( const char *pszFilename, long &nFileSize );
+
+// Counts a model sounds cache rebuild or a scene load from disk, for the stats.
+void PrecachePrefetch_CountModelSoundsRebuild();
+void PrecachePrefetch_CountSceneLoad();
+
+#endif // PRECACHEPREFETCH_H
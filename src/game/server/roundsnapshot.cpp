@@ -0,0 +1,695 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Round restarts that restore the map entities from a snapshot.
+//			See roundsnapshot.h.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "roundsnapshot.h"
+#include "saverestore.h"
+#include "datacache/imdlcache.h"
+#include "tier0/vprof.h"
+#include "vphysics_interface.h"
+#include "dt_send.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define ROUNDSNAPSHOT_MIN_BUFFER	( 1024 * 1024 )
+#define ROUNDSNAPSHOT_MAX_BUFFER	( 64 * 1024 * 1024 )
+#define ROUNDSNAPSHOT_SYMBOLS		0xfff
+
+ConVar mp_round_snapshot( "mp_round_snapshot", "0", FCVAR_GAMEDLL, "Restore the map entities from a snapshot on round restart instead of recreating them." );
+
+// These hook themselves into the game rules or the objective resource when they spawn,
+// restoring their fields doesn't redo that. Entries ending in * are prefixes.
+static const char *s_NotSnapshotted[] =
+{
+	"team_control_point",
+	"team_control_point_master",
+	"team_control_point_round",
+	"team_round_timer",
+	"team_train_watcher",
+	"team_train_watcher_master",
+	"trigger_capture_area",
+	"item_teamflag",
+	"tf_logic_*",
+	"of_logic_*",
+	"of_music_player",
+	"of_announcer",
+	"", // END Marker
+};
+
+// Networked fields that don't need to be in the datadesc
+static const char *s_UnsavedNetworkProps[] =
+{
+	"m_ubInterpolationFrame",	// bumped on restore
+	"", // END Marker
+};
+
+static bool MatchesList( const char **pStrings, const char *pszName )
+{
+	for ( int i = 0; pStrings[i][0]; i++ )
+	{
+		int nLength = V_strlen( pStrings[i] );
+		if ( pStrings[i][nLength - 1] == '*' )
+		{
+			if ( !V_strnicmp( pStrings[i], pszName, nLength - 1 ) )
+				return true;
+		}
+		else if ( !V_stricmp( pStrings[i], pszName ) )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+CRoundSnapshot g_RoundSnapshot;
+
+CRoundSnapshot::CRoundSnapshot() : CAutoGameSystem( "CRoundSnapshot" ),
+	m_KeptEntities( 0, 0, DefLessFunc( CBaseEntity * ) ),
+	m_UnsavedNetworkFields( DefLessFunc( ServerClass * ) )
+{
+	m_pSaveData = NULL;
+	m_nRestored = 0;
+
+	m_nFullCleanUps = 0;
+	m_flFullCleanUpTime = 0.0f;
+	m_flLastFullCleanUpTime = 0.0f;
+	m_nRestores = 0;
+	m_flRestoreTime = 0.0f;
+	m_flLastRestoreTime = 0.0f;
+	m_nFallbacks = 0;
+	m_nLastKept = 0;
+	m_nLastRecreated = 0;
+	m_nRecreated = 0;
+}
+
+CRoundSnapshot::~CRoundSnapshot()
+{
+	Purge();
+}
+
+void CRoundSnapshot::LevelShutdownPostEntity()
+{
+	Purge();
+
+	m_MapEntities.Purge();
+	m_KeptMapEntities.Purge();
+	m_KeptEntities.Purge();
+	m_MapUnsupported.Clear();
+	m_UnsupportedClasses.Purge();
+}
+
+void CRoundSnapshot::Purge()
+{
+	delete m_pSaveData;
+	m_pSaveData = NULL;
+
+	m_SaveBuffer.Purge();
+	m_SymbolTable.Purge();
+	m_EntityTable.Purge();
+	m_Entities.Purge();
+	m_nRestored = 0;
+}
+
+bool CRoundSnapshot::IsEnabled() const
+{
+	return mp_round_snapshot.GetBool();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Decides which entities this restart keeps. Every snapshotted entity
+//			that is still around is kept. Map entities that were removed during
+//			the round are recreated from the lump like the unsupported ones,
+//			unless they were part of a hierarchy, then the whole map is cleaned
+//			up and the snapshot taken again.
+//-----------------------------------------------------------------------------
+bool CRoundSnapshot::BeginRestore()
+{
+	m_MapEntities.RemoveAll();
+	m_KeptMapEntities.RemoveAll();
+	m_KeptEntities.RemoveAll();
+	m_nRecreated = 0;
+
+	if ( !IsEnabled() || !m_pSaveData )
+		return false;
+
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		const SnapshotEntity_t &entity = m_Entities[i];
+		if ( !entity.m_bRestore )
+			continue;
+
+		CBaseEntity *pEntity = entity.m_hEntity;
+		if ( pEntity && !pEntity->IsMarkedForDeletion() )
+		{
+			m_KeptEntities.Insert( pEntity );
+
+			if ( entity.m_iMapEntity != -1 )
+			{
+				while ( m_KeptMapEntities.Count() <= entity.m_iMapEntity )
+				{
+					m_KeptMapEntities.AddToTail( false );
+				}
+				m_KeptMapEntities[entity.m_iMapEntity] = true;
+			}
+			continue;
+		}
+
+		if ( entity.m_iMapEntity != -1 && !entity.m_bHierarchy )
+			continue;
+
+		DevMsg( "Round snapshot: %s was removed during the round and can't be recreated, cleaning up the whole map\n", STRING( m_EntityTable[i].classname ) );
+
+		m_nFallbacks++;
+		m_KeptMapEntities.RemoveAll();
+		m_KeptEntities.RemoveAll();
+		Purge();
+		return false;
+	}
+
+	return true;
+}
+
+bool CRoundSnapshot::ShouldKeepEntity( CBaseEntity *pEntity ) const
+{
+	return m_KeptEntities.Find( pEntity ) != m_KeptEntities.InvalidIndex();
+}
+
+bool CRoundSnapshot::ShouldKeepMapEntity( int iMapEntity ) const
+{
+	return iMapEntity < m_KeptMapEntities.Count() && m_KeptMapEntities[iMapEntity];
+}
+
+void CRoundSnapshot::SetMapEntity( int iMapEntity, CBaseEntity *pEntity )
+{
+	m_MapEntities.EnsureCount( iMapEntity + 1 );
+	m_MapEntities[iMapEntity] = pEntity;
+
+	if ( pEntity )
+	{
+		m_nRecreated++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Restores the kept entities in place. The map entities that were
+//			recreated this time already spawned, handles to them are pointed
+//			at the new entities before anything is read.
+//-----------------------------------------------------------------------------
+void CRoundSnapshot::FinishRestore()
+{
+	VPROF( "CRoundSnapshot::FinishRestore" );
+	MDLCACHE_CRITICAL_SECTION();
+
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		const SnapshotEntity_t &entity = m_Entities[i];
+
+		CBaseEntity *pEntity = entity.m_hEntity;
+		if ( !pEntity && entity.m_iMapEntity != -1 && entity.m_iMapEntity < m_MapEntities.Count() )
+		{
+			pEntity = m_MapEntities[entity.m_iMapEntity];
+		}
+
+		m_EntityTable[i].hEnt = pEntity;
+	}
+
+	// Break off whatever got attached to the kept entities during the round,
+	// and drop their touch and ground links, the restore rebuilds them
+	for ( int i = m_KeptEntities.FirstInorder(); i != m_KeptEntities.InvalidIndex(); i = m_KeptEntities.NextInorder( i ) )
+	{
+		CBaseEntity *pEntity = m_KeptEntities[i];
+
+		CBaseEntity::PhysicsRemoveTouchedList( pEntity );
+		CBaseEntity::PhysicsRemoveGroundList( pEntity );
+		pEntity->SetGroundEntity( NULL );
+
+		if ( pEntity->GetMoveParent() && !ShouldKeepEntity( pEntity->GetMoveParent() ) )
+		{
+			pEntity->SetParent( NULL );
+		}
+
+		CBaseEntity *pNext;
+		for ( CBaseEntity *pChild = pEntity->FirstMoveChild(); pChild; pChild = pNext )
+		{
+			pNext = pChild->NextMovePeer();
+			if ( !ShouldKeepEntity( pChild ) )
+			{
+				pChild->SetParent( NULL );
+			}
+		}
+	}
+
+	// Times were saved relative to when the snapshot was taken
+	m_pSaveData->levelInfo.time = gpGlobals->curtime;
+
+	CRestore restore( m_pSaveData );
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		CBaseEntity *pEntity = m_EntityTable[i].hEnt;
+		if ( !m_Entities[i].m_bRestore || !pEntity || !ShouldKeepEntity( pEntity ) )
+			continue;
+
+		restore.SetReadPos( m_Entities[i].m_iLocation );
+		m_pSaveData->SetCurrentEntityContext( pEntity );
+		pEntity->Restore( restore );
+		m_pSaveData->SetCurrentEntityContext( NULL );
+	}
+
+	// Same order as a save game restore
+	for ( int i = m_Entities.Count() - 1; i >= 0; i-- )
+	{
+		CBaseEntity *pEntity = m_EntityTable[i].hEnt;
+		if ( !m_Entities[i].m_bRestore || !pEntity || !ShouldKeepEntity( pEntity ) )
+			continue;
+
+		pEntity->OnRestore();
+
+		IPhysicsObject *pPhysics = pEntity->VPhysicsGetObject();
+		if ( pPhysics )
+		{
+			pPhysics->SetPosition( pEntity->GetAbsOrigin(), pEntity->GetAbsAngles(), true );
+			if ( pPhysics->GetShadowController() )
+			{
+				pEntity->UpdatePhysicsShadowToCurrentPosition( 0 );
+			}
+		}
+
+		pEntity->IncrementInterpolationFrame();
+		pEntity->NetworkStateChanged();
+	}
+
+	m_nLastKept = m_KeptEntities.Count();
+	m_KeptEntities.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CRoundSnapshot::Take( const CUtlVector<CBaseEntity *> &entities )
+{
+	VPROF( "CRoundSnapshot::Take" );
+
+	Purge();
+
+	if ( !m_MapUnsupported.IsEmpty() )
+		return;
+
+	m_UnsupportedClasses.RemoveAll();
+
+	CUtlRBTree<CBaseEntity *> candidates( 0, entities.Count(), DefLessFunc( CBaseEntity * ) );
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		candidates.Insert( entities[i] );
+	}
+
+	m_pSaveData = new CSaveRestoreData;
+
+	// The entity table has every entity, so handles to the ones that aren't
+	// restored (the players, the preserved entities) still come back
+	CUtlVector<CBaseEntity *> allEntities( 0, gEntList.NumberOfEntities() );
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		allEntities.AddToTail( pEntity );
+	}
+
+	m_EntityTable.SetCount( allEntities.Count() );
+	m_pSaveData->InitEntityTable( m_EntityTable.Base(), m_EntityTable.Count() );
+
+	for ( int i = 0; i < allEntities.Count(); i++ )
+	{
+		CBaseEntity *pEntity = allEntities[i];
+
+		entitytable_t *pEntInfo = m_pSaveData->GetEntityInfo( i );
+		pEntInfo->id = i;
+		pEntInfo->hEnt = pEntity;
+		pEntInfo->edictindex = pEntity->entindex();
+		pEntInfo->classname = pEntity->m_iClassname;
+
+		SnapshotEntity_t &entity = m_Entities[m_Entities.AddToTail()];
+		entity.m_hEntity = pEntity;
+		entity.m_iMapEntity = -1;
+		entity.m_iLocation = -1;
+		entity.m_bRestore = candidates.Find( pEntity ) != candidates.InvalidIndex();
+		entity.m_bHierarchy = pEntity->GetMoveParent() || pEntity->FirstMoveChild();
+	}
+
+	m_pSaveData->BuildEntityHash();
+
+	for ( int i = 0; i < m_MapEntities.Count(); i++ )
+	{
+		int iEntity = m_pSaveData->GetEntityIndex( m_MapEntities[i] );
+		if ( iEntity >= 0 )
+		{
+			m_Entities[iEntity].m_iMapEntity = i;
+		}
+	}
+
+	CUtlString reason;
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		if ( m_Entities[i].m_bRestore && !CanSnapshot( m_Entities[i].m_hEntity, reason ) )
+		{
+			m_Entities[i].m_bRestore = false;
+			NoteUnsupported( m_Entities[i].m_hEntity, reason );
+		}
+	}
+
+	// A hierarchy is restored as a whole or not at all, the links are saved in place
+	bool bChanged = true;
+	while ( bChanged )
+	{
+		bChanged = false;
+
+		for ( int i = 0; i < m_Entities.Count(); i++ )
+		{
+			if ( !m_Entities[i].m_bRestore || !m_Entities[i].m_bHierarchy )
+				continue;
+
+			CBaseEntity *pEntity = m_Entities[i].m_hEntity;
+			CBaseEntity *pOther = NULL;
+			if ( pEntity->GetMoveParent() && !IsRestored( pEntity->GetMoveParent() ) )
+			{
+				pOther = pEntity->GetMoveParent();
+			}
+
+			for ( CBaseEntity *pChild = pEntity->FirstMoveChild(); pChild && !pOther; pChild = pChild->NextMovePeer() )
+			{
+				if ( !IsRestored( pChild ) )
+				{
+					pOther = pChild;
+				}
+			}
+
+			if ( pOther )
+			{
+				m_Entities[i].m_bRestore = false;
+				reason.Format( "attached to %s, which isn't snapshotted", pOther->GetClassname() );
+				NoteUnsupported( pEntity, reason );
+				bChanged = true;
+			}
+		}
+	}
+
+	// Entities that aren't snapshotted are recreated from the entity lump, the ones
+	// that didn't come from there (spawned by another entity) can't be
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		const SnapshotEntity_t &entity = m_Entities[i];
+		if ( entity.m_bRestore || entity.m_iMapEntity != -1 || candidates.Find( entity.m_hEntity ) == candidates.InvalidIndex() )
+			continue;
+
+		m_MapUnsupported.Format( "%s wasn't created from the map and can't be snapshotted", entity.m_hEntity->GetClassname() );
+		DevMsg( "Round snapshot: %s, cleaning up the whole map every round\n", m_MapUnsupported.Get() );
+		Purge();
+		return;
+	}
+
+	m_SymbolTable.EnsureCapacity( ROUNDSNAPSHOT_SYMBOLS );
+	m_pSaveData->InitSymbolTable( m_SymbolTable.Base(), ROUNDSNAPSHOT_SYMBOLS );
+
+	int nBufferSize = ROUNDSNAPSHOT_MIN_BUFFER;
+	while ( !SaveEntities( nBufferSize ) )
+	{
+		nBufferSize *= 2;
+		if ( nBufferSize > ROUNDSNAPSHOT_MAX_BUFFER )
+		{
+			m_MapUnsupported = "the snapshot is too big";
+			Warning( "Round snapshot: %s, cleaning up the whole map every round\n", m_MapUnsupported.Get() );
+			Purge();
+			return;
+		}
+	}
+
+	DevMsg( "Round snapshot: %d of %d entities, %d KB\n", m_nRestored, m_Entities.Count(), m_pSaveData->GetCurPos() / 1024 );
+}
+
+bool CRoundSnapshot::SaveEntities( int nBufferSize )
+{
+	m_SaveBuffer.EnsureCapacity( nBufferSize );
+	m_pSaveData->Init( m_SaveBuffer.Base(), nBufferSize );
+	m_pSaveData->levelInfo.time = gpGlobals->curtime;
+	m_nRestored = 0;
+
+	CSave save( m_pSaveData );
+	for ( int i = 0; i < m_Entities.Count(); i++ )
+	{
+		SnapshotEntity_t &entity = m_Entities[i];
+		if ( !entity.m_bRestore )
+			continue;
+
+		CBaseEntity *pEntity = entity.m_hEntity;
+		pEntity->OnSave( GetEntitySaveUtils() );
+
+		entity.m_iLocation = save.GetWritePos();
+		m_pSaveData->SetCurrentEntityContext( pEntity );
+		pEntity->Save( save );
+		m_pSaveData->SetCurrentEntityContext( NULL );
+
+		// Writing past the end leaves nothing available
+		if ( !m_pSaveData->BytesAvailable() )
+			return false;
+
+		m_nRestored++;
+	}
+
+	return true;
+}
+
+bool CRoundSnapshot::IsRestored( CBaseEntity *pEntity )
+{
+	int iEntity = m_pSaveData->GetEntityIndex( pEntity );
+	return iEntity >= 0 && m_Entities[iEntity].m_bRestore;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether restoring the datadesc puts the entity back the way it was
+//			after it spawned.
+//-----------------------------------------------------------------------------
+bool CRoundSnapshot::CanSnapshot( CBaseEntity *pEntity, CUtlString &reason )
+{
+	if ( MatchesList( s_NotSnapshotted, pEntity->GetClassname() ) )
+	{
+		reason = "registers with the game rules when it spawns";
+		return false;
+	}
+
+	if ( pEntity->IsPlayer() || pEntity->MyNextBotPointer() )
+	{
+		reason = "player or NextBot";
+		return false;
+	}
+
+	if ( pEntity->ObjectCaps() & FCAP_DONT_SAVE )
+	{
+		reason = "FCAP_DONT_SAVE";
+		return false;
+	}
+
+	if ( pEntity->ObjectCaps() & FCAP_MUST_SPAWN )
+	{
+		reason = "has to spawn again after a restore";
+		return false;
+	}
+
+	IPhysicsObject *pList[2];
+	int nPhysics = pEntity->VPhysicsGetObjectList( pList, ARRAYSIZE( pList ) );
+	if ( nPhysics > 1 || ( nPhysics == 1 && pList[0]->IsMoveable() && !pList[0]->GetShadowController() ) )
+	{
+		reason = "simulated by physics";
+		return false;
+	}
+
+	// Saving a function pointer that isn't in the datadesc writes garbage
+	for ( datamap_t *pMap = pEntity->GetDataDescMap(); pMap; pMap = pMap->baseMap )
+	{
+		for ( int i = 0; i < pMap->dataNumFields; i++ )
+		{
+			typedescription_t *pField = &pMap->dataDesc[i];
+			if ( pField->fieldType != FIELD_FUNCTION || !( pField->flags & FTYPEDESC_SAVE ) )
+				continue;
+
+			inputfunc_t **pFunction = (inputfunc_t **)( (char *)pEntity + pField->fieldOffset[TD_OFFSET_NORMAL] );
+			if ( *pFunction && !UTIL_FunctionToName( pEntity->GetDataDescMap(), *pFunction ) )
+			{
+				reason.Format( "%s isn't in the datadesc", pField->fieldName );
+				return false;
+			}
+		}
+	}
+
+	const char *pszUnsaved = GetUnsavedNetworkFields( pEntity );
+	if ( pszUnsaved[0] )
+	{
+		reason.Format( "networked fields not in the datadesc: %s", pszUnsaved );
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lists the networked fields of the entity's class that its datadesc
+//			doesn't save, a restore would leave those as they were at the end
+//			of the round.
+//-----------------------------------------------------------------------------
+const char *CRoundSnapshot::GetUnsavedNetworkFields( CBaseEntity *pEntity )
+{
+	ServerClass *pClass = pEntity->GetServerClass();
+	if ( !pClass )
+		return "";
+
+	int iClass = m_UnsavedNetworkFields.Find( pClass );
+	if ( iClass == m_UnsavedNetworkFields.InvalidIndex() )
+	{
+		CUtlVector<SavedRange_t> ranges;
+		AddSavedRanges( pEntity->GetDataDescMap(), 0, ranges );
+
+		CUtlString props;
+		FindUnsavedProps( pClass->m_pTable, 0, ranges, props );
+
+		iClass = m_UnsavedNetworkFields.Insert( pClass, props );
+	}
+
+	return m_UnsavedNetworkFields[iClass].Get();
+}
+
+void CRoundSnapshot::AddSavedRanges( datamap_t *pMap, int nBaseOffset, CUtlVector<SavedRange_t> &ranges )
+{
+	for ( ; pMap; pMap = pMap->baseMap )
+	{
+		for ( int i = 0; i < pMap->dataNumFields; i++ )
+		{
+			typedescription_t *pField = &pMap->dataDesc[i];
+			if ( !( pField->flags & FTYPEDESC_SAVE ) )
+				continue;
+
+			int nOffset = nBaseOffset + pField->fieldOffset[TD_OFFSET_NORMAL];
+			if ( pField->fieldType == FIELD_EMBEDDED && pField->td )
+			{
+				AddSavedRanges( pField->td, nOffset, ranges );
+				continue;
+			}
+
+			SavedRange_t &range = ranges[ranges.AddToTail()];
+			range.m_nStart = nOffset;
+			range.m_nEnd = nOffset + MAX( pField->fieldSizeInBytes, 1 );
+		}
+	}
+}
+
+void CRoundSnapshot::FindUnsavedProps( SendTable *pTable, int nBaseOffset, const CUtlVector<SavedRange_t> &ranges, CUtlString &props )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); i++ )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() || pProp->IsInsideArray() )
+			continue;
+
+		int nOffset = nBaseOffset + pProp->GetOffset();
+		if ( pProp->GetType() == DPT_DataTable )
+		{
+			// Only tables that are part of the entity itself, not the ones a proxy builds
+			if ( pProp->GetDataTableProxyFn() == SendProxy_DataTableToDataTable )
+			{
+				FindUnsavedProps( pProp->GetDataTable(), nOffset, ranges, props );
+			}
+			continue;
+		}
+
+		if ( nOffset == 0 || MatchesList( s_UnsavedNetworkProps, pProp->GetName() ) )
+			continue;
+
+		bool bSaved = false;
+		for ( int j = 0; j < ranges.Count() && !bSaved; j++ )
+		{
+			bSaved = nOffset >= ranges[j].m_nStart && nOffset < ranges[j].m_nEnd;
+		}
+
+		if ( !bSaved )
+		{
+			if ( !props.IsEmpty() )
+			{
+				props += ", ";
+			}
+			props += pProp->GetName();
+		}
+	}
+}
+
+void CRoundSnapshot::NoteUnsupported( CBaseEntity *pEntity, const char *pszReason )
+{
+	int iClass = m_UnsupportedClasses.Find( pEntity->GetClassname() );
+	if ( iClass == m_UnsupportedClasses.InvalidIndex() )
+	{
+		iClass = m_UnsupportedClasses.Insert( pEntity->GetClassname() );
+		m_UnsupportedClasses[iClass].m_nCount = 0;
+		m_UnsupportedClasses[iClass].m_Reason = pszReason;
+	}
+
+	m_UnsupportedClasses[iClass].m_nCount++;
+}
+
+void CRoundSnapshot::RecordCleanUpTime( bool bRestored, float flTime )
+{
+	if ( bRestored )
+	{
+		m_nRestores++;
+		m_flRestoreTime += flTime;
+		m_flLastRestoreTime = flTime;
+		m_nLastRecreated = m_nRecreated;
+	}
+	else
+	{
+		m_nFullCleanUps++;
+		m_flFullCleanUpTime += flTime;
+		m_flLastFullCleanUpTime = flTime;
+	}
+
+	if ( IsEnabled() )
+	{
+		DevMsg( "Round restart: %s in %.2fms\n", bRestored ? "restored from the snapshot" : "recreated the map entities", flTime * 1000.0f );
+	}
+}
+
+void CRoundSnapshot::PrintReport()
+{
+	Msg( "Round snapshot: %s\n", IsEnabled() ? "enabled" : "disabled (mp_round_snapshot 0)" );
+
+	if ( !m_MapUnsupported.IsEmpty() )
+	{
+		Msg( "  This map can't be snapshotted: %s\n", m_MapUnsupported.Get() );
+	}
+	else if ( m_pSaveData )
+	{
+		Msg( "  %d of %d entities restored in place, %d KB\n", m_nRestored, m_Entities.Count(), m_pSaveData->GetCurPos() / 1024 );
+	}
+
+	Msg( "  Full cleanups: %d, last %.2fms, average %.2fms\n", m_nFullCleanUps, m_flLastFullCleanUpTime * 1000.0f,
+		m_nFullCleanUps ? m_flFullCleanUpTime * 1000.0f / m_nFullCleanUps : 0.0f );
+	Msg( "  Snapshot restores: %d, last %.2fms (%d kept, %d recreated), average %.2fms\n", m_nRestores, m_flLastRestoreTime * 1000.0f,
+		m_nLastKept, m_nLastRecreated, m_nRestores ? m_flRestoreTime * 1000.0f / m_nRestores : 0.0f );
+	Msg( "  Fell back to a full cleanup: %d\n", m_nFallbacks );
+
+	if ( m_UnsupportedClasses.Count() )
+	{
+		Msg( "  Recreated instead of restored:\n" );
+		for ( int i = m_UnsupportedClasses.First(); i != m_UnsupportedClasses.InvalidIndex(); i = m_UnsupportedClasses.Next( i ) )
+		{
+			Msg( "    %-32s %4d  %s\n", m_UnsupportedClasses.GetElementName( i ), m_UnsupportedClasses[i].m_nCount, m_UnsupportedClasses[i].m_Reason.Get() );
+		}
+	}
+}
+
+CON_COMMAND( mp_round_snapshot_report, "Lists the entity classes the round snapshot doesn't cover and the round restart times." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_RoundSnapshot.PrintReport();
+}
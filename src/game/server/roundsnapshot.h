@@ -0,0 +1,125 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Round restarts that restore the map entities from a snapshot.
+//
+//			With mp_round_snapshot 1, the first CleanUpMap on a map removes
+//			and recreates the map entities as usual, then saves every entity
+//			the cleanup left behind through its datadesc. Later round restarts
+//			restore those entities in place instead of removing and spawning
+//			them again. The entities that can't be snapshotted, the map
+//			entities removed during the round and everything created during
+//			the round still go through the usual remove/recreate path.
+//
+//=============================================================================//
+
+#ifndef ROUNDSNAPSHOT_H
+#define ROUNDSNAPSHOT_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "saverestoretypes.h"
+#include "utlrbtree.h"
+#include "utldict.h"
+#include "utlmap.h"
+
+class ServerClass;
+class SendTable;
+
+class CRoundSnapshot : public CAutoGameSystem
+{
+public:
+	CRoundSnapshot();
+	~CRoundSnapshot();
+
+	virtual void LevelShutdownPostEntity();
+
+	bool	IsEnabled() const;
+
+	// Called when CleanUpMap starts. Returns true if this restart restores the
+	// snapshot, in which case CleanUpMap must leave the entities ShouldKeepEntity
+	// and ShouldKeepMapEntity pick alone and call FinishRestore at the end.
+	bool	BeginRestore();
+	bool	ShouldKeepEntity( CBaseEntity *pEntity ) const;
+	bool	ShouldKeepMapEntity( int iMapEntity ) const;
+
+	// CleanUpMap reports every map entity it creates, by its position in the entity lump.
+	void	SetMapEntity( int iMapEntity, CBaseEntity *pEntity );
+
+	// Restores the kept entities, after the rest of the map entities were recreated.
+	void	FinishRestore();
+
+	// Snapshots the entities a full cleanup left behind. Entities that aren't in
+	// the list (players, the preserved entities) are only kept track of, so
+	// handles to them survive the restore.
+	void	Take( const CUtlVector<CBaseEntity *> &entities );
+
+	void	RecordCleanUpTime( bool bRestored, float flTime );
+	void	PrintReport();
+
+private:
+	struct SnapshotEntity_t
+	{
+		EHANDLE	m_hEntity;
+		int		m_iMapEntity;	// position in the entity lump, -1 if it didn't come from there
+		int		m_iLocation;	// of its data in the save buffer, -1 if it isn't restored
+		bool	m_bRestore;
+		bool	m_bHierarchy;	// had a parent or children when the snapshot was taken
+	};
+
+	struct UnsupportedClass_t
+	{
+		int			m_nCount;
+		CUtlString	m_Reason;
+	};
+
+	struct SavedRange_t
+	{
+		int		m_nStart;
+		int		m_nEnd;
+	};
+
+	void	Purge();
+	bool	CanSnapshot( CBaseEntity *pEntity, CUtlString &reason );
+	const char *GetUnsavedNetworkFields( CBaseEntity *pEntity );
+	void	NoteUnsupported( CBaseEntity *pEntity, const char *pszReason );
+	bool	IsRestored( CBaseEntity *pEntity );
+	bool	SaveEntities( int nBufferSize );
+
+	static void AddSavedRanges( datamap_t *pMap, int nBaseOffset, CUtlVector<SavedRange_t> &ranges );
+	static void FindUnsavedProps( SendTable *pTable, int nBaseOffset, const CUtlVector<SavedRange_t> &ranges, CUtlString &props );
+
+	CSaveRestoreData				*m_pSaveData;
+	CUtlMemory<char>				m_SaveBuffer;
+	CUtlMemory<char *>				m_SymbolTable;
+	CUtlVector<entitytable_t>		m_EntityTable;
+	CUtlVector<SnapshotEntity_t>	m_Entities;		// in entity table order
+	int								m_nRestored;
+
+	// Per restart
+	CUtlVector<EHANDLE>				m_MapEntities;
+	CUtlVector<bool>				m_KeptMapEntities;
+	CUtlRBTree<CBaseEntity *>		m_KeptEntities;
+
+	// Why the map can't be snapshotted at all, if it can't
+	CUtlString						m_MapUnsupported;
+	CUtlDict<UnsupportedClass_t, int>	m_UnsupportedClasses;
+	CUtlMap<ServerClass *, CUtlString>	m_UnsavedNetworkFields;
+
+	// Stats
+	int		m_nFullCleanUps;
+	float	m_flFullCleanUpTime;
+	float	m_flLastFullCleanUpTime;
+	int		m_nRestores;
+	float	m_flRestoreTime;
+	float	m_flLastRestoreTime;
+	int		m_nFallbacks;
+	int		m_nLastKept;
+	int		m_nLastRecreated;
+	int		m_nRecreated;
+};
+
+extern CRoundSnapshot g_RoundSnapshot;
+
+#endif // ROUNDSNAPSHOT_H
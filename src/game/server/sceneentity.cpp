@@ -31,6 +31,7 @@
 #include "ichoreoeventcallback.h"
 #include "scenefilecache/ISceneFileCache.h"
 #include "SceneCache.h"
+#include "precacheprefetch.h"
 #include "scripted.h"
 #include "env_debughistory.h"
 #ifdef OF_DLL
@@ -3412,7 +3413,14 @@ CChoreoScene *CSceneEntity::LoadScene( const char *filename, IChoreoEventCallbac
 	if (!g_SceneFileCache.IsValid(iIndex))
 	{
 
-		int fileSize = filesystem->ReadFileEx(loadfile, "MOD", &pBuffer, true);
+		int fileSize = PrecachePrefetch_TakeSceneFile(loadfile, &pBuffer);
+		if (!fileSize)
+		{
+			fileSize = filesystem->ReadFileEx(loadfile, "MOD", &pBuffer, true);
+			if (fileSize)
+				PrecachePrefetch_CountSceneLoad();
+		}
+
 		if (fileSize)
 		{
 			g_TokenProcessor.SetBuffer((char*)pBuffer);
@@ -0,0 +1,109 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Slow thinking entities to load the sim/think list with, so the
+//			cost of the tick loop can be measured with report_simthink_wheel
+//			and think_profile. They can be placed in a map or spawned with
+//			simthink_stress_spawn.
+//
+//=============================================================================//
+#include "cbase.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define SIMTHINK_STRESS_CLASSNAME	"simthink_stress_thinker"
+
+class CSimThinkStressThinker : public CLogicalEntity
+{
+public:
+	DECLARE_CLASS( CSimThinkStressThinker, CLogicalEntity );
+	DECLARE_DATADESC();
+
+	CSimThinkStressThinker();
+
+	void	Spawn( void );
+	void	StressThink( void );
+
+	float	m_flInterval;
+	float	m_flJitter;
+};
+
+LINK_ENTITY_TO_CLASS( simthink_stress_thinker, CSimThinkStressThinker );
+
+BEGIN_DATADESC( CSimThinkStressThinker )
+
+	DEFINE_KEYFIELD( m_flInterval, FIELD_FLOAT, "interval" ),
+	DEFINE_KEYFIELD( m_flJitter, FIELD_FLOAT, "jitter" ),
+
+	// Function Pointers
+	DEFINE_THINKFUNC( StressThink ),
+
+END_DATADESC()
+
+
+CSimThinkStressThinker::CSimThinkStressThinker()
+{
+	m_flInterval = 1.0f;
+	m_flJitter = 0.5f;
+}
+
+void CSimThinkStressThinker::Spawn( void )
+{
+	BaseClass::Spawn();
+
+	SetThink( &CSimThinkStressThinker::StressThink );
+	SetNextThink( gpGlobals->curtime + random->RandomFloat( 0.0f, m_flInterval + m_flJitter ) );
+}
+
+void CSimThinkStressThinker::StressThink( void )
+{
+	SetNextThink( gpGlobals->curtime + MAX( m_flInterval + random->RandomFloat( -m_flJitter, m_flJitter ), TICK_INTERVAL ) );
+}
+
+
+CON_COMMAND_F( simthink_stress_spawn, "Spawns slow thinking entities. Usage: simthink_stress_spawn <count> [interval] [jitter]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: simthink_stress_spawn <count> [interval] [jitter]\n" );
+		return;
+	}
+
+	int nCount = atoi( args[1] );
+	float flInterval = ( args.ArgC() > 2 ) ? atof( args[2] ) : 1.0f;
+	float flJitter = ( args.ArgC() > 3 ) ? atof( args[3] ) : 0.5f;
+
+	int nSpawned = 0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		CSimThinkStressThinker *pThinker = (CSimThinkStressThinker *)CreateEntityByName( SIMTHINK_STRESS_CLASSNAME );
+		if ( !pThinker )
+			break;
+
+		pThinker->m_flInterval = MAX( flInterval, 0.0f );
+		pThinker->m_flJitter = clamp( flJitter, 0.0f, pThinker->m_flInterval );
+		DispatchSpawn( pThinker );
+		nSpawned++;
+	}
+
+	Msg( "Spawned %d %s\n", nSpawned, SIMTHINK_STRESS_CLASSNAME );
+}
+
+CON_COMMAND_F( simthink_stress_remove, "Removes the entities simthink_stress_spawn made.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nRemoved = 0;
+	CBaseEntity *pEntity = NULL;
+	while ( ( pEntity = gEntList.FindEntityByClassname( pEntity, SIMTHINK_STRESS_CLASSNAME ) ) != NULL )
+	{
+		UTIL_Remove( pEntity );
+		nRemoved++;
+	}
+
+	Msg( "Removed %d %s\n", nRemoved, SIMTHINK_STRESS_CLASSNAME );
+}
@@ -18,6 +18,7 @@
 #include "tf_bot.h"
 #include "tf_bot_components.h"
 #include "tf_bot_squad.h"
+#include "tf_bot_threat_table.h"
 #include "tf_bot_manager.h"
 #include "tf_weapon_medigun.h"
 #include "nav_mesh/tf_nav_mesh.h"
@@ -1108,12 +1109,7 @@ bool CTFBot::IsLineOfFireClear( const Vector &to )
 //-----------------------------------------------------------------------------
 bool CTFBot::IsLineOfFireClear( const Vector &from, CBaseEntity *to )
 {
-	NextBotTraceFilterIgnoreActors filter( nullptr, COLLISION_GROUP_NONE );
-
-	trace_t trace;
-	UTIL_TraceLine( from, to->WorldSpaceCenter(), MASK_SOLID_BRUSHONLY, &filter, &trace );
-
-	return !trace.DidHit() || trace.m_pEnt == to;
+	return TheTFBotThreatTable.IsLineOfFireClear( from, to );
 }
 
 //-----------------------------------------------------------------------------
@@ -1121,12 +1117,7 @@ bool CTFBot::IsLineOfFireClear( const Vector &from, CBaseEntity *to )
 //-----------------------------------------------------------------------------
 bool CTFBot::IsLineOfFireClear( const Vector &from, const Vector &to )
 {
-	NextBotTraceFilterIgnoreActors filter( nullptr, COLLISION_GROUP_NONE );
-
-	trace_t trace;
-	UTIL_TraceLine( from, to, MASK_SOLID_BRUSHONLY, &filter, &trace );
-
-	return !trace.DidHit();
+	return TheTFBotThreatTable.IsLineOfFireClear( from, to );
 }
 
 //-----------------------------------------------------------------------------
@@ -1134,23 +1125,7 @@ bool CTFBot::IsLineOfFireClear( const Vector &from, const Vector &to )
 //-----------------------------------------------------------------------------
 bool CTFBot::IsAnyEnemySentryAbleToAttackMe( void ) const
 {
-	for ( int i=0; i<IBaseObjectAutoList::AutoList().Count(); ++i )
-	{
-		CBaseObject *obj = static_cast<CBaseObject *>( IBaseObjectAutoList::AutoList()[i] );
-		if ( obj == nullptr )
-			continue;
-
-		if ( obj->ObjectType() == OBJ_SENTRYGUN && !obj->IsPlacing() &&
-			!obj->IsBuilding() && !obj->IsHauling() && !obj->HasSapper() )
-		{
-			if ( ( GetAbsOrigin() - obj->GetAbsOrigin() ).LengthSqr() < Square( SENTRYGUN_BASE_RANGE ) &&
-				IsThreatAimingTowardsMe( obj, 0.95f ) && IsLineOfSightClear( obj, CBaseCombatCharacter::IGNORE_ACTORS ) )
-			{
-				return true;
-			}
-		}
-	}
-	return false;
+	return TheTFBotThreatTable.IsAnyEnemySentryAbleToAttack( this );
 }
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,280 @@
+//========= Copyright  Valve LLC, All rights reserved. =======================
+//
+// Purpose:		Per-tick table of the threat questions TF bots ask each other
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "cbase.h"
+#include "tf_obj.h"
+#include "tf_obj_sentrygun.h"
+#include "tf_bot.h"
+#include "tf_bot_threat_table.h"
+#include "NextBotUtil.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar tf_bot_threat_table( "tf_bot_threat_table", "1", FCVAR_CHEAT, "Share the answers to the threat questions bots ask (sentry coverage, line of fire) between bots for the current tick" );
+
+CTFBotThreatTable TheTFBotThreatTable;
+
+static const char *s_queryName[] =
+{
+	"sentry",
+	"line of fire",
+};
+COMPILE_TIME_ASSERT( ARRAYSIZE( s_queryName ) == 2 );
+
+
+//--------------------------------------------------------------------------------------------------------
+CTFBotThreatTable::CTFBotThreatTable( void )
+{
+	m_tick = -1;
+	ResetStats();
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::IsEnabled( void )
+{
+	if ( !tf_bot_threat_table.GetBool() )
+	{
+		if ( m_tick != -1 )
+		{
+			m_victims.Purge();
+			m_lines.Purge();
+			m_tick = -1;
+		}
+		return false;
+	}
+
+	if ( m_tick != gpGlobals->tickcount )
+	{
+		m_victims.RemoveAll();
+		m_lines.RemoveAll();
+		m_tick = gpGlobals->tickcount;
+		++m_tickCount;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CTFBotThreatTable::CountQuery( QueryType type, bool isHit )
+{
+	++m_queryCount[ type ];
+	if ( isHit )
+	{
+		++m_hitCount[ type ];
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Everything about the sentries that ComputeSentryCoverage() looks at
+ */
+CRC32_t CTFBotThreatTable::ComputeSentryState( void )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	for ( int i=0; i<IBaseObjectAutoList::AutoList().Count(); ++i )
+	{
+		CBaseObject *obj = static_cast<CBaseObject *>( IBaseObjectAutoList::AutoList()[i] );
+		if ( obj == nullptr || obj->ObjectType() != OBJ_SENTRYGUN )
+			continue;
+
+		int index = obj->entindex();
+		CRC32_ProcessBuffer( &crc, &index, sizeof( index ) );
+		CRC32_ProcessBuffer( &crc, &obj->GetAbsOrigin(), sizeof( Vector ) );
+
+		CObjectSentrygun *sentry = static_cast<CObjectSentrygun *>( obj );
+		CRC32_ProcessBuffer( &crc, &sentry->GetTurretAngles(), sizeof( QAngle ) );
+
+		int flags = ( obj->IsPlacing() ? 1 : 0 ) | ( obj->IsBuilding() ? 2 : 0 ) | ( obj->IsHauling() ? 4 : 0 ) | ( obj->HasSapper() ? 8 : 0 );
+		CRC32_ProcessBuffer( &crc, &flags, sizeof( flags ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::ComputeSentryCoverage( const CTFBot *victim )
+{
+	for ( int i=0; i<IBaseObjectAutoList::AutoList().Count(); ++i )
+	{
+		CBaseObject *obj = static_cast<CBaseObject *>( IBaseObjectAutoList::AutoList()[i] );
+		if ( obj == nullptr )
+			continue;
+
+		if ( obj->ObjectType() == OBJ_SENTRYGUN && !obj->IsPlacing() &&
+			!obj->IsBuilding() && !obj->IsHauling() && !obj->HasSapper() )
+		{
+			if ( ( victim->GetAbsOrigin() - obj->GetAbsOrigin() ).LengthSqr() < Square( SENTRYGUN_BASE_RANGE ) &&
+				victim->IsThreatAimingTowardsMe( obj, 0.95f ) && victim->IsLineOfSightClear( obj, CBaseCombatCharacter::IGNORE_ACTORS ) )
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::IsAnyEnemySentryAbleToAttack( const CTFBot *victim )
+{
+	if ( !IsEnabled() )
+	{
+		return ComputeSentryCoverage( victim );
+	}
+
+	const Vector &victimOrigin = victim->GetAbsOrigin();
+	Vector victimEye = victim->EyePosition();
+	CRC32_t sentryState = ComputeSentryState();
+	int key = victim->entindex();
+
+	UtlHashHandle_t h = m_victims.Find( key );
+	if ( h != m_victims.InvalidHandle() )
+	{
+		const VictimInfo &cached = m_victims.Element( h );
+		if ( cached.origin == victimOrigin && cached.eyePosition == victimEye && cached.sentryState == sentryState )
+		{
+			CountQuery( QUERY_SENTRY, true );
+			return cached.isCoveredBySentry;
+		}
+	}
+
+	VictimInfo info;
+	info.origin = victimOrigin;
+	info.eyePosition = victimEye;
+	info.sentryState = sentryState;
+	info.isCoveredBySentry = ComputeSentryCoverage( victim );
+
+	h = m_victims.Insert( key, info );
+	m_victims.Element( h ) = info;
+
+	CountQuery( QUERY_SENTRY, false );
+	return info.isCoveredBySentry;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::TraceLineOfFire( const Vector &from, const Vector &to, CBaseEntity *toEntity ) const
+{
+	NextBotTraceFilterIgnoreActors filter( nullptr, COLLISION_GROUP_NONE );
+
+	trace_t trace;
+	UTIL_TraceLine( from, to, MASK_SOLID_BRUSHONLY, &filter, &trace );
+
+	return !trace.DidHit() || ( toEntity && trace.m_pEnt == toEntity );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::IsLineOfFireClear( const Vector &from, CBaseEntity *to )
+{
+	const Vector &toPos = to->WorldSpaceCenter();
+
+	if ( !IsEnabled() )
+	{
+		return TraceLineOfFire( from, toPos, to );
+	}
+
+	LineKey key;
+	key.from = from;
+	key.to = toPos;
+	key.entity = to->GetRefEHandle().ToInt();
+
+	UtlHashHandle_t h = m_lines.Find( key );
+	if ( h != m_lines.InvalidHandle() )
+	{
+		CountQuery( QUERY_LINE_OF_FIRE, true );
+		return m_lines.Element( h );
+	}
+
+	bool isClear = TraceLineOfFire( from, toPos, to );
+	m_lines.Insert( key, isClear );
+
+	CountQuery( QUERY_LINE_OF_FIRE, false );
+	return isClear;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+bool CTFBotThreatTable::IsLineOfFireClear( const Vector &from, const Vector &to )
+{
+	if ( !IsEnabled() )
+	{
+		return TraceLineOfFire( from, to, nullptr );
+	}
+
+	LineKey key;
+	key.from = from;
+	key.to = to;
+	key.entity = 0;
+
+	UtlHashHandle_t h = m_lines.Find( key );
+	if ( h != m_lines.InvalidHandle() )
+	{
+		CountQuery( QUERY_LINE_OF_FIRE, true );
+		return m_lines.Element( h );
+	}
+
+	bool isClear = TraceLineOfFire( from, to, nullptr );
+	m_lines.Insert( key, isClear );
+
+	CountQuery( QUERY_LINE_OF_FIRE, false );
+	return isClear;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CTFBotThreatTable::ResetStats( void )
+{
+	V_memset( m_queryCount, 0, sizeof( m_queryCount ) );
+	V_memset( m_hitCount, 0, sizeof( m_hitCount ) );
+	m_tickCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CTFBotThreatTable::PrintStats( void ) const
+{
+	unsigned int totalQueries = 0;
+	unsigned int totalHits = 0;
+
+	Msg( "Bot threat table over %u ticks:\n", m_tickCount );
+	for( int i=0; i<NUM_QUERY_TYPES; ++i )
+	{
+		Msg( "  %-14s %8u queries, %8u shared (%.1f%%)\n", s_queryName[i], m_queryCount[i], m_hitCount[i],
+			m_queryCount[i] ? 100.0f * m_hitCount[i] / m_queryCount[i] : 0.0f );
+
+		totalQueries += m_queryCount[i];
+		totalHits += m_hitCount[i];
+	}
+
+	Msg( "  %-14s %8u queries, %8u shared (%.1f%%)\n", "total", totalQueries, totalHits,
+		totalQueries ? 100.0f * totalHits / totalQueries : 0.0f );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( tf_bot_threat_table_stats, "Show how often bots shared the answers to their threat questions. 'tf_bot_threat_table_stats reset' clears the counters.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		TheTFBotThreatTable.ResetStats();
+		return;
+	}
+
+	TheTFBotThreatTable.PrintStats();
+}
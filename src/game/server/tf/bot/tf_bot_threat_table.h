@@ -0,0 +1,95 @@
+//========= Copyright  Valve LLC, All rights reserved. =======================
+//
+// Purpose:		Per-tick table of the threat questions TF bots ask each other
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef TF_BOT_THREAT_TABLE_H
+#define TF_BOT_THREAT_TABLE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlhashtable.h"
+#include "tier1/generichash.h"
+#include "checksum_crc.h"
+
+class CTFBot;
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Every bot asks whether an enemy sentry covers it and whether its line of fire is clear, several
+ * times per update. The answers are shared here for the current tick, so each one is traced once
+ * no matter how many behaviors ask for it. Bots and sentries move and turn during their own
+ * updates, so a sentry answer is only reused while the victim's origin and eye position and the
+ * state of every sentry (position, aim, and whether it is placing, building, hauled or sapped)
+ * are unchanged. Line of fire answers are keyed by their exact endpoints.
+ */
+class CTFBotThreatTable
+{
+public:
+	CTFBotThreatTable( void );
+
+	bool IsAnyEnemySentryAbleToAttack( const CTFBot *victim );
+	bool IsLineOfFireClear( const Vector &from, CBaseEntity *to );
+	bool IsLineOfFireClear( const Vector &from, const Vector &to );
+
+	void PrintStats( void ) const;
+	void ResetStats( void );
+
+private:
+	enum QueryType
+	{
+		QUERY_SENTRY,
+		QUERY_LINE_OF_FIRE,
+
+		NUM_QUERY_TYPES
+	};
+
+	struct VictimInfo
+	{
+		Vector origin;
+		Vector eyePosition;								// the line of sight to the sentries starts here
+		CRC32_t sentryState;							// ComputeSentryState() when the answer was computed
+		bool isCoveredBySentry;
+	};
+
+	struct LineKey
+	{
+		Vector from;
+		Vector to;
+		int entity;										// EHANDLE of the target entity, or 0 for a position
+	};
+
+	struct LineKeyHash
+	{
+		unsigned int operator()( const LineKey &key ) const { return HashBlock( &key, sizeof( LineKey ) ); }
+	};
+
+	struct LineKeyEqual
+	{
+		bool operator()( const LineKey &lhs, const LineKey &rhs ) const { return lhs.entity == rhs.entity && lhs.from == rhs.from && lhs.to == rhs.to; }
+	};
+
+	bool IsEnabled( void );							// also starts a new table when the tick changed
+	bool TraceLineOfFire( const Vector &from, const Vector &to, CBaseEntity *toEntity ) const;
+
+	static CRC32_t ComputeSentryState( void );
+	static bool ComputeSentryCoverage( const CTFBot *victim );
+
+	void CountQuery( QueryType type, bool isHit );
+
+	int m_tick;
+	CUtlHashtable< int, VictimInfo > m_victims;		// by entindex
+	CUtlHashtable< LineKey, bool, LineKeyHash, LineKeyEqual > m_lines;
+
+	unsigned int m_queryCount[ NUM_QUERY_TYPES ];
+	unsigned int m_hitCount[ NUM_QUERY_TYPES ];
+	unsigned int m_tickCount;
+};
+
+extern CTFBotThreatTable TheTFBotThreatTable;
+
+#endif // TF_BOT_THREAT_TABLE_H
@@ -35,6 +35,9 @@ DEFINE_KEYFIELD( fl_RespawnTime, FIELD_FLOAT, "respawntime" ),
 DEFINE_KEYFIELD( m_iszSpawnSound, FIELD_STRING, "spawn_sound" ),
 DEFINE_KEYFIELD( fl_RespawnDelay, FIELD_FLOAT, "respawndelay" ),
 
+DEFINE_FIELD( bInitialDelay, FIELD_BOOLEAN ),
+DEFINE_FIELD( m_bRespawning, FIELD_BOOLEAN ),
+
 // Inputs.
 DEFINE_INPUTFUNC( FIELD_VOID, "Enable", InputEnable ),
 DEFINE_INPUTFUNC( FIELD_VOID, "Disable", InputDisable ),
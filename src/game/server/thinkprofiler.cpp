@@ -0,0 +1,452 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per entity class think and simulate profiler.
+//			See thinkprofiler.h.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "thinkprofiler.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define EXTRACT_INPUTFUNC_FUNCTIONPTR(x)		(*(inputfunc_t **)(&(x)))
+
+ConVar think_profile( "think_profile", "0", FCVAR_GAMEDLL, "Records the think and simulate times of every entity class. See think_profile_report." );
+ConVar think_profile_dump_interval( "think_profile_dump_interval", "0", FCVAR_GAMEDLL, "While think_profile is on, dump the profile to think_profile_dump_file every this many seconds (0 = don't).", true, 0.0f, false, 0.0f );
+ConVar think_profile_dump_file( "think_profile_dump_file", "think_profile.csv", FCVAR_GAMEDLL, "File think_profile_dump_interval writes to. Use a .json extension for json, anything else is csv." );
+
+//-----------------------------------------------------------------------------
+// Histogram
+//-----------------------------------------------------------------------------
+static int GetBucket( float flUS )
+{
+	if ( flUS <= THINKPROFILE_MIN_US )
+		return 0;
+
+	// two buckets per doubling, 2 / ln(2)
+	int iBucket = 1 + (int)( logf( flUS / THINKPROFILE_MIN_US ) * 2.8853901f );
+	return MIN( iBucket, THINKPROFILE_BUCKETS - 1 );
+}
+
+static float GetBucketStart( int iBucket )
+{
+	if ( iBucket <= 0 )
+		return 0.0f;
+
+	return THINKPROFILE_MIN_US * powf( 2.0f, ( iBucket - 1 ) * 0.5f );
+}
+
+void ThinkProfileStats_t::Clear()
+{
+	m_nCalls = 0;
+	m_flTotalUS = 0.0;
+	m_flMaxUS = 0.0f;
+	Q_memset( m_Buckets, 0, sizeof( m_Buckets ) );
+}
+
+void ThinkProfileStats_t::Add( float flUS )
+{
+	++m_nCalls;
+	m_flTotalUS += flUS;
+	m_flMaxUS = MAX( m_flMaxUS, flUS );
+	++m_Buckets[ GetBucket( flUS ) ];
+}
+
+float ThinkProfileStats_t::GetPercentile( float flPercentile ) const
+{
+	if ( !m_nCalls )
+		return 0.0f;
+
+	float flTarget = flPercentile * m_nCalls;
+	int nBelow = 0;
+	for ( int i = 0; i < THINKPROFILE_BUCKETS; i++ )
+	{
+		if ( !m_Buckets[i] || nBelow + m_Buckets[i] < flTarget )
+		{
+			nBelow += m_Buckets[i];
+			continue;
+		}
+
+		// interpolate inside the bucket, the last one ends at the max
+		float flStart = GetBucketStart( i );
+		float flEnd = ( i < THINKPROFILE_BUCKETS - 1 ) ? GetBucketStart( i + 1 ) : m_flMaxUS;
+		float flUS = flStart + ( flEnd - flStart ) * ( flTarget - nBelow ) / m_Buckets[i];
+		return MIN( flUS, m_flMaxUS );
+	}
+
+	return m_flMaxUS;
+}
+
+//-----------------------------------------------------------------------------
+// CThinkProfiler
+//-----------------------------------------------------------------------------
+CThinkProfiler g_ThinkProfiler;
+
+CThinkProfiler::CThinkProfiler() : CAutoGameSystemPerFrame( "CThinkProfiler" )
+{
+	m_bEnabled = false;
+	m_nTicks = 0;
+	m_flStartTime = 0.0;
+	m_flLastDumpTime = 0.0;
+}
+
+void CThinkProfiler::LevelShutdownPostEntity()
+{
+	m_ClassByPointer.RemoveAll();
+}
+
+void CThinkProfiler::FrameUpdatePreEntityThink()
+{
+	bool bEnabled = think_profile.GetBool();
+	if ( bEnabled && !m_bEnabled )
+	{
+		if ( !m_nTicks )
+		{
+			m_flStartTime = Plat_FloatTime();
+		}
+		m_flLastDumpTime = Plat_FloatTime();
+	}
+
+	m_bEnabled = bEnabled;
+	if ( m_bEnabled )
+	{
+		++m_nTicks;
+	}
+}
+
+void CThinkProfiler::FrameUpdatePostEntityThink()
+{
+	if ( !m_bEnabled || think_profile_dump_interval.GetFloat() <= 0.0f )
+		return;
+
+	if ( Plat_FloatTime() - m_flLastDumpTime < think_profile_dump_interval.GetFloat() )
+		return;
+
+	Dump( think_profile_dump_file.GetString() );
+	m_flLastDumpTime = Plat_FloatTime();
+}
+
+int CThinkProfiler::FindClass( CBaseEntity *pEntity )
+{
+	const char *pszClassName = pEntity->GetClassname();
+
+	UtlHashHandle_t h = m_ClassByPointer.Find( pszClassName );
+	if ( h != m_ClassByPointer.InvalidHandle() )
+		return m_ClassByPointer.Element( h );
+
+	// a new level, or the same class name from a different string
+	int iClass;
+	int iName = m_ClassByName.Find( pszClassName );
+	if ( iName != m_ClassByName.InvalidIndex() )
+	{
+		iClass = m_ClassByName[iName];
+	}
+	else
+	{
+		iClass = m_Classes.AddToTail();
+		m_Classes[iClass].m_Name = pszClassName;
+		m_Classes[iClass].m_Stats.Clear();
+		m_ClassByName.Insert( pszClassName, iClass );
+	}
+
+	m_ClassByPointer.Insert( pszClassName, iClass );
+	return iClass;
+}
+
+int CThinkProfiler::FindThink( CBaseEntity *pEntity, BASEPTR thinkFunc )
+{
+	// The base think calls m_pfnThink, unless the class overrides Think()
+	if ( thinkFunc == &CBaseEntity::Think )
+	{
+		thinkFunc = pEntity->m_pfnThink;
+	}
+
+	ThinkKey_t key;
+	key.m_iClass = FindClass( pEntity );
+	key.m_pFunction = thinkFunc ? EXTRACT_INPUTFUNC_FUNCTIONPTR( thinkFunc ) : NULL;
+
+	UtlHashHandle_t h = m_ThinkByKey.Find( key );
+	if ( h != m_ThinkByKey.InvalidHandle() )
+		return m_ThinkByKey.Element( h );
+
+	const char *pszName = "Think";
+	if ( thinkFunc )
+	{
+		pszName = UTIL_FunctionToName( pEntity->GetDataDescMap(), EXTRACT_INPUTFUNC_FUNCTIONPTR( thinkFunc ) );
+	}
+
+	int iThink = m_Thinks.AddToTail();
+	ThinkEntry_t &think = m_Thinks[iThink];
+	think.m_iClass = key.m_iClass;
+	if ( pszName )
+	{
+		think.m_Name = pszName;
+	}
+	else
+	{
+		think.m_Name.Format( "%p", key.m_pFunction );
+	}
+	think.m_Stats.Clear();
+
+	m_ThinkByKey.Insert( key, iThink );
+	return iThink;
+}
+
+void CThinkProfiler::Reset()
+{
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		m_Classes[i].m_Stats.Clear();
+	}
+
+	FOR_EACH_VEC( m_Thinks, i )
+	{
+		m_Thinks[i].m_Stats.Clear();
+	}
+
+	m_nTicks = 0;
+	m_flStartTime = Plat_FloatTime();
+}
+
+//-----------------------------------------------------------------------------
+// Report
+//-----------------------------------------------------------------------------
+struct ThinkProfileRow_t
+{
+	const char *m_pszClass;
+	const char *m_pszFunction;
+	const ThinkProfileStats_t *m_pStats;
+	float m_flSortKey;
+};
+
+static int __cdecl ThinkProfileRowCompare( const ThinkProfileRow_t *lhs, const ThinkProfileRow_t *rhs )
+{
+	if ( lhs->m_flSortKey == rhs->m_flSortKey )
+		return 0;
+
+	return ( lhs->m_flSortKey > rhs->m_flSortKey ) ? -1 : 1;
+}
+
+static float GetSortKey( const ThinkProfileStats_t &stats, const char *pszSortBy )
+{
+	if ( !Q_stricmp( pszSortBy, "calls" ) )
+		return stats.m_nCalls;
+	if ( !Q_stricmp( pszSortBy, "avg" ) )
+		return stats.m_nCalls ? stats.m_flTotalUS / stats.m_nCalls : 0.0f;
+	if ( !Q_stricmp( pszSortBy, "p99" ) )
+		return stats.GetPercentile( 0.99f );
+	if ( !Q_stricmp( pszSortBy, "max" ) )
+		return stats.m_flMaxUS;
+
+	return stats.m_flTotalUS;
+}
+
+static void PrintRows( CUtlVector<ThinkProfileRow_t> &rows, int nCount, int nTicks )
+{
+	rows.Sort( ThinkProfileRowCompare );
+
+	Msg( "  %-48s %9s %10s %8s %9s %9s %9s %9s %9s\n", "", "calls", "total ms", "ms/tick", "avg us", "p50 us", "p90 us", "p99 us", "max us" );
+	for ( int i = 0; i < rows.Count() && i < nCount; i++ )
+	{
+		const ThinkProfileStats_t &stats = *rows[i].m_pStats;
+
+		char szName[256];
+		if ( rows[i].m_pszFunction )
+		{
+			Q_snprintf( szName, sizeof( szName ), "%s::%s", rows[i].m_pszClass, rows[i].m_pszFunction );
+		}
+		else
+		{
+			Q_strncpy( szName, rows[i].m_pszClass, sizeof( szName ) );
+		}
+
+		Msg( "  %-48s %9d %10.2f %8.3f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+			szName,
+			stats.m_nCalls,
+			stats.m_flTotalUS / 1000.0,
+			nTicks ? stats.m_flTotalUS / 1000.0 / nTicks : 0.0,
+			stats.m_flTotalUS / stats.m_nCalls,
+			stats.GetPercentile( 0.5f ),
+			stats.GetPercentile( 0.9f ),
+			stats.GetPercentile( 0.99f ),
+			stats.m_flMaxUS );
+	}
+}
+
+void CThinkProfiler::PrintReport( int nCount, const char *pszSortBy )
+{
+	Msg( "Think profile: %d ticks over %.1f seconds%s\n", m_nTicks, m_nTicks ? Plat_FloatTime() - m_flStartTime : 0.0, m_bEnabled ? "" : " (think_profile is off)" );
+
+	CUtlVector<ThinkProfileRow_t> rows;
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		if ( !m_Classes[i].m_Stats.m_nCalls )
+			continue;
+
+		ThinkProfileRow_t &row = rows[ rows.AddToTail() ];
+		row.m_pszClass = m_Classes[i].m_Name.Get();
+		row.m_pszFunction = NULL;
+		row.m_pStats = &m_Classes[i].m_Stats;
+		row.m_flSortKey = GetSortKey( m_Classes[i].m_Stats, pszSortBy );
+	}
+
+	Msg( "Simulate, by class (think functions included):\n" );
+	PrintRows( rows, nCount, m_nTicks );
+
+	rows.RemoveAll();
+	FOR_EACH_VEC( m_Thinks, i )
+	{
+		if ( !m_Thinks[i].m_Stats.m_nCalls )
+			continue;
+
+		ThinkProfileRow_t &row = rows[ rows.AddToTail() ];
+		row.m_pszClass = m_Classes[ m_Thinks[i].m_iClass ].m_Name.Get();
+		row.m_pszFunction = m_Thinks[i].m_Name.Get();
+		row.m_pStats = &m_Thinks[i].m_Stats;
+		row.m_flSortKey = GetSortKey( m_Thinks[i].m_Stats, pszSortBy );
+	}
+
+	Msg( "Think functions:\n" );
+	PrintRows( rows, nCount, m_nTicks );
+}
+
+//-----------------------------------------------------------------------------
+// Dump
+//-----------------------------------------------------------------------------
+static void WriteCSVRow( CUtlBuffer &buf, const char *pszType, const char *pszClass, const char *pszFunction, const ThinkProfileStats_t &stats, int nTicks )
+{
+	buf.Printf( "%s,%s,%s,%d,%.3f,%.4f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+		pszType, pszClass, pszFunction,
+		stats.m_nCalls,
+		stats.m_flTotalUS / 1000.0,
+		nTicks ? stats.m_flTotalUS / 1000.0 / nTicks : 0.0,
+		stats.m_nCalls ? stats.m_flTotalUS / stats.m_nCalls : 0.0,
+		stats.GetPercentile( 0.5f ),
+		stats.GetPercentile( 0.9f ),
+		stats.GetPercentile( 0.99f ),
+		stats.m_flMaxUS );
+}
+
+void CThinkProfiler::WriteCSV( CUtlBuffer &buf )
+{
+	buf.Printf( "type,class,function,calls,total_ms,ms_per_tick,avg_us,p50_us,p90_us,p99_us,max_us\n" );
+
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		if ( m_Classes[i].m_Stats.m_nCalls )
+		{
+			WriteCSVRow( buf, "simulate", m_Classes[i].m_Name.Get(), "", m_Classes[i].m_Stats, m_nTicks );
+		}
+	}
+
+	FOR_EACH_VEC( m_Thinks, i )
+	{
+		if ( m_Thinks[i].m_Stats.m_nCalls )
+		{
+			WriteCSVRow( buf, "think", m_Classes[ m_Thinks[i].m_iClass ].m_Name.Get(), m_Thinks[i].m_Name.Get(), m_Thinks[i].m_Stats, m_nTicks );
+		}
+	}
+}
+
+static void WriteJSONStats( CUtlBuffer &buf, const ThinkProfileStats_t &stats, int nTicks )
+{
+	buf.Printf( "\"calls\": %d, \"total_ms\": %.3f, \"ms_per_tick\": %.4f, \"avg_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f",
+		stats.m_nCalls,
+		stats.m_flTotalUS / 1000.0,
+		nTicks ? stats.m_flTotalUS / 1000.0 / nTicks : 0.0,
+		stats.m_nCalls ? stats.m_flTotalUS / stats.m_nCalls : 0.0,
+		stats.GetPercentile( 0.5f ),
+		stats.GetPercentile( 0.9f ),
+		stats.GetPercentile( 0.99f ),
+		stats.m_flMaxUS );
+}
+
+void CThinkProfiler::WriteJSON( CUtlBuffer &buf )
+{
+	buf.Printf( "{\n\t\"map\": \"%s\",\n\t\"ticks\": %d,\n\t\"seconds\": %.3f,\n", STRING( gpGlobals->mapname ), m_nTicks, m_nTicks ? Plat_FloatTime() - m_flStartTime : 0.0 );
+
+	buf.Printf( "\t\"classes\": [" );
+	bool bFirst = true;
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		if ( !m_Classes[i].m_Stats.m_nCalls )
+			continue;
+
+		buf.Printf( "%s\n\t\t{ \"class\": \"%s\", ", bFirst ? "" : ",", m_Classes[i].m_Name.Get() );
+		WriteJSONStats( buf, m_Classes[i].m_Stats, m_nTicks );
+		buf.Printf( " }" );
+		bFirst = false;
+	}
+	buf.Printf( "\n\t],\n" );
+
+	buf.Printf( "\t\"thinks\": [" );
+	bFirst = true;
+	FOR_EACH_VEC( m_Thinks, i )
+	{
+		if ( !m_Thinks[i].m_Stats.m_nCalls )
+			continue;
+
+		buf.Printf( "%s\n\t\t{ \"class\": \"%s\", \"function\": \"%s\", ", bFirst ? "" : ",", m_Classes[ m_Thinks[i].m_iClass ].m_Name.Get(), m_Thinks[i].m_Name.Get() );
+		WriteJSONStats( buf, m_Thinks[i].m_Stats, m_nTicks );
+		buf.Printf( " }" );
+		bFirst = false;
+	}
+	buf.Printf( "\n\t]\n}\n" );
+}
+
+bool CThinkProfiler::Dump( const char *pszFilename )
+{
+	CUtlBuffer buf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	if ( !Q_stricmp( Q_GetFileExtension( pszFilename ) ? Q_GetFileExtension( pszFilename ) : "", "json" ) )
+	{
+		WriteJSON( buf );
+	}
+	else
+	{
+		WriteCSV( buf );
+	}
+
+	if ( !filesystem->WriteFile( pszFilename, "MOD", buf ) )
+	{
+		Warning( "Unable to write think profile '%s'\n", pszFilename );
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Commands
+//-----------------------------------------------------------------------------
+CON_COMMAND( think_profile_report, "Prints the entity classes and think functions that took the most time. Usage: think_profile_report [count] [total|avg|p99|max|calls]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCount = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 20;
+	g_ThinkProfiler.PrintReport( nCount > 0 ? nCount : 20, ( args.ArgC() > 2 ) ? args[2] : "total" );
+}
+
+CON_COMMAND( think_profile_reset, "Clears the think profile." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_ThinkProfiler.Reset();
+}
+
+CON_COMMAND( think_profile_dump, "Writes the think profile to a file, json if its extension is .json and csv otherwise. Usage: think_profile_dump [filename]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	const char *pszFilename = ( args.ArgC() > 1 ) ? args[1] : think_profile_dump_file.GetString();
+	if ( g_ThinkProfiler.Dump( pszFilename ) )
+	{
+		Msg( "Wrote think profile to %s\n", pszFilename );
+	}
+}
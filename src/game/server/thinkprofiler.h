@@ -0,0 +1,162 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per entity class think and simulate profiler.
+//
+//			With think_profile 1, Physics_SimulateEntity records the time
+//			each entity class spends simulating (think functions included)
+//			and PhysicsDispatchThink records the time of each think function
+//			by class. Every entry keeps a call count, the total and max time
+//			and a histogram the percentiles are taken from.
+//			think_profile_report prints the top entries, think_profile_dump
+//			writes them all to a csv or json file, and think_profile_dump_interval
+//			does that on a timer.
+//
+//=============================================================================//
+
+#ifndef THINKPROFILER_H
+#define THINKPROFILER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "utlhashtable.h"
+#include "utldict.h"
+#include "tier1/generichash.h"
+#include "tier0/fasttimer.h"
+
+class CUtlBuffer;
+
+// Half octaves of microseconds, from THINKPROFILE_MIN_US up to a quarter second
+#define THINKPROFILE_BUCKETS	40
+#define THINKPROFILE_MIN_US		0.25f
+
+struct ThinkProfileStats_t
+{
+	int		m_nCalls;
+	double	m_flTotalUS;
+	float	m_flMaxUS;
+	int		m_Buckets[THINKPROFILE_BUCKETS];
+
+	void	Clear();
+	void	Add( float flUS );
+	float	GetPercentile( float flPercentile ) const;
+};
+
+class CThinkProfiler : public CAutoGameSystemPerFrame
+{
+public:
+	CThinkProfiler();
+
+	virtual void LevelShutdownPostEntity();
+	virtual void FrameUpdatePreEntityThink();
+	virtual void FrameUpdatePostEntityThink();
+
+	bool	IsEnabled() const { return m_bEnabled; }
+
+	// Returns the entry to pass to AddSimulateTime/AddThinkTime
+	int		FindClass( CBaseEntity *pEntity );
+	int		FindThink( CBaseEntity *pEntity, BASEPTR thinkFunc );
+
+	void	AddSimulateTime( int iClass, float flUS )	{ m_Classes[iClass].m_Stats.Add( flUS ); }
+	void	AddThinkTime( int iThink, float flUS )		{ m_Thinks[iThink].m_Stats.Add( flUS ); }
+
+	void	Reset();
+	void	PrintReport( int nCount, const char *pszSortBy );
+	bool	Dump( const char *pszFilename );
+
+private:
+	struct ClassEntry_t
+	{
+		CUtlString			m_Name;
+		ThinkProfileStats_t	m_Stats;
+	};
+
+	struct ThinkEntry_t
+	{
+		int					m_iClass;
+		CUtlString			m_Name;
+		ThinkProfileStats_t	m_Stats;
+	};
+
+	struct ThinkKey_t
+	{
+		int					m_iClass;
+		const void			*m_pFunction;
+	};
+
+	struct ThinkKeyHash
+	{
+		unsigned int operator()( const ThinkKey_t &key ) const { return HashItem( key.m_pFunction ) ^ HashInt( key.m_iClass ); }
+	};
+
+	struct ThinkKeyEqual
+	{
+		bool operator()( const ThinkKey_t &lhs, const ThinkKey_t &rhs ) const { return lhs.m_iClass == rhs.m_iClass && lhs.m_pFunction == rhs.m_pFunction; }
+	};
+
+	void	WriteCSV( CUtlBuffer &buf );
+	void	WriteJSON( CUtlBuffer &buf );
+
+	CUtlVector<ClassEntry_t>	m_Classes;
+	CUtlVector<ThinkEntry_t>	m_Thinks;
+
+	// The class names are pooled strings, which only live as long as the level
+	CUtlHashtable<const void *, int>	m_ClassByPointer;
+	CUtlDict<int, int>					m_ClassByName;
+	CUtlHashtable<ThinkKey_t, int, ThinkKeyHash, ThinkKeyEqual>	m_ThinkByKey;
+
+	bool	m_bEnabled;
+	int		m_nTicks;
+	double	m_flStartTime;
+	double	m_flLastDumpTime;
+};
+
+extern CThinkProfiler g_ThinkProfiler;
+
+//-----------------------------------------------------------------------------
+// Times the scope if the profiler is on
+//-----------------------------------------------------------------------------
+class CThinkProfileScope
+{
+public:
+	CThinkProfileScope( CBaseEntity *pEntity )
+	{
+		m_bThink = false;
+		m_iEntry = g_ThinkProfiler.IsEnabled() ? g_ThinkProfiler.FindClass( pEntity ) : -1;
+		if ( m_iEntry >= 0 )
+			m_Timer.Start();
+	}
+
+	CThinkProfileScope( CBaseEntity *pEntity, BASEPTR thinkFunc )
+	{
+		m_bThink = true;
+		m_iEntry = g_ThinkProfiler.IsEnabled() ? g_ThinkProfiler.FindThink( pEntity, thinkFunc ) : -1;
+		if ( m_iEntry >= 0 )
+			m_Timer.Start();
+	}
+
+	~CThinkProfileScope()
+	{
+		if ( m_iEntry < 0 )
+			return;
+
+		m_Timer.End();
+		float flUS = (float)m_Timer.GetDuration().GetMicrosecondsF();
+		if ( m_bThink )
+		{
+			g_ThinkProfiler.AddThinkTime( m_iEntry, flUS );
+		}
+		else
+		{
+			g_ThinkProfiler.AddSimulateTime( m_iEntry, flUS );
+		}
+	}
+
+private:
+	CFastTimer	m_Timer;
+	int			m_iEntry;
+	bool		m_bThink;
+};
+
+#endif // THINKPROFILER_H
@@ -15,6 +15,7 @@
 #include "tier0/vprof.h"
 #include "checksum_crc.h"
 #include "tier0/icommandline.h"
+#include "tier1/utldict.h"
 
 #if defined( TF_CLIENT_DLL ) || defined( TF_DLL )
 #include "tf_shareddefs.h"
@@ -57,6 +58,105 @@ static ConVar sv_snd_filter( "sv_snd_filter", "", FCVAR_REPLICATED, "Filters out
 extern ISoundEmitterSystemBase *soundemitterbase;
 static ConVar *g_pClosecaption = NULL;
 
+// See CSoundScriptHandle
+int g_nSoundScriptHandleSerial = 0;
+
+#if defined( CLIENT_DLL )
+static ConVar soundemitter_lookups( "cl_soundemitter_lookups", "0", 0, "Once a second, report how many sound script names were looked up while emitting sounds instead of using a handle, and the most common ones.\n" );
+#else
+static ConVar soundemitter_lookups( "sv_soundemitter_lookups", "0", 0, "Once a second, report how many sound script names were looked up while emitting sounds instead of using a handle, and the most common ones.\n" );
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Counts sound script name lookups on the emit path, to find the
+//			callers that should be using a CSoundScriptHandle
+//-----------------------------------------------------------------------------
+class CSoundNameLookupCounter
+{
+public:
+	CSoundNameLookupCounter() : m_nLookups( 0 ), m_flStartTime( 0.0 )
+	{
+	}
+
+	void Count( const char *pszSoundName )
+	{
+		if ( !soundemitter_lookups.GetBool() )
+		{
+			if ( m_flStartTime != 0.0 )
+			{
+				Reset( 0.0 );
+			}
+			return;
+		}
+
+		double flNow = Plat_FloatTime();
+		if ( m_flStartTime == 0.0 )
+		{
+			m_flStartTime = flNow;
+		}
+
+		m_nLookups++;
+		if ( pszSoundName )
+		{
+			int i = m_Names.Find( pszSoundName );
+			if ( i == m_Names.InvalidIndex() )
+			{
+				i = m_Names.Insert( pszSoundName, 0 );
+			}
+			m_Names[i]++;
+		}
+
+		if ( flNow - m_flStartTime >= 1.0 )
+		{
+			Report( flNow - m_flStartTime );
+			Reset( flNow );
+		}
+	}
+
+private:
+	void Reset( double flNow )
+	{
+		m_nLookups = 0;
+		m_flStartTime = flNow;
+		m_Names.Purge();
+	}
+
+	static int CompareCounts( const int *a, const int *b )
+	{
+		return s_pSortNames->Element( *b ) - s_pSortNames->Element( *a );
+	}
+
+	void Report( double flElapsed )
+	{
+		Msg( "%s Sound script name lookups: %.1f/s\n", CBaseEntity::IsServer() ? "(sv)" : "(cl)", m_nLookups / flElapsed );
+
+		CUtlVector<int> sorted;
+		for ( int i = m_Names.First(); i != m_Names.InvalidIndex(); i = m_Names.Next( i ) )
+		{
+			sorted.AddToTail( i );
+		}
+
+		s_pSortNames = &m_Names;
+		sorted.Sort( CompareCounts );
+		s_pSortNames = NULL;
+
+		for ( int i = 0; i < MIN( sorted.Count(), 8 ); i++ )
+		{
+			Msg( "  %5d %s\n", m_Names[ sorted[i] ], m_Names.GetElementName( sorted[i] ) );
+		}
+	}
+
+	int					m_nLookups;
+	double				m_flStartTime;
+	CUtlDict<int, int>	m_Names;
+
+	static CUtlDict<int, int> *s_pSortNames;
+};
+
+CUtlDict<int, int> *CSoundNameLookupCounter::s_pSortNames = NULL;
+
+static CSoundNameLookupCounter g_SoundNameLookups;
+
 #ifdef _XBOX
 int LookupStringFromCloseCaptionToken( char const *token );
 const wchar_t *GetStringForIndex( int index );
@@ -236,6 +336,7 @@ public:
 #endif
 		g_pClosecaption = cvar->FindVar("closecaption");
 		Assert(g_pClosecaption);
+		g_nSoundScriptHandleSerial++;
 		return soundemitterbase->ModInit();
 	}
 
@@ -246,11 +347,13 @@ public:
 		FinishLog();
 #endif
 		soundemitterbase->ModShutdown();
+		g_nSoundScriptHandleSerial++;
 	}
 
 	void ReloadSoundEntriesInList( IFileList *pFilesToReload )
 	{
 		soundemitterbase->ReloadSoundEntriesInList( pFilesToReload );
+		g_nSoundScriptHandleSerial++;
 	}
 
 	virtual void TraceEmitSound( char const *fmt, ... )
@@ -271,6 +374,9 @@ public:
 	// Precache all wave files referenced in wave or rndwave keys
 	virtual void LevelInitPreEntity()
 	{
+		// The map's overrides can add and replace scripts
+		g_nSoundScriptHandleSerial++;
+
 		char mapname[ 256 ];
 #if !defined( CLIENT_DLL )
 		StartLog();
@@ -338,6 +444,7 @@ public:
 	virtual void LevelShutdownPostEntity()
 	{
 		soundemitterbase->ClearSoundOverrides();
+		g_nSoundScriptHandleSerial++;
 
 #if !defined( CLIENT_DLL )
 		FinishLog();
@@ -353,6 +460,7 @@ public:
 		FinishLog();
 #endif
 		soundemitterbase->Flush();
+		g_nSoundScriptHandleSerial++;
 	}
 #endif
 	
@@ -458,6 +566,11 @@ public:
 
 	void EmitSoundByHandle( IRecipientFilter& filter, int entindex, const EmitSound_t & ep, HSOUNDSCRIPTHANDLE& handle )
 	{
+		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
+		{
+			g_SoundNameLookups.Count( ep.m_pSoundName );
+		}
+
 		// Pull data from parameters
 		CSoundParameters params;
 
@@ -719,6 +832,7 @@ public:
 
 		if ( ep.m_hSoundScriptHandle == SOUNDEMITTER_INVALID_HANDLE )
 		{
+			g_SoundNameLookups.Count( ep.m_pSoundName );
 			ep.m_hSoundScriptHandle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( ep.m_pSoundName );
 		}
 
@@ -1150,7 +1264,8 @@ void S_SoundEmitterSystemFlush( void )
 	ClearModelSoundsCache();
 #endif
 
-	// TODO:  when we go to a handle system, we'll need to invalidate handles somehow
+	// Shutdown/Init and LevelInitPreEntity bumped g_nSoundScriptHandleSerial, so any
+	// CSoundScriptHandle looks its name up again
 }
 
 #if defined( CLIENT_DLL )
@@ -1412,6 +1527,19 @@ void CBaseEntity::EmitSound( IRecipientFilter& filter, int iEntIndex, const char
 	EmitSound( filter, iEntIndex, params, handle );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Interned versions, the name is only looked up the first time
+//-----------------------------------------------------------------------------
+void CBaseEntity::EmitSound( const CSoundScriptHandle &sound, float soundtime /*= 0.0f*/, float *duration /*=NULL*/ )
+{
+	EmitSound( sound.GetName(), sound.GetHandle(), soundtime, duration );
+}
+
+void CBaseEntity::EmitSound( IRecipientFilter& filter, int iEntIndex, const CSoundScriptHandle &sound, const Vector *pOrigin /*= NULL*/, float soundtime /*= 0.0f*/, float *duration /*=NULL*/ )
+{
+	EmitSound( filter, iEntIndex, sound.GetName(), sound.GetHandle(), pOrigin, soundtime, duration );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : filter - 
@@ -1515,12 +1643,17 @@ void CBaseEntity::StopSound( int iEntIndex, int iChannel, const char *pSample )
 
 soundlevel_t CBaseEntity::LookupSoundLevel( const char *soundname )
 {
+	g_SoundNameLookups.Count( soundname );
 	return soundemitterbase->LookupSoundLevel( soundname );
 }
 
 
 soundlevel_t CBaseEntity::LookupSoundLevel( const char *soundname, HSOUNDSCRIPTHANDLE& handle )
 {
+	if ( handle == SOUNDEMITTER_INVALID_HANDLE )
+	{
+		g_SoundNameLookups.Count( soundname );
+	}
 	return soundemitterbase->LookupSoundLevelByHandle( soundname, handle );
 }
 
@@ -1615,6 +1748,8 @@ void CBaseEntity::GenderExpandString( char const *in, char *out, int maxlen )
 
 bool CBaseEntity::GetParametersForSound( const char *soundname, CSoundParameters &params, const char *actormodel )
 {
+	g_SoundNameLookups.Count( soundname );
+
 	gender_t gender = soundemitterbase->GetActorGender( actormodel );
 	
 	return soundemitterbase->GetParametersForSound( soundname, params, gender );
@@ -1622,6 +1757,11 @@ bool CBaseEntity::GetParametersForSound( const char *soundname, CSoundParameters
 
 bool CBaseEntity::GetParametersForSound( const char *soundname, HSOUNDSCRIPTHANDLE& handle, CSoundParameters &params, const char *actormodel )
 {
+	if ( handle == SOUNDEMITTER_INVALID_HANDLE )
+	{
+		g_SoundNameLookups.Count( soundname );
+	}
+
 	gender_t gender = soundemitterbase->GetActorGender( actormodel );
 	
 	return soundemitterbase->GetParametersForSoundEx( soundname, handle, params, gender );
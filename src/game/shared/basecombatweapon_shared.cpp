@@ -2057,9 +2057,13 @@ void CBaseCombatWeapon::WeaponSound( WeaponSound_t sound_type, float soundtime /
 	if ( !shootsound || !shootsound[0] )
 		return;
 
+	// Sounds straight from the weapon script are only looked up once
+	HSOUNDSCRIPTHANDLE hOverride = SOUNDEMITTER_INVALID_HANDLE;
+	HSOUNDSCRIPTHANDLE &hShootSound = ( shootsound == GetWpnData().aShootSounds[ sound_type ] ) ? GetWpnData().aShootSoundHandles[ sound_type ].GetHandle() : hOverride;
+
 	CSoundParameters params;
 	
-	if ( !GetParametersForSound( shootsound, params, NULL ) )
+	if ( !GetParametersForSound( shootsound, hShootSound, params, NULL ) )
 		return;
 
 	if ( params.play_to_owner_only )
@@ -2072,7 +2076,7 @@ void CBaseCombatWeapon::WeaponSound( WeaponSound_t sound_type, float soundtime /
 			{
 				filter.UsePredictionRules();
 			}
-			EmitSound( filter, GetOwner()->entindex(), shootsound, NULL, soundtime );
+			EmitSound( filter, GetOwner()->entindex(), shootsound, hShootSound, NULL, soundtime );
 		}
 	}
 	else
@@ -2085,7 +2089,7 @@ void CBaseCombatWeapon::WeaponSound( WeaponSound_t sound_type, float soundtime /
 			{
 				filter.UsePredictionRules();
 			}
-			EmitSound( filter, GetOwner()->entindex(), shootsound, NULL, soundtime ); 
+			EmitSound( filter, GetOwner()->entindex(), shootsound, hShootSound, NULL, soundtime ); 
 
 #if !defined( CLIENT_DLL )
 			if( sound_type == EMPTY )
@@ -2102,7 +2106,7 @@ void CBaseCombatWeapon::WeaponSound( WeaponSound_t sound_type, float soundtime /
 			{
 				filter.UsePredictionRules();
 			}
-			EmitSound( filter, entindex(), shootsound, NULL, soundtime ); 
+			EmitSound( filter, entindex(), shootsound, hShootSound, NULL, soundtime ); 
 		}
 	}
 }
@@ -55,6 +55,15 @@ ConVar player_limit_jump_speed( "player_limit_jump_speed", "1", FCVAR_REPLICATED
 // duck controls. Its value is meaningless anytime we don't have the options window open.
 ConVar option_duck_method("option_duck_method", "1", FCVAR_REPLICATED|FCVAR_ARCHIVE );// 0 = HOLD to duck, 1 = Duck is a toggle
 
+// Collect the leaves and entities around the player once per usercmd and run the movement
+// traces against that list. Replicated so prediction takes the same path as the server.
+// Run movement_replay on a recording from your maps to check the results are unchanged.
+ConVar sv_movement_tracelist( "sv_movement_tracelist", "0", FCVAR_REPLICATED, "Run player movement traces against a per-command list of nearby leaves and entities." );
+ConVar sv_movement_tracelist_verify( "sv_movement_tracelist_verify", "0", FCVAR_REPLICATED | FCVAR_CHEAT, "Also do a full trace for every movement trace list hit and report any difference." );
+
+// Don't bother with the list if the player could cover more than this in one command.
+#define MOVEMENT_TRACELIST_MAX_REACH	256.0f
+
 #ifdef STAGING_ONLY
 #ifdef CLIENT_DLL
 ConVar debug_latch_reset_onduck( "debug_latch_reset_onduck", "1", FCVAR_CHEAT );
@@ -625,6 +634,12 @@ CGameMovement::CGameMovement( void )
 	mv					= NULL;
 
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
+
+	m_pTraceList			= NULL;
+	m_bTraceListValid		= false;
+	m_nTraceListOverride	= -1;
+	m_nTraceListHits		= 0;
+	m_nTraceListMisses		= 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -632,6 +647,7 @@ CGameMovement::CGameMovement( void )
 //-----------------------------------------------------------------------------
 CGameMovement::~CGameMovement( void )
 {
+	delete m_pTraceList;
 }
 
 //-----------------------------------------------------------------------------
@@ -785,7 +801,8 @@ CBaseHandle CGameMovement::TestPlayerPosition( const Vector& pos, int collisionG
 {
 	Ray_t ray;
 	ray.Init( pos, pos, GetPlayerMins(), GetPlayerMaxs() );
-	UTIL_TraceRay( ray, PlayerSolidMask(), mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+	CTraceFilterSimple traceFilter( mv->m_nPlayerHandle.Get(), collisionGroup );
+	TraceMovementRay( ray, PlayerSolidMask(), &traceFilter, pm );
 	if ( (pm.contents & PlayerSolidMask()) && pm.m_pEnt )
 	{
 		return pm.m_pEnt->GetRefEHandle();
@@ -1158,11 +1175,15 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	DiffPrint( "start %f %f %f", mv->GetAbsOrigin().x, mv->GetAbsOrigin().y, mv->GetAbsOrigin().z );
 
+	SetupMovementTraceList();
+
 	// Run the command.
 	PlayerMove();
 
 	FinishMove();
 
+	ClearMovementTraceList();
+
 	DiffPrint( "end %f %f %f", mv->GetAbsOrigin().x, mv->GetAbsOrigin().y, mv->GetAbsOrigin().z );
 
 	// CheckV( player->CurrentCommandNumber(), "EndPos", mv->GetAbsOrigin() );
@@ -4920,8 +4941,8 @@ void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, uns
 
 	Ray_t ray;
 	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
-	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
-
+	CTraceFilterSimple traceFilter( mv->m_nPlayerHandle.Get(), collisionGroup );
+	TraceMovementRay( ray, fMask, &traceFilter, pm );
 }
 
 
@@ -4935,6 +4956,202 @@ void  CGameMovement::TryTouchGround( const Vector& start, const Vector& end, con
 
 	Ray_t ray;
 	ray.Init( start, end, mins, maxs );
-	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+	CTraceFilterSimple traceFilter( mv->m_nPlayerHandle.Get(), collisionGroup );
+	TraceMovementRay( ray, fMask, &traceFilter, pm );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the trace list for this command. The box covers both hulls
+//			moved as far as the player could get this command, plus a step up
+//			and down for StepMove/StayOnGround. Traces that leave the box fall
+//			back to a regular trace, so the size only affects the hit rate.
+//-----------------------------------------------------------------------------
+void CGameMovement::SetupMovementTraceList( void )
+{
+	m_bTraceListValid = false;
+
+	bool bEnabled = ( m_nTraceListOverride >= 0 ) ? ( m_nTraceListOverride != 0 ) : sv_movement_tracelist.GetBool();
+	if ( !bEnabled || player->GetMoveType() == MOVETYPE_NOCLIP || player->GetMoveType() == MOVETYPE_OBSERVER )
+		return;
+
+	Vector vecHullMins, vecHullMaxs;
+	VectorMin( GetPlayerMins( false ), GetPlayerMins( true ), vecHullMins );
+	VectorMax( GetPlayerMaxs( false ), GetPlayerMaxs( true ), vecHullMaxs );
+
+	float flSpeed = mv->m_vecVelocity.Length() + player->GetBaseVelocity().Length() + mv->m_flMaxSpeed;
+	flSpeed = MIN( flSpeed, sv_maxvelocity.GetFloat() * 2.0f );
+
+	float flReach = flSpeed * gpGlobals->frametime + player->GetStepSize() * 2.0f + ( vecHullMaxs.z - vecHullMins.z ) * 0.5f;
+	if ( flReach > MOVEMENT_TRACELIST_MAX_REACH )
+		return;
+
+	Vector vecReach( flReach, flReach, flReach );
+	m_vecTraceListMins = mv->GetAbsOrigin() + vecHullMins - vecReach;
+	m_vecTraceListMaxs = mv->GetAbsOrigin() + vecHullMaxs + vecReach;
+
+	if ( !m_pTraceList )
+	{
+		m_pTraceList = new CTraceListData;
+	}
+
+	m_pTraceList->Reset();
+	enginetrace->SetupLeafAndEntityListBox( m_vecTraceListMins, m_vecTraceListMaxs, *m_pTraceList );
+	m_bTraceListValid = true;
+}
+
+void CGameMovement::ClearMovementTraceList( void )
+{
+	m_bTraceListValid = false;
+}
+
+static inline bool RayInsideBox( const Ray_t &ray, const Vector &mins, const Vector &maxs )
+{
+	for ( int i = 0; i < 3; i++ )
+	{
+		float flLo = MIN( ray.m_Start[i], ray.m_Start[i] + ray.m_Delta[i] ) - ray.m_Extents[i];
+		float flHi = MAX( ray.m_Start[i], ray.m_Start[i] + ray.m_Delta[i] ) + ray.m_Extents[i];
+		if ( flLo < mins[i] || flHi > maxs[i] )
+			return false;
+	}
+
+	return true;
+}
+
+static bool MovementTracesMatch( const trace_t &a, const trace_t &b )
+{
+	return a.fraction == b.fraction &&
+		a.endpos == b.endpos &&
+		a.plane.normal == b.plane.normal &&
+		a.plane.dist == b.plane.dist &&
+		a.startsolid == b.startsolid &&
+		a.allsolid == b.allsolid &&
+		a.contents == b.contents &&
+		a.m_pEnt == b.m_pEnt;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces against the trace list for this command if there is one
+//			and the ray stays inside it.
+//-----------------------------------------------------------------------------
+void CGameMovement::TraceMovementRay( const Ray_t &ray, unsigned int fMask, ITraceFilter *pFilter, trace_t &pm )
+{
+	if ( m_bTraceListValid && RayInsideBox( ray, m_vecTraceListMins, m_vecTraceListMaxs ) )
+	{
+		m_nTraceListHits++;
+		enginetrace->TraceRayAgainstLeafAndEntityList( ray, *m_pTraceList, fMask, pFilter, &pm );
+
+		if ( sv_movement_tracelist_verify.GetBool() )
+		{
+			trace_t full;
+			enginetrace->TraceRay( ray, fMask, pFilter, &full );
+			if ( !MovementTracesMatch( pm, full ) )
+			{
+				DevWarning( "Movement trace list mismatch: fraction %f vs %f, normal (%f %f %f) vs (%f %f %f)\n",
+					pm.fraction, full.fraction, VectorExpand( pm.plane.normal ), VectorExpand( full.plane.normal ) );
+			}
+		}
+	}
+	else
+	{
+		if ( m_bTraceListValid )
+		{
+			m_nTraceListMisses++;
+		}
+
+		enginetrace->TraceRay( ray, fMask, pFilter, &pm );
+	}
+
+	if ( r_visualizetraces.GetBool() )
+	{
+		DebugDrawLine( pm.startpos, pm.endpos, 255, 0, 0, true, -1.0f );
+	}
+}
+
+#ifdef GAME_DLL
+//-----------------------------------------------------------------------------
+// Purpose: Snapshot of the movement related player state for movement_replay.
+//-----------------------------------------------------------------------------
+void CGameMovement::SaveMovementState( CBasePlayer *pPlayer, MovementState_t &state )
+{
+	// Clear the padding too, so states can be compared with memcmp.
+	memset( &state, 0, sizeof( state ) );
+
+	state.m_vecOrigin				= pPlayer->GetAbsOrigin();
+	state.m_vecVelocity				= pPlayer->GetAbsVelocity();
+	state.m_vecBaseVelocity			= pPlayer->GetBaseVelocity();
+	state.m_vecViewOffset			= pPlayer->GetViewOffset();
+	state.m_nFlags					= pPlayer->GetFlags();
+	state.m_iGroundEntity			= pPlayer->GetGroundEntity() ? pPlayer->GetGroundEntity()->entindex() : -1;
+	state.m_nMoveType				= pPlayer->GetMoveType();
+	state.m_nMoveCollide			= pPlayer->GetMoveCollide();
+	state.m_nWaterLevel				= pPlayer->GetWaterLevel();
+	state.m_nWaterType				= pPlayer->GetWaterType();
+	state.m_flSurfaceFriction		= pPlayer->m_surfaceFriction;
+	state.m_nSurfaceProps			= pPlayer->m_surfaceProps;
+	state.m_chTextureType			= pPlayer->m_chTextureType;
+	state.m_chPreviousTextureType	= pPlayer->m_chPreviousTextureType;
+	state.m_bDucked					= pPlayer->m_Local.m_bDucked;
+	state.m_bDucking				= pPlayer->m_Local.m_bDucking;
+	state.m_bInDuckJump				= pPlayer->m_Local.m_bInDuckJump;
+	state.m_flDucktime				= pPlayer->m_Local.m_flDucktime;
+	state.m_flDuckJumpTime			= pPlayer->m_Local.m_flDuckJumpTime;
+	state.m_flJumpTime				= pPlayer->m_Local.m_flJumpTime;
+	state.m_flFallVelocity			= pPlayer->m_Local.m_flFallVelocity;
+	state.m_vecPunchAngle			= pPlayer->m_Local.m_vecPunchAngle;
+	state.m_vecPunchAngleVel		= pPlayer->m_Local.m_vecPunchAngleVel;
+	state.m_flWaterJumpTime			= pPlayer->m_flWaterJumpTime;
+	state.m_vecWaterJumpVel			= pPlayer->m_vecWaterJumpVel;
+	state.m_flStepSoundTime			= pPlayer->m_flStepSoundTime;
+	state.m_flSwimSoundTime			= pPlayer->m_flSwimSoundTime;
+	state.m_flMaxspeed				= pPlayer->m_flMaxspeed;
+
+	state.m_nOldWaterLevel			= m_nOldWaterLevel;
+	state.m_flWaterEntryTime		= m_flWaterEntryTime;
+	state.m_nOnLadder				= m_nOnLadder;
+	state.m_flStuckCheckTime[0]		= m_flStuckCheckTime[ pPlayer->entindex() ][0];
+	state.m_flStuckCheckTime[1]		= m_flStuckCheckTime[ pPlayer->entindex() ][1];
+}
+
+void CGameMovement::RestoreMovementState( CBasePlayer *pPlayer, const MovementState_t &state )
+{
+	pPlayer->SetAbsOrigin( state.m_vecOrigin );
+	pPlayer->SetAbsVelocity( state.m_vecVelocity );
+	pPlayer->SetBaseVelocity( state.m_vecBaseVelocity );
+	pPlayer->SetViewOffset( state.m_vecViewOffset );
+	pPlayer->RemoveFlag( pPlayer->GetFlags() & ~state.m_nFlags );
+	pPlayer->AddFlag( state.m_nFlags );
+	pPlayer->SetGroundEntity( ( state.m_iGroundEntity >= 0 ) ? CBaseEntity::Instance( state.m_iGroundEntity ) : NULL );
+	if ( pPlayer->GetMoveType() != state.m_nMoveType || pPlayer->GetMoveCollide() != state.m_nMoveCollide )
+	{
+		pPlayer->SetMoveType( (MoveType_t)state.m_nMoveType, (MoveCollide_t)state.m_nMoveCollide );
+	}
+	pPlayer->SetWaterLevel( state.m_nWaterLevel );
+	pPlayer->SetWaterType( state.m_nWaterType );
+	pPlayer->m_surfaceFriction				= state.m_flSurfaceFriction;
+	pPlayer->m_surfaceProps					= state.m_nSurfaceProps;
+	pPlayer->m_pSurfaceData					= MoveHelper()->GetSurfaceProps()->GetSurfaceData( state.m_nSurfaceProps );
+	pPlayer->m_chTextureType				= state.m_chTextureType;
+	pPlayer->m_chPreviousTextureType		= state.m_chPreviousTextureType;
+	pPlayer->m_Local.m_bDucked				= state.m_bDucked;
+	pPlayer->m_Local.m_bDucking				= state.m_bDucking;
+	pPlayer->m_Local.m_bInDuckJump			= state.m_bInDuckJump;
+	pPlayer->m_Local.m_flDucktime			= state.m_flDucktime;
+	pPlayer->m_Local.m_flDuckJumpTime		= state.m_flDuckJumpTime;
+	pPlayer->m_Local.m_flJumpTime			= state.m_flJumpTime;
+	pPlayer->m_Local.m_flFallVelocity		= state.m_flFallVelocity;
+	pPlayer->m_Local.m_vecPunchAngle		= state.m_vecPunchAngle;
+	pPlayer->m_Local.m_vecPunchAngleVel		= state.m_vecPunchAngleVel;
+	pPlayer->m_flWaterJumpTime				= state.m_flWaterJumpTime;
+	pPlayer->m_vecWaterJumpVel				= state.m_vecWaterJumpVel;
+	pPlayer->m_flStepSoundTime				= state.m_flStepSoundTime;
+	pPlayer->m_flSwimSoundTime				= state.m_flSwimSoundTime;
+	pPlayer->m_flMaxspeed					= state.m_flMaxspeed;
+
+	m_nOldWaterLevel						= state.m_nOldWaterLevel;
+	m_flWaterEntryTime						= state.m_flWaterEntryTime;
+	m_nOnLadder								= state.m_nOnLadder;
+	m_flStuckCheckTime[ pPlayer->entindex() ][0] = state.m_flStuckCheckTime[0];
+	m_flStuckCheckTime[ pPlayer->entindex() ][1] = state.m_flStuckCheckTime[1];
 }
+#endif // GAME_DLL
 
@@ -35,6 +35,7 @@ enum
 struct surfacedata_t;
 
 class CBasePlayer;
+class ITraceFilter;
 
 class CGameMovement : public IGameMovement
 {
@@ -59,6 +60,60 @@ public:
 	// allows derived classes to exclude entities from trace
 	virtual void	TryTouchGround( const Vector& start, const Vector& end, const Vector& mins, const Vector& maxs, unsigned int fMask, int collisionGroup, trace_t& pm );
 
+	// All the movement traces go through here. Uses the trace list for this command
+	// if the ray fits in it, otherwise does a regular trace.
+	void			TraceMovementRay( const Ray_t &ray, unsigned int fMask, ITraceFilter *pFilter, trace_t &pm );
+
+	// -1 follows sv_movement_tracelist, 0/1 forces it off/on (used by movement_replay).
+	void			SetMovementTraceListOverride( int nOverride ) { m_nTraceListOverride = nOverride; }
+	void			GetMovementTraceListStats( int &nListTraces, int &nFullTraces ) const { nListTraces = m_nTraceListHits; nFullTraces = m_nTraceListMisses; }
+	void			ResetMovementTraceListStats( void ) { m_nTraceListHits = m_nTraceListMisses = 0; }
+
+#ifdef GAME_DLL
+	// Everything movement reads from and leaves behind on the player, so a
+	// command can be replayed from the same starting point (movement_replay).
+	struct MovementState_t
+	{
+		Vector		m_vecOrigin;
+		Vector		m_vecVelocity;
+		Vector		m_vecBaseVelocity;
+		Vector		m_vecViewOffset;
+		int			m_nFlags;
+		int			m_iGroundEntity;
+		int			m_nMoveType;
+		int			m_nMoveCollide;
+		int			m_nWaterLevel;
+		int			m_nWaterType;
+		float		m_flSurfaceFriction;
+		int			m_nSurfaceProps;
+		char		m_chTextureType;
+		char		m_chPreviousTextureType;
+		bool		m_bDucked;
+		bool		m_bDucking;
+		bool		m_bInDuckJump;
+		float		m_flDucktime;
+		float		m_flDuckJumpTime;
+		float		m_flJumpTime;
+		float		m_flFallVelocity;
+		QAngle		m_vecPunchAngle;
+		QAngle		m_vecPunchAngleVel;
+		float		m_flWaterJumpTime;
+		Vector		m_vecWaterJumpVel;
+		float		m_flStepSoundTime;
+		float		m_flSwimSoundTime;
+		float		m_flMaxspeed;
+
+		// CGameMovement's own per player state
+		int			m_nOldWaterLevel;
+		float		m_flWaterEntryTime;
+		int			m_nOnLadder;
+		float		m_flStuckCheckTime[2];
+	};
+
+	void			SaveMovementState( CBasePlayer *pPlayer, MovementState_t &state );
+	void			RestoreMovementState( CBasePlayer *pPlayer, const MovementState_t &state );
+#endif
+
 
 #define BRUSH_ONLY true
 	virtual unsigned int PlayerSolidMask( bool brushOnly = false );	///< returns the solid mask for the given player, so bots can have a more-restrictive set
@@ -250,6 +305,11 @@ protected:
 	// when we step on ground that's too steep, search to see if there's any ground nearby that isn't too steep
 	void			TryTouchGroundInQuadrants( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm );
 
+	// Collects the world leaves and entities the player can reach this command, so the
+	// movement traces don't each start from the top of the BSP tree.
+	void			SetupMovementTraceList( void );
+	void			ClearMovementTraceList( void );
+
 
 protected:
 
@@ -278,6 +338,15 @@ protected:
 
 	float			m_flStuckCheckTime[MAX_PLAYERS+1][2]; // Last time we did a full test
 
+	// Trace list for the current command
+	CTraceListData	*m_pTraceList;
+	bool			m_bTraceListValid;
+	Vector			m_vecTraceListMins;
+	Vector			m_vecTraceListMaxs;
+	int				m_nTraceListOverride;
+	int				m_nTraceListHits;
+	int				m_nTraceListMisses;
+
 	// special function for teleport-with-duck for episodic
 #ifdef HL2_EPISODIC
 public:
@@ -207,12 +207,26 @@ skipwhite:
 
 bool CEntityMapData::ExtractValue( const char *keyName, char *value )
 {
+	if ( m_pTokens )
+	{
+		for ( int i = 0; i < m_pTokens->m_nKeyValues; i++ )
+		{
+			if ( !strcmp( m_pTokens->m_pKeyValues[i].m_pKey, keyName ) )
+			{
+				Q_strncpy( value, m_pTokens->m_pKeyValues[i].m_pValue, MAPKEY_MAXLENGTH );
+				return true;
+			}
+		}
+		return false;
+	}
+
 	return MapEntity_ExtractValue( m_pEntData, keyName, value );
 }
 
 bool CEntityMapData::GetFirstKey( char *keyName, char *value )
 {
 	m_pCurrentKey = m_pEntData; // reset the status pointer
+	m_iNextKeyValue = 0;
 	return GetNextKey( keyName, value );
 }
 
@@ -223,6 +237,30 @@ const char *CEntityMapData::CurrentBufferPosition( void )
 
 bool CEntityMapData::GetNextKey( char *keyName, char *value )
 {
+	if ( m_pTokens )
+	{
+		if ( m_iNextKeyValue >= m_pTokens->m_nKeyValues )
+		{
+			// leave the position where the text parser would have
+			m_pCurrentKey = (char*)m_pTokens->m_pDataEnd;
+			return false;
+		}
+
+		const MapEntityKeyValue_t &kv = m_pTokens->m_pKeyValues[m_iNextKeyValue++];
+		Q_strncpy( keyName, kv.m_pKey, MAPKEY_MAXLENGTH );
+
+		// fix up keynames with trailing spaces
+		int n = strlen(keyName);
+		while (n && keyName[n-1] == ' ')
+		{
+			keyName[n-1] = 0;
+			n--;
+		}
+
+		Q_strncpy( value, kv.m_pValue, MAPKEY_MAXLENGTH );
+		return true;
+	}
+
 	char token[MAPKEY_MAXLENGTH];
 
 	// parse key
@@ -278,8 +316,9 @@ bool CEntityMapData::GetNextKey( char *keyName, char *value )
 bool CEntityMapData::SetValue( const char *keyName, char *NewValue, int nKeyInstance )
 {
 	// If this is -1, the size of the string is unknown and cannot be safely modified!
-	Assert( m_nEntDataSize != -1 );
-	if ( m_nEntDataSize == -1 )
+	// Pre-tokenized data is shared, so it can't be modified either.
+	Assert( m_nEntDataSize != -1 && !m_pTokens );
+	if ( m_nEntDataSize == -1 || m_pTokens )
 		return false;
 
 	char token[MAPKEY_MAXLENGTH];
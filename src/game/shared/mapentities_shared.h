@@ -13,6 +13,25 @@
 #define MAPKEY_MAXLENGTH	2048
 
 
+//-----------------------------------------------------------------------------
+// Purpose: one entity out of a pre-tokenized entity lump (see CMapEntityLump
+//			on the server). The keys and values are exactly the tokens
+//			MapEntity_ParseToken returns for the text.
+//-----------------------------------------------------------------------------
+struct MapEntityKeyValue_t
+{
+	const char	*m_pKey;
+	const char	*m_pValue;
+};
+
+struct MapEntityTokens_t
+{
+	const MapEntityKeyValue_t	*m_pKeyValues;
+	int							m_nKeyValues;
+	const char					*m_pDataEnd;	// where the text parser stops, just before the closing brace
+};
+
+
 //-----------------------------------------------------------------------------
 // Purpose: encapsulates the data string in the map file 
 //			that is used to initialise entities.  The data
@@ -25,9 +44,17 @@ private:
 	int		m_nEntDataSize;
 	char	*m_pCurrentKey;
 
+	// Set when the keys come from a pre-tokenized lump instead of the text.
+	const MapEntityTokens_t	*m_pTokens;
+	int		m_iNextKeyValue;
+
 public:
 	explicit CEntityMapData( char *entBlock, int nEntBlockSize = -1 ) : 
-		m_pEntData(entBlock), m_nEntDataSize(nEntBlockSize), m_pCurrentKey(entBlock) {}
+		m_pEntData(entBlock), m_nEntDataSize(nEntBlockSize), m_pCurrentKey(entBlock), m_pTokens(NULL), m_iNextKeyValue(0) {}
+
+	// entBlock is still the entity's text, for anything that wants to copy it (templates).
+	CEntityMapData( char *entBlock, const MapEntityTokens_t *pTokens ) : 
+		m_pEntData(entBlock), m_nEntDataSize(-1), m_pCurrentKey(entBlock), m_pTokens(pTokens), m_iNextKeyValue(0) {}
 
 	// find the keyName in the entdata and puts it's value into Value.  returns false if key is not found
 	bool ExtractValue( const char *keyName, char *Value );
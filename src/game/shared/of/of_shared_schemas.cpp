@@ -15,6 +15,7 @@
 #include "c_tf_player.h"
 #endif
 #include "of_shared_schemas.h"
+#include "of_soundscript_index.h"
 
 #include "ienginevgui.h"
 #include "engine/IEngineSound.h"
@@ -27,76 +28,58 @@
 	#define SHARED_ARGS UTIL_VarArgs
 #endif
 
-KeyValues* gSoundManifest;
 KeyValues* GlobalSoundManifest()
 {
-	return gSoundManifest;
+	return GlobalSoundScriptIndex()->GetRoot();
 }
 
 void InitGlobalSoundManifest()
 {
-	if( gSoundManifest )
-	{
-		gSoundManifest->deleteThis();
-	}
-	gSoundManifest = new KeyValues( "GlobalSoundManifest" );
+	GlobalSoundScriptIndex()->Purge();
 }
 
-KeyValues* gLevelSoundManifest;
 KeyValues* LevelSoundManifest()
 {
-	return gLevelSoundManifest;
+	return LevelSoundScriptIndex()->GetRoot();
 }
 
 void InitLevelSoundManifest()
 {
-	if( gLevelSoundManifest )
-	{
-		gLevelSoundManifest->deleteThis();
-	}
-	gLevelSoundManifest = new KeyValues( "LevelSoundManifest" );
+	LevelSoundScriptIndex()->Purge();
 }
 
 void ParseSoundManifest( void )
 {	
 	InitGlobalSoundManifest();
 	
+	// Only the manifest is read here, the sound scripts themselves are parsed
+	// (or loaded from the cache) on a job thread while the rest of the game loads
 	KeyValues *pManifestFile = new KeyValues( "game_sounds_manifest" );
-	pManifestFile->LoadFromFile( filesystem, "scripts/game_sounds_manifest.txt" );
-	
-	if ( pManifestFile )
+	if ( !pManifestFile->LoadFromFile( filesystem, "scripts/game_sounds_manifest.txt" ) )
 	{
-		KeyValues *pManifest = new KeyValues( "Manifest" );
-		pManifest = pManifestFile->GetFirstValue();
-		for( pManifest; pManifest != NULL; pManifest = pManifest->GetNextValue() ) // Loop through all the keyvalues
-		{
-			KeyValues *pSoundFile = new KeyValues( "SoundFile" );
-			pSoundFile->LoadFromFile( filesystem, pManifest->GetString() );
-			if( pSoundFile )
-			{
-				KeyValues *pSound = new KeyValues( "SoundScript" );
-				pSound = pSoundFile;
-				GlobalSoundManifest()->AddSubKey( pSound );
-
-				for( pSound; pSound != NULL; pSound = pSound->GetNextKey() ) // Loop through all the keyvalues
-				{
-					if( pSound )
-					{
-						// +developer 5 to start seeing this noise
-						DevMsg(  5, "Parsed: %s\n", pSound->GetString( "wave" ) );
-					}
-				}
-			}
-		}	
+		pManifestFile->deleteThis();
+		return;
 	}
+
+	CUtlVector<CUtlString> files;
+	for( KeyValues *pManifest = pManifestFile->GetFirstValue(); pManifest != NULL; pManifest = pManifest->GetNextValue() ) // Loop through all the keyvalues
+	{
+		files.AddToTail( pManifest->GetString() );
+	}
+	pManifestFile->deleteThis();
+
+#ifdef CLIENT_DLL
+	GlobalSoundScriptIndex()->BeginBuild( files, NULL, "soundscripts_client.cache" );
+#else
+	GlobalSoundScriptIndex()->BeginBuild( files, NULL, "soundscripts_server.cache" );
+#endif
 }
 
 void CheckGlobalSounManifest( void )
 {
 	if ( GlobalSoundManifest() )
 	{		
-		KeyValues *pSound = new KeyValues( "SoundScript" );
-		pSound = GlobalSoundManifest()->GetFirstSubKey();
+		KeyValues *pSound = GlobalSoundManifest()->GetFirstSubKey();
 		for( pSound; pSound != NULL; pSound = pSound->GetNextKey() ) // Loop through all the keyvalues
 		{
 			if( strcmp( pSound->GetString( "wave" ), "" ) )
@@ -125,138 +108,72 @@ void ParseLevelSoundManifest( void )
 		return;
 	}
 	DevMsg("%s\n", mapsounds);
-	KeyValues *pSoundFile = new KeyValues( "level_sounds" );
-	pSoundFile->LoadFromFile( filesystem, mapsounds, "GAME" );
 
-	if( pSoundFile )
+	CUtlVector<CUtlString> files;
+	files.AddToTail( mapsounds );
+	LevelSoundScriptIndex()->BeginBuild( files, "GAME", NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Level sounds override the global ones
+//-----------------------------------------------------------------------------
+static const SoundScriptEntry_t *FindSoundScript( const char *szSoundScript, CSoundScriptIndex **ppIndex )
+{
+	const SoundScriptEntry_t *pEntry = LevelSoundScriptIndex()->Find( szSoundScript );
+	*ppIndex = LevelSoundScriptIndex();
+	if ( !pEntry )
 	{
-		KeyValues *pSound = new KeyValues( "SoundScript" );
-		pSound = pSoundFile;
-		LevelSoundManifest()->AddSubKey( pSound );
-		for( pSound; pSound != NULL; pSound = pSound->GetNextKey() ) // Loop through all the keyvalues
-		{
-			if( pSound )
-			{
-				// +developer 5 to start seeing this noise
-				DevMsg( 5, "Parsed: %s\n", pSound->GetString( "wave" ) );
-			}
-		}
+		pEntry = GlobalSoundScriptIndex()->Find( szSoundScript );
+		*ppIndex = GlobalSoundScriptIndex();
 	}
+
+	return pEntry;
 }
 
 KeyValues* GetSoundscript( const char *szSoundScript )
 {
-	KeyValues *pSound = new KeyValues( "SoundScript" );
-			
-	char mapsounds[MAX_PATH];
-	char mapname[ 256 ];
-	Q_StripExtension( 
-#if CLIENT_DLL
-	engine->GetLevelName()
-#else
-	STRING(gpGlobals->mapname)
-#endif
-	, mapname, sizeof( mapname ) );
-	Q_snprintf( mapsounds, sizeof( mapsounds ), "%s_level_sounds.txt", mapname );
-			
-	if( filesystem->FileExists( mapsounds , "GAME" ) )
-	{
-		pSound = LevelSoundManifest()->FindKey( szSoundScript );
-		if( !pSound )
-		{
-			DevMsg("Key not found in level sounds\n");
-			return GlobalSoundManifest()->FindKey( szSoundScript );
-		}
-		else
-			return pSound;
-	}
-	else if ( GlobalSoundManifest() )	
-	{
-		return GlobalSoundManifest()->FindKey( szSoundScript );
-	}
-	
-	return NULL;
+	CSoundScriptIndex *pIndex;
+	const SoundScriptEntry_t *pEntry = FindSoundScript( szSoundScript, &pIndex );
+	return pEntry ? pEntry->m_pScript : NULL;
 }
 #ifdef CLIENT_DLL
 void PrecacheUISoundScript( char *szSoundScript )
 {
-	KeyValues *pSoundScript = GetSoundscript( szSoundScript );
-	if( !pSoundScript )
+	CSoundScriptIndex *pIndex;
+	const SoundScriptEntry_t *pEntry = FindSoundScript( szSoundScript, &pIndex );
+	if( !pEntry )
 		return;
 	
-	KeyValues *pWave = pSoundScript->FindKey("rndwave");
-	if( pWave )
+	if( !pIndex->GetWaveCount( pEntry ) )
 	{
-		bool bSuccess = false;
-		for( KeyValues *pSub = pWave->GetFirstSubKey(); pSub != NULL ; pSub = pSub->GetNextKey() )
-		{
-			bSuccess = true;
-			enginesound->PrecacheSound( pSub->GetString(), true, false );
-		}
-
-		if( !bSuccess )
-		{
-			Warning("Failed to precache UI sound %s", szSoundScript);
-			return;
-		}
+		Warning("Failed to precache UI sound %s", szSoundScript);
+		return;
 	}
-	else
+
+	for( int i = 0; i < pIndex->GetWaveCount( pEntry ); i++ )
 	{
-		pWave = pSoundScript->FindKey("wave");
-		if( !pWave )
-		{
-			Warning("Failed to precache UI sound %s", szSoundScript);
-			return;
-		}
-		
-		enginesound->PrecacheSound( pWave->GetString(), true, false );
+		enginesound->PrecacheSound( pIndex->GetWave( pEntry, i ), true, false );
 	}
 }
 #endif
-char *GetSoundScriptWave( char *szSoundScript )
+const char *GetSoundScriptWave( const char *szSoundScript )
 {
 	if( !szSoundScript )
 		return NULL;
 
-	char *szReturn = new char[128];
-	KeyValues *pSoundScript = GetSoundscript( szSoundScript );
-	if( !pSoundScript )
+	CSoundScriptIndex *pIndex;
+	const SoundScriptEntry_t *pEntry = FindSoundScript( szSoundScript, &pIndex );
+	if( !pEntry )
 		return NULL;
 	
-	KeyValues *pWave = pSoundScript->FindKey("rndwave");
-	if( pWave )
+	int iMaxSounds = pIndex->GetWaveCount( pEntry );
+	if( !iMaxSounds )
 	{
-		KeyValues *pRand = new KeyValues("Rand");
-		int iMaxSounds = 0;
-		for( KeyValues *pSub = pWave->GetFirstSubKey(); pSub != NULL ; pSub = pSub->GetNextKey() )
-		{
-			pRand->SetString(SHARED_ARGS("%d",iMaxSounds),pSub->GetString());
-			iMaxSounds++;
-		}
-
-		if( iMaxSounds )
-		{
-			Q_strncpy(szReturn, pRand->GetString(SHARED_ARGS("%d", random->RandomInt( 0, iMaxSounds - 1 ) ) ), 128 );
-			return szReturn;
-		}
-		else
-			Warning("Failed to Play UI sound %s\n", szSoundScript);
-		
-		// We dont need rand anymore, so clear it to not cause memory leaks
-		pRand->deleteThis();
+		Warning("Failed to play UI sound %s\n", szSoundScript);
 		return NULL;
 	}
-	else
-	{
-		pWave = pSoundScript->FindKey("wave");
-		if( !pWave )
-		{
-			Warning("Failed to play UI sound %s\n", szSoundScript);
-			return NULL;
-		}
-		Q_strncpy(szReturn, pWave->GetString(), 128 );
-		return szReturn;
-	}
+
+	return pIndex->GetWave( pEntry, random->RandomInt( 0, iMaxSounds - 1 ) );
 }
 
 KeyValues* gItemsGame;
@@ -13,7 +13,7 @@ extern KeyValues *GetSoundscript( const char *szSoundScript );
 #ifdef CLIENT_DLL
 extern void PrecacheUISoundScript( char *szSoundScript );
 #endif
-extern char *GetSoundScriptWave( char *szSoundScript );
+extern const char *GetSoundScriptWave( const char *szSoundScript );
 
 extern KeyValues* GlobalSoundManifest();
 extern void InitGlobalSoundManifest();
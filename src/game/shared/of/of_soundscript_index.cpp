@@ -0,0 +1,312 @@
+//=============================================================================
+//
+// Purpose: Compiled index of the OF sound scripts. See of_soundscript_index.h.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "cbase.h"
+#include "KeyValues.h"
+#include "filesystem.h"
+#include "tier1/generichash.h"
+#include "vstdlib/jobthread.h"
+#include "of_soundscript_index.h"
+
+#include "tier0/memdbgon.h"
+
+#define SOUNDSCRIPT_CACHE_ID		(('I'<<24)+('C'<<16)+('S'<<8)+'S')
+#define SOUNDSCRIPT_CACHE_VERSION	1
+
+static CSoundScriptIndex g_GlobalSoundScriptIndex( "GlobalSoundManifest" );
+static CSoundScriptIndex g_LevelSoundScriptIndex( "LevelSoundManifest" );
+
+CSoundScriptIndex *GlobalSoundScriptIndex()
+{
+	return &g_GlobalSoundScriptIndex;
+}
+
+CSoundScriptIndex *LevelSoundScriptIndex()
+{
+	return &g_LevelSoundScriptIndex;
+}
+
+CSoundScriptIndex::CSoundScriptIndex( const char *pszRootName ) : m_EntriesByHash( DefLessFunc( unsigned int ) )
+{
+	m_RootName = pszRootName;
+	m_pBuildJob = NULL;
+	m_pRoot = NULL;
+}
+
+CSoundScriptIndex::~CSoundScriptIndex()
+{
+	// The KeyValues are left for process teardown, the KeyValues system may already be gone by now
+}
+
+void CSoundScriptIndex::BeginBuild( const CUtlVector<CUtlString> &files, const char *pszPathID, const char *pszCacheFile )
+{
+	Purge();
+
+	m_Files = files;
+	m_PathID = pszPathID ? pszPathID : "";
+	m_CacheFile = pszCacheFile ? pszCacheFile : "";
+
+	if ( g_pThreadPool )
+	{
+		m_pBuildJob = ThreadExecute( this, &CSoundScriptIndex::Build );
+	}
+	else
+	{
+		Build();
+	}
+}
+
+void CSoundScriptIndex::WaitForBuild()
+{
+	if ( m_pBuildJob )
+	{
+		m_pBuildJob->WaitForFinishAndRelease();
+		m_pBuildJob = NULL;
+	}
+}
+
+void CSoundScriptIndex::Purge()
+{
+	WaitForBuild();
+
+	if ( m_pRoot )
+	{
+		m_pRoot->deleteThis();
+		m_pRoot = NULL;
+	}
+
+	m_Entries.Purge();
+	m_EntriesByHash.Purge();
+	m_Waves.Purge();
+	m_Files.Purge();
+}
+
+bool CSoundScriptIndex::IsEmpty()
+{
+	WaitForBuild();
+	return m_Entries.Count() == 0;
+}
+
+KeyValues *CSoundScriptIndex::GetRoot()
+{
+	WaitForBuild();
+	return m_pRoot;
+}
+
+const SoundScriptEntry_t *CSoundScriptIndex::Find( const char *pszName )
+{
+	WaitForBuild();
+
+	if ( !pszName || !pszName[0] )
+		return NULL;
+
+	int iHash = m_EntriesByHash.Find( HashStringCaseless( pszName ) );
+	if ( iHash == m_EntriesByHash.InvalidIndex() )
+		return NULL;
+
+	for ( int i = m_EntriesByHash[iHash]; i != -1; i = m_Entries[i].m_iNextSameHash )
+	{
+		if ( !Q_stricmp( m_Entries[i].m_pScript->GetName(), pszName ) )
+			return &m_Entries[i];
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs on the job thread. Nothing else touches the index until
+//			WaitForBuild returns.
+//-----------------------------------------------------------------------------
+void CSoundScriptIndex::Build()
+{
+	const char *pszPathID = m_PathID.IsEmpty() ? NULL : m_PathID.Get();
+
+	CUtlVector<long> fileTimes;
+	fileTimes.SetCount( m_Files.Count() );
+	for ( int i = 0; i < m_Files.Count(); i++ )
+	{
+		fileTimes[i] = filesystem->GetFileTime( m_Files[i], pszPathID );
+	}
+
+	double flStart = Plat_FloatTime();
+	bool bCached = LoadCache( fileTimes );
+	if ( !bCached )
+	{
+		ParseFiles();
+		SaveCache( fileTimes );
+	}
+
+	AddEntries();
+
+	DevMsg( "%s: %d sound scripts from %d files in %.1fms%s\n", m_RootName.Get(), m_Entries.Count(), m_Files.Count(),
+		( Plat_FloatTime() - flStart ) * 1000.0, bCached ? " (cached)" : "" );
+}
+
+bool CSoundScriptIndex::LoadCache( CUtlVector<long> &fileTimes )
+{
+	if ( m_CacheFile.IsEmpty() )
+		return false;
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( m_CacheFile, "MOD", buf ) )
+		return false;
+
+	if ( buf.GetInt() != SOUNDSCRIPT_CACHE_ID || buf.GetInt() != SOUNDSCRIPT_CACHE_VERSION )
+		return false;
+
+	// The cache is only good if it was built from exactly these files, unchanged
+	int nFiles = buf.GetInt();
+	if ( nFiles != m_Files.Count() )
+		return false;
+
+	for ( int i = 0; i < nFiles; i++ )
+	{
+		char szFile[MAX_PATH];
+		buf.GetString( szFile );
+		long nFileTime = buf.GetInt();
+
+		if ( !buf.IsValid() || Q_stricmp( szFile, m_Files[i] ) || nFileTime != fileTimes[i] )
+			return false;
+	}
+
+	KeyValues *pRoot = new KeyValues( m_RootName );
+	if ( !pRoot->ReadAsBinary( buf ) || !buf.IsValid() )
+	{
+		pRoot->deleteThis();
+		return false;
+	}
+
+	m_pRoot = pRoot;
+	return true;
+}
+
+void CSoundScriptIndex::SaveCache( const CUtlVector<long> &fileTimes )
+{
+	if ( m_CacheFile.IsEmpty() )
+		return;
+
+	// Don't cache anything built from files that are missing
+	for ( int i = 0; i < fileTimes.Count(); i++ )
+	{
+		if ( !fileTimes[i] )
+			return;
+	}
+
+	CUtlBuffer buf;
+	buf.PutInt( SOUNDSCRIPT_CACHE_ID );
+	buf.PutInt( SOUNDSCRIPT_CACHE_VERSION );
+	buf.PutInt( m_Files.Count() );
+	for ( int i = 0; i < m_Files.Count(); i++ )
+	{
+		buf.PutString( m_Files[i] );
+		buf.PutInt( fileTimes[i] );
+	}
+
+	if ( !m_pRoot->WriteAsBinary( buf ) )
+		return;
+
+	if ( !filesystem->WriteFile( m_CacheFile, "MOD", buf ) )
+	{
+		DevWarning( "Couldn't write sound script cache %s\n", m_CacheFile.Get() );
+	}
+}
+
+void CSoundScriptIndex::ParseFiles()
+{
+	const char *pszPathID = m_PathID.IsEmpty() ? NULL : m_PathID.Get();
+
+	m_pRoot = new KeyValues( m_RootName );
+
+	// Chain each file's scripts onto the end of the last file's, AddSubKey would walk the whole list every time
+	KeyValues *pTail = NULL;
+	for ( int i = 0; i < m_Files.Count(); i++ )
+	{
+		KeyValues *pSoundFile = new KeyValues( "SoundFile" );
+		if ( !pSoundFile->LoadFromFile( filesystem, m_Files[i], pszPathID ) )
+		{
+			DevWarning( "Couldn't load sound script file %s\n", m_Files[i].Get() );
+			pSoundFile->deleteThis();
+			continue;
+		}
+
+		if ( pTail )
+		{
+			pTail->SetNextKey( pSoundFile );
+		}
+		else
+		{
+			m_pRoot->AddSubKey( pSoundFile );
+		}
+
+		for ( KeyValues *pSound = pSoundFile; pSound; pSound = pSound->GetNextKey() )
+		{
+			// +developer 5 to start seeing this noise
+			DevMsg( 5, "Parsed: %s\n", pSound->GetString( "wave" ) );
+			pTail = pSound;
+		}
+	}
+}
+
+void CSoundScriptIndex::AddEntries()
+{
+	for ( KeyValues *pScript = m_pRoot->GetFirstSubKey(); pScript; pScript = pScript->GetNextKey() )
+	{
+		unsigned int nHash = HashStringCaseless( pScript->GetName() );
+
+		// FindKey returns the first script with a name, so later duplicates are never seen
+		int iHash = m_EntriesByHash.Find( nHash );
+		if ( iHash != m_EntriesByHash.InvalidIndex() )
+		{
+			bool bDuplicate = false;
+			for ( int i = m_EntriesByHash[iHash]; i != -1; i = m_Entries[i].m_iNextSameHash )
+			{
+				if ( !Q_stricmp( m_Entries[i].m_pScript->GetName(), pScript->GetName() ) )
+				{
+					bDuplicate = true;
+					break;
+				}
+			}
+
+			if ( bDuplicate )
+				continue;
+		}
+
+		int iEntry = m_Entries.AddToTail();
+		SoundScriptEntry_t &entry = m_Entries[iEntry];
+		entry.m_pScript = pScript;
+		entry.m_iFirstWave = m_Waves.Count();
+		entry.m_iNextSameHash = -1;
+
+		KeyValues *pWave = pScript->FindKey( "rndwave" );
+		if ( pWave )
+		{
+			for ( KeyValues *pSub = pWave->GetFirstSubKey(); pSub; pSub = pSub->GetNextKey() )
+			{
+				m_Waves.AddToTail( pSub->GetString() );
+			}
+		}
+		else
+		{
+			pWave = pScript->FindKey( "wave" );
+			if ( pWave )
+			{
+				m_Waves.AddToTail( pWave->GetString() );
+			}
+		}
+		entry.m_nWaves = m_Waves.Count() - entry.m_iFirstWave;
+
+		if ( iHash != m_EntriesByHash.InvalidIndex() )
+		{
+			entry.m_iNextSameHash = m_EntriesByHash[iHash];
+			m_EntriesByHash[iHash] = iEntry;
+		}
+		else
+		{
+			m_EntriesByHash.Insert( nHash, iEntry );
+		}
+	}
+}
@@ -0,0 +1,86 @@
+//=============================================================================
+//
+// Purpose: Compiled index of the sound scripts listed in game_sounds_manifest.txt
+//			and the map's <map>_level_sounds.txt.
+//
+//			The script files are parsed on a job thread while the rest of the
+//			game loads. The global index is cached in a binary file and reused
+//			as long as none of the listed files changed. Lookups go through a
+//			name hash instead of walking the KeyValues, and every script's
+//			wave list is gathered up front.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef OF_SOUNDSCRIPT_INDEX_H
+#define OF_SOUNDSCRIPT_INDEX_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlstring.h"
+
+class KeyValues;
+class CJob;
+
+struct SoundScriptEntry_t
+{
+	KeyValues	*m_pScript;
+	int			m_iFirstWave;	// into the index's wave list
+	int			m_nWaves;
+	int			m_iNextSameHash;
+};
+
+class CSoundScriptIndex
+{
+public:
+	CSoundScriptIndex( const char *pszRootName );
+	~CSoundScriptIndex();
+
+	// Starts parsing the given script files on a job thread. pszCacheFile can be NULL
+	// to always parse the files.
+	void		BeginBuild( const CUtlVector<CUtlString> &files, const char *pszPathID, const char *pszCacheFile );
+
+	// Blocks until the build job is done. Every accessor below calls this.
+	void		WaitForBuild();
+
+	void		Purge();
+
+	bool		IsEmpty();
+
+	// All of the scripts as subkeys, in file order.
+	KeyValues	*GetRoot();
+
+	// Returns the first script with this name, like FindKey on the root.
+	const SoundScriptEntry_t *Find( const char *pszName );
+
+	int			GetWaveCount( const SoundScriptEntry_t *pEntry ) const { return pEntry->m_nWaves; }
+	const char	*GetWave( const SoundScriptEntry_t *pEntry, int iWave ) const { return m_Waves[ pEntry->m_iFirstWave + iWave ]; }
+
+private:
+	void		Build();
+	bool		LoadCache( CUtlVector<long> &fileTimes );
+	void		SaveCache( const CUtlVector<long> &fileTimes );
+	void		ParseFiles();
+	void		AddEntries();
+
+	CUtlString				m_RootName;
+	CUtlVector<CUtlString>	m_Files;
+	CUtlString				m_PathID;
+	CUtlString				m_CacheFile;
+
+	CJob					*m_pBuildJob;
+
+	KeyValues				*m_pRoot;
+	CUtlVector<SoundScriptEntry_t>	m_Entries;
+	CUtlMap<unsigned int, int, int>	m_EntriesByHash;
+	CUtlVector<const char *>	m_Waves;
+};
+
+extern CSoundScriptIndex *GlobalSoundScriptIndex();
+extern CSoundScriptIndex *LevelSoundScriptIndex();
+
+#endif // OF_SOUNDSCRIPT_INDEX_H
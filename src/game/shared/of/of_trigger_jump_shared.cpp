@@ -106,6 +106,7 @@ void COFDTriggerJump::StartTouch( CBaseEntity *pOther )
 		actor->TouchJumpPad();
 	}
 
-	pOther->EmitSound( "JumpPadSound" );
+	static CSoundScriptHandle s_JumpPadSound( "JumpPadSound" );
+	pOther->EmitSound( s_JumpPadSound );
 #endif
 }
\ No newline at end of file
@@ -1596,7 +1596,8 @@ void CBaseEntity::PhysicsCheckWaterTransition( void )
 #endif // !CLIENT_DLL
 
 			// just crossed into water
-			EmitSound( "BaseEntity.EnterWater" );
+			static CSoundScriptHandle s_EnterWater( "BaseEntity.EnterWater" );
+			EmitSound( s_EnterWater );
 
 			if ( !IsEFlagSet( EFL_NO_WATER_VELOCITY_CHANGE ) )
 			{
@@ -1611,7 +1612,8 @@ void CBaseEntity::PhysicsCheckWaterTransition( void )
 		if ( oldcont != CONTENTS_EMPTY )
 		{	
 			// just crossed out of water
-			EmitSound( "BaseEntity.ExitWater" );
+			static CSoundScriptHandle s_ExitWater( "BaseEntity.ExitWater" );
+			EmitSound( s_ExitWater );
 		}		
 	}
 }
@@ -12,6 +12,7 @@
 #if defined( CLIENT_DLL )
 
 #include "igamesystem.h"
+#include "c_baseplayer.h"
 
 #endif
 #include <memory.h>
@@ -1373,6 +1374,369 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 	m_pWatchField = FindFieldByName( pwatchvar.GetString(), dmap );
 }
 
+//-----------------------------------------------------------------------------
+// Compiled copy plans
+//
+// Walking the datamap field by field is most of the cost of SaveData and
+// RestoreData. For the common cases (a plain copy, or an error check that
+// doesn't print anything) each datamap is flattened once per copy type and
+// data layout into a list of ops. Fields that sit back to back in both the
+// source and the destination are merged, so most of a copy is a few memcpys
+// and most of a compare a few memcmps. Strings, EHANDLEs and floats (which
+// have to compare as floats, and may have a tolerance) get ops of their own.
+//-----------------------------------------------------------------------------
+static ConVar pcompiledcopy( "pcompiledcopy", "1", FCVAR_CHEAT, "Use compiled datamap plans for prediction copies and error checks." );
+
+class CPredictionCopyPlan
+{
+public:
+	enum
+	{
+		OP_RAW = 0,		// memcpy / memcmp
+		OP_FLOAT,		// m_nCount floats, compared with m_flTolerance
+		OP_STRING,
+		OP_EHANDLE,		// m_nCount handles
+	};
+
+	struct Op_t
+	{
+		int		m_nOp;
+		int		m_nDestOffset;
+		int		m_nSrcOffset;
+		int		m_nBytes;
+		int		m_nCount;
+		float	m_flTolerance;
+		bool	m_bErrorCheck;
+	};
+
+	CPredictionCopyPlan() : m_bValid( true ) {}
+
+	void	Build( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex );
+
+	// False if the map has something the plan can't do (embedded pointers into
+	// unpacked data, field types CopyFields asserts on), use CopyFields instead
+	bool				m_bValid;
+	CUtlVector<Op_t>	m_CopyOps;
+	CUtlVector<Op_t>	m_CompareOps;
+
+private:
+	void	AddFields_R( int chain_count, int destBase, int srcBase, typedescription_t *pFields, int fieldCount );
+	void	AddField( int nOp, int destOffset, int srcOffset, int nBytes, int nCount, const typedescription_t *pField );
+	static void	MergeOps( CUtlVector<Op_t> &ops );
+	static int	OpCompare( const Op_t *a, const Op_t *b );
+
+	int		m_nType;
+	int		m_nDestOffsetIndex;
+	int		m_nSrcOffsetIndex;
+	CUtlVector<Op_t>	m_Fields;
+};
+
+void CPredictionCopyPlan::AddField( int nOp, int destOffset, int srcOffset, int nBytes, int nCount, const typedescription_t *pField )
+{
+	Op_t &op = m_Fields[ m_Fields.AddToTail() ];
+	op.m_nOp = nOp;
+	op.m_nDestOffset = destOffset;
+	op.m_nSrcOffset = srcOffset;
+	op.m_nBytes = nBytes;
+	op.m_nCount = nCount;
+	op.m_flTolerance = pField->fieldTolerance;
+	op.m_bErrorCheck = !( pField->flags & FTYPEDESC_NOERRORCHECK );
+}
+
+// Mirrors the field selection in CPredictionCopy::CopyFields
+void CPredictionCopyPlan::AddFields_R( int chain_count, int destBase, int srcBase, typedescription_t *pFields, int fieldCount )
+{
+	for ( int i = 0; i < fieldCount && m_bValid; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( m_nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( m_nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		int destOffset = destBase + pField->fieldOffset[ m_nDestOffsetIndex ];
+		int srcOffset = srcBase + pField->fieldOffset[ m_nSrcOffsetIndex ];
+		int fieldSize = pField->fieldSize;
+
+		switch ( pField->fieldType )
+		{
+		case FIELD_EMBEDDED:
+			// Pointers get followed at copy time, which a plan can't do
+			if ( ( flags & FTYPEDESC_PTR ) && ( m_nDestOffsetIndex == TD_OFFSET_NORMAL || m_nSrcOffsetIndex == TD_OFFSET_NORMAL ) )
+			{
+				m_bValid = false;
+				return;
+			}
+			AddFields_R( chain_count, destOffset, srcOffset, pField->td->dataDesc, pField->td->dataNumFields );
+			break;
+		case FIELD_FLOAT:
+			AddField( OP_FLOAT, destOffset, srcOffset, sizeof( float ) * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_VECTOR:
+			AddField( OP_FLOAT, destOffset, srcOffset, sizeof( Vector ) * fieldSize, 3 * fieldSize, pField );
+			break;
+		case FIELD_QUATERNION:
+			AddField( OP_FLOAT, destOffset, srcOffset, sizeof( Quaternion ) * fieldSize, 4 * fieldSize, pField );
+			break;
+		case FIELD_COLOR32:
+			AddField( OP_RAW, destOffset, srcOffset, 4 * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_BOOLEAN:
+			AddField( OP_RAW, destOffset, srcOffset, sizeof( bool ) * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_INTEGER:
+			AddField( OP_RAW, destOffset, srcOffset, sizeof( int ) * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_SHORT:
+			AddField( OP_RAW, destOffset, srcOffset, sizeof( short ) * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_CHARACTER:
+			AddField( OP_RAW, destOffset, srcOffset, fieldSize, fieldSize, pField );
+			break;
+		case FIELD_STRING:
+			AddField( OP_STRING, destOffset, srcOffset, 0, 1, pField );
+			break;
+		case FIELD_EHANDLE:
+			AddField( OP_EHANDLE, destOffset, srcOffset, sizeof( EHANDLE ) * fieldSize, fieldSize, pField );
+			break;
+		case FIELD_VOID:
+			break;
+		default:
+			m_bValid = false;
+			return;
+		}
+	}
+}
+
+int CPredictionCopyPlan::OpCompare( const Op_t *a, const Op_t *b )
+{
+	if ( a->m_nDestOffset != b->m_nDestOffset )
+		return a->m_nDestOffset - b->m_nDestOffset;
+
+	return a->m_nSrcOffset - b->m_nSrcOffset;
+}
+
+// Merges raw runs, and float runs with the same tolerance, that are contiguous on both sides
+void CPredictionCopyPlan::MergeOps( CUtlVector<Op_t> &ops )
+{
+	ops.Sort( OpCompare );
+
+	int nOut = 0;
+	for ( int i = 0; i < ops.Count(); i++ )
+	{
+		const Op_t &op = ops[ i ];
+		if ( nOut > 0 )
+		{
+			Op_t &prev = ops[ nOut - 1 ];
+			if ( prev.m_nOp == op.m_nOp &&
+				( op.m_nOp == OP_RAW || ( op.m_nOp == OP_FLOAT && prev.m_flTolerance == op.m_flTolerance ) ) &&
+				prev.m_nDestOffset + prev.m_nBytes == op.m_nDestOffset &&
+				prev.m_nSrcOffset + prev.m_nBytes == op.m_nSrcOffset )
+			{
+				prev.m_nBytes += op.m_nBytes;
+				prev.m_nCount += op.m_nCount;
+				continue;
+			}
+		}
+
+		ops[ nOut++ ] = op;
+	}
+
+	ops.RemoveMultipleFromTail( ops.Count() - nOut );
+}
+
+void CPredictionCopyPlan::Build( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	m_nType = type;
+	m_nDestOffsetIndex = destOffsetIndex;
+	m_nSrcOffsetIndex = srcOffsetIndex;
+
+	// Same chain bookkeeping as TransferData, so overridden baseclass fields drop out
+	++g_nChainCount;
+	for ( datamap_t *pMap = dmap; pMap && m_bValid; pMap = pMap->baseMap )
+	{
+		AddFields_R( g_nChainCount, 0, 0, pMap->dataDesc, pMap->dataNumFields );
+	}
+
+	if ( !m_bValid )
+	{
+		m_Fields.Purge();
+		return;
+	}
+
+	// Copies don't care about types other than strings and handles
+	for ( int i = 0; i < m_Fields.Count(); i++ )
+	{
+		Op_t op = m_Fields[ i ];
+		if ( op.m_nOp == OP_FLOAT )
+		{
+			op.m_nOp = OP_RAW;
+		}
+		m_CopyOps.AddToTail( op );
+
+		// Fields that are never error checked always compare as identical
+		if ( m_Fields[ i ].m_bErrorCheck )
+		{
+			m_CompareOps.AddToTail( m_Fields[ i ] );
+		}
+	}
+
+	MergeOps( m_CopyOps );
+	MergeOps( m_CompareOps );
+	m_Fields.Purge();
+}
+
+struct PredictionCopyPlans_t
+{
+	CPredictionCopyPlan *m_pPlans[ 3 ][ TD_OFFSET_COUNT ][ TD_OFFSET_COUNT ];	// type, dest layout, src layout
+};
+
+static CUtlMap< datamap_t *, PredictionCopyPlans_t > g_PredictionCopyPlans( DefLessFunc( datamap_t * ) );
+
+static const CPredictionCopyPlan *GetPredictionCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	Assert( type >= PC_EVERYTHING && type <= PC_NETWORKED_ONLY );
+
+	unsigned short i = g_PredictionCopyPlans.Find( dmap );
+	if ( i == g_PredictionCopyPlans.InvalidIndex() )
+	{
+		PredictionCopyPlans_t plans;
+		memset( &plans, 0, sizeof( plans ) );
+		i = g_PredictionCopyPlans.Insert( dmap, plans );
+	}
+
+	CPredictionCopyPlan *&pPlan = g_PredictionCopyPlans[ i ].m_pPlans[ type ][ destOffsetIndex ][ srcOffsetIndex ];
+	if ( !pPlan )
+	{
+		pPlan = new CPredictionCopyPlan;
+		pPlan->Build( dmap, type, destOffsetIndex, srcOffsetIndex );
+	}
+
+	return pPlan;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Plans only cover plain copies and error checks that don't report,
+//			describe or watch anything
+//-----------------------------------------------------------------------------
+bool CPredictionCopy::CanUseCompiledPlan( void ) const
+{
+	if ( !pcompiledcopy.GetBool() )
+		return false;
+
+	if ( m_bDescribeFields || m_pWatchField )
+		return false;
+
+	if ( m_bPerformCopy )
+		return !m_bErrorCheck;
+
+	return m_bErrorCheck && !m_bReportErrors;
+}
+
+int CPredictionCopy::TransferDataCompiled( const CPredictionCopyPlan *pPlan )
+{
+	char *pDest = (char *)m_pDest;
+	const char *pSrc = (const char *)m_pSrc;
+
+	if ( m_bPerformCopy )
+	{
+		const CPredictionCopyPlan::Op_t *pOp = pPlan->m_CopyOps.Base();
+		for ( int i = pPlan->m_CopyOps.Count(); --i >= 0; ++pOp )
+		{
+			char *pOut = pDest + pOp->m_nDestOffset;
+			const char *pIn = pSrc + pOp->m_nSrcOffset;
+
+			switch ( pOp->m_nOp )
+			{
+			case CPredictionCopyPlan::OP_RAW:
+				memcpy( pOut, pIn, pOp->m_nBytes );
+				break;
+			case CPredictionCopyPlan::OP_STRING:
+				memcpy( pOut, pIn, Q_strlen( pIn ) + 1 );
+				break;
+			case CPredictionCopyPlan::OP_EHANDLE:
+				for ( int j = 0; j < pOp->m_nCount; j++ )
+				{
+					( (EHANDLE *)pOut )[ j ] = ( (EHANDLE const *)pIn )[ j ];
+				}
+				break;
+			}
+		}
+
+		return m_nErrorCount;
+	}
+
+	const CPredictionCopyPlan::Op_t *pOp = pPlan->m_CompareOps.Base();
+	for ( int i = pPlan->m_CompareOps.Count(); --i >= 0; ++pOp )
+	{
+		const char *pOut = pDest + pOp->m_nDestOffset;
+		const char *pIn = pSrc + pOp->m_nSrcOffset;
+
+		bool bDiffers = false;
+		switch ( pOp->m_nOp )
+		{
+		case CPredictionCopyPlan::OP_RAW:
+			bDiffers = memcmp( pOut, pIn, pOp->m_nBytes ) != 0;
+			break;
+		case CPredictionCopyPlan::OP_FLOAT:
+			{
+				const float *pOutValue = (const float *)pOut;
+				const float *pInValue = (const float *)pIn;
+				float tolerance = pOp->m_flTolerance;
+				for ( int j = 0; j < pOp->m_nCount; j++ )
+				{
+					if ( pOutValue[ j ] == pInValue[ j ] )
+						continue;
+
+					if ( tolerance > 0.0f && fabs( pOutValue[ j ] - pInValue[ j ] ) <= tolerance )
+						continue;
+
+					bDiffers = true;
+					break;
+				}
+			}
+			break;
+		case CPredictionCopyPlan::OP_STRING:
+			bDiffers = Q_strcmp( pOut, pIn ) != 0;
+			break;
+		case CPredictionCopyPlan::OP_EHANDLE:
+			for ( int j = 0; j < pOp->m_nCount; j++ )
+			{
+				if ( ( (EHANDLE const *)pOut )[ j ].Get() != ( (EHANDLE const *)pIn )[ j ].Get() )
+				{
+					bDiffers = true;
+					break;
+				}
+			}
+			break;
+		}
+
+		if ( bDiffers )
+		{
+			++m_nErrorCount;
+		}
+	}
+
+	return m_nErrorCount;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *operation - 
@@ -1391,6 +1755,13 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	if ( CanUseCompiledPlan() )
+	{
+		const CPredictionCopyPlan *pPlan = GetPredictionCopyPlan( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+		if ( pPlan->m_bValid )
+			return TransferDataCompiled( pPlan );
+	}
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
@@ -2020,6 +2391,78 @@ CON_COMMAND_F( cl_pred_track, "<entindex> <fieldname>:  Track changes to entity
 	g_pChangeTracker->SetupTracking( ent, args[2] );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Times SaveData / RestoreData / the error check on the local player
+//			with and without the compiled plans
+//-----------------------------------------------------------------------------
+static double TimePredictionCopy( int iterations, bool bCompiled, int type, void *dest, bool dest_packed, const void *src, bool src_packed,
+	bool counterrors, datamap_t *dmap, int &errors )
+{
+	bool bWasCompiled = pcompiledcopy.GetBool();
+	pcompiledcopy.SetValue( bCompiled ? 1 : 0 );
+
+	errors = 0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < iterations; i++ )
+	{
+		CPredictionCopy copyHelper( type, dest, dest_packed, src, src_packed, counterrors, false, !counterrors );
+		errors = copyHelper.TransferData( "pcopy_benchmark", -1, dmap );
+	}
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	pcompiledcopy.SetValue( bWasCompiled ? 1 : 0 );
+	return flElapsed;
+}
+
+CON_COMMAND_F( pcopy_benchmark, "[iterations]:  Time prediction copies of the local player with and without compiled plans.", FCVAR_CHEAT )
+{
+	C_BasePlayer *pPlayer = C_BasePlayer::GetLocalPlayer();
+	if ( !pPlayer )
+	{
+		Msg( "pcopy_benchmark:  No local player\n" );
+		return;
+	}
+
+	datamap_t *dmap = pPlayer->GetPredDescMap();
+	if ( !dmap || !dmap->packed_offsets_computed || !pPlayer->GetOriginalNetworkDataObject() )
+	{
+		Msg( "pcopy_benchmark:  %s isn't set up for prediction\n", pPlayer->GetClassname() );
+		return;
+	}
+
+	int iterations = args.ArgC() > 1 ? max( Q_atoi( args[1] ), 1 ) : 10000;
+
+	byte *pSlow = new byte[ dmap->packed_size ];
+	byte *pFast = new byte[ dmap->packed_size ];
+	Q_memset( pSlow, 0, dmap->packed_size );
+	Q_memset( pFast, 0, dmap->packed_size );
+
+	int errors;
+	double flSaveSlow = TimePredictionCopy( iterations, false, PC_EVERYTHING, pSlow, PC_DATA_PACKED, pPlayer, PC_DATA_NORMAL, false, dmap, errors );
+	double flSaveFast = TimePredictionCopy( iterations, true, PC_EVERYTHING, pFast, PC_DATA_PACKED, pPlayer, PC_DATA_NORMAL, false, dmap, errors );
+
+	bool bMatches = !Q_memcmp( pSlow, pFast, dmap->packed_size );
+
+	// Restoring what was just saved leaves the player as it was
+	double flRestoreSlow = TimePredictionCopy( iterations, false, PC_EVERYTHING, pPlayer, PC_DATA_NORMAL, pFast, PC_DATA_PACKED, false, dmap, errors );
+	double flRestoreFast = TimePredictionCopy( iterations, true, PC_EVERYTHING, pPlayer, PC_DATA_NORMAL, pFast, PC_DATA_PACKED, false, dmap, errors );
+
+	int slowErrors, fastErrors;
+	const void *pOriginal = pPlayer->GetOriginalNetworkDataObject();
+	double flCheckSlow = TimePredictionCopy( iterations, false, PC_NETWORKED_ONLY, pFast, PC_DATA_PACKED, pOriginal, PC_DATA_PACKED, true, dmap, slowErrors );
+	double flCheckFast = TimePredictionCopy( iterations, true, PC_NETWORKED_ONLY, pFast, PC_DATA_PACKED, pOriginal, PC_DATA_PACKED, true, dmap, fastErrors );
+
+	Msg( "%s, %d bytes packed, %d iterations\n", pPlayer->GetClassname(), dmap->packed_size, iterations );
+	Msg( "  save:    %8.3f us per copy, compiled %8.3f us (%s)\n", flSaveSlow * 1e6 / iterations, flSaveFast * 1e6 / iterations,
+		bMatches ? "identical" : "MISMATCH" );
+	Msg( "  restore: %8.3f us per copy, compiled %8.3f us\n", flRestoreSlow * 1e6 / iterations, flRestoreFast * 1e6 / iterations );
+	Msg( "  check:   %8.3f us per copy, compiled %8.3f us (%d / %d differences)\n", flCheckSlow * 1e6 / iterations, flCheckFast * 1e6 / iterations,
+		slowErrors, fastErrors );
+
+	delete[] pSlow;
+	delete[] pFast;
+}
+
 #endif
 
 #if defined( CLIENT_DLL ) && defined( COPY_CHECK_STRESSTEST )
@@ -41,6 +41,8 @@ enum
 #define PC_DATA_PACKED			true
 #define PC_DATA_NORMAL			false
 
+class CPredictionCopyPlan;
+
 typedef void ( *FN_FIELD_COMPARE )( const char *classname, const char *fieldname, const char *fieldtype,
 	bool networked, bool noterrorchecked, bool differs, bool withintolerance, const char *value );
 
@@ -80,10 +82,15 @@ public:
 		memcpy( outdata, indata, size );
 	}
 
+	// Returns the number of errors found. Plain copies and silent error checks run
+	// from a compiled plan of the datamap, in which case the count is only
+	// guaranteed to be non-zero when something differs.
 	int		TransferData( const char *operation, int entindex, datamap_t *dmap );
 
 private:
 	void	TransferData_R( int chaincount, datamap_t *dmap );
+	bool	CanUseCompiledPlan( void ) const;
+	int		TransferDataCompiled( const CPredictionCopyPlan *pPlan );
 
 	void	DetermineWatchField( const char *operation, int entindex,  datamap_t *dmap );
 	void	DumpWatchField( typedescription_t *field );
@@ -1915,6 +1915,10 @@ CBaseEntity *CRestore::EntityFromIndex( int entityIndex )
 	if ( !m_pGameInfo || entityIndex < 0 )
 		return NULL;
 
+	// Tables are usually built with the ids in order
+	if ( entityIndex < m_pGameInfo->NumEntities() && m_pGameInfo->GetEntityInfo( entityIndex )->id == entityIndex )
+		return m_pGameInfo->GetEntityInfo( entityIndex )->hEnt;
+
 	int i;
 	entitytable_t *pTable;
 
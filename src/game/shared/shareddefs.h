@@ -837,6 +837,9 @@ struct ModelScale
 
 struct CSoundParameters;
 typedef short HSOUNDSCRIPTHANDLE;
+#ifndef SOUNDEMITTER_INVALID_HANDLE
+#define SOUNDEMITTER_INVALID_HANDLE	(HSOUNDSCRIPTHANDLE)-1
+#endif
 //-----------------------------------------------------------------------------
 // Purpose: Aggregates and sets default parameters for EmitSound function calls
 //-----------------------------------------------------------------------------
@@ -882,6 +885,58 @@ struct EmitSound_t
 	mutable HSOUNDSCRIPTHANDLE		m_hSoundScriptHandle;
 };
 
+// Bumped whenever the sound emitter reloads its scripts, which renumbers the handles
+extern int g_nSoundScriptHandleSerial;
+
+//-----------------------------------------------------------------------------
+// Purpose: A sound script name that only gets looked up the first time it's
+//			emitted. The handle is kept until the sound emitter reloads its
+//			scripts. The name isn't copied, so these are meant to be statics
+//			or to live next to the string:
+//
+//			static CSoundScriptHandle s_JumpSound( "Player.Jump" );
+//			EmitSound( s_JumpSound );
+//
+//			Only for sound scripts, raw wave names don't have a handle.
+//-----------------------------------------------------------------------------
+class CSoundScriptHandle
+{
+public:
+	explicit CSoundScriptHandle( const char *pszSoundName = NULL ) :
+		m_pszSoundName( pszSoundName ),
+		m_hHandle( SOUNDEMITTER_INVALID_HANDLE ),
+		m_nSerial( -1 )
+	{
+	}
+
+	void SetName( const char *pszSoundName )
+	{
+		m_pszSoundName = pszSoundName;
+		m_hHandle = SOUNDEMITTER_INVALID_HANDLE;
+	}
+
+	const char *GetName() const
+	{
+		return m_pszSoundName;
+	}
+
+	// The EmitSound / GetParametersForSound handle overloads fill this in
+	HSOUNDSCRIPTHANDLE &GetHandle() const
+	{
+		if ( m_nSerial != g_nSoundScriptHandleSerial )
+		{
+			m_hHandle = SOUNDEMITTER_INVALID_HANDLE;
+			m_nSerial = g_nSoundScriptHandleSerial;
+		}
+		return m_hHandle;
+	}
+
+private:
+	const char					*m_pszSoundName;
+	mutable HSOUNDSCRIPTHANDLE	m_hHandle;
+	mutable int					m_nSerial;
+};
+
 #define MAX_ACTORS_IN_SCENE 16
 
 //-----------------------------------------------------------------------------
@@ -39,6 +39,7 @@
 	#include "serverbenchmark_base.h"
 	#include "tf_gamestats.h"
 	#include "of_music_player.h"
+	#include "roundsnapshot.h"
 #if defined( REPLAY_ENABLED )	
 	#include "replay/ireplaysystem.h"
 	#include "replay/iserverreplaycontext.h"
@@ -3166,17 +3167,23 @@ void CTeamplayRoundBasedRules::RoundRespawn( void )
 //-----------------------------------------------------------------------------
 void CTeamplayRoundBasedRules::CleanUpMap()
 {
+	double flStartTime = Plat_FloatTime();
+
 	if( mp_showcleanedupents.GetInt() )
 	{
 		Msg( "CleanUpMap\n===============\n" );
 		Msg( "  Entities: %d (%d edicts)\n", gEntList.NumberOfEntities(), gEntList.NumberOfEdicts() );
 	}
 
+	// With mp_round_snapshot, the entities the snapshot covers are restored in place
+	// at the end instead of being removed and recreated.
+	bool bRestoreSnapshot = g_RoundSnapshot.BeginRestore();
+
 	// Get rid of all entities except players.
 	CBaseEntity *pCur = gEntList.FirstEnt();
 	while ( pCur )
 	{
-		if ( !RoundCleanupShouldIgnore( pCur ) )
+		if ( !RoundCleanupShouldIgnore( pCur ) && !( bRestoreSnapshot && g_RoundSnapshot.ShouldKeepEntity( pCur ) ) )
 		{
 			if( mp_showcleanedupents.GetInt() & 1 )
 			{
@@ -3214,12 +3221,14 @@ void CTeamplayRoundBasedRules::CleanUpMap()
 		CTeamplayMapEntityFilter()
 		{
 			m_pRules = assert_cast<CTeamplayRoundBasedRules*>( GameRules() );
+			m_iMapEntity = 0;
+			m_bRestoreSnapshot = false;
 		}
 
 		virtual bool ShouldCreateEntity( const char *pClassname )
 		{
-			// Don't recreate the preserved entities.
-			if ( m_pRules->ShouldCreateEntity( pClassname ) )
+			// Don't recreate the preserved entities, or the ones the snapshot restores.
+			if ( m_pRules->ShouldCreateEntity( pClassname ) && !( m_bRestoreSnapshot && g_RoundSnapshot.ShouldKeepMapEntity( m_iMapEntity ) ) )
 				return true;
 
 			// Increment our iterator since it's not going to call CreateNextEntity for this ent.
@@ -3227,12 +3236,20 @@ void CTeamplayRoundBasedRules::CleanUpMap()
 			{
 				m_iIterator = g_MapEntityRefs.Next( m_iIterator );
 			}
+			m_iMapEntity++;
 
 			return false;
 		}
 
 
 		virtual CBaseEntity* CreateNextEntity( const char *pClassname )
+		{
+			CBaseEntity *pEntity = CreateMapEntity( pClassname );
+			g_RoundSnapshot.SetMapEntity( m_iMapEntity++, pEntity );
+			return pEntity;
+		}
+
+		CBaseEntity* CreateMapEntity( const char *pClassname )
 		{
 			if ( m_iIterator == g_MapEntityRefs.InvalidIndex() )
 			{
@@ -3264,14 +3281,42 @@ void CTeamplayRoundBasedRules::CleanUpMap()
 
 	public:
 		int m_iIterator; // Iterator into g_MapEntityRefs.
+		int m_iMapEntity; // Position in the entity lump.
+		bool m_bRestoreSnapshot;
 		CTeamplayRoundBasedRules *m_pRules;
 	};
 	CTeamplayMapEntityFilter filter;
 	filter.m_iIterator = g_MapEntityRefs.Head();
+	filter.m_bRestoreSnapshot = bRestoreSnapshot;
 
 	// DO NOT CALL SPAWN ON info_node ENTITIES!
 
-	MapEntity_ParseAllEntities( engine->GetMapEntitiesString(), &filter, true );
+	{
+		// The lump was tokenized when the map loaded, so this only creates and spawns
+		// (compare with sv_mapentities_pretokenized 0 under vprof).
+		VPROF( "CTeamplayRoundBasedRules::CleanUpMap_RespawnEntities" );
+		MapEntity_ParseAllEntities( engine->GetMapEntitiesString(), &filter, true );
+	}
+
+	if ( bRestoreSnapshot )
+	{
+		g_RoundSnapshot.FinishRestore();
+	}
+	else if ( g_RoundSnapshot.IsEnabled() )
+	{
+		CUtlVector<CBaseEntity *> entities;
+		for ( pCur = gEntList.FirstEnt(); pCur; pCur = gEntList.NextEnt( pCur ) )
+		{
+			if ( !RoundCleanupShouldIgnore( pCur ) )
+			{
+				entities.AddToTail( pCur );
+			}
+		}
+
+		g_RoundSnapshot.Take( entities );
+	}
+
+	g_RoundSnapshot.RecordCleanUpTime( bRestoreSnapshot, Plat_FloatTime() - flStartTime );
 }
 
 //-----------------------------------------------------------------------------
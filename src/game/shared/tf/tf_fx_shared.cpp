@@ -76,7 +76,7 @@ void FX_WeaponSound( int iPlayer, WeaponSound_t soundType, const Vector &vecOrig
 	if ( !te->CanPredict() )
 		return;
 
-	CBaseEntity::EmitSound( filter, iPlayer, pShootSound, &vecOrigin ); 
+	CBaseEntity::EmitSound( filter, iPlayer, pShootSound, pWeaponInfo->aShootSoundHandles[soundType].GetHandle(), &vecOrigin ); 
 }
 
 //-----------------------------------------------------------------------------
@@ -191,7 +191,8 @@ void CTFGameMovement::PlayerMove()
 
 			if (bPlaySplash)
 			{
-				m_pTFPlayer->EmitSound("Physics.WaterSplash");
+				static CSoundScriptHandle s_WaterSplash( "Physics.WaterSplash" );
+				m_pTFPlayer->EmitSound( s_WaterSplash );
 			}
 		}
 	}
@@ -280,8 +281,12 @@ void CTFGameMovement::ProcessMovement(CBasePlayer *pBasePlayer, CMoveData *pMove
 		ShieldChargeMove();
 	}
 
+	SetupMovementTraceList();
+
 	PlayerMove();
 	FinishMove();
+
+	ClearMovementTraceList();
 }
 
 
@@ -1210,10 +1215,6 @@ float CTFGameMovement::GetAirSpeedCap(void)
 	return mp_maxairspeed.GetFloat();
 }
 
-extern void TracePlayerBBoxForGround(const Vector& start, const Vector& end, const Vector& minsSrc,
-	const Vector& maxsSrc, IHandleEntity *player, unsigned int fMask,
-	int collisionGroup, trace_t& pm);
-
 //-----------------------------------------------------------------------------
 // This filter checks against buildable objects.
 //-----------------------------------------------------------------------------
@@ -1261,7 +1262,7 @@ CBaseHandle CTFGameMovement::TestPlayerPosition(const Vector& pos, int collision
 	ray.Init(pos, pos, GetPlayerMins(), GetPlayerMaxs());
 
 	CTraceFilterObject traceFilter(mv->m_nPlayerHandle.Get(), collisionGroup);
-	enginetrace->TraceRay(ray, PlayerSolidMask(), &traceFilter, &pm);
+	TraceMovementRay(ray, PlayerSolidMask(), &traceFilter, pm);
 
 	if ((pm.contents & PlayerSolidMask()) && pm.m_pEnt)
 	{
@@ -1286,7 +1287,7 @@ void CTFGameMovement::TracePlayerBBox(const Vector& start, const Vector& end, un
 
 	CTraceFilterObject traceFilter(mv->m_nPlayerHandle.Get(), collisionGroup);
 
-	enginetrace->TraceRay(ray, fMask, &traceFilter, &pm);
+	TraceMovementRay(ray, fMask, &traceFilter, pm);
 }
 
 //-----------------------------------------------------------------------------
@@ -1345,7 +1346,7 @@ void CTFGameMovement::CategorizePosition(void)
 	if (trace.plane.normal.z < 0.7f)
 	{
 		// Test four sub-boxes, to see if any of them would have found shallower slope we could actually stand on.
-		TracePlayerBBoxForGround(vecStartPos, vecEndPos, GetPlayerMins(), GetPlayerMaxs(), mv->m_nPlayerHandle.Get(), PlayerSolidMask(), COLLISION_GROUP_PLAYER_MOVEMENT, trace);
+		TryTouchGroundInQuadrants(vecStartPos, vecEndPos, PlayerSolidMask(), COLLISION_GROUP_PLAYER_MOVEMENT, trace);
 		if (trace.plane.normal[2] < 0.7f)
 		{
 			// Too steep.
@@ -1698,7 +1699,8 @@ void CTFGameMovement::CheckCSlideSound(bool CSliding)
 	{
 		if (!player->m_bIsCSliding)
 		{
-			player->EmitSound("Player.Slide");
+			static CSoundScriptHandle s_Slide( "Player.Slide" );
+			player->EmitSound( s_Slide );
 			player->m_bIsCSliding = true;
 		}
 	}
@@ -516,5 +516,10 @@ void FileWeaponInfo_t::Parse( KeyValues *pKeyValuesData, const char *szWeaponNam
 			}
 		}
 	}
+
+	for ( int i = EMPTY; i < NUM_SHOOT_SOUND_TYPES; i++ )
+	{
+		aShootSoundHandles[i].SetName( aShootSounds[i] );
+	}
 }
 
@@ -116,6 +116,7 @@ public:
 
 	// Sound blocks
 	char					aShootSounds[NUM_SHOOT_SOUND_TYPES][MAX_WEAPON_STRING];	
+	CSoundScriptHandle		aShootSoundHandles[NUM_SHOOT_SOUND_TYPES];	// interned aShootSounds
 
 	int						iAmmoType;
 	int						iAmmo2Type;
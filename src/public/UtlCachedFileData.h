@@ -108,6 +108,26 @@ public:
 		return idx != m_Elements.InvalidIndex() ? true : false;
 	}
 
+	// Supplies the disk fileinfo ahead of Get(), for callers that already looked it up.
+	// Does nothing for files that aren't in the cache yet, so EntryExists() still reports them.
+	void SetDiskFileInfo( char const *filename, long diskfileinfo )
+	{
+		if ( m_bNeverCheckDisk )
+			return;
+
+		ElementType_t element;
+		element.handle = g_pFullFileSystem->FindOrAddFileName( filename );
+		int idx = m_Elements.Find( element );
+		if ( idx == m_Elements.InvalidIndex() )
+			return;
+
+		ElementType_t& e = m_Elements[ idx ];
+		if ( e.diskfileinfo == UTL_CACHED_FILE_DATA_UNDEFINED_DISKINFO )
+		{
+			e.diskfileinfo = diskfileinfo;
+		}
+	}
+
 	void SetElement( char const *name, long fileinfo, T* src )
 	{
 		SetDirty( true );
@@ -1244,6 +1244,297 @@ FORCEINLINE fltx4 QuaternionAccumulateSIMD( const fltx4 &p, float s, const fltx4
 }
 #endif
 
+//-----------------------------------------------------------------------------
+// Structure of arrays bone blending.
+//
+// The per bone blends above widen a single quaternion into a fltx4, so SIMD
+// only helps within one bone. SlerpBones and BlendBones instead gather the
+// bones they blend four at a time, one register per component (x x x x, y y y y,
+// ...) the way FourVectors does, so every SIMD op works on four bones at once.
+//-----------------------------------------------------------------------------
+static ConVar anim_simd_blend( "anim_simd_blend", "1", FCVAR_REPLICATED, "Blend animation layers four bones at a time." );
+
+class ALIGN16 FourQuaternions
+{
+public:
+	fltx4 x, y, z, w;
+
+	/// LoadAndSwizzle - load 4 Quaternions into a FourQuaternions, performing transpose op
+	FORCEINLINE void LoadAndSwizzle( const Quaternion &a, const Quaternion &b, const Quaternion &c, const Quaternion &d )
+	{
+		x = LoadUnalignedSIMD( a.Base() );
+		y = LoadUnalignedSIMD( b.Base() );
+		z = LoadUnalignedSIMD( c.Base() );
+		w = LoadUnalignedSIMD( d.Base() );
+		TransposeSIMD( x, y, z, w );
+	}
+
+	/// SwizzleAndStore - transpose back and store the 4 Quaternions
+	FORCEINLINE void SwizzleAndStore( Quaternion &a, Quaternion &b, Quaternion &c, Quaternion &d ) const
+	{
+		fltx4 ta = x, tb = y, tc = z, td = w;
+		TransposeSIMD( ta, tb, tc, td );
+		StoreUnalignedSIMD( a.Base(), ta );
+		StoreUnalignedSIMD( b.Base(), tb );
+		StoreUnalignedSIMD( c.Base(), tc );
+		StoreUnalignedSIMD( d.Base(), td );
+	}
+
+	FORCEINLINE fltx4 operator*( const FourQuaternions &b ) const		//< 4 dot products
+	{
+		fltx4 dot = MulSIMD( x, b.x );
+		dot = MaddSIMD( y, b.y, dot );
+		dot = MaddSIMD( z, b.z, dot );
+		dot = MaddSIMD( w, b.w, dot );
+		return dot;
+	}
+} ALIGN16_POST;
+
+static FORCEINLINE void SwizzleAndStore( const FourVectors &v, Vector &a, Vector &b, Vector &c, Vector &d )
+{
+	fltx4 ta = v.x, tb = v.y, tc = v.z, td = Four_Zeros;
+	TransposeSIMD( ta, tb, tc, td );
+	StoreUnaligned3SIMD( a.Base(), ta );
+	StoreUnaligned3SIMD( b.Base(), tb );
+	StoreUnaligned3SIMD( c.Base(), tc );
+	StoreUnaligned3SIMD( d.Base(), td );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: flip q to the same side as p, except in the lanes set in noAlign
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionAlignSoA( const FourQuaternions &p, FourQuaternions &q, const fltx4 &noAlign )
+{
+	// same test as QuaternionAlign(), |p-q|^2 > |p+q|^2
+	fltx4 flip = AndNotSIMD( noAlign, CmpLtSIMD( p * q, Four_Zeros ) );
+	q.x = MaskedAssign( flip, NegSIMD( q.x ), q.x );
+	q.y = MaskedAssign( flip, NegSIMD( q.y ), q.y );
+	q.z = MaskedAssign( flip, NegSIMD( q.z ), q.z );
+	q.w = MaskedAssign( flip, NegSIMD( q.w ), q.w );
+}
+
+static FORCEINLINE void QuaternionNormalizeSoA( FourQuaternions &q )
+{
+	fltx4 radius = q * q;
+	fltx4 iradius = MaskedAssign( CmpGtSIMD( radius, Four_Zeros ), DivSIMD( Four_Ones, SqrtSIMD( radius ) ), Four_Ones );
+	q.x = MulSIMD( q.x, iradius );
+	q.y = MulSIMD( q.y, iradius );
+	q.z = MulSIMD( q.z, iradius );
+	q.w = MulSIMD( q.w, iradius );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionScale() on four quaternions, with a scale per lane
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionScaleSoA( const FourQuaternions &p, const fltx4 &t, FourQuaternions &q )
+{
+	fltx4 sinom = MaddSIMD( p.z, p.z, MaddSIMD( p.y, p.y, MulSIMD( p.x, p.x ) ) );
+	sinom = MinSIMD( SqrtSIMD( sinom ), Four_Ones );
+
+	fltx4 sinsom = SinSIMD( MulSIMD( ArcSinSIMD( sinom ), t ) );
+	fltx4 scale = DivSIMD( sinsom, AddSIMD( sinom, Four_Epsilons ) );
+	q.x = MulSIMD( p.x, scale );
+	q.y = MulSIMD( p.y, scale );
+	q.z = MulSIMD( p.z, scale );
+
+	// rescale rotation, keeping its sign
+	fltx4 r = SqrtSIMD( MaxSIMD( SubSIMD( Four_Ones, MulSIMD( sinsom, sinsom ) ), Four_Zeros ) );
+	q.w = MaskedAssign( CmpLtSIMD( p.w, Four_Zeros ), NegSIMD( r ), r );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionMult() on four quaternions, q aligned to p first
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionMultSoA( const FourQuaternions &p, const FourQuaternions &q, FourQuaternions &qt )
+{
+	FourQuaternions q2 = q;
+	QuaternionAlignSoA( p, q2, Four_Zeros );
+
+	qt.x = AddSIMD( SubSIMD( MaddSIMD( p.x, q2.w, MulSIMD( p.y, q2.z ) ), MulSIMD( p.z, q2.y ) ), MulSIMD( p.w, q2.x ) );
+	qt.y = AddSIMD( SubSIMD( MaddSIMD( p.y, q2.w, MulSIMD( p.z, q2.x ) ), MulSIMD( p.x, q2.z ) ), MulSIMD( p.w, q2.y ) );
+	qt.z = AddSIMD( SubSIMD( MaddSIMD( p.x, q2.y, MulSIMD( p.z, q2.w ) ), MulSIMD( p.y, q2.x ) ), MulSIMD( p.w, q2.z ) );
+	qt.w = SubSIMD( MulSIMD( p.w, q2.w ), MaddSIMD( p.x, q2.x, MaddSIMD( p.y, q2.y, MulSIMD( p.z, q2.z ) ) ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionSlerpNoAlign() on four quaternions, with a t per lane
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionSlerpNoAlignSoA( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t, FourQuaternions &qt )
+{
+	fltx4 epsilon = ReplicateX4( 0.000001f );
+	fltx4 oneMinusT = SubSIMD( Four_Ones, t );
+
+	fltx4 cosom = p * q;
+	fltx4 notOpposite = CmpGtSIMD( AddSIMD( Four_Ones, cosom ), epsilon );
+	fltx4 useSin = AndSIMD( notOpposite, CmpGtSIMD( SubSIMD( Four_Ones, cosom ), epsilon ) );
+
+	// nearly identical quaternions lerp
+	fltx4 sclp = oneMinusT;
+	fltx4 sclq = t;
+	if ( TestSignSIMD( useSin ) )
+	{
+		fltx4 omega = ArcCosSIMD( MaskedAssign( useSin, cosom, Four_Zeros ) );
+		fltx4 sinom = MaskedAssign( useSin, SinSIMD( omega ), Four_Ones );
+		sclp = MaskedAssign( useSin, DivSIMD( SinSIMD( MulSIMD( oneMinusT, omega ) ), sinom ), sclp );
+		sclq = MaskedAssign( useSin, DivSIMD( SinSIMD( MulSIMD( t, omega ) ), sinom ), sclq );
+	}
+
+	qt.x = MaddSIMD( sclp, p.x, MulSIMD( sclq, q.x ) );
+	qt.y = MaddSIMD( sclp, p.y, MulSIMD( sclq, q.y ) );
+	qt.z = MaddSIMD( sclp, p.z, MulSIMD( sclq, q.z ) );
+	qt.w = MaddSIMD( sclp, p.w, MulSIMD( sclq, q.w ) );
+
+	if ( TestSignSIMD( notOpposite ) != 0xf )
+	{
+		// opposite quaternions, slerp towards a perpendicular one
+		fltx4 halfPi = ReplicateX4( 0.5f * M_PI_F );
+		fltx4 sclpPerp = SinSIMD( MulSIMD( oneMinusT, halfPi ) );
+		fltx4 sclqPerp = SinSIMD( MulSIMD( t, halfPi ) );
+
+		qt.x = MaskedAssign( notOpposite, qt.x, SubSIMD( MulSIMD( sclpPerp, p.x ), MulSIMD( sclqPerp, q.y ) ) );
+		qt.y = MaskedAssign( notOpposite, qt.y, MaddSIMD( sclpPerp, p.y, MulSIMD( sclqPerp, q.x ) ) );
+		qt.z = MaskedAssign( notOpposite, qt.z, SubSIMD( MulSIMD( sclpPerp, p.z ), MulSIMD( sclqPerp, q.w ) ) );
+		qt.w = MaskedAssign( notOpposite, qt.w, q.z );
+	}
+}
+
+struct ALIGN16 BoneBatch_t
+{
+	float	m_flWeight[4];
+	uint32	m_nNoAlign[4];			// ~0 for BONE_FIXED_ALIGNMENT bones
+	int		m_nBone[4];
+} ALIGN16_POST;
+
+//-----------------------------------------------------------------------------
+// Purpose: collect the next four bones of the list. A short batch repeats its
+//			last bone, which just computes and stores the same result twice.
+//-----------------------------------------------------------------------------
+static FORCEINLINE void GetBoneBatch( const CStudioHdr *pStudioHdr, const int *pBones, const float *pWeights, int nBones, int nFirst, BoneBatch_t &batch )
+{
+	for ( int k = 0; k < 4; k++ )
+	{
+		int n = MIN( nFirst + k, nBones - 1 );
+		batch.m_nBone[k] = pBones[n];
+		batch.m_flWeight[k] = pWeights ? pWeights[n] : 0.0f;
+		batch.m_nNoAlign[k] = ( pStudioHdr->boneFlags( pBones[n] ) & BONE_FIXED_ALIGNMENT ) ? 0xffffffff : 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the SlerpBones() blends, for the listed bones with their weights
+//-----------------------------------------------------------------------------
+static void SlerpBonesSIMD( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	int nSeqFlags,
+	const QuaternionAligned q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	const int *pBones,
+	const float *pWeights,
+	int nBones )
+{
+	BoneBatch_t batch;
+	FourQuaternions fq1, fq2, fqt;
+	FourVectors fpos1, fpos2;
+
+	for ( int n = 0; n < nBones; n += 4 )
+	{
+		GetBoneBatch( pStudioHdr, pBones, pWeights, nBones, n, batch );
+		const int *b = batch.m_nBone;
+
+		fq1.LoadAndSwizzle( q1[b[0]], q1[b[1]], q1[b[2]], q1[b[3]] );
+		fq2.LoadAndSwizzle( q2[b[0]], q2[b[1]], q2[b[2]], q2[b[3]] );
+		fpos1.LoadAndSwizzle( pos1[b[0]], pos1[b[1]], pos1[b[2]], pos1[b[3]] );
+		fpos2.LoadAndSwizzle( pos2[b[0]], pos2[b[1]], pos2[b[2]], pos2[b[3]] );
+
+		fltx4 s2 = LoadAlignedSIMD( batch.m_flWeight );
+
+		if ( nSeqFlags & STUDIO_DELTA )
+		{
+			FourQuaternions fqScaled;
+			QuaternionScaleSoA( fq2, s2, fqScaled );
+			if ( nSeqFlags & STUDIO_POST )
+			{
+				// QuaternionMA
+				QuaternionMultSoA( fq1, fqScaled, fqt );
+			}
+			else
+			{
+				// QuaternionSM
+				QuaternionMultSoA( fqScaled, fq1, fqt );
+			}
+			QuaternionNormalizeSoA( fqt );
+
+			fpos2 *= s2;
+			fpos1 += fpos2;
+		}
+		else
+		{
+			fltx4 s1 = SubSIMD( Four_Ones, s2 );
+
+			// QuaternionSlerp( q2, q1, s1 )
+			QuaternionAlignSoA( fq2, fq1, LoadAlignedSIMD( batch.m_nNoAlign ) );
+			QuaternionSlerpNoAlignSoA( fq2, fq1, s1, fqt );
+
+			fpos1 *= s1;
+			fpos2 *= s2;
+			fpos1 += fpos2;
+		}
+
+		fqt.SwizzleAndStore( q1[b[0]], q1[b[1]], q1[b[2]], q1[b[3]] );
+		SwizzleAndStore( fpos1, pos1[b[0]], pos1[b[1]], pos1[b[2]], pos1[b[3]] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the BlendBones() blend, for the listed bones
+//-----------------------------------------------------------------------------
+static void BlendBonesSIMD( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	const Quaternion q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	const int *pBones,
+	int nBones,
+	float s )
+{
+	BoneBatch_t batch;
+	FourQuaternions fq1, fq2, fqt;
+	FourVectors fpos1, fpos2;
+
+	fltx4 s2 = ReplicateX4( s );
+	fltx4 s1 = SubSIMD( Four_Ones, s2 );
+
+	for ( int n = 0; n < nBones; n += 4 )
+	{
+		GetBoneBatch( pStudioHdr, pBones, NULL, nBones, n, batch );
+		const int *b = batch.m_nBone;
+
+		fq1.LoadAndSwizzle( q1[b[0]], q1[b[1]], q1[b[2]], q1[b[3]] );
+		fq2.LoadAndSwizzle( q2[b[0]], q2[b[1]], q2[b[2]], q2[b[3]] );
+		fpos1.LoadAndSwizzle( pos1[b[0]], pos1[b[1]], pos1[b[2]], pos1[b[3]] );
+		fpos2.LoadAndSwizzle( pos2[b[0]], pos2[b[1]], pos2[b[2]], pos2[b[3]] );
+
+		// QuaternionBlend( q2, q1, s1 )
+		QuaternionAlignSoA( fq2, fq1, LoadAlignedSIMD( batch.m_nNoAlign ) );
+		fqt.x = MaddSIMD( s2, fq2.x, MulSIMD( s1, fq1.x ) );
+		fqt.y = MaddSIMD( s2, fq2.y, MulSIMD( s1, fq1.y ) );
+		fqt.z = MaddSIMD( s2, fq2.z, MulSIMD( s1, fq1.z ) );
+		fqt.w = MaddSIMD( s2, fq2.w, MulSIMD( s1, fq1.w ) );
+		QuaternionNormalizeSoA( fqt );
+
+		fpos1 *= s1;
+		fpos2 *= s2;
+		fpos1 += fpos2;
+
+		fqt.SwizzleAndStore( q1[b[0]], q1[b[1]], q1[b[2]], q1[b[3]] );
+		SwizzleAndStore( fpos1, pos1[b[0]], pos1[b[1]], pos1[b[2]], pos1[b[3]] );
+	}
+}
+
+
 
 
 //-----------------------------------------------------------------------------
@@ -1437,6 +1728,25 @@ void SlerpBones(
 		}
 	}
 
+	if ( anim_simd_blend.GetBool() )
+	{
+		// list the bones that blend in, packing their weights to match
+		int *pBones = (int*)stackalloc( nBoneCount * sizeof(int) );
+		int nBones = 0;
+		for ( i = 0; i < nBoneCount; i++ )
+		{
+			if ( pS2[i] > 0.0f )
+			{
+				pBones[nBones] = i;
+				pS2[nBones] = pS2[i];
+				nBones++;
+			}
+		}
+
+		SlerpBonesSIMD( pStudioHdr, q1, pos1, seqdesc.flags, q2, pos2, pBones, pS2, nBones );
+		return;
+	}
+
 	float s1, s2;
 	if ( seqdesc.flags & STUDIO_DELTA )
 	{
@@ -1592,6 +1902,29 @@ void BlendBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
+	if ( anim_simd_blend.GetBool() )
+	{
+		int *pBones = (int*)stackalloc( pStudioHdr->numbones() * sizeof(int) );
+		int nBones = 0;
+		for (i = 0; i < pStudioHdr->numbones(); i++)
+		{
+			// skip unused bones
+			if (!(pStudioHdr->boneFlags(i) & boneMask))
+			{
+				continue;
+			}
+
+			j = pSeqGroup ? pSeqGroup->boneMap[i] : i;
+			if (j >= 0 && seqdesc.weight( j ) > 0.0)
+			{
+				pBones[nBones++] = i;
+			}
+		}
+
+		BlendBonesSIMD( pStudioHdr, q1, pos1, q2, pos2, pBones, nBones, s2 );
+		return;
+	}
+
 	for (i = 0; i < pStudioHdr->numbones(); i++)
 	{
 		// skip unused bones
@@ -0,0 +1,999 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Work distribution across several tool processes without VMPI.
+//			See localdist.h for an overview.
+//
+//			Wire format: every message is an int length (covering the type
+//			byte and the payload), a type byte and the payload. Unit results
+//			are always sent as (int start, int count) followed by count
+//			(int length, bytes) pairs, which is also the layout the master
+//			uses to store and merge them.
+//
+//=============================================================================//
+
+#include <winsock2.h>
+#include <windows.h>
+#include "cmdlib.h"
+#define NO_THREAD_NAMES
+#include "threads.h"
+#include "pacifier.h"
+#include "localdist.h"
+#include "tier0/platform.h"
+#include "tier1/strtools.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+
+
+#define LOCALDIST_VERSION			1
+
+// How long the master waits for a worker to show up before doing the work itself.
+#define LOCALDIST_WORKER_TIMEOUT	30.0
+
+// How long a worker keeps trying to reach the master.
+#define LOCALDIST_CONNECT_TIMEOUT	30.0
+
+#define LOCALDIST_MAX_STAGE_NAME	64
+
+// Master hands out at most this many units at a time.
+#define LOCALDIST_MAX_RANGE			1024
+
+enum ELocalDistMsg
+{
+	LD_MSG_HELLO=0,			// worker -> master: version, thread count, map name
+	LD_MSG_STAGE_READY,		// worker -> master: unit count, stage name
+	LD_MSG_WORK_RANGE,		// master -> worker: first unit, unit count
+	LD_MSG_RESULTS,			// worker -> master: unit results
+	LD_MSG_STAGE_DONE,		// master -> worker: shared flag and merged results
+	LD_MSG_QUIT				// master -> worker
+};
+
+enum ELocalDistMode
+{
+	k_eLocalDist_None=0,
+	k_eLocalDist_Master,
+	k_eLocalDist_Worker
+};
+
+
+// ------------------------------------------------------------------------------------------ //
+// Shared state.
+// ------------------------------------------------------------------------------------------ //
+
+static ELocalDistMode g_eLocalDistMode = k_eLocalDist_None;
+static int g_nLocalDistSpawnWorkers = 0;
+static int g_nLocalDistPort = LOCALDIST_DEFAULT_PORT;
+static bool g_bLocalDistListenOnLAN = false;
+static char g_szLocalDistMasterAddr[256];
+static char g_szLocalDistMapName[MAX_PATH];
+
+
+class CLocalDistWorker
+{
+public:
+	SOCKET m_Socket;
+	int m_nThreads;
+	char m_szName[64];
+	char m_szStage[LOCALDIST_MAX_STAGE_NAME];	// Stage the worker is waiting in, empty if none.
+	int m_iRangeStart;
+	int m_nRangeCount;							// 0 if the worker has no range outstanding.
+};
+
+class CLocalDistRange
+{
+public:
+	int m_iStart;
+	int m_nCount;
+	CUtlBuffer m_Data;
+};
+
+class CLocalDistStage
+{
+public:
+	char m_szName[LOCALDIST_MAX_STAGE_NAME];
+	bool m_bShareResults;
+	CUtlBuffer m_Merged;
+};
+
+// Master.
+static SOCKET g_ListenSocket = INVALID_SOCKET;
+static CUtlVector<CLocalDistWorker*> g_LocalDistWorkers;
+static CUtlVector<HANDLE> g_LocalDistProcesses;
+static CUtlVector<CLocalDistStage*> g_LocalDistCompletedStages;
+
+// Worker.
+static SOCKET g_MasterSocket = INVALID_SOCKET;
+
+
+// ------------------------------------------------------------------------------------------ //
+// Socket helpers.
+// ------------------------------------------------------------------------------------------ //
+
+static bool LocalDist_SendAll( SOCKET s, const void *pData, int nBytes )
+{
+	const char *pCur = (const char*)pData;
+	while ( nBytes > 0 )
+	{
+		int nSent = send( s, pCur, nBytes, 0 );
+		if ( nSent == SOCKET_ERROR || nSent == 0 )
+			return false;
+
+		pCur += nSent;
+		nBytes -= nSent;
+	}
+	return true;
+}
+
+static bool LocalDist_RecvAll( SOCKET s, void *pData, int nBytes )
+{
+	char *pCur = (char*)pData;
+	while ( nBytes > 0 )
+	{
+		int nRecv = recv( s, pCur, nBytes, 0 );
+		if ( nRecv == SOCKET_ERROR || nRecv == 0 )
+			return false;
+
+		pCur += nRecv;
+		nBytes -= nRecv;
+	}
+	return true;
+}
+
+static bool LocalDist_SendMsg( SOCKET s, int type, const void *pPayload, int nPayloadBytes )
+{
+	char header[5];
+	*(int*)header = nPayloadBytes + 1;
+	header[4] = (char)type;
+
+	if ( !LocalDist_SendAll( s, header, sizeof( header ) ) )
+		return false;
+
+	return nPayloadBytes == 0 || LocalDist_SendAll( s, pPayload, nPayloadBytes );
+}
+
+static bool LocalDist_SendMsg( SOCKET s, int type, const CUtlBuffer &payload )
+{
+	return LocalDist_SendMsg( s, type, payload.Base(), payload.TellMaxPut() );
+}
+
+// Reads one whole message. The payload ends up in buf, ready to be read from the start.
+static bool LocalDist_RecvMsg( SOCKET s, int &type, CUtlBuffer &buf )
+{
+	int nLen;
+	if ( !LocalDist_RecvAll( s, &nLen, sizeof( nLen ) ) || nLen < 1 )
+		return false;
+
+	unsigned char cType;
+	if ( !LocalDist_RecvAll( s, &cType, 1 ) )
+		return false;
+	type = cType;
+
+	buf.Purge();
+	int nPayload = nLen - 1;
+	if ( nPayload > 0 )
+	{
+		buf.EnsureCapacity( nPayload );
+		if ( !LocalDist_RecvAll( s, buf.Base(), nPayload ) )
+			return false;
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nPayload );
+	}
+	buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+	return true;
+}
+
+static void LocalDist_InitSockets()
+{
+	WSADATA wsaData;
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) != 0 )
+		Error( "LocalDist: WSAStartup failed." );
+}
+
+
+// ------------------------------------------------------------------------------------------ //
+// Processing a range of work units with the tool threads.
+// ------------------------------------------------------------------------------------------ //
+
+class CLocalDistThreadContext
+{
+public:
+	int m_iStart;
+	LocalDistProcessFn m_pProcess;
+	CUtlBuffer *m_pResults;
+};
+
+static void LocalDist_ProcessThreadFn( int iThread, void *pUserData )
+{
+	CLocalDistThreadContext *pContext = (CLocalDistThreadContext*)pUserData;
+
+	int iWork;
+	while ( ( iWork = GetThreadWork() ) != -1 )
+	{
+		pContext->m_pProcess( iThread, pContext->m_iStart + iWork, pContext->m_pResults[iWork] );
+	}
+}
+
+// Processes [iStart, iStart+nCount) and appends the results to out in the wire format.
+static void LocalDist_ProcessRange( int iStart, int nCount, LocalDistProcessFn pProcess, CUtlBuffer &out )
+{
+	CLocalDistThreadContext context;
+	context.m_iStart = iStart;
+	context.m_pProcess = pProcess;
+	context.m_pResults = new CUtlBuffer[nCount];
+
+	RunThreadsOn( nCount, false, LocalDist_ProcessThreadFn, &context );
+
+	out.PutInt( iStart );
+	out.PutInt( nCount );
+	for ( int i=0; i < nCount; i++ )
+	{
+		CUtlBuffer &unit = context.m_pResults[i];
+		out.PutInt( unit.TellMaxPut() );
+		out.Put( unit.Base(), unit.TellMaxPut() );
+	}
+
+	delete [] context.m_pResults;
+}
+
+// Walks a run of (int length, bytes) unit results and hands each to pReceive.
+static void LocalDist_ReceiveUnits( CUtlBuffer &buf, int iStart, int nCount, LocalDistReceiveFn pReceive )
+{
+	for ( int i=0; i < nCount; i++ )
+	{
+		int nLen = buf.GetInt();
+		if ( !buf.IsValid() || nLen < 0 || nLen > buf.GetBytesRemaining() )
+			Error( "LocalDist: corrupt results for work unit %d.", iStart + i );
+
+		CUtlBuffer unit( buf.PeekGet(), nLen, CUtlBuffer::READ_ONLY );
+		pReceive( iStart + i, unit );
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, nLen );
+	}
+}
+
+
+// ------------------------------------------------------------------------------------------ //
+// Command line.
+// ------------------------------------------------------------------------------------------ //
+
+bool LocalDist_ParseArg( int argc, char **argv, int &i )
+{
+	if ( !Q_stricmp( argv[i], "-dist" ) )
+	{
+		if ( i+1 >= argc )
+			Error( "Expected a worker count after '-dist'." );
+
+		g_eLocalDistMode = k_eLocalDist_Master;
+		g_nLocalDistSpawnWorkers = clamp( atoi( argv[i+1] ), 0, 64 );
+		++i;
+		return true;
+	}
+	else if ( !Q_stricmp( argv[i], "-dist_port" ) )
+	{
+		if ( i+1 >= argc )
+			Error( "Expected a port after '-dist_port'." );
+
+		g_nLocalDistPort = atoi( argv[i+1] );
+		++i;
+		return true;
+	}
+	else if ( !Q_stricmp( argv[i], "-dist_listen" ) )
+	{
+		g_eLocalDistMode = k_eLocalDist_Master;
+		g_bLocalDistListenOnLAN = true;
+		return true;
+	}
+	else if ( !Q_stricmp( argv[i], "-dist_worker" ) )
+	{
+		if ( i+1 >= argc )
+			Error( "Expected <host:port> after '-dist_worker'." );
+
+		g_eLocalDistMode = k_eLocalDist_Worker;
+		Q_strncpy( g_szLocalDistMasterAddr, argv[i+1], sizeof( g_szLocalDistMasterAddr ) );
+		++i;
+		return true;
+	}
+
+	return false;
+}
+
+
+void LocalDist_PrintUsage()
+{
+	Warning(
+		"  -dist <N>       : Spawn N local worker processes and distribute the heavy\n"
+		"                    stages across them (doesn't need VMPI).\n"
+		"  -dist_listen    : Also accept workers from other machines on the LAN.\n"
+		"  -dist_port <n>  : Port the -dist master listens on (default %d).\n"
+		"  -dist_worker <host:port> : Run as a worker for a -dist master. The map\n"
+		"                    and game files must be at the same paths as on the master.\n",
+		LOCALDIST_DEFAULT_PORT );
+}
+
+
+bool LocalDist_IsActive()
+{
+	return g_eLocalDistMode != k_eLocalDist_None;
+}
+
+bool LocalDist_IsMaster()
+{
+	return g_eLocalDistMode == k_eLocalDist_Master;
+}
+
+bool LocalDist_IsWorker()
+{
+	return g_eLocalDistMode == k_eLocalDist_Worker;
+}
+
+
+// ------------------------------------------------------------------------------------------ //
+// Master.
+// ------------------------------------------------------------------------------------------ //
+
+static void LocalDist_OpenListenSocket()
+{
+	g_ListenSocket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	if ( g_ListenSocket == INVALID_SOCKET )
+		Error( "LocalDist: can't create listen socket." );
+
+	// If the port is taken (another compile on the same box), walk up a few ports.
+	// Local workers are told the port we end up on; LAN workers need -dist_port to be free.
+	int iTry;
+	for ( iTry=0; iTry < 16; iTry++ )
+	{
+		sockaddr_in addr;
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( (unsigned short)( g_nLocalDistPort + iTry ) );
+		addr.sin_addr.s_addr = htonl( g_bLocalDistListenOnLAN ? INADDR_ANY : INADDR_LOOPBACK );
+
+		if ( bind( g_ListenSocket, (sockaddr*)&addr, sizeof( addr ) ) == 0 )
+			break;
+
+		if ( g_bLocalDistListenOnLAN )
+			Error( "LocalDist: can't bind to port %d.", g_nLocalDistPort );
+	}
+
+	if ( iTry == 16 )
+		Error( "LocalDist: can't bind to any port from %d to %d.", g_nLocalDistPort, g_nLocalDistPort + 15 );
+
+	g_nLocalDistPort += iTry;
+
+	if ( listen( g_ListenSocket, SOMAXCONN ) != 0 )
+		Error( "LocalDist: listen() failed on port %d.", g_nLocalDistPort );
+
+	Msg( "LocalDist: master listening on port %d%s.\n", g_nLocalDistPort, g_bLocalDistListenOnLAN ? " (LAN)" : "" );
+}
+
+
+static void LocalDist_AppendArg( CUtlVector<char> &cmdLine, const char *pArg )
+{
+	if ( cmdLine.Count() )
+		cmdLine.AddToTail( ' ' );
+
+	cmdLine.AddToTail( '"' );
+	cmdLine.AddMultipleToTail( V_strlen( pArg ), pArg );
+	cmdLine.AddToTail( '"' );
+}
+
+
+static void LocalDist_SpawnWorkers( int argc, char **argv )
+{
+	if ( g_nLocalDistSpawnWorkers <= 0 )
+		return;
+
+	char szExe[MAX_PATH];
+	if ( !GetModuleFileName( NULL, szExe, sizeof( szExe ) ) )
+		Error( "LocalDist: GetModuleFileName failed." );
+
+	// Workers share the machine with each other, so split the cores between them
+	// unless -threads was given explicitly.
+	bool bHasThreads = false;
+	for ( int i=1; i < argc; i++ )
+	{
+		if ( !Q_stricmp( argv[i], "-threads" ) )
+			bHasThreads = true;
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	int nWorkerThreads = max( 1, (int)info.dwNumberOfProcessors / g_nLocalDistSpawnWorkers );
+
+	char szAddr[64], szThreads[16];
+	Q_snprintf( szAddr, sizeof( szAddr ), "127.0.0.1:%d", g_nLocalDistPort );
+	Q_snprintf( szThreads, sizeof( szThreads ), "%d", nWorkerThreads );
+
+	// Same command line as ours minus the master-only options. The worker options go right
+	// after the exe since some tools expect the map to be the last argument.
+	CUtlVector<char> cmdLine;
+	LocalDist_AppendArg( cmdLine, szExe );
+	LocalDist_AppendArg( cmdLine, "-dist_worker" );
+	LocalDist_AppendArg( cmdLine, szAddr );
+	if ( !bHasThreads )
+	{
+		LocalDist_AppendArg( cmdLine, "-threads" );
+		LocalDist_AppendArg( cmdLine, szThreads );
+	}
+
+	for ( int i=1; i < argc; i++ )
+	{
+		if ( !Q_stricmp( argv[i], "-dist" ) || !Q_stricmp( argv[i], "-dist_port" ) )
+		{
+			++i;
+			continue;
+		}
+
+		if ( !Q_stricmp( argv[i], "-dist_listen" ) )
+			continue;
+
+		LocalDist_AppendArg( cmdLine, argv[i] );
+	}
+	cmdLine.AddToTail( 0 );
+
+	for ( int iWorker=0; iWorker < g_nLocalDistSpawnWorkers; iWorker++ )
+	{
+		STARTUPINFO si;
+		memset( &si, 0, sizeof( si ) );
+		si.cb = sizeof( si );
+
+		PROCESS_INFORMATION pi;
+		memset( &pi, 0, sizeof( pi ) );
+
+		// CreateProcess may write to the command line, so give each one its own copy.
+		CUtlVector<char> cmdLineCopy;
+		cmdLineCopy.CopyArray( cmdLine.Base(), cmdLine.Count() );
+
+		DWORD dwFlags = CREATE_NO_WINDOW | ( g_bLowPriorityThreads ? IDLE_PRIORITY_CLASS : 0 );
+		if ( !CreateProcess( szExe, cmdLineCopy.Base(), NULL, NULL, FALSE, dwFlags, NULL, NULL, &si, &pi ) )
+		{
+			Warning( "LocalDist: failed to spawn worker %d (error %d).\n", iWorker, (int)GetLastError() );
+			continue;
+		}
+
+		CloseHandle( pi.hThread );
+		g_LocalDistProcesses.AddToTail( pi.hProcess );
+	}
+
+	Msg( "LocalDist: spawned %d local workers (%d threads each).\n", g_LocalDistProcesses.Count(), bHasThreads ? numthreads : nWorkerThreads );
+}
+
+
+static bool LocalDist_AnySpawnedWorkerAlive()
+{
+	for ( int i=0; i < g_LocalDistProcesses.Count(); i++ )
+	{
+		if ( WaitForSingleObject( g_LocalDistProcesses[i], 0 ) == WAIT_TIMEOUT )
+			return true;
+	}
+	return false;
+}
+
+
+static void LocalDist_AcceptWorker()
+{
+	sockaddr_in addr;
+	int addrLen = sizeof( addr );
+	SOCKET s = accept( g_ListenSocket, (sockaddr*)&addr, &addrLen );
+	if ( s == INVALID_SOCKET )
+		return;
+
+	int type;
+	CUtlBuffer buf;
+	if ( !LocalDist_RecvMsg( s, type, buf ) || type != LD_MSG_HELLO )
+	{
+		closesocket( s );
+		return;
+	}
+
+	int version = buf.GetInt();
+	int nThreads = buf.GetInt();
+	char szMapName[MAX_PATH];
+	buf.GetString( szMapName );
+
+	const char *pFrom = inet_ntoa( addr.sin_addr );
+	if ( version != LOCALDIST_VERSION || Q_stricmp( szMapName, g_szLocalDistMapName ) )
+	{
+		Warning( "LocalDist: rejected worker from %s (version %d, map '%s').\n", pFrom, version, szMapName );
+		closesocket( s );
+		return;
+	}
+
+	CLocalDistWorker *pWorker = new CLocalDistWorker;
+	pWorker->m_Socket = s;
+	pWorker->m_nThreads = max( nThreads, 1 );
+	pWorker->m_szStage[0] = 0;
+	pWorker->m_iRangeStart = 0;
+	pWorker->m_nRangeCount = 0;
+	Q_snprintf( pWorker->m_szName, sizeof( pWorker->m_szName ), "%s:%d", pFrom, (int)ntohs( addr.sin_port ) );
+	g_LocalDistWorkers.AddToTail( pWorker );
+}
+
+
+static CLocalDistStage* LocalDist_FindCompletedStage( const char *pName )
+{
+	for ( int i=0; i < g_LocalDistCompletedStages.Count(); i++ )
+	{
+		if ( !Q_stricmp( g_LocalDistCompletedStages[i]->m_szName, pName ) )
+			return g_LocalDistCompletedStages[i];
+	}
+	return NULL;
+}
+
+
+static void LocalDist_SendStageDone( CLocalDistWorker *pWorker, CLocalDistStage *pStage )
+{
+	CUtlBuffer payload;
+	payload.PutInt( pStage->m_bShareResults );
+	if ( pStage->m_bShareResults )
+		payload.Put( pStage->m_Merged.Base(), pStage->m_Merged.TellMaxPut() );
+
+	LocalDist_SendMsg( pWorker->m_Socket, LD_MSG_STAGE_DONE, payload );
+	pWorker->m_szStage[0] = 0;
+}
+
+
+// State for the stage the master is currently running.
+class CLocalDistMasterStage
+{
+public:
+	const char *m_pName;
+	int m_nWorkUnits;
+	int m_iNextUnit;					// First unit that hasn't been handed out yet.
+	int m_nUnitsReceived;
+	CUtlVector<CLocalDistRange*> m_Returned;	// Ranges dropped by disconnected workers.
+	CUtlVector<CLocalDistRange*> m_Done;
+};
+
+
+static bool LocalDist_GetNextRange( CLocalDistMasterStage &stage, int nWorkerThreads, int &iStart, int &nCount )
+{
+	if ( stage.m_Returned.Count() )
+	{
+		CLocalDistRange *pRange = stage.m_Returned.Tail();
+		stage.m_Returned.Remove( stage.m_Returned.Count() - 1 );
+		iStart = pRange->m_iStart;
+		nCount = pRange->m_nCount;
+		delete pRange;
+		return true;
+	}
+
+	int nRemaining = stage.m_nWorkUnits - stage.m_iNextUnit;
+	if ( nRemaining <= 0 )
+		return false;
+
+	// Big ranges early on keep the message overhead down, small ranges towards the end
+	// keep everyone busy until the last unit is in.
+	int nWorkers = max( g_LocalDistWorkers.Count(), 1 );
+	nCount = nRemaining / ( nWorkers * 4 );
+	nCount = clamp( nCount, nWorkerThreads, LOCALDIST_MAX_RANGE );
+	nCount = min( nCount, nRemaining );
+
+	iStart = stage.m_iNextUnit;
+	stage.m_iNextUnit += nCount;
+	return true;
+}
+
+
+static void LocalDist_GiveWork( CLocalDistMasterStage &stage, CLocalDistWorker *pWorker )
+{
+	int iStart, nCount;
+	if ( !LocalDist_GetNextRange( stage, pWorker->m_nThreads, iStart, nCount ) )
+		return;
+
+	pWorker->m_iRangeStart = iStart;
+	pWorker->m_nRangeCount = nCount;
+
+	int range[2] = { iStart, nCount };
+	LocalDist_SendMsg( pWorker->m_Socket, LD_MSG_WORK_RANGE, range, sizeof( range ) );
+}
+
+
+static void LocalDist_DropWorker( CLocalDistMasterStage *pStage, int iWorker )
+{
+	CLocalDistWorker *pWorker = g_LocalDistWorkers[iWorker];
+	Warning( "\nLocalDist: lost worker %s.\n", pWorker->m_szName );
+
+	if ( pStage && pWorker->m_nRangeCount )
+	{
+		CLocalDistRange *pRange = new CLocalDistRange;
+		pRange->m_iStart = pWorker->m_iRangeStart;
+		pRange->m_nCount = pWorker->m_nRangeCount;
+		pStage->m_Returned.AddToTail( pRange );
+	}
+
+	closesocket( pWorker->m_Socket );
+	delete pWorker;
+	g_LocalDistWorkers.Remove( iWorker );
+}
+
+
+// Handles one message from a worker. Returns false if the worker should be dropped.
+static bool LocalDist_HandleWorkerMsg( CLocalDistMasterStage &stage, CLocalDistWorker *pWorker )
+{
+	int type;
+	CUtlBuffer buf;
+	if ( !LocalDist_RecvMsg( pWorker->m_Socket, type, buf ) )
+		return false;
+
+	if ( type == LD_MSG_STAGE_READY )
+	{
+		int nWorkUnits = buf.GetInt();
+		buf.GetString( pWorker->m_szStage );
+
+		// Workers that connected late (or finished a stage quickly) catch up on finished stages.
+		CLocalDistStage *pCompleted = LocalDist_FindCompletedStage( pWorker->m_szStage );
+		if ( pCompleted )
+		{
+			LocalDist_SendStageDone( pWorker, pCompleted );
+		}
+		else if ( !Q_stricmp( pWorker->m_szStage, stage.m_pName ) )
+		{
+			if ( nWorkUnits != stage.m_nWorkUnits )
+			{
+				Warning( "\nLocalDist: worker %s has %d work units in %s, expected %d.\n", pWorker->m_szName, nWorkUnits, stage.m_pName, stage.m_nWorkUnits );
+				return false;
+			}
+
+			LocalDist_GiveWork( stage, pWorker );
+		}
+
+		// Otherwise the worker is already waiting in a later stage. We'll get to it.
+		return true;
+	}
+	else if ( type == LD_MSG_RESULTS )
+	{
+		CLocalDistRange *pRange = new CLocalDistRange;
+		pRange->m_iStart = buf.GetInt();
+		pRange->m_nCount = buf.GetInt();
+
+		if ( pRange->m_iStart != pWorker->m_iRangeStart || pRange->m_nCount != pWorker->m_nRangeCount )
+		{
+			delete pRange;
+			Warning( "\nLocalDist: worker %s sent results for a range it wasn't given.\n", pWorker->m_szName );
+			return false;
+		}
+
+		pRange->m_Data.Put( buf.Base(), buf.TellMaxPut() );
+		stage.m_Done.AddToTail( pRange );
+		stage.m_nUnitsReceived += pRange->m_nCount;
+		pWorker->m_nRangeCount = 0;
+
+		UpdatePacifier( (float)stage.m_nUnitsReceived / stage.m_nWorkUnits );
+
+		LocalDist_GiveWork( stage, pWorker );
+		return true;
+	}
+
+	Warning( "\nLocalDist: unexpected message %d from worker %s.\n", type, pWorker->m_szName );
+	return false;
+}
+
+
+static int LocalDist_SortRanges( CLocalDistRange * const *ppA, CLocalDistRange * const *ppB )
+{
+	return (*ppA)->m_iStart - (*ppB)->m_iStart;
+}
+
+
+static double LocalDist_MasterDistributeWork(
+	const char *pStageName,
+	int nWorkUnits,
+	LocalDistProcessFn pProcess,
+	LocalDistReceiveFn pReceive,
+	bool bShareResults )
+{
+	double flStart = Plat_FloatTime();
+
+	CLocalDistMasterStage stage;
+	stage.m_pName = pStageName;
+	stage.m_nWorkUnits = nWorkUnits;
+	stage.m_iNextUnit = 0;
+	stage.m_nUnitsReceived = 0;
+
+	Msg( "%-20s ", pStageName );
+	StartPacifier( "" );
+
+	// Workers that already asked for this stage while we were busy get their first range now.
+	for ( int i=0; i < g_LocalDistWorkers.Count(); i++ )
+	{
+		if ( !Q_stricmp( g_LocalDistWorkers[i]->m_szStage, pStageName ) )
+			LocalDist_GiveWork( stage, g_LocalDistWorkers[i] );
+	}
+
+	double flLastWorkerSeen = Plat_FloatTime();
+	while ( stage.m_nUnitsReceived < nWorkUnits )
+	{
+		fd_set readSet;
+		FD_ZERO( &readSet );
+		FD_SET( g_ListenSocket, &readSet );
+		for ( int i=0; i < g_LocalDistWorkers.Count(); i++ )
+			FD_SET( g_LocalDistWorkers[i]->m_Socket, &readSet );
+
+		timeval timeout = { 0, 100 * 1000 };
+		int nReady = select( 0, &readSet, NULL, NULL, &timeout );
+		if ( nReady == SOCKET_ERROR )
+			Error( "LocalDist: select() failed (%d).", WSAGetLastError() );
+
+		if ( FD_ISSET( g_ListenSocket, &readSet ) )
+			LocalDist_AcceptWorker();
+
+		for ( int i=g_LocalDistWorkers.Count()-1; i >= 0; i-- )
+		{
+			// Newly accepted workers weren't in the set.
+			if ( !FD_ISSET( g_LocalDistWorkers[i]->m_Socket, &readSet ) )
+				continue;
+
+			if ( !LocalDist_HandleWorkerMsg( stage, g_LocalDistWorkers[i] ) )
+				LocalDist_DropWorker( &stage, i );
+		}
+
+		if ( g_LocalDistWorkers.Count() )
+		{
+			flLastWorkerSeen = Plat_FloatTime();
+			continue;
+		}
+
+		// Nobody to hand the work to. Give the spawned workers time to load the map, and
+		// LAN workers time to connect, then do the rest ourselves.
+		if ( LocalDist_AnySpawnedWorkerAlive() || Plat_FloatTime() - flLastWorkerSeen < LOCALDIST_WORKER_TIMEOUT )
+			continue;
+
+		Warning( "\nLocalDist: no workers, processing the remaining %d units of %s locally.\n", nWorkUnits - stage.m_nUnitsReceived, pStageName );
+		SuppressPacifier( true );
+
+		int iStart, nCount;
+		while ( LocalDist_GetNextRange( stage, numthreads, iStart, nCount ) )
+		{
+			CLocalDistRange *pRange = new CLocalDistRange;
+			pRange->m_iStart = iStart;
+			pRange->m_nCount = nCount;
+			LocalDist_ProcessRange( iStart, nCount, pProcess, pRange->m_Data );
+			stage.m_Done.AddToTail( pRange );
+			stage.m_nUnitsReceived += nCount;
+		}
+
+		SuppressPacifier( false );
+	}
+
+	// Merge in work unit order so the output doesn't depend on who did what.
+	stage.m_Done.Sort( LocalDist_SortRanges );
+
+	CLocalDistStage *pCompleted = new CLocalDistStage;
+	Q_strncpy( pCompleted->m_szName, pStageName, sizeof( pCompleted->m_szName ) );
+	pCompleted->m_bShareResults = bShareResults;
+
+	for ( int i=0; i < stage.m_Done.Count(); i++ )
+	{
+		CLocalDistRange *pRange = stage.m_Done[i];
+
+		// Every stored range starts with its (start, count) header.
+		pRange->m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, 2 * sizeof( int ) );
+		if ( bShareResults )
+			pCompleted->m_Merged.Put( pRange->m_Data.PeekGet(), pRange->m_Data.GetBytesRemaining() );
+
+		LocalDist_ReceiveUnits( pRange->m_Data, pRange->m_iStart, pRange->m_nCount, pReceive );
+		delete pRange;
+	}
+	stage.m_Done.Purge();
+
+	g_LocalDistCompletedStages.AddToTail( pCompleted );
+
+	for ( int i=0; i < g_LocalDistWorkers.Count(); i++ )
+	{
+		if ( !Q_stricmp( g_LocalDistWorkers[i]->m_szStage, pStageName ) )
+			LocalDist_SendStageDone( g_LocalDistWorkers[i], pCompleted );
+	}
+
+	double flElapsed = Plat_FloatTime() - flStart;
+	EndPacifier( false );
+	Msg( " (%d)\n", (int)flElapsed );
+	return flElapsed;
+}
+
+
+// ------------------------------------------------------------------------------------------ //
+// Worker.
+// ------------------------------------------------------------------------------------------ //
+
+static void LocalDist_ConnectToMaster()
+{
+	char szHost[256];
+	Q_strncpy( szHost, g_szLocalDistMasterAddr, sizeof( szHost ) );
+
+	int nPort = LOCALDIST_DEFAULT_PORT;
+	char *pColon = strrchr( szHost, ':' );
+	if ( pColon )
+	{
+		*pColon = 0;
+		nPort = atoi( pColon + 1 );
+	}
+
+	sockaddr_in addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( (unsigned short)nPort );
+	addr.sin_addr.s_addr = inet_addr( szHost );
+	if ( addr.sin_addr.s_addr == INADDR_NONE )
+	{
+		hostent *pHost = gethostbyname( szHost );
+		if ( !pHost )
+			Error( "LocalDist: can't resolve master '%s'.", szHost );
+		memcpy( &addr.sin_addr, pHost->h_addr_list[0], sizeof( addr.sin_addr ) );
+	}
+
+	double flStart = Plat_FloatTime();
+	while ( 1 )
+	{
+		g_MasterSocket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+		if ( g_MasterSocket == INVALID_SOCKET )
+			Error( "LocalDist: can't create socket." );
+
+		if ( connect( g_MasterSocket, (sockaddr*)&addr, sizeof( addr ) ) == 0 )
+			break;
+
+		closesocket( g_MasterSocket );
+		g_MasterSocket = INVALID_SOCKET;
+
+		if ( Plat_FloatTime() - flStart > LOCALDIST_CONNECT_TIMEOUT )
+			Error( "LocalDist: can't connect to master at %s.", g_szLocalDistMasterAddr );
+
+		Sleep( 250 );
+	}
+
+	CUtlBuffer hello;
+	hello.PutInt( LOCALDIST_VERSION );
+	hello.PutInt( numthreads );
+	hello.PutString( g_szLocalDistMapName );
+	if ( !LocalDist_SendMsg( g_MasterSocket, LD_MSG_HELLO, hello ) )
+		Error( "LocalDist: lost connection to master." );
+
+	Msg( "LocalDist: connected to master at %s.\n", g_szLocalDistMasterAddr );
+}
+
+
+static void LocalDist_WorkerLostMaster()
+{
+	// The master either finished or died. Either way there's nothing left for us to do.
+	Warning( "LocalDist: lost connection to master.\n" );
+	CmdLib_Exit( 1 );
+}
+
+
+static double LocalDist_WorkerDistributeWork(
+	const char *pStageName,
+	int nWorkUnits,
+	LocalDistProcessFn pProcess,
+	LocalDistReceiveFn pReceive )
+{
+	double flStart = Plat_FloatTime();
+
+	CUtlBuffer ready;
+	ready.PutInt( nWorkUnits );
+	ready.PutString( pStageName );
+	if ( !LocalDist_SendMsg( g_MasterSocket, LD_MSG_STAGE_READY, ready ) )
+		LocalDist_WorkerLostMaster();
+
+	int nUnitsProcessed = 0;
+	while ( 1 )
+	{
+		int type;
+		CUtlBuffer buf;
+		if ( !LocalDist_RecvMsg( g_MasterSocket, type, buf ) )
+			LocalDist_WorkerLostMaster();
+
+		if ( type == LD_MSG_WORK_RANGE )
+		{
+			int iStart = buf.GetInt();
+			int nCount = buf.GetInt();
+
+			CUtlBuffer results;
+			LocalDist_ProcessRange( iStart, nCount, pProcess, results );
+			nUnitsProcessed += nCount;
+
+			if ( !LocalDist_SendMsg( g_MasterSocket, LD_MSG_RESULTS, results ) )
+				LocalDist_WorkerLostMaster();
+		}
+		else if ( type == LD_MSG_STAGE_DONE )
+		{
+			if ( buf.GetInt() )
+				LocalDist_ReceiveUnits( buf, 0, nWorkUnits, pReceive );
+			break;
+		}
+		else if ( type == LD_MSG_QUIT )
+		{
+			CmdLib_Exit( 0 );
+		}
+		else
+		{
+			Error( "LocalDist: unexpected message %d from master.", type );
+		}
+	}
+
+	double flElapsed = Plat_FloatTime() - flStart;
+	Msg( "LocalDist: %s processed %d of %d units (%.1f seconds).\n", pStageName, nUnitsProcessed, nWorkUnits, flElapsed );
+	return flElapsed;
+}
+
+
+// ------------------------------------------------------------------------------------------ //
+// Interface.
+// ------------------------------------------------------------------------------------------ //
+
+void LocalDist_Init( int argc, char **argv, const char *pMapName )
+{
+	if ( !LocalDist_IsActive() )
+		return;
+
+	if ( numthreads == -1 )
+		ThreadSetDefault();
+
+	V_FileBase( pMapName, g_szLocalDistMapName, sizeof( g_szLocalDistMapName ) );
+
+	LocalDist_InitSockets();
+
+	if ( LocalDist_IsMaster() )
+	{
+		LocalDist_OpenListenSocket();
+		LocalDist_SpawnWorkers( argc, argv );
+	}
+	else
+	{
+		// Workers don't want the pacifier from every range they process.
+		SuppressPacifier( true );
+		LocalDist_ConnectToMaster();
+	}
+}
+
+
+double LocalDist_DistributeWork(
+	const char *pStageName,
+	int nWorkUnits,
+	LocalDistProcessFn pProcess,
+	LocalDistReceiveFn pReceive,
+	bool bShareResults )
+{
+	Assert( LocalDist_IsActive() );
+	Assert( V_strlen( pStageName ) < LOCALDIST_MAX_STAGE_NAME );
+
+	if ( nWorkUnits <= 0 )
+		return 0;
+
+	if ( LocalDist_IsMaster() )
+		return LocalDist_MasterDistributeWork( pStageName, nWorkUnits, pProcess, pReceive, bShareResults );
+	else
+		return LocalDist_WorkerDistributeWork( pStageName, nWorkUnits, pProcess, pReceive );
+}
+
+
+void LocalDist_Finish()
+{
+	if ( LocalDist_IsWorker() )
+	{
+		Msg( "LocalDist: worker finished.\n" );
+		closesocket( g_MasterSocket );
+		g_MasterSocket = INVALID_SOCKET;
+		CmdLib_Exit( 0 );
+	}
+
+	if ( !LocalDist_IsMaster() )
+		return;
+
+	for ( int i=0; i < g_LocalDistWorkers.Count(); i++ )
+	{
+		LocalDist_SendMsg( g_LocalDistWorkers[i]->m_Socket, LD_MSG_QUIT, NULL, 0 );
+		closesocket( g_LocalDistWorkers[i]->m_Socket );
+	}
+	g_LocalDistWorkers.PurgeAndDeleteElements();
+	g_LocalDistCompletedStages.PurgeAndDeleteElements();
+
+	for ( int i=0; i < g_LocalDistProcesses.Count(); i++ )
+		CloseHandle( g_LocalDistProcesses[i] );
+	g_LocalDistProcesses.Purge();
+
+	if ( g_ListenSocket != INVALID_SOCKET )
+	{
+		closesocket( g_ListenSocket );
+		g_ListenSocket = INVALID_SOCKET;
+	}
+
+	// Anything after this point runs on the master only.
+	g_eLocalDistMode = k_eLocalDist_None;
+}
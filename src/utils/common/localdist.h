@@ -0,0 +1,74 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Work distribution across several tool processes without VMPI.
+//
+//			The master process listens on a TCP port and hands out ranges of
+//			work units to worker processes, which are either spawned locally
+//			(-dist <N>) or started by hand on other machines on the LAN
+//			(-dist_worker <host:port>). Every worker loads the same input
+//			files from disk and runs the same code path as the master, so the
+//			only things that travel over the wire are work unit ranges and
+//			their results.
+//
+//			Results are buffered on the master and handed to the receive
+//			function in work unit order once the whole stage is finished, so
+//			the output doesn't depend on how the work was split up or which
+//			worker finished first.
+//
+//=============================================================================//
+
+#ifndef LOCALDIST_H
+#define LOCALDIST_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+class CUtlBuffer;
+
+
+#define LOCALDIST_DEFAULT_PORT		27950
+
+
+// Called on a worker (or on the master if no workers showed up) for each work unit.
+// Whatever is written into buf is handed to the LocalDistReceiveFn for that unit.
+typedef void (*LocalDistProcessFn)( int iThread, int iWorkUnit, CUtlBuffer &buf );
+
+// Called on the master for every work unit, in work unit order, after the stage is done.
+// If the stage shares its results, workers get the same calls once the stage is done.
+typedef void (*LocalDistReceiveFn)( int iWorkUnit, CUtlBuffer &buf );
+
+
+// Handles -dist <N>, -dist_port <port>, -dist_listen and -dist_worker <host:port>.
+// Returns false if argv[i] isn't one of those, otherwise leaves i on the last argument it used.
+bool	LocalDist_ParseArg( int argc, char **argv, int &i );
+
+// Call once the command line is parsed. The master opens its listen socket and spawns
+// its local workers, workers connect to the master. pMapName is used to make sure
+// workers from other machines are working on the same map.
+void	LocalDist_Init( int argc, char **argv, const char *pMapName );
+
+bool	LocalDist_IsActive();
+bool	LocalDist_IsMaster();
+bool	LocalDist_IsWorker();
+
+// Runs one stage. On the master this returns once every work unit has been received, and
+// returns the elapsed time. Workers process ranges until the master says the stage is over.
+//
+// If bShareResults is set, the merged results are sent back to every worker, which then
+// calls pReceive on them as well. Use this when later stages need the results on the workers.
+double	LocalDist_DistributeWork(
+	const char *pStageName,
+	int nWorkUnits,
+	LocalDistProcessFn pProcess,
+	LocalDistReceiveFn pReceive,
+	bool bShareResults = false );
+
+// Called at the point where workers have nothing left to do. Workers exit here, the master
+// tells every worker to quit and carries on.
+void	LocalDist_Finish();
+
+void	LocalDist_PrintUsage();
+
+
+#endif // LOCALDIST_H
@@ -84,6 +84,54 @@ int			entity_num;
 
 node_t		*block_nodes[BLOCKS_SPACE+2][BLOCKS_SPACE+2];
 
+//-----------------------------------------------------------------------------
+// Per-stage timing
+//-----------------------------------------------------------------------------
+struct StageTime_t
+{
+	const char	*m_pName;
+	double		m_flSeconds;
+};
+
+static CUtlVector<StageTime_t> s_StageTimes;
+
+void AddStageTime( const char *pStageName, double flSeconds )
+{
+	for ( int i = 0; i < s_StageTimes.Count(); i++ )
+	{
+		if ( !Q_stricmp( s_StageTimes[i].m_pName, pStageName ) )
+		{
+			s_StageTimes[i].m_flSeconds += flSeconds;
+			return;
+		}
+	}
+
+	StageTime_t &stage = s_StageTimes[ s_StageTimes.AddToTail() ];
+	stage.m_pName = pStageName;
+	stage.m_flSeconds = flSeconds;
+}
+
+void PrintStageTimes( void )
+{
+	if ( !s_StageTimes.Count() )
+		return;
+
+	double flTotal = 0;
+	for ( int i = 0; i < s_StageTimes.Count(); i++ )
+	{
+		flTotal += s_StageTimes[i].m_flSeconds;
+	}
+
+	Msg( "\nStage times:\n" );
+	for ( int i = 0; i < s_StageTimes.Count(); i++ )
+	{
+		Msg( "  %-24s %8.2fs  %5.1f%%\n", s_StageTimes[i].m_pName, s_StageTimes[i].m_flSeconds,
+			flTotal > 0 ? 100.0 * s_StageTimes[i].m_flSeconds / flTotal : 0.0 );
+	}
+	Msg( "  %-24s %8.2fs\n\n", "total", flTotal );
+}
+
+
 //-----------------------------------------------------------------------------
 // Assign occluder areas (must happen *after* the world model is processed)
 //-----------------------------------------------------------------------------
@@ -208,6 +256,7 @@ void ProcessWorldModel (void)
 	qboolean	leaked;
 	int	optimize;
 	int			start;
+	double		flStageStart;
 
 	e = &entities[entity_num];
 
@@ -257,8 +306,10 @@ void ProcessWorldModel (void)
 	{
 		qprintf ("--------------------------------------------\n");
 
+		flStageStart = Plat_FloatTime();
 		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
 			!verbose, ProcessBlock_Thread);
+		AddStageTime( "CSG / block BSP", Plat_FloatTime() - flStageStart );
 
 		//
 		// build the division tree
@@ -284,8 +335,11 @@ void ProcessWorldModel (void)
 		//
 
 		// make the portals/faces by traversing down to each empty leaf
+		flStageStart = Plat_FloatTime();
 		MakeTreePortals (tree);
+		AddStageTime( "Portals", Plat_FloatTime() - flStageStart );
 
+		flStageStart = Plat_FloatTime();
 		if (FloodEntities (tree))
 		{
 			// turns everthing outside into solid
@@ -305,6 +359,7 @@ void ProcessWorldModel (void)
 
 		// mark the brush sides that actually turned into faces
 		MarkVisibleSides (tree, brush_start, brush_end, NO_DETAIL);
+		AddStageTime( "Flood / visible sides", Plat_FloatTime() - flStageStart );
 		if (noopt || leaked)
 			break;
 		if (!optimize)
@@ -321,11 +376,13 @@ void ProcessWorldModel (void)
 	RemoveAreaPortalBrushes_R( tree->headnode );
 
 	start = Plat_FloatTime();
+	flStageStart = Plat_FloatTime();
 	Msg("Building Faces...");
 	// this turns portals with one solid side into faces
 	// it also subdivides each face if necessary to fit max lightmap dimensions
 	MakeFaces (tree->headnode);
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
+	AddStageTime( "Faces", Plat_FloatTime() - flStageStart );
 
 	if (glview)
 	{
@@ -337,34 +394,44 @@ void ProcessWorldModel (void)
 	face_t *pLeafFaceList = NULL;
 	if ( !nodetail )
 	{
+		flStageStart = Plat_FloatTime();
 		pLeafFaceList = MergeDetailTree( tree, brush_start, brush_end );
+		AddStageTime( "Detail merge", Plat_FloatTime() - flStageStart );
 	}
 
 	start = Plat_FloatTime();
+	flStageStart = Plat_FloatTime();
 
 	Msg("FixTjuncs...\n");
 	
 	// This unifies the vertex list for all edges (splits collinear edges to remove t-junctions)
 	// It also welds the list of vertices out of each winding/portal and rounds nearly integer verts to integer
 	pLeafFaceList = FixTjuncs (tree->headnode, pLeafFaceList);
+	AddStageTime( "Tjuncs", Plat_FloatTime() - flStageStart );
 
 	// this merges all of the solid nodes that have separating planes
 	if (!noprune)
 	{
 		Msg("PruneNodes...\n");
+		flStageStart = Plat_FloatTime();
 		PruneNodes (tree->headnode);
+		AddStageTime( "Prune", Plat_FloatTime() - flStageStart );
 	}
 
 //	Msg( "SplitSubdividedFaces...\n" );
 //	SplitSubdividedFaces( tree->headnode );
 
 	Msg("WriteBSP...\n");
+	flStageStart = Plat_FloatTime();
 	WriteBSP (tree->headnode, pLeafFaceList);
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
+	AddStageTime( "Write tree", Plat_FloatTime() - flStageStart );
 
 	if (!leaked)
 	{
+		flStageStart = Plat_FloatTime();
 		WritePortalFile (tree);
+		AddStageTime( "Portal file", Plat_FloatTime() - flStageStart );
 	}
 
 	FreeTree( tree );
@@ -847,7 +914,9 @@ void ProcessModels (void)
 		}
 		else
 		{
+			double flStageStart = Plat_FloatTime();
 			ProcessSubModel( );
+			AddStageTime( "Brush models", Plat_FloatTime() - flStageStart );
 		}
 
 		EndModel ();
@@ -1392,7 +1461,9 @@ int RunVBSP( int argc, char **argv )
 			AddBufferToPak( GetPakFile(), "stale.txt", "stale", strlen( "stale" ) + 1, false );
 		}
 
+		double flStageStart = Plat_FloatTime();
 		LoadMapFile (name);
+		AddStageTime( "Load map", Plat_FloatTime() - flStageStart );
 		WorldVertexTransitionFixup();
 		if( ( g_nDXLevel == 0 ) || ( g_nDXLevel >= 70 ) )
 		{
@@ -1416,6 +1487,8 @@ int RunVBSP( int argc, char **argv )
 	end = Plat_FloatTime();
 	
 	char str[512];
+	PrintStageTimes();
+
 	GetHourMinuteSecondsString( (int)( end - start ), str, sizeof( str ) );
 	Msg( "%s elapsed\n", str );
 
@@ -375,6 +375,10 @@ bool 	LoadMapFile( const char *pszFileName );
 int		GetVertexnum( Vector& v );
 bool Is3DSkyboxArea( int area );
 
+// Per-stage timing, printed at the end of the compile. Stages with the same name add up.
+void	AddStageTime( const char *pStageName, double flSeconds );
+void	PrintStageTimes( void );
+
 //=============================================================================
 
 // textures.c
@@ -1257,17 +1257,23 @@ void EndBSPFile (void)
 	OverlayTransition_EmitOverlayFaces();
 
 	// phys collision needs dispinfo to operate (needs to generate phys collision for displacement surfs)
+	double flStageStart = Plat_FloatTime();
 	EmitPhysCollision();
+	AddStageTime( "Physics collision", Plat_FloatTime() - flStageStart );
 
 	// We can't calculate this properly until vvis (since we need vis to do this), so we set
 	// to zero everywhere by default.
 	ClearDistToClosestWater();
 
 	// Emit static props found in the .vmf file
+	flStageStart = Plat_FloatTime();
 	EmitStaticProps();
+	AddStageTime( "Static props", Plat_FloatTime() - flStageStart );
 
 	// Place detail props found in .vmf and based on material properties
+	flStageStart = Plat_FloatTime();
 	EmitDetailObjects();
+	AddStageTime( "Detail props", Plat_FloatTime() - flStageStart );
 
 	// Compute bounds after creating disp info because we need to reference it
 	ComputeBoundsNoSkybox();
@@ -1288,7 +1294,9 @@ void EndBSPFile (void)
 	V_strncpy( fileName, source, sizeof( fileName ) );
 	V_DefaultExtension( fileName, ".bsp", sizeof( fileName ) );
 	Msg ("Writing %s\n", fileName);
+	flStageStart = Plat_FloatTime();
 	WriteBSPFile (fileName);
+	AddStageTime( "Write bsp / pak", Plat_FloatTime() - flStageStart );
 }
 
 
@@ -0,0 +1,253 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: vrad stages distributed with localdist (-dist) instead of VMPI.
+//
+//			This follows mpivrad.cpp: workers build facelights and transfers
+//			and send them back, the master runs BuildPatchLights and
+//			everything after the transfers are built. Workers exit at the
+//			LocalDist_Finish() call in RadWorld_Go.
+//
+//=============================================================================//
+
+#include <windows.h>
+#include "vrad.h"
+#include "lightmap.h"
+#include "vismat.h"
+#include "localdist.h"
+#include "distvrad.h"
+#include "transferstore.h"
+#include "tier1/utlbuffer.h"
+
+
+extern int total_transfer;
+extern int max_transfer;
+
+extern void BuildPatchLights( int facenum );
+
+
+template<class T> void PutValues( CUtlBuffer &buf, T const *pSrc, int nNumValues )
+{
+	buf.Put( pSrc, sizeof( pSrc[0] ) * nNumValues );
+}
+
+template<class T> void GetValues( CUtlBuffer &buf, T *pDest, int nNumValues )
+{
+	buf.Get( pDest, sizeof( pDest[0] ) * nNumValues );
+}
+
+
+//-----------------------------------------
+//
+// BuildFacelights
+//
+
+static void Dist_ProcessFace( int iThread, int iFace, CUtlBuffer &buf )
+{
+	BuildFacelights( iThread, iFace );
+
+	dface_t     *f  = &g_pFaces[iFace];
+	facelight_t *fl = &facelight[iFace];
+
+	buf.Put( f, sizeof( dface_t ) );
+	buf.Put( fl, sizeof( facelight_t ) );
+
+	PutValues( buf, fl->sample, fl->numsamples );
+
+	for ( int i=0; i < MAXLIGHTMAPS; ++i )
+	{
+		for ( int n=0; n < NUM_BUMP_VECTS+1; ++n )
+		{
+			if ( fl->light[i][n] )
+			{
+				PutValues( buf, fl->light[i][n], fl->numsamples );
+			}
+		}
+	}
+
+	if ( fl->luxel )
+		PutValues( buf, fl->luxel, fl->numluxels );
+
+	if ( fl->luxelNormals )
+		PutValues( buf, fl->luxelNormals, fl->numluxels );
+}
+
+
+// Frees the arrays of a face that was already built here, before results for it are read over it.
+static void Dist_FreeFacelight( facelight_t *fl )
+{
+	free( fl->sample );
+	fl->sample = NULL;
+
+	for ( int i=0; i < MAXLIGHTMAPS; ++i )
+	{
+		for ( int n=0; n < NUM_BUMP_VECTS+1; ++n )
+		{
+			free( fl->light[i][n] );
+			fl->light[i][n] = NULL;
+		}
+	}
+
+	free( fl->luxel );
+	fl->luxel = NULL;
+
+	free( fl->luxelNormals );
+	fl->luxelNormals = NULL;
+}
+
+
+static void Dist_ReceiveFace( int iFace, CUtlBuffer &buf )
+{
+	dface_t     *f  = &g_pFaces[iFace];
+	facelight_t *fl = &facelight[iFace];
+
+	// The master builds faces itself when it has no workers, and those arrays would
+	// otherwise be overwritten by the copies read below.
+	Dist_FreeFacelight( fl );
+
+	buf.Get( f, sizeof( dface_t ) );
+	buf.Get( fl, sizeof( facelight_t ) );
+
+	// The pointers that came across are only used as flags for which arrays follow.
+	fl->sample = (sample_t *)calloc( fl->numsamples, sizeof( sample_t ) );
+	GetValues( buf, fl->sample, fl->numsamples );
+
+	for ( int i=0; i < MAXLIGHTMAPS; ++i )
+	{
+		for ( int n=0; n < NUM_BUMP_VECTS+1; ++n )
+		{
+			if ( fl->light[i][n] )
+			{
+				fl->light[i][n] = (LightingValue_t *)calloc( fl->numsamples, sizeof( LightingValue_t ) );
+				GetValues( buf, fl->light[i][n], fl->numsamples );
+			}
+		}
+	}
+
+	if ( fl->luxel )
+	{
+		fl->luxel = (Vector *)calloc( fl->numluxels, sizeof( Vector ) );
+		GetValues( buf, fl->luxel, fl->numluxels );
+	}
+
+	if ( fl->luxelNormals )
+	{
+		fl->luxelNormals = (Vector *)calloc( fl->numluxels, sizeof( Vector ) );
+		GetValues( buf, fl->luxelNormals, fl->numluxels );
+	}
+
+	if ( !buf.IsValid() )
+		Error( "Invalid BuildFacelights results for face %d.", iFace );
+}
+
+
+void RunDistBuildFacelights()
+{
+	LocalDist_DistributeWork( "BuildFacelights:", numfaces, Dist_ProcessFace, Dist_ReceiveFace );
+
+	if ( LocalDist_IsMaster() )
+	{
+		// BuildFacelights leaves this to the master when the work is distributed.
+		for ( int i=0; i < numfaces; ++i )
+		{
+			BuildPatchLights( i );
+		}
+	}
+}
+
+
+//-----------------------------------------
+//
+// BuildVisLeafs
+//
+
+class CDistVisLeafsData
+{
+public:
+	CUtlBuffer *m_pBuf;
+	int m_nPatchesInCluster;
+	transfer_t *m_pTransfers;
+};
+
+static CDistVisLeafsData g_DistVisLeafsData[MAX_TOOL_THREADS+1];
+
+
+// Called by BuildVisLeafs_Cluster every time it finishes a patch.
+static void Dist_AddPatchData( int iThread, int patchnum, CPatch *patch )
+{
+	CDistVisLeafsData *pData = &g_DistVisLeafsData[iThread];
+
+	++pData->m_nPatchesInCluster;
+	pData->m_pBuf->PutInt( patchnum );
+	pData->m_pBuf->PutInt( patch->numtransfers );
+	PutValues( *pData->m_pBuf, patch->transfers, patch->numtransfers );
+}
+
+
+static void Dist_ProcessVisLeafs( int iThread, int iCluster, CUtlBuffer &buf )
+{
+	CDistVisLeafsData *pData = &g_DistVisLeafsData[iThread];
+	if ( !pData->m_pTransfers )
+		pData->m_pTransfers = BuildVisLeafs_Start();
+
+	pData->m_pBuf = &buf;
+	pData->m_nPatchesInCluster = 0;
+
+	// Write a temp value in there. We overwrite it once the cluster is done.
+	int iSavePos = buf.TellPut();
+	buf.PutInt( 0 );
+
+	BuildVisLeafs_Cluster( iThread, pData->m_pTransfers, iCluster, Dist_AddPatchData );
+
+	int iEndPos = buf.TellPut();
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, iSavePos );
+	buf.PutInt( pData->m_nPatchesInCluster );
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, iEndPos );
+
+	pData->m_pBuf = NULL;
+}
+
+
+static void Dist_ReceiveVisLeafs( int iCluster, CUtlBuffer &buf )
+{
+	int patchesInCluster = buf.GetInt();
+	for ( int k=0; k < patchesInCluster; ++k )
+	{
+		int patchnum = buf.GetInt();
+		int numtransfers = buf.GetInt();
+		if ( !buf.IsValid() || patchnum < 0 || patchnum >= g_Patches.Count() || numtransfers < 0 )
+			Error( "Invalid BuildVisLeafs results for cluster %d.", iCluster );
+
+		CPatch *patch = &g_Patches[patchnum];
+		patch->numtransfers = numtransfers;
+		if ( numtransfers )
+		{
+			patch->transfers = new transfer_t[numtransfers];
+			GetValues( buf, patch->transfers, numtransfers );
+
+			if ( g_TransferStore.IsActive() )
+			{
+				transfer_t *pTransfers = patch->transfers;
+				g_TransferStore.StorePatchTransfers( patch, pTransfers, numtransfers );
+				delete [] pTransfers;
+			}
+		}
+
+		total_transfer += numtransfers;
+		if ( max_transfer < numtransfers )
+			max_transfer = numtransfers;
+	}
+}
+
+
+void RunDistBuildVisLeafs()
+{
+	memset( g_DistVisLeafsData, 0, sizeof( g_DistVisLeafsData ) );
+
+	LocalDist_DistributeWork( "BuildVisLeafs:", dvis->numclusters, Dist_ProcessVisLeafs, Dist_ReceiveVisLeafs );
+
+	for ( int i=0; i < ARRAYSIZE( g_DistVisLeafsData ); i++ )
+	{
+		if ( g_DistVisLeafsData[i].m_pTransfers )
+			BuildVisLeafs_End( g_DistVisLeafsData[i].m_pTransfers );
+	}
+}
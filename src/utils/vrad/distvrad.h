@@ -0,0 +1,18 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: vrad stages distributed with localdist (-dist) instead of VMPI.
+//
+//=============================================================================//
+
+#ifndef DISTVRAD_H
+#define DISTVRAD_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+void RunDistBuildFacelights();
+void RunDistBuildVisLeafs();
+
+
+#endif // DISTVRAD_H
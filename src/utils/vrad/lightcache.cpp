@@ -0,0 +1,930 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-face lighting cache for incremental relighting. See lightcache.h.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/utlbuffer.h"
+#include "filesystem.h"
+
+
+CLightCache g_LightCache;
+
+int GetVisCache( int lastoffset, int cluster, byte *pvs );
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+template<class T>
+static inline void HashValue( MD5Context_t &ctx, const T &value )
+{
+	MD5Update( &ctx, (const unsigned char*)&value, sizeof( value ) );
+}
+
+static inline void HashBytes( MD5Context_t &ctx, const void *pData, int nBytes )
+{
+	if ( nBytes > 0 )
+		MD5Update( &ctx, (const unsigned char*)pData, nBytes );
+}
+
+static inline void FinishHash( MD5Context_t &ctx, MD5Value_t &hash )
+{
+	MD5Final( hash.bits, &ctx );
+}
+
+static int HashCompare( const MD5Value_t *a, const MD5Value_t *b )
+{
+	return memcmp( a->bits, b->bits, sizeof( a->bits ) );
+}
+
+
+// Cells are packed into an int, 8 bits per axis.
+#define CELL_OFFSET		128
+
+static inline int CellCoord( float f )
+{
+	int n = (int)floor( f / LIGHTCACHE_CELL_SIZE ) + CELL_OFFSET;
+	return clamp( n, 0, 255 );
+}
+
+static inline int CellKey( int x, int y, int z )
+{
+	return x | ( y << 8 ) | ( z << 16 );
+}
+
+static void CellBounds( int nKey, Vector &mins, Vector &maxs )
+{
+	int coords[3] = { nKey & 0xff, ( nKey >> 8 ) & 0xff, ( nKey >> 16 ) & 0xff };
+	for ( int i=0; i < 3; i++ )
+	{
+		mins[i] = (float)( ( coords[i] - CELL_OFFSET ) * LIGHTCACHE_CELL_SIZE );
+		maxs[i] = mins[i] + LIGHTCACHE_CELL_SIZE;
+	}
+}
+
+
+static void HashFaceThread( int iThread, int facenum )
+{
+	g_LightCache.HashFace( facenum );
+}
+
+
+//-----------------------------------------------------------------------------
+// CLightCache
+//-----------------------------------------------------------------------------
+CLightCache::CLightCache() :
+	m_OldCells( 0, 0, CellLessFunc ),
+	m_NewCells( 0, 0, CellLessFunc ),
+	m_CacheLookup( 0, 0, HashLessFunc )
+{
+	m_bActive = false;
+	m_szFilename[0] = 0;
+	m_SettingsHash.Zero();
+}
+
+
+void CLightCache::Init( const char *pFilename )
+{
+	m_bActive = true;
+	Q_strncpy( m_szFilename, pFilename, sizeof( m_szFilename ) );
+
+	HashSettings( m_SettingsHash );
+	HashOccluders();
+
+	if ( Load() )
+	{
+		Msg( "Relighting against %s (%d faces cached)\n", m_szFilename, m_CachedFaces.Count() );
+	}
+	else
+	{
+		Msg( "No usable light cache in %s, relighting everything.\n", m_szFilename );
+	}
+
+	// Find the occluder cells that changed since the last run.
+	if ( m_CachedFaces.Count() )
+	{
+		for ( int i = m_NewCells.FirstInorder(); i != m_NewCells.InvalidIndex(); i = m_NewCells.NextInorder( i ) )
+		{
+			int iOld = m_OldCells.Find( m_NewCells.Key( i ) );
+			if ( iOld != m_OldCells.InvalidIndex() && m_OldCells[iOld] == m_NewCells[i] )
+				continue;
+
+			ChangedCell_t &cell = m_ChangedCells[ m_ChangedCells.AddToTail() ];
+			CellBounds( m_NewCells.Key( i ), cell.m_vecMins, cell.m_vecMaxs );
+		}
+
+		for ( int i = m_OldCells.FirstInorder(); i != m_OldCells.InvalidIndex(); i = m_OldCells.NextInorder( i ) )
+		{
+			if ( m_NewCells.Find( m_OldCells.Key( i ) ) != m_NewCells.InvalidIndex() )
+				continue;
+
+			ChangedCell_t &cell = m_ChangedCells[ m_ChangedCells.AddToTail() ];
+			CellBounds( m_OldCells.Key( i ), cell.m_vecMins, cell.m_vecMaxs );
+		}
+
+		qprintf( "%d of %d occluder cells changed\n", m_ChangedCells.Count(), m_NewCells.Count() );
+	}
+	m_OldCells.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Anything that changes the lighting of every face. If it doesn't match,
+// the whole cache is thrown away.
+//-----------------------------------------------------------------------------
+void CLightCache::HashSettings( MD5Value_t &hash )
+{
+	MD5Context_t ctx;
+	memset( &ctx, 0, sizeof( ctx ) );
+	MD5Init( &ctx );
+
+	HashValue( ctx, (int)LIGHTCACHE_VERSION );
+	HashValue( ctx, g_bHDR );
+	HashValue( ctx, numbounce );
+	HashValue( ctx, do_extra );
+	HashValue( ctx, extrapasses );
+	HashValue( ctx, do_fast );
+	HashValue( ctx, do_centersamples );
+	HashValue( ctx, ambient );
+	HashValue( ctx, lightscale );
+	HashValue( ctx, coring );
+	HashValue( ctx, maxlight );
+	HashValue( ctx, dlight_map );
+	HashValue( ctx, smoothing_threshold );
+	HashValue( ctx, indirect_sun );
+	HashValue( ctx, g_flSkySampleScale );
+	HashValue( ctx, g_SunAngularExtent );
+	HashValue( ctx, g_flMaxDispSampleSize );
+	HashValue( ctx, g_bLargeDispSampleRadius );
+	HashValue( ctx, g_bTextureShadows );
+	HashValue( ctx, g_bNoSkyRecurse );
+
+	FinishHash( ctx, hash );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes the ray trace triangles into grid cells. The per cell hash doesn't
+// depend on the order the triangles were added in, so unrelated changes
+// elsewhere in the map don't show up as changed cells.
+//-----------------------------------------------------------------------------
+void CLightCache::HashOccluders()
+{
+	m_NewCells.RemoveAll();
+
+	int nTriangles = g_RtEnv.OptimizedTriangleList.Count();
+	for ( int i=0; i < nTriangles; i++ )
+	{
+		CacheOptimizedTriangle &tri = g_RtEnv.OptimizedTriangleList[i];
+
+		CRC32_t crc;
+		CRC32_Init( &crc );
+		CRC32_ProcessBuffer( &crc, tri.m_Data.m_GeometryData.m_VertexCoordData, sizeof( tri.m_Data.m_GeometryData.m_VertexCoordData ) );
+		CRC32_ProcessBuffer( &crc, &tri.m_Data.m_GeometryData.m_nFlags, sizeof( tri.m_Data.m_GeometryData.m_nFlags ) );
+		if ( i < g_RtEnv.TriangleColors.Count() )
+		{
+			CRC32_ProcessBuffer( &crc, &g_RtEnv.TriangleColors[i], sizeof( Vector ) );
+		}
+		CRC32_Final( &crc );
+
+		Vector mins = tri.Vertex( 0 );
+		Vector maxs = tri.Vertex( 0 );
+		AddPointToBounds( tri.Vertex( 1 ), mins, maxs );
+		AddPointToBounds( tri.Vertex( 2 ), mins, maxs );
+
+		int cellMins[3], cellMaxs[3];
+		for ( int j=0; j < 3; j++ )
+		{
+			cellMins[j] = CellCoord( mins[j] );
+			cellMaxs[j] = CellCoord( maxs[j] );
+		}
+
+		for ( int z = cellMins[2]; z <= cellMaxs[2]; z++ )
+		{
+			for ( int y = cellMins[1]; y <= cellMaxs[1]; y++ )
+			{
+				for ( int x = cellMins[0]; x <= cellMaxs[0]; x++ )
+				{
+					int nKey = CellKey( x, y, z );
+					int iCell = m_NewCells.Find( nKey );
+					if ( iCell == m_NewCells.InvalidIndex() )
+					{
+						CellHash_t empty = { 0, 0, 0 };
+						iCell = m_NewCells.Insert( nKey, empty );
+					}
+
+					CellHash_t &cell = m_NewCells[iCell];
+					cell.m_nSum += crc;
+					cell.m_nXor ^= crc;
+					cell.m_nTriangles++;
+				}
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Which clusters each face lies in: the clusters of the leaves that reference
+// it, plus the clusters of its patches (displacements aren't in any leaf).
+//-----------------------------------------------------------------------------
+void CLightCache::BuildFaceClusters()
+{
+	m_FaceClusters.SetCount( numfaces );
+	for ( int i=0; i < numfaces; i++ )
+	{
+		m_FaceClusters[i].RemoveAll();
+	}
+
+	for ( int iLeaf=0; iLeaf < numleafs; iLeaf++ )
+	{
+		int iCluster = dleafs[iLeaf].cluster;
+		if ( iCluster < 0 )
+			continue;
+
+		for ( int i=0; i < dleafs[iLeaf].numleaffaces; i++ )
+		{
+			int facenum = dleaffaces[ dleafs[iLeaf].firstleafface + i ];
+			if ( m_FaceClusters[facenum].Find( iCluster ) == -1 )
+			{
+				m_FaceClusters[facenum].AddToTail( iCluster );
+			}
+		}
+	}
+
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		if ( g_FacePatches.Element( facenum ) != g_FacePatches.InvalidIndex() )
+		{
+			for ( int iPatch = g_FacePatches.Element( facenum ); iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+			{
+				int iCluster = g_Patches[iPatch].clusterNumber;
+				if ( m_FaceClusters[facenum].Find( iCluster ) == -1 )
+				{
+					m_FaceClusters[facenum].AddToTail( iCluster );
+				}
+			}
+		}
+
+		// No idea where it is, so assume every light can see it (see PVSCheck).
+		if ( !m_FaceClusters[facenum].Count() )
+		{
+			m_FaceClusters[facenum].AddToTail( -1 );
+		}
+	}
+}
+
+
+void CLightCache::GetFaceBounds( int facenum, Vector &mins, Vector &maxs )
+{
+	dface_t *f = &g_pFaces[facenum];
+
+	ClearBounds( mins, maxs );
+	for ( int i=0; i < f->numedges; i++ )
+	{
+		int se = dsurfedges[f->firstedge + i];
+		int v = ( se < 0 ) ? dedges[-se].v[1] : dedges[se].v[0];
+		AddPointToBounds( dvertexes[v].point, mins, maxs );
+	}
+
+	if ( g_FacePatches.Element( facenum ) != g_FacePatches.InvalidIndex() )
+	{
+		for ( int iPatch = g_FacePatches.Element( facenum ); iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+		{
+			AddPointToBounds( g_Patches[iPatch].mins, mins, maxs );
+			AddPointToBounds( g_Patches[iPatch].maxs, mins, maxs );
+		}
+	}
+}
+
+
+bool CLightCache::TouchesChangedCell( const Vector &mins, const Vector &maxs ) const
+{
+	for ( int i=0; i < m_ChangedCells.Count(); i++ )
+	{
+		if ( IsBoxIntersectingBox( mins, maxs, m_ChangedCells[i].m_vecMins, m_ChangedCells[i].m_vecMaxs ) )
+			return true;
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Does the space between the face and the light cross a changed cell?
+//-----------------------------------------------------------------------------
+bool CLightCache::LightVolumeTouchesChangedCell( const directlight_t *dl, const Vector &faceMins, const Vector &faceMaxs ) const
+{
+	Vector mins = faceMins - Vector( 1, 1, 1 );
+	Vector maxs = faceMaxs + Vector( 1, 1, 1 );
+	const Vector &worldMins = dmodels[0].mins;
+	const Vector &worldMaxs = dmodels[0].maxs;
+
+	switch ( dl->light.type )
+	{
+	case emit_skylight:
+		// Stretch the face back towards the sun, out to the edge of the world.
+		for ( int i=0; i < 3; i++ )
+		{
+			if ( dl->light.normal[i] < 0.0f )
+				maxs[i] = worldMaxs[i];
+			else if ( dl->light.normal[i] > 0.0f )
+				mins[i] = worldMins[i];
+		}
+		break;
+
+	case emit_skyambient:
+		// Light comes from the whole sky.
+		mins.x = worldMins.x;
+		mins.y = worldMins.y;
+		maxs = worldMaxs;
+		break;
+
+	default:
+		AddPointToBounds( dl->light.origin, mins, maxs );
+		break;
+	}
+
+	return TouchesChangedCell( mins, maxs );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes everything the face's direct lighting depends on. Threaded.
+//-----------------------------------------------------------------------------
+void CLightCache::HashFace( int facenum )
+{
+	dface_t *f = &g_pFaces[facenum];
+	texinfo_t *tx = &texinfo[f->texinfo];
+	dtexdata_t *td = &dtexdata[tx->texdata];
+	faceneighbor_t *fn = &faceneighbor[facenum];
+
+	MD5Context_t ctx;
+	memset( &ctx, 0, sizeof( ctx ) );
+	MD5Init( &ctx );
+
+	// Geometry and material.
+	HashValue( ctx, dplanes[f->planenum].normal );
+	HashValue( ctx, dplanes[f->planenum].dist );
+	HashValue( ctx, f->side );
+	HashValue( ctx, f->smoothingGroups );
+	HashValue( ctx, f->m_LightmapTextureMinsInLuxels );
+	HashValue( ctx, f->m_LightmapTextureSizeInLuxels );
+	HashValue( ctx, tx->textureVecsTexelsPerWorldUnits );
+	HashValue( ctx, tx->lightmapVecsLuxelsPerWorldUnits );
+	HashValue( ctx, tx->flags );
+	HashValue( ctx, td->reflectivity );
+	const char *pTextureName = TexDataStringTable_GetString( td->nameStringTableID );
+	HashBytes( ctx, pTextureName, Q_strlen( pTextureName ) );
+
+	HashValue( ctx, f->numedges );
+	for ( int i=0; i < f->numedges; i++ )
+	{
+		int se = dsurfedges[f->firstedge + i];
+		int v = ( se < 0 ) ? dedges[-se].v[1] : dedges[se].v[0];
+		HashValue( ctx, dvertexes[v].point );
+	}
+
+	if ( f->dispinfo != -1 )
+	{
+		ddispinfo_t *pDisp = &g_dispinfo[f->dispinfo];
+		HashValue( ctx, pDisp->startPosition );
+		HashValue( ctx, pDisp->power );
+		HashValue( ctx, pDisp->smoothingAngle );
+		HashValue( ctx, pDisp->contents );
+		HashBytes( ctx, &g_DispVerts[pDisp->m_iDispVertStart], pDisp->NumVerts() * sizeof( CDispVert ) );
+	}
+
+	// Smoothed normals, which depend on the neighbours.
+	HashValue( ctx, fn->facenormal );
+	if ( fn->normal )
+	{
+		HashBytes( ctx, fn->normal, f->numedges * sizeof( Vector ) );
+	}
+
+	float flMinLight = FloatForKey( face_entity[facenum], "_minlight" );
+	HashValue( ctx, flMinLight );
+
+	// Patches, which carry emissive light and reflectivity into radiosity.
+	Vector faceMins, faceMaxs;
+	GetFaceBounds( facenum, faceMins, faceMaxs );
+
+	if ( g_FacePatches.Element( facenum ) != g_FacePatches.InvalidIndex() )
+	{
+		for ( int iPatch = g_FacePatches.Element( facenum ); iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+		{
+			CPatch *patch = &g_Patches[iPatch];
+			HashValue( ctx, patch->area );
+			HashValue( ctx, patch->baselight );
+			HashValue( ctx, patch->reflectivity );
+			HashValue( ctx, patch->origin );
+		}
+	}
+
+	// Lights that can see the face. Sorted so the order lights were created in doesn't matter.
+	CUtlVector<MD5Value_t> lightHashes;
+	const CUtlVector<int> &clusters = m_FaceClusters[facenum];
+	bool bOccluded = false;
+
+	for ( int iLight=0; iLight < m_Lights.Count(); iLight++ )
+	{
+		directlight_t *dl = m_Lights[iLight];
+
+		if ( dl->pvs )
+		{
+			int i;
+			for ( i=0; i < clusters.Count(); i++ )
+			{
+				if ( PVSCheck( dl->pvs, clusters[i] ) )
+					break;
+			}
+			if ( i == clusters.Count() )
+				continue;
+		}
+
+		lightHashes.AddToTail( m_LightHashes[iLight] );
+
+		if ( !bOccluded && m_ChangedCells.Count() )
+		{
+			bOccluded = LightVolumeTouchesChangedCell( dl, faceMins, faceMaxs );
+		}
+	}
+
+	lightHashes.Sort( HashCompare );
+	HashValue( ctx, lightHashes.Count() );
+	HashBytes( ctx, lightHashes.Base(), lightHashes.Count() * sizeof( MD5Value_t ) );
+
+	FinishHash( ctx, m_FaceBaseHashes[facenum] );
+	m_FaceOccluded[facenum] = bOccluded;
+}
+
+
+//-----------------------------------------------------------------------------
+// The final hash folds in the neighbours, since lightmaps are blended across
+// smoothed edges.
+//-----------------------------------------------------------------------------
+void CLightCache::CombineFaceHash( int facenum )
+{
+	faceneighbor_t *fn = &faceneighbor[facenum];
+
+	MD5Context_t ctx;
+	memset( &ctx, 0, sizeof( ctx ) );
+	MD5Init( &ctx );
+
+	HashValue( ctx, m_FaceBaseHashes[facenum] );
+	for ( int i=0; i < fn->numneighbors; i++ )
+	{
+		HashValue( ctx, m_FaceBaseHashes[ fn->neighbor[i] ] );
+	}
+
+	FinishHash( ctx, m_FaceHashes[facenum] );
+}
+
+
+void CLightCache::FindChangedFaces()
+{
+	if ( !m_bActive )
+		return;
+
+	double flStart = Plat_FloatTime();
+
+	BuildFaceClusters();
+
+	m_Lights.RemoveAll();
+	m_LightHashes.RemoveAll();
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		MD5Context_t ctx;
+		memset( &ctx, 0, sizeof( ctx ) );
+		MD5Init( &ctx );
+
+		// Not the cluster, texinfo or owner; those are indices that move when other things change.
+		HashValue( ctx, dl->light.origin );
+		HashValue( ctx, dl->light.intensity );
+		HashValue( ctx, dl->light.normal );
+		HashValue( ctx, dl->light.type );
+		HashValue( ctx, dl->light.style );
+		HashValue( ctx, dl->light.stopdot );
+		HashValue( ctx, dl->light.stopdot2 );
+		HashValue( ctx, dl->light.exponent );
+		HashValue( ctx, dl->light.radius );
+		HashValue( ctx, dl->light.constant_attn );
+		HashValue( ctx, dl->light.linear_attn );
+		HashValue( ctx, dl->light.quadratic_attn );
+		HashValue( ctx, dl->light.flags );
+		HashValue( ctx, dl->m_flStartFadeDistance );
+		HashValue( ctx, dl->m_flEndFadeDistance );
+		HashValue( ctx, dl->m_flCapDist );
+
+		m_Lights.AddToTail( dl );
+		FinishHash( ctx, m_LightHashes[ m_LightHashes.AddToTail() ] );
+	}
+
+	m_FaceBaseHashes.SetCount( numfaces );
+	m_FaceHashes.SetCount( numfaces );
+	m_FaceOccluded.SetCount( numfaces );
+	m_FaceCacheEntry.SetCount( numfaces );
+	m_FaceReason.SetCount( numfaces );
+	m_FaceNeedsFacelights.SetCount( numfaces );
+
+	RunThreadsOnIndividual( numfaces, false, HashFaceThread );
+
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		CombineFaceHash( facenum );
+	}
+
+	// Faces whose inputs changed, or that may be shadowed differently.
+	CUtlVector<byte> changedClusters;
+	changedClusters.SetCount( ( dvis->numclusters / 8 ) + 1 );
+	memset( changedClusters.Base(), 0, changedClusters.Count() );
+	bool bAnyChanged = false;
+
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		int iLookup = m_CacheLookup.Find( m_FaceHashes[facenum] );
+		if ( iLookup == m_CacheLookup.InvalidIndex() )
+		{
+			m_FaceReason[facenum] = FACE_CHANGED;
+		}
+		else if ( m_FaceOccluded[facenum] )
+		{
+			m_FaceReason[facenum] = FACE_OCCLUDERS;
+		}
+		else
+		{
+			m_FaceReason[facenum] = FACE_CACHED;
+			m_FaceCacheEntry[facenum] = m_CacheLookup[iLookup];
+			continue;
+		}
+
+		m_FaceCacheEntry[facenum] = -1;
+		bAnyChanged = true;
+
+		const CUtlVector<int> &clusters = m_FaceClusters[facenum];
+		for ( int i=0; i < clusters.Count(); i++ )
+		{
+			if ( clusters[i] >= 0 )
+				changedClusters[ clusters[i] >> 3 ] |= ( 1 << ( clusters[i] & 7 ) );
+		}
+	}
+
+	// Bounced light: anything that can see a changed face or a changed occluder gets relit too.
+	// This only goes one PVS hop, so the last bits of multi-bounce light further away are
+	// left as they were. Run without -relight for the reference result.
+	if ( numbounce > 0 && m_CachedFaces.Count() && ( bAnyChanged || m_ChangedCells.Count() ) )
+	{
+		for ( int iLeaf=0; iLeaf < numleafs; iLeaf++ )
+		{
+			int iCluster = dleafs[iLeaf].cluster;
+			if ( iCluster < 0 )
+				continue;
+
+			Vector mins( dleafs[iLeaf].mins[0], dleafs[iLeaf].mins[1], dleafs[iLeaf].mins[2] );
+			Vector maxs( dleafs[iLeaf].maxs[0], dleafs[iLeaf].maxs[1], dleafs[iLeaf].maxs[2] );
+			if ( TouchesChangedCell( mins, maxs ) )
+			{
+				changedClusters[ iCluster >> 3 ] |= ( 1 << ( iCluster & 7 ) );
+			}
+		}
+
+		CUtlVector<byte> bounceClusters;
+		bounceClusters.SetCount( changedClusters.Count() );
+		memset( bounceClusters.Base(), 0, bounceClusters.Count() );
+
+		byte pvs[MAX_MAP_CLUSTERS/8];
+		for ( int iCluster=0; iCluster < dvis->numclusters; iCluster++ )
+		{
+			if ( !PVSCheck( changedClusters.Base(), iCluster ) )
+				continue;
+
+			GetVisCache( -1, iCluster, pvs );
+			for ( int i=0; i < bounceClusters.Count(); i++ )
+			{
+				bounceClusters[i] |= pvs[i];
+			}
+		}
+
+		for ( int facenum=0; facenum < numfaces; facenum++ )
+		{
+			if ( m_FaceReason[facenum] != FACE_CACHED )
+				continue;
+
+			const CUtlVector<int> &clusters = m_FaceClusters[facenum];
+			for ( int i=0; i < clusters.Count(); i++ )
+			{
+				if ( clusters[i] >= 0 && PVSCheck( bounceClusters.Base(), clusters[i] ) )
+				{
+					m_FaceReason[facenum] = FACE_BOUNCE;
+					m_FaceCacheEntry[facenum] = -1;
+					break;
+				}
+			}
+		}
+	}
+
+	// Relit faces need the direct light samples of their smoothing neighbours
+	// (BuildLuxelRadial), and displacements are all blended together, so
+	// those get facelights too even though their own lightmap comes from the cache.
+	bool bDispRelit = false;
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		m_FaceNeedsFacelights[facenum] = ( m_FaceCacheEntry[facenum] == -1 );
+		if ( m_FaceNeedsFacelights[facenum] && g_pFaces[facenum].dispinfo != -1 )
+			bDispRelit = true;
+	}
+
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		if ( m_FaceCacheEntry[facenum] != -1 )
+			continue;
+
+		faceneighbor_t *fn = &faceneighbor[facenum];
+		for ( int i=0; i < fn->numneighbors; i++ )
+		{
+			m_FaceNeedsFacelights[ fn->neighbor[i] ] = true;
+		}
+	}
+
+	int nCounts[4] = { 0, 0, 0, 0 };
+	int nFacelights = 0;
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		if ( bDispRelit && g_pFaces[facenum].dispinfo != -1 )
+		{
+			m_FaceNeedsFacelights[facenum] = true;
+		}
+
+		if ( !m_FaceNeedsFacelights[facenum] )
+		{
+			g_FacesVisibleToLights[facenum >> 3] &= ~( 1 << ( facenum & 7 ) );
+		}
+
+		nCounts[ m_FaceReason[facenum] ]++;
+		nFacelights += m_FaceNeedsFacelights[facenum];
+	}
+
+	Msg( "Relighting %d of %d faces (%d changed, %d near moved occluders, %d for bounced light), "
+		"%d need facelights (%.2f seconds)\n",
+		numfaces - nCounts[FACE_CACHED], numfaces, nCounts[FACE_CHANGED], nCounts[FACE_OCCLUDERS], nCounts[FACE_BOUNCE],
+		nFacelights, Plat_FloatTime() - flStart );
+}
+
+
+void CLightCache::RestoreSkippedFaces()
+{
+	if ( !m_bActive )
+		return;
+
+	m_NewPatches.RemoveAll();
+	m_NewFirstPatch.SetCount( numfaces + 1 );
+
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		dface_t *f = &g_pFaces[facenum];
+		int iFirstPatch = g_FacePatches.Element( facenum );
+
+		if ( !m_FaceNeedsFacelights[facenum] )
+		{
+			const CachedFace_t &cached = m_CachedFaces[ m_FaceCacheEntry[facenum] ];
+			memcpy( f->styles, cached.m_Styles, sizeof( f->styles ) );
+
+			int iCached = cached.m_iFirstPatch;
+			for ( int iPatch = iFirstPatch; iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+			{
+				// Patch counts are part of the face hash.
+				Assert( iCached < cached.m_iFirstPatch + cached.m_nPatches );
+
+				CPatch *patch = &g_Patches[iPatch];
+				const CachedPatch_t &cachedPatch = m_CachedPatches[iCached++];
+				patch->samplelight = cachedPatch.m_vecSampleLight;
+				patch->samplearea = cachedPatch.m_flSampleArea;
+				patch->totallight.light[0] = cachedPatch.m_vecTotalLight;
+				patch->directlight = cachedPatch.m_vecDirectLight;
+			}
+		}
+
+		// Save the direct patch light before radiosity adds to it.
+		m_NewFirstPatch[facenum] = m_NewPatches.Count();
+		for ( int iPatch = iFirstPatch; iPatch != g_Patches.InvalidIndex(); iPatch = g_Patches[iPatch].ndxNext )
+		{
+			CPatch *patch = &g_Patches[iPatch];
+			CachedPatch_t &newPatch = m_NewPatches[ m_NewPatches.AddToTail() ];
+			newPatch.m_vecSampleLight = patch->samplelight;
+			newPatch.m_flSampleArea = patch->samplearea;
+			newPatch.m_vecTotalLight = patch->totallight.light[0];
+			newPatch.m_vecDirectLight = patch->directlight;
+		}
+	}
+	m_NewFirstPatch[numfaces] = m_NewPatches.Count();
+}
+
+
+bool CLightCache::IsFaceCached( int facenum ) const
+{
+	return m_bActive && m_FaceCacheEntry[facenum] != -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Size of the face's data in the lighting lump, including the average colors
+// stored in front of lightofs. Matches PrecompLightmapOffsets.
+//-----------------------------------------------------------------------------
+int CLightCache::GetLightmapBytes( int facenum, int &nStart ) const
+{
+	dface_t *f = &g_pFaces[facenum];
+	nStart = 0;
+
+	if ( f->lightofs == -1 || ( texinfo[f->texinfo].flags & TEX_SPECIAL ) )
+		return 0;
+
+	int lightstyles;
+	for ( lightstyles=0; lightstyles < MAXLIGHTMAPS; lightstyles++ )
+	{
+		if ( f->styles[lightstyles] == 255 )
+			break;
+	}
+
+	if ( !lightstyles )
+		return 0;
+
+	int nLuxels = ( f->m_LightmapTextureSizeInLuxels[0]+1 ) * ( f->m_LightmapTextureSizeInLuxels[1]+1 );
+	int nBumpSamples = ( texinfo[f->texinfo].flags & SURF_BUMPLIGHT ) ? NUM_BUMP_VECTS + 1 : 1;
+
+	nStart = f->lightofs - lightstyles * 4;
+	return lightstyles * 4 + nLuxels * 4 * lightstyles * nBumpSamples;
+}
+
+
+void CLightCache::Finish()
+{
+	if ( !m_bActive )
+		return;
+
+	int nCopied = 0;
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		if ( m_FaceCacheEntry[facenum] == -1 )
+			continue;
+
+		const CachedFace_t &cached = m_CachedFaces[ m_FaceCacheEntry[facenum] ];
+
+		int nStart;
+		int nBytes = GetLightmapBytes( facenum, nStart );
+		if ( nBytes != cached.m_nLightmapBytes )
+		{
+			Warning( "Cached lightmap for face %d doesn't fit (%d bytes, expected %d), delete %s and run again.\n",
+				facenum, cached.m_nLightmapBytes, nBytes, m_szFilename );
+			continue;
+		}
+
+		if ( nBytes )
+		{
+			memcpy( &(*pdlightdata)[nStart], &m_CachedLightmaps[cached.m_iFirstLightmapByte], nBytes );
+			++nCopied;
+		}
+	}
+
+	qprintf( "%d lightmaps copied from the light cache\n", nCopied );
+
+	Save();
+}
+
+
+//-----------------------------------------------------------------------------
+// File format:
+//		int			version
+//		MD5			settings hash
+//		int			cell count, then (int key, CellHash_t) per cell
+//		int			face count, then per face:
+//			MD5		face hash
+//			byte	styles[MAXLIGHTMAPS]
+//			int		patch count, then CachedPatch_t per patch
+//			int		lightmap byte count, then the bytes
+//-----------------------------------------------------------------------------
+bool CLightCache::Load()
+{
+	CUtlBuffer buf;
+	if ( !g_pFullFileSystem->ReadFile( m_szFilename, NULL, buf ) )
+		return false;
+
+	if ( buf.GetInt() != LIGHTCACHE_VERSION )
+		return false;
+
+	MD5Value_t settings;
+	buf.Get( &settings, sizeof( settings ) );
+	if ( settings != m_SettingsHash )
+	{
+		Msg( "Lighting settings changed since %s was written.\n", m_szFilename );
+		return false;
+	}
+
+	int nCells = buf.GetInt();
+	for ( int i=0; i < nCells && buf.IsValid(); i++ )
+	{
+		int nKey = buf.GetInt();
+		CellHash_t cell;
+		buf.Get( &cell, sizeof( cell ) );
+		m_OldCells.Insert( nKey, cell );
+	}
+
+	int nFaces = buf.GetInt();
+	for ( int i=0; i < nFaces && buf.IsValid(); i++ )
+	{
+		CachedFace_t &face = m_CachedFaces[ m_CachedFaces.AddToTail() ];
+		buf.Get( &face.m_Hash, sizeof( face.m_Hash ) );
+		buf.Get( face.m_Styles, sizeof( face.m_Styles ) );
+
+		face.m_nPatches = buf.GetInt();
+		face.m_iFirstPatch = m_CachedPatches.Count();
+		if ( face.m_nPatches < 0 || face.m_nPatches * (int)sizeof( CachedPatch_t ) > buf.GetBytesRemaining() )
+			break;
+		if ( face.m_nPatches )
+		{
+			m_CachedPatches.AddMultipleToTail( face.m_nPatches );
+			buf.Get( &m_CachedPatches[face.m_iFirstPatch], face.m_nPatches * sizeof( CachedPatch_t ) );
+		}
+
+		face.m_nLightmapBytes = buf.GetInt();
+		face.m_iFirstLightmapByte = m_CachedLightmaps.Count();
+		if ( face.m_nLightmapBytes < 0 || face.m_nLightmapBytes > buf.GetBytesRemaining() )
+			break;
+		if ( face.m_nLightmapBytes )
+		{
+			m_CachedLightmaps.AddMultipleToTail( face.m_nLightmapBytes );
+			buf.Get( &m_CachedLightmaps[face.m_iFirstLightmapByte], face.m_nLightmapBytes );
+		}
+	}
+
+	if ( !buf.IsValid() || m_CachedFaces.Count() != nFaces )
+	{
+		Warning( "%s is truncated or corrupt, ignoring it.\n", m_szFilename );
+		m_OldCells.Purge();
+		m_CachedFaces.Purge();
+		m_CachedPatches.Purge();
+		m_CachedLightmaps.Purge();
+		return false;
+	}
+
+	for ( int i=0; i < m_CachedFaces.Count(); i++ )
+	{
+		if ( m_CacheLookup.Find( m_CachedFaces[i].m_Hash ) == m_CacheLookup.InvalidIndex() )
+		{
+			m_CacheLookup.Insert( m_CachedFaces[i].m_Hash, i );
+		}
+	}
+
+	return true;
+}
+
+
+void CLightCache::Save()
+{
+	CUtlBuffer buf;
+
+	buf.PutInt( LIGHTCACHE_VERSION );
+	buf.Put( &m_SettingsHash, sizeof( m_SettingsHash ) );
+
+	buf.PutInt( m_NewCells.Count() );
+	for ( int i = m_NewCells.FirstInorder(); i != m_NewCells.InvalidIndex(); i = m_NewCells.NextInorder( i ) )
+	{
+		buf.PutInt( m_NewCells.Key( i ) );
+		buf.Put( &m_NewCells[i], sizeof( CellHash_t ) );
+	}
+
+	buf.PutInt( numfaces );
+	for ( int facenum=0; facenum < numfaces; facenum++ )
+	{
+		dface_t *f = &g_pFaces[facenum];
+
+		buf.Put( &m_FaceHashes[facenum], sizeof( MD5Value_t ) );
+		buf.Put( f->styles, sizeof( f->styles ) );
+
+		int nPatches = m_NewFirstPatch[facenum+1] - m_NewFirstPatch[facenum];
+		buf.PutInt( nPatches );
+		if ( nPatches )
+		{
+			buf.Put( &m_NewPatches[ m_NewFirstPatch[facenum] ], nPatches * sizeof( CachedPatch_t ) );
+		}
+
+		int nStart;
+		int nBytes = GetLightmapBytes( facenum, nStart );
+		buf.PutInt( nBytes );
+		if ( nBytes )
+		{
+			buf.Put( &(*pdlightdata)[nStart], nBytes );
+		}
+	}
+
+	if ( !g_pFullFileSystem->WriteFile( m_szFilename, NULL, buf ) )
+	{
+		Warning( "Couldn't write light cache %s\n", m_szFilename );
+		return;
+	}
+
+	Msg( "Wrote light cache %s (%.1f megs)\n", m_szFilename, buf.TellPut() / ( 1024.0f * 1024.0f ) );
+}
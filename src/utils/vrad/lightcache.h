@@ -0,0 +1,167 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-face lighting cache used for incremental relighting (-relight).
+//
+//			Every -relight run saves each face's final lightmap next to a hash
+//			of what went into it: the face's geometry and material, its
+//			smoothing neighbours, its patches and every light whose PVS reaches
+//			it. The ray trace triangles are also hashed into a coarse grid so
+//			moved occluders can be found.
+//
+//			The next -relight run rehashes everything and relights:
+//				- faces whose hash changed,
+//				- faces whose shadow volume towards one of their lights crosses
+//				  a grid cell whose occluders changed,
+//				- faces that can see (PVS) a changed area, for bounced light.
+//			Everything else skips BuildFacelights and FinalLightFace and gets
+//			its old lightmap copied back into the lighting lump. Radiosity
+//			still runs over the whole map, using the cached patch light for
+//			the faces that weren't relit.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vrad.h"
+#include "tier1/checksum_md5.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlmap.h"
+
+
+#define LIGHTCACHE_VERSION		1
+
+// Size of the grid cells used to find moved occluders.
+#define LIGHTCACHE_CELL_SIZE	256
+
+
+class CLightCache
+{
+public:
+	CLightCache();
+
+	// Loads the cache from the last run if there is one, and hashes the occluders.
+	// Must be called after the ray trace triangles are added but before
+	// the acceleration structure is built, which throws the vertices away.
+	void	Init( const char *pFilename );
+
+	bool	IsActive() const { return m_bActive; }
+
+	// Call once the lights and patches are set up. Works out which faces need
+	// lighting and clears the others out of g_FacesVisibleToLights.
+	void	FindChangedFaces();
+
+	// Call after BuildFacelights. Puts back the styles and patch light of the
+	// faces that were skipped, so radiosity sees the whole map.
+	void	RestoreSkippedFaces();
+
+	// FinalLightFace is skipped for these, their lightmap comes from the cache.
+	bool	IsFaceCached( int facenum ) const;
+
+	// Call after FinalLightFace. Copies the cached lightmaps into the lighting
+	// lump and writes out the cache for the next run.
+	void	Finish();
+
+	// Used by the threaded face hashing.
+	void	HashFace( int facenum );
+	void	CombineFaceHash( int facenum );
+
+private:
+	struct CellHash_t
+	{
+		uint32	m_nSum;
+		uint32	m_nXor;
+		int		m_nTriangles;
+
+		bool operator==( const CellHash_t &other ) const
+		{
+			return m_nSum == other.m_nSum && m_nXor == other.m_nXor && m_nTriangles == other.m_nTriangles;
+		}
+	};
+
+	struct CachedPatch_t
+	{
+		Vector	m_vecSampleLight;
+		float	m_flSampleArea;
+		Vector	m_vecTotalLight;
+		Vector	m_vecDirectLight;
+	};
+
+	struct CachedFace_t
+	{
+		MD5Value_t	m_Hash;
+		byte		m_Styles[MAXLIGHTMAPS];
+		int			m_nLightmapBytes;
+		int			m_iFirstLightmapByte;
+		int			m_nPatches;
+		int			m_iFirstPatch;
+	};
+
+	struct ChangedCell_t
+	{
+		Vector	m_vecMins;
+		Vector	m_vecMaxs;
+	};
+
+	// Face relight reasons, for stats.
+	enum
+	{
+		FACE_CACHED = 0,
+		FACE_CHANGED,
+		FACE_OCCLUDERS,
+		FACE_BOUNCE,
+	};
+
+	void	HashOccluders();
+	bool	Load();
+	void	Save();
+	void	HashSettings( MD5Value_t &hash );
+	void	BuildFaceClusters();
+	void	GetFaceBounds( int facenum, Vector &mins, Vector &maxs );
+	bool	TouchesChangedCell( const Vector &mins, const Vector &maxs ) const;
+	bool	LightVolumeTouchesChangedCell( const directlight_t *dl, const Vector &faceMins, const Vector &faceMaxs ) const;
+	int		GetLightmapBytes( int facenum, int &nStart ) const;
+
+	static bool CellLessFunc( const int &a, const int &b ) { return a < b; }
+	static bool HashLessFunc( const MD5Value_t &a, const MD5Value_t &b ) { return memcmp( a.bits, b.bits, sizeof( a.bits ) ) < 0; }
+
+	bool	m_bActive;
+	char	m_szFilename[MAX_PATH];
+	MD5Value_t	m_SettingsHash;
+
+	// Occluder grid from the last run and this one.
+	CUtlMap<int, CellHash_t>	m_OldCells;
+	CUtlMap<int, CellHash_t>	m_NewCells;
+	CUtlVector<ChangedCell_t>	m_ChangedCells;
+
+	// What the last run left behind, looked up by face hash.
+	CUtlVector<CachedFace_t>	m_CachedFaces;
+	CUtlVector<byte>			m_CachedLightmaps;
+	CUtlVector<CachedPatch_t>	m_CachedPatches;
+	CUtlMap<MD5Value_t, int>	m_CacheLookup;
+
+	// Per face state for this run.
+	CUtlVector< CUtlVector<int> >	m_FaceClusters;
+	CUtlVector<MD5Value_t>		m_FaceBaseHashes;
+	CUtlVector<MD5Value_t>		m_FaceHashes;
+	CUtlVector<byte>			m_FaceOccluded;	// shadow volume crosses a changed cell
+	CUtlVector<int>				m_FaceCacheEntry;	// -1 if the face gets relit
+	CUtlVector<byte>			m_FaceReason;
+	CUtlVector<byte>			m_FaceNeedsFacelights;
+
+	// Digest of each active light, in activelights order.
+	CUtlVector<directlight_t*>	m_Lights;
+	CUtlVector<MD5Value_t>		m_LightHashes;
+
+	// Patch light of every face after BuildFacelights, saved for the next run.
+	CUtlVector<CachedPatch_t>	m_NewPatches;
+	CUtlVector<int>				m_NewFirstPatch;
+};
+
+extern CLightCache g_LightCache;
+
+
+#endif // LIGHTCACHE_H
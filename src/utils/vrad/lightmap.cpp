@@ -12,6 +12,7 @@
 #include "mathlib/bumpvects.h"
 #include "tier1/utlvector.h"
 #include "vmpi.h"
+#include "localdist.h"
 #include "mathlib/anorms.h"
 #include "map_utils.h"
 #include "mathlib/halton.h"
@@ -3174,10 +3175,10 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
-	if (!g_bUseMPI) 
+	if ( !g_bUseMPI && !LocalDist_IsActive() ) 
 	{
 		//
-		// This is done on the master node when MPI is used
+		// This is done on the master node when MPI or -dist is used
 		//
 		BuildPatchLights( facenum );
 	}
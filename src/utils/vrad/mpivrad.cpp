@@ -29,6 +29,7 @@
 #include "mpi_stats.h"
 #include "vmpi_distribute_work.h"
 #include "vmpi_tools_shared.h"
+#include "transferstore.h"
 
 
 
@@ -296,6 +297,13 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		{
 			patch->transfers = new transfer_t[numtransfers];
 			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+
+			if ( g_TransferStore.IsActive() )
+			{
+				transfer_t *pTransfers = patch->transfers;
+				g_TransferStore.StorePatchTransfers( patch, pTransfers, numtransfers );
+				delete [] pTransfers;
+			}
 		}
 		
 		total_transfer += numtransfers;
@@ -356,8 +364,8 @@ void MPI_ProcessVisLeafs( int iThread, uint64 iWorkUnit, MessageBuffer *pBuf )
 		pBuf->write( &pData->m_nPatchesInCluster, sizeof(pData->m_nPatchesInCluster) );
 	}
 
-	// Collect the results in MPI_AddPatchData.
-	BuildVisLeafs_Cluster( iThread, pData->m_pBuildVisLeafsTransfers, iCluster, MPI_AddPatchData );
+	// Collect the results in MPI_AddPatchData. Work the master does itself keeps its transfers.
+	BuildVisLeafs_Cluster( iThread, pData->m_pBuildVisLeafsTransfers, iCluster, pBuf ? MPI_AddPatchData : NULL );
 
 	// Now send the results back..
 	if ( pBuf )
@@ -0,0 +1,225 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for patch transfer lists. See transferstore.h.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "transferstore.h"
+
+
+// Blocks are carved up between patches. Keep them a multiple of the allocation
+// granularity (64k) so they can be mapped straight out of the spill file.
+#define TRANSFER_BLOCK_SIZE			( 16 * 1024 * 1024 )
+#define TRANSFER_BLOCK_GRANULARITY	( 64 * 1024 )
+
+// Worst case: 5 byte varint + 2 byte factor.
+#define MAX_PACKED_TRANSFER_BYTES	7
+
+
+CTransferStore g_TransferStore;
+
+
+CTransferStore::CTransferStore()
+{
+	m_bActive = false;
+	m_pCur = NULL;
+	m_nCurBytesLeft = 0;
+	m_hSpillFile = INVALID_HANDLE_VALUE;
+	m_nSpillFileSize = 0;
+	m_szSpillFilename[0] = 0;
+	m_nTransfers = 0;
+	m_nPackedBytes = 0;
+	m_nBlockBytes = 0;
+}
+
+
+CTransferStore::~CTransferStore()
+{
+	Shutdown();
+}
+
+
+void CTransferStore::Init( const char *pSpillFilename )
+{
+	Assert( !m_bActive );
+	m_bActive = true;
+
+	if ( pSpillFilename )
+	{
+		Q_strncpy( m_szSpillFilename, pSpillFilename, sizeof( m_szSpillFilename ) );
+
+		m_hSpillFile = CreateFile( pSpillFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL );
+		if ( m_hSpillFile == INVALID_HANDLE_VALUE )
+			Error( "Can't create transfer spill file %s.", pSpillFilename );
+	}
+}
+
+
+void CTransferStore::Shutdown()
+{
+	for ( int i=0; i < m_Blocks.Count(); i++ )
+	{
+		if ( m_hSpillFile != INVALID_HANDLE_VALUE )
+			UnmapViewOfFile( m_Blocks[i].m_pMemory );
+		else
+			free( m_Blocks[i].m_pMemory );
+	}
+	m_Blocks.Purge();
+
+	if ( m_hSpillFile != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( m_hSpillFile );
+		m_hSpillFile = INVALID_HANDLE_VALUE;
+	}
+
+	m_pCur = NULL;
+	m_nCurBytesLeft = 0;
+	m_bActive = false;
+}
+
+
+byte *CTransferStore::AllocBlock( int nMinSize, int &nSize )
+{
+	nSize = max( nMinSize, TRANSFER_BLOCK_SIZE );
+	nSize = ( nSize + TRANSFER_BLOCK_GRANULARITY - 1 ) & ~( TRANSFER_BLOCK_GRANULARITY - 1 );
+
+	byte *pMemory;
+	if ( m_hSpillFile != INVALID_HANDLE_VALUE )
+	{
+		// Grow the file by one block and map the new part. The view keeps the
+		// mapping alive, so the mapping handle can be closed right away.
+		int64 nOffset = m_nSpillFileSize;
+		int64 nEnd = nOffset + nSize;
+
+		HANDLE hMapping = CreateFileMapping( m_hSpillFile, NULL, PAGE_READWRITE, (DWORD)( nEnd >> 32 ), (DWORD)nEnd, NULL );
+		if ( !hMapping )
+			Error( "Can't grow transfer spill file %s to %lld bytes.", m_szSpillFilename, nEnd );
+
+		pMemory = (byte*)MapViewOfFile( hMapping, FILE_MAP_ALL_ACCESS, (DWORD)( nOffset >> 32 ), (DWORD)nOffset, nSize );
+		CloseHandle( hMapping );
+
+		if ( !pMemory )
+			Error( "Can't map transfer spill file %s.", m_szSpillFilename );
+
+		m_nSpillFileSize = nEnd;
+	}
+	else
+	{
+		pMemory = (byte*)malloc( nSize );
+		if ( !pMemory )
+			Error( "Memory allocation failure" );
+	}
+
+	Block_t &block = m_Blocks[ m_Blocks.AddToTail() ];
+	block.m_pMemory = pMemory;
+	block.m_nSize = nSize;
+	m_nBlockBytes += nSize;
+
+	return pMemory;
+}
+
+
+// Must be called with the thread lock held.
+byte *CTransferStore::Alloc( int nBytes )
+{
+	if ( nBytes > m_nCurBytesLeft )
+	{
+		int nBlockSize;
+		byte *pBlock = AllocBlock( nBytes, nBlockSize );
+
+		// Oversized lists get a block of their own; keep filling the current one.
+		if ( nBytes > TRANSFER_BLOCK_SIZE / 4 && m_nCurBytesLeft > 0 )
+			return pBlock;
+
+		m_pCur = pBlock;
+		m_nCurBytesLeft = nBlockSize;
+	}
+
+	byte *pRet = m_pCur;
+	m_pCur += nBytes;
+	m_nCurBytesLeft -= nBytes;
+	return pRet;
+}
+
+
+static int TransferPatchCompare( const void *pA, const void *pB )
+{
+	return ((const transfer_t*)pA)->patch - ((const transfer_t*)pB)->patch;
+}
+
+
+void CTransferStore::StorePatchTransfers( CPatch *patch, transfer_t *pTransfers, int nTransfers )
+{
+	Assert( m_bActive );
+
+	patch->numtransfers = nTransfers;
+	patch->transfers = NULL;
+	patch->packedTransfers = NULL;
+	patch->transferScale = 0.0f;
+
+	if ( !nTransfers )
+		return;
+
+	// Sorting makes the index deltas small, and also means GatherLight reads
+	// emitlight and the other patches in order.
+	qsort( pTransfers, nTransfers, sizeof( transfer_t ), TransferPatchCompare );
+
+	float flMax = 0.0f;
+	for ( int i=0; i < nTransfers; i++ )
+	{
+		flMax = max( flMax, pTransfers[i].transfer );
+	}
+
+	float flQuantize = ( flMax > 0.0f ) ? TRANSFER_QUANTIZE_MAX / flMax : 0.0f;
+
+	// Encode outside the lock, then copy into the store.
+	CUtlVector<byte> packed;
+	packed.EnsureCapacity( nTransfers * MAX_PACKED_TRANSFER_BYTES );
+
+	int ndxPrev = 0;
+	for ( int i=0; i < nTransfers; i++ )
+	{
+		unsigned int nDelta = (unsigned int)( pTransfers[i].patch - ndxPrev );
+		ndxPrev = pTransfers[i].patch;
+
+		while ( nDelta >= 0x80 )
+		{
+			packed.AddToTail( (byte)( nDelta | 0x80 ) );
+			nDelta >>= 7;
+		}
+		packed.AddToTail( (byte)nDelta );
+
+		int q = (int)( pTransfers[i].transfer * flQuantize + 0.5f );
+		q = clamp( q, 0, TRANSFER_QUANTIZE_MAX );
+		packed.AddToTail( (byte)( q & 0xff ) );
+		packed.AddToTail( (byte)( q >> 8 ) );
+	}
+
+	ThreadLock();
+	byte *pDest = Alloc( packed.Count() );
+	m_nTransfers += nTransfers;
+	m_nPackedBytes += packed.Count();
+	ThreadUnlock();
+
+	memcpy( pDest, packed.Base(), packed.Count() );
+
+	patch->packedTransfers = pDest;
+	patch->transferScale = flMax;
+}
+
+
+void CTransferStore::PrintStats() const
+{
+	if ( !m_bActive )
+		return;
+
+	double flFloatMegs = (double)m_nTransfers * sizeof( transfer_t ) / ( 1024*1024 );
+	double flPackedMegs = (double)m_nPackedBytes / ( 1024*1024 );
+	double flBlockMegs = (double)m_nBlockBytes / ( 1024*1024 );
+
+	Msg( "compact transfers: %5.1f megs packed in %d blocks (%5.1f megs reserved%s), %5.1f megs as floats (%.2f bytes/transfer)\n",
+		flPackedMegs, m_Blocks.Count(), flBlockMegs, ( m_hSpillFile != INVALID_HANDLE_VALUE ) ? ", spilled to disk" : "",
+		flFloatMegs, m_nTransfers ? (double)m_nPackedBytes / m_nTransfers : 0.0 );
+}
@@ -0,0 +1,147 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compact storage for patch transfer lists (-compacttransfers).
+//
+//			Each patch's transfers are sorted by patch index and written as a
+//			varint delta from the previous patch index followed by a 16 bit
+//			transfer factor, quantized against the largest factor in the list.
+//			That's typically 3-4 bytes per transfer instead of 8. The lists are
+//			packed back to back into large blocks so GatherLight walks memory
+//			linearly, and the blocks can live in a memory-mapped file
+//			(-spilltransfers) so the OS can page them out instead of running
+//			out of memory.
+//
+//=============================================================================//
+
+#ifndef TRANSFERSTORE_H
+#define TRANSFERSTORE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vrad.h"
+#include "tier1/utlvector.h"
+
+
+#define TRANSFER_QUANTIZE_MAX	65535
+
+
+class CTransferStore
+{
+public:
+	CTransferStore();
+	~CTransferStore();
+
+	// pSpillFilename puts the blocks in a memory-mapped file instead of the heap.
+	void	Init( const char *pSpillFilename );
+	void	Shutdown();
+
+	bool	IsActive() const { return m_bActive; }
+
+	// Packs the (already scaled) transfers into the store and points the patch at them.
+	// pTransfers gets sorted by patch index. Thread safe.
+	void	StorePatchTransfers( CPatch *patch, transfer_t *pTransfers, int nTransfers );
+
+	void	PrintStats() const;
+
+private:
+	struct Block_t
+	{
+		byte *m_pMemory;
+		int m_nSize;
+	};
+
+	byte	*AllocBlock( int nMinSize, int &nSize );
+	byte	*Alloc( int nBytes );
+
+	bool	m_bActive;
+	CUtlVector<Block_t> m_Blocks;
+	byte	*m_pCur;
+	int		m_nCurBytesLeft;
+
+	// Spill file.
+	HANDLE	m_hSpillFile;
+	int64	m_nSpillFileSize;
+	char	m_szSpillFilename[MAX_PATH];
+
+	// Stats.
+	int64	m_nTransfers;
+	int64	m_nPackedBytes;
+	int64	m_nBlockBytes;
+};
+
+extern CTransferStore g_TransferStore;
+
+
+//-----------------------------------------------------------------------------
+// Readers used by GatherLight to walk either layout.
+//-----------------------------------------------------------------------------
+class CFloatTransferReader
+{
+public:
+	CFloatTransferReader( const CPatch *patch ) :
+		m_pCur( patch->transfers ), m_nLeft( patch->numtransfers )
+	{
+	}
+
+	FORCEINLINE bool Next( int &ndxPatch, float &flTransfer )
+	{
+		if ( !m_nLeft )
+			return false;
+
+		--m_nLeft;
+		ndxPatch = m_pCur->patch;
+		flTransfer = m_pCur->transfer;
+		++m_pCur;
+		return true;
+	}
+
+private:
+	const transfer_t *m_pCur;
+	int m_nLeft;
+};
+
+
+class CPackedTransferReader
+{
+public:
+	CPackedTransferReader( const CPatch *patch ) :
+		m_pCur( patch->packedTransfers ), m_nLeft( patch->numtransfers ), m_ndxPatch( 0 ),
+		m_flScale( patch->transferScale * ( 1.0f / TRANSFER_QUANTIZE_MAX ) )
+	{
+	}
+
+	FORCEINLINE bool Next( int &ndxPatch, float &flTransfer )
+	{
+		if ( !m_nLeft )
+			return false;
+
+		--m_nLeft;
+
+		unsigned int nDelta = 0;
+		int nShift = 0;
+		byte b;
+		do
+		{
+			b = *m_pCur++;
+			nDelta |= ( b & 0x7f ) << nShift;
+			nShift += 7;
+		} while ( b & 0x80 );
+
+		m_ndxPatch += nDelta;
+		ndxPatch = m_ndxPatch;
+
+		flTransfer = ( m_pCur[0] | ( m_pCur[1] << 8 ) ) * m_flScale;
+		m_pCur += 2;
+		return true;
+	}
+
+private:
+	const byte *m_pCur;
+	int m_nLeft;
+	int m_ndxPatch;
+	float m_flScale;
+};
+
+
+#endif // TRANSFERSTORE_H
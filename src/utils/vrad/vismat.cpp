@@ -8,6 +8,8 @@
 
 #include "vrad.h"
 #include "vmpi.h"
+#include "localdist.h"
+#include "distvrad.h"
 #ifdef MPI
 #include "messbuf.h"
 static MessageBuffer mb;
@@ -382,7 +384,8 @@ transfer_t* BuildVisLeafs_Start()
 }
 
 
-// If PatchCB is non-null, it is called after each row is generated (used by MPI).
+// If PatchCB is non-null, it is called after each row is generated (used by MPI) to send the
+// patch's transfers to the machine that keeps them, and they're freed here afterwards.
 void BuildVisLeafs_Cluster( 
 	int threadnum,
 	transfer_t *transfers, 
@@ -422,11 +425,16 @@ void BuildVisLeafs_Cluster(
 			transferMaker.Finish();
 			
 			// do the transfers
-			MakeScales( patchnum, transfers );
+			MakeScales( patchnum, transfers, PatchCB != NULL );
 
-			// Let MPI aggregate the data if it's being used.
+			// Let MPI aggregate the data if it's being used. The receiving side keeps its own copy.
 			if ( PatchCB )
+			{
 				PatchCB( threadnum, patchnum, patch );
+
+				free( patch->transfers );
+				patch->transfers = NULL;
+			}
 		}
 	}
 }
@@ -471,6 +479,10 @@ void BuildVisMatrix (void)
 	{
 		RunMPIBuildVisLeafs();
 	}
+	else if ( LocalDist_IsActive() )
+	{
+		RunDistBuildVisLeafs();
+	}
 	else 
 	{
 		RunThreadsOn (dvis->numclusters, true, BuildVisLeafs);
@@ -15,6 +15,10 @@
 #include "vmpi.h"
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
+#include "localdist.h"
+#include "distvrad.h"
+#include "transferstore.h"
+#include "lightcache.h"
 #include "leaf_ambient_lighting.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
@@ -100,6 +104,9 @@ float		reflectivityScale = 1.0;
 qboolean	do_extra = true;
 bool		debug_extra = false;
 qboolean	do_fast = false;
+bool		g_bCompactTransfers = false;
+bool		g_bSpillTransfers = false;
+bool		g_bRelight = false;
 qboolean	do_centersamples = false;
 int			extrapasses = 4;
 float		smoothing_threshold = 0.7071067; // cos(45.0*(M_PI/180)) 
@@ -1199,7 +1206,10 @@ void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers )
 }
 
 
-void MakeScales ( int ndxPatch, transfer_t *all_transfers )
+// bKeepTransfers is set when the transfers are sent to another machine (or to the -dist master)
+// as raw floats. They are left in patch->transfers, and the side that receives them stores and
+// counts them.
+void MakeScales ( int ndxPatch, transfer_t *all_transfers, bool bKeepTransfers )
 {
 	int		j;
 	float	total;
@@ -1218,11 +1228,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 			max_transfer = patch->numtransfers;
 		}
 
-
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1238,12 +1243,30 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		if ( g_TransferStore.IsActive() && !bKeepTransfers )
+		{
+			// all_transfers is this thread's scratch, so scale in place and pack from there.
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t2++)
+			{
+				t2->transfer *= total;
+			}
+
+			g_TransferStore.StorePatchTransfers( patch, all_transfers, patch->numtransfers );
+		}
+		else
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
 		}
 		if (patch->numtransfers > max_transfer)
 		{
@@ -1256,9 +1279,12 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		// patch->totallight[2] = 255;
 	}
 
-	ThreadLock ();
-	total_transfer += patch->numtransfers;
-	ThreadUnlock ();
+	if ( !bKeepTransfers )
+	{
+		ThreadLock ();
+		total_transfer += patch->numtransfers;
+		ThreadUnlock ();
+	}
 }
 
 /*
@@ -1532,110 +1558,127 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
-void GatherLight (int threadnum, void *pUserData)
+// Gathers the light for one patch. TransferReader walks the patch's transfers
+// in whichever layout they're stored in (see transferstore.h).
+template< class TransferReader >
+static void GatherPatchLight( int j, CPatch *patch, TransferReader &trans )
 {
-	int			i, j, k;
-	transfer_t	*trans;
-	int			num;
-	CPatch		*patch;
+	int			i;
+	int			ndxTransfer;
+	float		flTransfer;
 	Vector		sum, v;
 
-	while (1)
+	if ( patch->needsBumpmap )
 	{
-		j = GetThreadWork ();
-		if (j == -1)
-			break;
+		Vector delta;
+		Vector bumpSum[NUM_BUMP_VECTS+1];
+		Vector normals[NUM_BUMP_VECTS+1];
 
-		patch = &g_Patches[j];
+		// Disps
+		bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
+		if ( bDisp )
+		{
+			normals[0] = patch->normal;
+			texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+			Vector vecTexU, vecTexV;
+			PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
 
-		trans = patch->transfers;
-		num = patch->numtransfers;
-		if ( patch->needsBumpmap )
+			// use facenormal along with the smooth normal to build the three bump map vectors
+			GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+		}
+		else
 		{
-			Vector delta;
-			Vector bumpSum[NUM_BUMP_VECTS+1];
-			Vector normals[NUM_BUMP_VECTS+1];
+			GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
 
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
-			if ( bDisp )
-			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+			texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+			// use facenormal along with the smooth normal to build the three bump map vectors
+			GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
+				pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
+				normals[0], &normals[1] );
+		}
 
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
-			}
-			else
-			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+		// force the base lightmap to use the flat normal instead of the phong normal
+		// FIXME: why does the patch not use the phong normal?
+		normals[0] = patch->normal;
 
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
-					normals[0], &normals[1] );
-			}
+		for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		{
+			VectorFill( bumpSum[i], 0 );
+		}
 
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+		float dot;
+		while ( trans.Next( ndxTransfer, flTransfer ) )
+		{
+			CPatch *patch2 = &g_Patches[ndxTransfer];
 
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+			// get vector to other patch
+			VectorSubtract (patch2->origin, patch->origin, delta);
+			VectorNormalize (delta);
+			// find light emitted from other patch
+			for(i=0; i<3; i++)
 			{
-				VectorFill( bumpSum[i], 0 );
+				v[i] = emitlight[ndxTransfer][i] * patch2->reflectivity[i];
 			}
-
-			float dot;
-			for (k=0 ; k<num ; k++, trans++)
+			// remove normal already factored into transfer steradian
+			float scale = 1.0f / DotProduct (delta, patch->normal);
+			VectorScale( v, flTransfer * scale, v );
+			
+			Vector bumpTransfer;
+			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
-				CPatch *patch2 = &g_Patches[trans->patch];
-
-				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
-				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
-				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+				dot = DotProduct( delta, normals[i] );
+				if ( dot <= 0 )
 				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
-					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
-					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
+//					Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
+					continue;
 				}
+				bumpTransfer = v * dot;
+				VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
 			}
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		}
+		for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		{
+			VectorCopy( bumpSum[i], addlight[j].light[i] );
+		}
+	}
+	else
+	{
+		VectorFill( sum, 0 );
+		while ( trans.Next( ndxTransfer, flTransfer ) )
+		{
+			for(i=0; i<3; i++)
 			{
-				VectorCopy( bumpSum[i], addlight[j].light[i] );
+				v[i] = emitlight[ndxTransfer][i] * g_Patches[ndxTransfer].reflectivity[i];
 			}
+			VectorScale( v, flTransfer, v );
+			VectorAdd( sum, v, sum );
+		}
+		VectorCopy( sum, addlight[j].light[0] );
+	}
+}
+
+void GatherLight (int threadnum, void *pUserData)
+{
+	int			j;
+	CPatch		*patch;
+
+	while (1)
+	{
+		j = GetThreadWork ();
+		if (j == -1)
+			break;
+
+		patch = &g_Patches[j];
+
+		if ( patch->packedTransfers )
+		{
+			CPackedTransferReader trans( patch );
+			GatherPatchLight( j, patch, trans );
 		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
-			{
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
-				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
-			}
-			VectorCopy( sum, addlight[j].light[0] );
+			CFloatTransferReader trans( patch );
+			GatherPatchLight( j, patch, trans );
 		}
 	}
 }
@@ -1701,12 +1744,15 @@ void BounceLight (void)
 #endif
 
 	i = 0;
+	double flGatherTime = 0.0;
 	while ( bouncing )
 	{
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
+		double flGatherStart = Plat_FloatTime();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
+		flGatherTime += Plat_FloatTime() - flGatherStart;
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
 		// light is always received to leaf patches
@@ -1724,6 +1770,9 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	// Compare against a run with/without -compacttransfers to see what the packing costs.
+	Msg( "GatherLight: %.2f seconds over %d bounces (%s transfers)\n", flGatherTime, i, g_TransferStore.IsActive() ? "compact" : "float" );
 }
 
 
@@ -1924,6 +1973,20 @@ void BuildFacesVisibleToLights( bool bAllVisible )
 
 void MakeAllScales (void)
 {
+	// Workers hand their transfers back as floats, the master packs them as they come in.
+	bool bWorker = ( g_bUseMPI && !g_bMPIMaster ) || LocalDist_IsWorker();
+	if ( g_bCompactTransfers && !bWorker )
+	{
+		char szSpillFile[MAX_PATH];
+		if ( g_bSpillTransfers )
+		{
+			Q_StripExtension( source, szSpillFile, sizeof( szSpillFile ) );
+			Q_strncat( szSpillFile, ".transfers.tmp", sizeof( szSpillFile ), COPY_ALL_CHARACTERS );
+		}
+
+		g_TransferStore.Init( g_bSpillTransfers ? szSpillFile : NULL );
+	}
+
 	// determine visibility between patches
 	BuildVisMatrix ();
 	
@@ -1934,6 +1997,8 @@ void MakeAllScales (void)
 
 	qprintf ("transfer lists: %5.1f megs\n"
 		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+
+	g_TransferStore.PrintStats();
 }
 
 
@@ -1998,6 +2063,15 @@ void MakeAllScales (void)
 #endif
 
 
+static void FinalLightChangedFace( int iThread, int facenum )
+{
+	if ( !g_LightCache.IsFaceCached( facenum ) )
+	{
+		FinalLightFace( iThread, facenum );
+	}
+}
+
+
 bool RadWorld_Go()
 {
 	g_iCurFace = 0;
@@ -2019,12 +2093,19 @@ bool RadWorld_Go()
 		BuildFacesVisibleToLights( true );
 	}
 
+	// With -relight, skip the faces whose lighting can come from the light cache.
+	g_LightCache.FindChangedFaces();
+
 	// build initial facelights
 	if (g_bUseMPI) 
 	{
 		// RunThreadsOnIndividual (numfaces, true, BuildFacelights);
 		RunMPIBuildFacelights();
 	}
+	else if ( LocalDist_IsActive() )
+	{
+		RunDistBuildFacelights();
+	}
 	else 
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
@@ -2034,6 +2115,8 @@ bool RadWorld_Go()
 	if( g_pIncremental && (g_iCurFace != numfaces) )
 		return false;
 
+	g_LightCache.RestoreSkippedFaces();
+
 	// Figure out the offset into lightmap data for each face.
 	PrecompLightmapOffsets();
 	
@@ -2067,8 +2150,13 @@ bool RadWorld_Go()
 
 			MakeAllScales ();
 
+			// Local workers are done once the transfers are built.
+			LocalDist_Finish();
+
 			// spread light around
 			BounceLight ();
+
+			g_TransferStore.Shutdown();
 		}
 
 		//
@@ -2082,7 +2170,19 @@ bool RadWorld_Go()
 		// blend bounced light into direct light and save
 		VMPI_SetCurrentStage( "FinalLightFace" );
 		if ( !g_bUseMPI || g_bMPIMaster )
-			RunThreadsOnIndividual (numfaces, true, FinalLightFace);
+		{
+			if ( g_LightCache.IsActive() )
+			{
+				RunThreadsOnIndividual (numfaces, true, FinalLightChangedFace);
+			}
+			else
+			{
+				RunThreadsOnIndividual (numfaces, true, FinalLightFace);
+			}
+		}
+
+		// Put the cached lightmaps back and save the cache for next time.
+		g_LightCache.Finish();
 		
 		// Distribute the lighting data to workers.
 		VMPI_DistributeLightData();
@@ -2143,7 +2243,7 @@ void VRAD_LoadBSP( char const *pFilename )
 	// so we prepend qdir here.
 	strcpy( source, ExpandPath( source ) );
 
-	if ( !g_bUseMPI )
+	if ( !g_bUseMPI && !LocalDist_IsWorker() )
 	{
 		// Setup the logfile.
 		char logFile[512];
@@ -2268,6 +2368,23 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+	// The light cache hashes the occluders, so this has to happen before the
+	// acceleration structure is built.
+	if ( g_bRelight )
+	{
+		if ( g_bUseMPI || LocalDist_IsActive() || g_pIncremental )
+		{
+			Warning( "-relight doesn't work with -mpi, -dist or incremental lighting, relighting everything.\n" );
+		}
+		else
+		{
+			char szCacheFile[MAX_PATH];
+			Q_StripExtension( source, szCacheFile, sizeof( szCacheFile ) );
+			Q_strncat( szCacheFile, g_bHDR ? ".hdr.lightcache" : ".ldr.lightcache", sizeof( szCacheFile ), COPY_ALL_CHARACTERS );
+			g_LightCache.Init( szCacheFile );
+		}
+	}
+
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
@@ -2491,6 +2608,19 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			do_fast = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-compacttransfers" ) )
+		{
+			g_bCompactTransfers = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-spilltransfers" ) )
+		{
+			g_bCompactTransfers = true;
+			g_bSpillTransfers = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-relight" ) )
+		{
+			g_bRelight = true;
+		}
 		else if (!Q_stricmp(argv[i],"-noskyboxrecurse"))
 		{
 			g_bNoSkyRecurse = true;
@@ -2751,6 +2881,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 			}
 		}
 #endif
+		else if ( LocalDist_ParseArg( argc, argv, i ) )
+		{
+			// -dist options, handled by localdist.
+		}
 		// NOTE: the -mpi checks must come last here because they allow the previous argument 
 		// to be -mpi as well. If it game before something else like -game, then if the previous
 		// argument was -mpi and the current argument was something valid like -game, it would skip it.
@@ -2802,6 +2936,12 @@ void PrintUsage( int argc, char **argv )
 		"  -bounce #       : Set max number of bounces (default: 100).\n"
 		"  -fast           : Quick and dirty lighting.\n"
 		"  -fastambient    : Per-leaf ambient sampling is lower quality to save compute time.\n"
+		"  -compacttransfers : Store radiosity transfers quantized and packed (uses\n"
+		"                    about half the memory of the default layout).\n"
+		"  -spilltransfers : Same as -compacttransfers, but keep the packed transfers\n"
+		"                    in a memory-mapped file next to the .bsp.\n"
+		"  -relight        : Only relight faces whose inputs changed since the last\n"
+		"                    -relight run (cached in <mapname>.ldr/hdr.lightcache).\n"
 		"  -final          : High quality processing. equivalent to -extrasky 16.\n"
 		"  -extrasky n     : trace N times as many rays for indirect light and sky ambient.\n"
 		"  -low            : Run as an idle-priority process.\n"
@@ -2883,6 +3023,9 @@ void PrintUsage( int argc, char **argv )
 		}
 	}
 #endif
+
+	Warning( "Local distribution options:\n\n" );
+	LocalDist_PrintUsage();
 }
 
 int RunVRAD( int argc, char **argv )
@@ -2911,6 +3054,13 @@ int RunVRAD( int argc, char **argv )
 	CmdLib_InitFileSystem( argv[ i ] );
 	Q_FileBase( source, source, sizeof( source ) );
 
+	if ( g_bUseMPI && LocalDist_IsActive() )
+	{
+		Error( "-mpi and -dist can't be used together." );
+	}
+
+	LocalDist_Init( argc, argv, argv[i] );
+
 	VRAD_LoadBSP( argv[i] );
 
 	if ( (! onlydetail) && (! g_bOnlyStaticProps ) )
@@ -2918,6 +3068,9 @@ int RunVRAD( int argc, char **argv )
 		RadWorld_Go();
 	}
 
+	// Workers stop here if RadWorld_Go didn't already send them home.
+	LocalDist_Finish();
+
 	VRAD_ComputeOtherLighting();
 
 	VRAD_Finish();
@@ -238,6 +238,8 @@ struct CPatch
 
 	int			numtransfers;
 	transfer_t	*transfers;
+	byte		*packedTransfers;		// used instead of transfers with -compacttransfers
+	float		transferScale;			// largest transfer in packedTransfers
 
 	short		indices[3];				// displacement use these for subdivision
 };
@@ -279,6 +281,9 @@ extern float		maxchop;
 extern FileHandle_t	pFileSamples[4][4];
 extern qboolean		g_bLowPriority;
 extern qboolean		do_fast;
+extern bool			g_bCompactTransfers;
+extern bool			g_bSpillTransfers;
+extern bool			g_bRelight;
 extern bool			g_bInterrupt;		// Was used with background lighting in WC. Tells VRAD to stop lighting.
 extern IIncremental *g_pIncremental;	// null if not doing incremental lighting
 extern bool			g_bDumpPropLightmaps;
@@ -399,7 +404,7 @@ void CreateDirectLights (void);
 void GetPhongNormal( int facenum, Vector const& spot, Vector& phongnormal );
 int LightForString( char *pLight, Vector& intensity );
 void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers );
-void MakeScales( int ndxPatch, transfer_t *all_transfers );
+void MakeScales( int ndxPatch, transfer_t *all_transfers, bool bKeepTransfers );
 
 // Run startup code like initialize mathlib.
 void VRAD_Init();
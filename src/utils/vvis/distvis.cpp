@@ -0,0 +1,103 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: vvis stages distributed with localdist (-dist) instead of VMPI.
+//
+//			Every worker loads the same .bsp and .prt as the master, so the
+//			only thing that needs to travel is the portal bits each stage
+//			produces.
+//
+//=============================================================================//
+
+#include <windows.h>
+#include "vis.h"
+#include "threads.h"
+#include "localdist.h"
+#include "distvis.h"
+#include "tier1/utlbuffer.h"
+
+
+extern bool fastvis;
+
+
+static void Dist_ProcessBasePortalVis( int iThread, int iPortal, CUtlBuffer &buf )
+{
+	BasePortalVis( iThread, iPortal );
+
+	portal_t *p = &portals[iPortal];
+	buf.Put( p->portalfront, portalbytes );
+	buf.Put( p->portalflood, portalbytes );
+}
+
+
+static void Dist_ReceiveBasePortalVis( int iPortal, CUtlBuffer &buf )
+{
+	if ( buf.TellMaxPut() != portalbytes*2 )
+		Error( "Invalid BasePortalVis results for portal %d.", iPortal );
+
+	// Workers get every portal back, including the ones they did themselves.
+	portal_t *p = &portals[iPortal];
+	if ( !p->portalfront )
+	{
+		p->portalfront = (byte*)malloc( portalbytes );
+		p->portalflood = (byte*)malloc( portalbytes );
+		p->portalvis = (byte*)malloc( portalbytes );
+		memset( p->portalvis, 0, portalbytes );
+	}
+
+	buf.Get( p->portalfront, portalbytes );
+	buf.Get( p->portalflood, portalbytes );
+
+	p->nummightsee = CountBits( p->portalflood, g_numportals*2 );
+}
+
+
+//-----------------------------------------
+//
+// Run BasePortalVis across the local workers. PortalFlow needs
+// every portal's flood bits, so the workers get the merged results too.
+//
+void RunDistBasePortalVis()
+{
+	LocalDist_DistributeWork(
+		"BasePortalVis:",
+		g_numportals * 2,
+		Dist_ProcessBasePortalVis,
+		Dist_ReceiveBasePortalVis,
+		!fastvis );
+}
+
+
+static void Dist_ProcessPortalFlow( int iThread, int iPortal, CUtlBuffer &buf )
+{
+	PortalFlow( iThread, iPortal );
+
+	portal_t *p = sorted_portals[iPortal];
+	buf.Put( p->portalvis, portalbytes );
+}
+
+
+static void Dist_ReceivePortalFlow( int iPortal, CUtlBuffer &buf )
+{
+	if ( buf.TellMaxPut() != portalbytes )
+		Error( "Invalid PortalFlow results for portal %d.", iPortal );
+
+	portal_t *p = sorted_portals[iPortal];
+	buf.Get( p->portalvis, portalbytes );
+	p->status = stat_done;
+}
+
+
+//-----------------------------------------
+//
+// Run PortalFlow across the local workers. Unlike the VMPI version the
+// finished portals aren't multicast to the other workers while the stage
+// runs, so workers can't use them to cut their own flows short.
+//
+void RunDistPortalFlow()
+{
+	LocalDist_DistributeWork(
+		"PortalFlow:",
+		g_numportals * 2,
+		Dist_ProcessPortalFlow,
+		Dist_ReceivePortalFlow );
+}
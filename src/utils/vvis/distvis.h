@@ -0,0 +1,18 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: vvis stages distributed with localdist (-dist) instead of VMPI.
+//
+//=============================================================================//
+
+#ifndef DISTVIS_H
+#define DISTVIS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+void RunDistBasePortalVis();
+void RunDistPortalFlow();
+
+
+#endif // DISTVIS_H
@@ -7,6 +7,7 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include <emmintrin.h>
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -29,13 +30,28 @@ int g_TraceClusterStop = -1;
   void CalcMightSee (leaf_t *leaf, 
 */
 
+static inline int PopCount64( uint64 x )
+{
+	x = x - ( ( x >> 1 ) & 0x5555555555555555ull );
+	x = ( x & 0x3333333333333333ull ) + ( ( x >> 2 ) & 0x3333333333333333ull );
+	x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0full;
+	return (int)( ( x * 0x0101010101010101ull ) >> 56 );
+}
+
 int CountBits (byte *bits, int numbits)
 {
 	int		i;
 	int		c;
 
 	c = 0;
-	for (i=0 ; i<numbits ; i++)
+
+	// whole 64 bit words first, then whatever is left over
+	int nWords = numbits >> 6;
+	const uint64 *words = (const uint64 *)bits;
+	for (i=0 ; i<nWords ; i++)
+		c += PopCount64( words[i] );
+
+	for (i=nWords<<6 ; i<numbits ; i++)
 		if ( CheckBit( bits, i ) )
 			c++;
 
@@ -467,6 +483,105 @@ void WritePortalTrace( const char *source )
 	Warning("Wrote %s!!!\n", filename);
 }
 
+/*
+==================
+Portal bit vector kernels
+
+portalbytes is always a multiple of 8 (see LoadPortals), so the portal
+vectors are walked as 64 bit words, two at a time with SSE2. Each stack
+level also remembers which words of its mightsee can be nonzero, so
+deeper levels only look at the part of the vector that's still alive.
+==================
+*/
+
+static inline int PortalWords()
+{
+	return portalbytes >> 3;
+}
+
+static inline bool MightSeePortal( const pstack_t *stack, int pnum )
+{
+	int word = pnum >> 6;
+	if ( word < stack->mightlo || word >= stack->mighthi )
+		return false;
+
+	return CheckBit( stack->mightsee, pnum ) != 0;
+}
+
+// stack->mightsee = prev->mightsee & test over the live words of prev.
+// Returns true if that sees anything that isn't in vis yet.
+static bool FlowMightSee( pstack_t *stack, const pstack_t *prev, const byte *test, const byte *vis )
+{
+	const uint64 *a = (const uint64 *)prev->mightsee;
+	const uint64 *b = (const uint64 *)test;
+	const uint64 *v = (const uint64 *)vis;
+	uint64 *out = (uint64 *)stack->mightsee;
+
+	int lo = prev->mightlo;
+	int hi = prev->mighthi;
+	int first = hi;
+	int last = lo;
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i more = zero;
+
+	int i = lo;
+	for ( ; i + 2 <= hi; i += 2 )
+	{
+		__m128i m = _mm_and_si128( _mm_loadu_si128( (const __m128i *)( a + i ) ), _mm_loadu_si128( (const __m128i *)( b + i ) ) );
+		_mm_storeu_si128( (__m128i *)( out + i ), m );
+
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( m, zero ) ) != 0xffff )
+		{
+			if ( first == hi )
+				first = i;
+			last = i + 2;
+			more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)( v + i ) ), m ) );
+		}
+	}
+
+	uint64 moretail = 0;
+	for ( ; i < hi; i++ )
+	{
+		out[i] = a[i] & b[i];
+		if ( out[i] )
+		{
+			if ( first == hi )
+				first = i;
+			last = i + 1;
+			moretail |= out[i] & ~v[i];
+		}
+	}
+
+	stack->mightlo = first;
+	stack->mighthi = ( first == hi ) ? first : last;
+
+	return moretail || _mm_movemask_epi8( _mm_cmpeq_epi8( more, zero ) ) != 0xffff;
+}
+
+// dest |= src
+static void OrPortalBits( byte *dest, const byte *src )
+{
+	uint64 *d = (uint64 *)dest;
+	const uint64 *s = (const uint64 *)src;
+	int nWords = PortalWords();
+	for ( int i=0 ; i<nWords ; i++ )
+		d[i] |= s[i];
+}
+
+// popcount( a & b )
+static int CountBitsAnd( const byte *a, const byte *b )
+{
+	const uint64 *pa = (const uint64 *)a;
+	const uint64 *pb = (const uint64 *)b;
+	int nWords = PortalWords();
+	int c = 0;
+	for ( int i=0 ; i<nWords ; i++ )
+		c += PopCount64( pa[i] & pb[i] );
+	return c;
+}
+
+
 /*
 ==================
 RecursiveLeafFlow
@@ -481,8 +596,8 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		*test, *might, *vis, more;
+	int			i;
+	byte		*test, *vis;
 	int			pnum;
 
 	// Early-out if we're a VMPI worker that's told to exit. If we don't do this here, then the
@@ -506,17 +621,19 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.leaf = leaf;
 	stack.portal = NULL;
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
+	vis = thread->portalvis;
 	
 	// check all portals for flowing into other leafs	
 	for (i=0 ; i<leaf->portals.Count() ; i++)
 	{
+		// split portals only take one way out of the first leaf
+		if ( thread->branch >= 0 && prevstack == &thread->pstack_head && i != thread->branch )
+			continue;
 
 		p = leaf->portals[i];
 		pnum = p - portals;
 
-		if ( ! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
+		if ( !MightSeePortal( prevstack, pnum ) )
 		{
 			continue;	// can't possibly see it
 		}
@@ -524,21 +641,16 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		// if the portal can't see anything we haven't allready seen, skip it
 		if (p->status == stat_done)
 		{
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		bool more = FlowMightSee( &stack, prevstack, test, vis );
 		
-		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
+		if ( !more && CheckBit( vis, pnum ) )
 		{	// can't see anything new
 			continue;
 		}
@@ -594,7 +706,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		{	// the second leaf can only be blocked if coplanar
 
 			// mark the portal as visible
-			SetBit( thread->base->portalvis, pnum );
+			SetBit( vis, pnum );
 
 			RecursiveLeafFlow (p->leaf, thread, &stack);
 			continue;
@@ -609,7 +721,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			continue;
 
 		// mark the portal as visible
-		SetBit( thread->base->portalvis, pnum );
+		SetBit( vis, pnum );
 
 		// flow through it for real
 		RecursiveLeafFlow (p->leaf, thread, &stack);
@@ -617,6 +729,29 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 }
 
 
+// Flows out of p into portalvis, either through every portal of its leaf or just one of them.
+static int FlowFromPortal( portal_t *p, byte *portalvis, int branch )
+{
+	threaddata_t	data;
+
+	memset (&data, 0, sizeof(data));
+	data.base = p;
+	data.portalvis = portalvis;
+	data.branch = branch;
+	
+	data.pstack_head.portal = p;
+	data.pstack_head.source = p->winding;
+	data.pstack_head.portalplane = p->plane;
+	data.pstack_head.mightlo = 0;
+	data.pstack_head.mighthi = PortalWords();
+	memcpy( data.pstack_head.mightsee, p->portalflood, portalbytes );
+
+	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
+
+	return data.c_chains;
+}
+
+
 /*
 ===============
 PortalFlow
@@ -626,34 +761,174 @@ generates the portalvis bit vector
 */
 void PortalFlow (int iThread, int portalnum)
 {
-	threaddata_t	data;
-	int				i;
 	portal_t		*p;
-	int				c_might, c_can;
+	int				c_might, c_can, c_chains;
 
 	p = sorted_portals[portalnum];
 	p->status = stat_working;
 				
 	c_might = CountBits (p->portalflood, g_numportals*2);
 
-	memset (&data, 0, sizeof(data));
-	data.base = p;
-	
-	data.pstack_head.portal = p;
-	data.pstack_head.source = p->winding;
-	data.pstack_head.portalplane = p->plane;
-	for (i=0 ; i<portallongs ; i++)
-		((long *)data.pstack_head.mightsee)[i] = ((long *)p->portalflood)[i];
-
-	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
-
+	c_chains = FlowFromPortal( p, p->portalvis, -1 );
 
 	p->status = stat_done;
 
 	c_can = CountBits (p->portalvis, g_numportals*2);
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
-		(int)(p - portals),	c_might, c_can, data.c_chains);
+		(int)(p - portals),	c_might, c_can, c_chains);
+}
+
+
+/*
+===============
+EstimatePortalFlowCost
+
+Rough cost of PortalFlow for a portal: how much of the mightsee vector
+survives the first step through each way out of its leaf.
+===============
+*/
+void EstimatePortalFlowCost (int iThread, int portalnum)
+{
+	portal_t	*p = portals + portalnum;
+	leaf_t		*leaf = &leafs[p->leaf];
+
+	p->flowcost = 1;
+	for ( int i=0 ; i<leaf->portals.Count() ; i++ )
+	{
+		portal_t *next = leaf->portals[i];
+		if ( CheckBit( p->portalflood, next - portals ) )
+		{
+			p->flowcost += CountBitsAnd( p->portalflood, next->portalflood );
+		}
+	}
+}
+
+
+/*
+===============
+RunPortalFlow
+
+Threaded PortalFlow over sorted_portals. The portals are still handed out
+cheapest first so the expensive ones can use the finished portalvis of the
+cheap ones, but anything much more expensive than average is split into
+one task per way out of its leaf. Otherwise the last few portals run on
+one thread each while the rest sit idle.
+===============
+*/
+struct portalflowtask_t
+{
+	int		sortedindex;	// into sorted_portals
+	int		branch;			// -1 for the whole portal
+};
+
+static CUtlVector<portalflowtask_t>	g_PortalFlowTasks;
+static CUtlVector<int>				g_PortalFlowTasksLeft;
+static CUtlVector<int>				g_PortalFlowChains;
+
+static void PortalFlowTask (int iThread, int iTask)
+{
+	const portalflowtask_t &task = g_PortalFlowTasks[iTask];
+	if ( task.branch < 0 )
+	{
+		PortalFlow( iThread, task.sortedindex );
+		return;
+	}
+
+	portal_t *p = sorted_portals[task.sortedindex];
+	p->status = stat_working;
+
+	byte *vis = (byte*)malloc( portalbytes );
+	memset( vis, 0, portalbytes );
+
+	int c_chains = FlowFromPortal( p, vis, task.branch );
+
+	ThreadLock();
+
+	OrPortalBits( p->portalvis, vis );
+	g_PortalFlowChains[task.sortedindex] += c_chains;
+
+	if ( --g_PortalFlowTasksLeft[task.sortedindex] == 0 )
+	{
+		p->status = stat_done;
+
+		qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains, split)\n", 
+			(int)(p - portals),	p->nummightsee, CountBits( p->portalvis, g_numportals*2 ), g_PortalFlowChains[task.sortedindex]);
+	}
+
+	ThreadUnlock();
+
+	free( vis );
+}
+
+void RunPortalFlow (void)
+{
+	int nPortals = g_numportals*2;
+
+	double flTotalCost = 0;
+	for ( int i=0 ; i<nPortals ; i++ )
+	{
+		flTotalCost += portals[i].flowcost;
+	}
+
+	// Split anything that would be more than a small slice of one thread's share.
+	double flSplitCost = flTotalCost / ( max( numthreads, 1 ) * 16 );
+
+	g_PortalFlowTasks.RemoveAll();
+	g_PortalFlowTasksLeft.SetCount( nPortals );
+	g_PortalFlowChains.SetCount( nPortals );
+
+	int nSplit = 0;
+	for ( int i=0 ; i<nPortals ; i++ )
+	{
+		portal_t *p = sorted_portals[i];
+		leaf_t *leaf = &leafs[p->leaf];
+
+		g_PortalFlowTasksLeft[i] = 0;
+		g_PortalFlowChains[i] = 0;
+
+		if ( numthreads > 1 && p->flowcost > flSplitCost )
+		{
+			for ( int j=0 ; j<leaf->portals.Count() ; j++ )
+			{
+				if ( !CheckBit( p->portalflood, leaf->portals[j] - portals ) )
+					continue;
+
+				portalflowtask_t &task = g_PortalFlowTasks[ g_PortalFlowTasks.AddToTail() ];
+				task.sortedindex = i;
+				task.branch = j;
+				g_PortalFlowTasksLeft[i]++;
+			}
+		}
+
+		if ( g_PortalFlowTasksLeft[i] > 1 )
+		{
+			nSplit++;
+			continue;
+		}
+
+		// Not worth splitting, or only one way out.
+		if ( g_PortalFlowTasksLeft[i] == 1 )
+		{
+			g_PortalFlowTasks.RemoveMultipleFromTail( 1 );
+		}
+
+		portalflowtask_t &task = g_PortalFlowTasks[ g_PortalFlowTasks.AddToTail() ];
+		task.sortedindex = i;
+		task.branch = -1;
+		g_PortalFlowTasksLeft[i] = 1;
+	}
+
+	double flStart = Plat_FloatTime();
+
+	RunThreadsOnIndividual (g_PortalFlowTasks.Count(), true, PortalFlowTask);
+
+	Msg ("PortalFlow: %d portals, %d split into %d tasks (%.2f seconds)\n",
+		nPortals, nSplit, g_PortalFlowTasks.Count(), Plat_FloatTime() - flStart );
+
+	g_PortalFlowTasks.Purge();
+	g_PortalFlowTasksLeft.Purge();
+	g_PortalFlowChains.Purge();
 }
 
 
@@ -56,6 +56,7 @@ struct portal_t
 	byte		*portalvis;		// [portals], final
 
 	int			nummightsee;	// bit count on portalflood for sort
+	int			flowcost;		// estimated PortalFlow cost, for sorting and splitting
 };
 
 struct leaf_t
@@ -67,6 +68,7 @@ struct leaf_t
 struct pstack_t
 {
 	byte		mightsee[MAX_PORTALS/8];		// bit string
+	int			mightlo, mighthi;		// range of 64 bit words in mightsee that can be nonzero
 	pstack_t	*next;
 	leaf_t		*leaf;
 	portal_t	*portal;	// portal exiting
@@ -82,6 +84,8 @@ struct pstack_t
 struct threaddata_t
 {
 	portal_t	*base;
+	byte		*portalvis;		// where the results go, base->portalvis unless the portal was split
+	int			branch;			// only flow through this portal out of the base leaf, -1 for all
 	int			c_chains;
 	pstack_t	pstack_head;
 };
@@ -113,6 +117,8 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+void EstimatePortalFlowCost (int iThread, int portalnum);
+void RunPortalFlow (void);
 void WritePortalTrace( const char *source );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
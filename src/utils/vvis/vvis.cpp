@@ -14,6 +14,8 @@
 #include "pacifier.h"
 #include "vmpi.h"
 #include "mpivis.h"
+#include "localdist.h"
+#include "distvis.h"
 #include "tier1/strtools.h"
 #include "collisionutils.h"
 #include "tier0/icommandline.h"
@@ -121,17 +123,20 @@ void prl(leaf_t *l)
 SortPortals
 
 Sorts the portals from the least complex, so the later ones can reuse
-the earlier information.
+the earlier information. Complexity is the estimated flow cost rather
+than just the mightsee count, and ties go by portal number so the order
+doesn't depend on qsort.
 =============
 */
 int PComp (const void *a, const void *b)
 {
-	if ( (*(portal_t **)a)->nummightsee == (*(portal_t **)b)->nummightsee)
-		return 0;
-	if ( (*(portal_t **)a)->nummightsee < (*(portal_t **)b)->nummightsee)
-		return -1;
+	portal_t *pa = *(portal_t **)a;
+	portal_t *pb = *(portal_t **)b;
 
-	return 1;
+	if ( pa->flowcost != pb->flowcost )
+		return ( pa->flowcost < pb->flowcost ) ? -1 : 1;
+
+	return ( pa < pb ) ? -1 : ( ( pa > pb ) ? 1 : 0 );
 }
 
 void BuildTracePortals( int clusterStart )
@@ -151,6 +156,9 @@ void SortPortals (void)
 	for (i=0 ; i<g_numportals*2 ; i++)
 		sorted_portals[i] = &portals[i];
 
+	// RunPortalFlow also uses the cost to decide which portals to split.
+	RunThreadsOnIndividual (g_numportals*2, false, EstimatePortalFlowCost);
+
 	if (nosort)
 		return;
 	qsort (sorted_portals, g_numportals*2, sizeof(sorted_portals[0]), PComp);
@@ -306,9 +314,13 @@ void CalcPortalVis (void)
 	{
  		RunMPIPortalFlow();
 	}
+	else if ( LocalDist_IsActive() )
+	{
+		RunDistPortalFlow();
+	}
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		RunPortalFlow ();
 	}
 }
 
@@ -331,19 +343,30 @@ void CalcVis (void)
 {
 	int		i;
 
+	double flStart = Plat_FloatTime();
+
 	if (g_bUseMPI) 
 	{
 		RunMPIBasePortalVis();
 	}
+	else if ( LocalDist_IsActive() )
+	{
+		RunDistBasePortalVis();
+	}
 	else 
 	{
 	    RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
 	}
 
+	Msg ("BasePortalVis: %.2f seconds\n", Plat_FloatTime() - flStart);
+
 	SortPortals ();
 
 	CalcPortalVis ();
 
+	// Local workers are done once the portal flow is in.
+	LocalDist_Finish();
+
 	//
 	// assemble the leaf vis lists by oring the portal lists
 	//
@@ -968,6 +991,10 @@ int ParseCommandLine( int argc, char **argv )
 		{
 			// nothing to do here, but don't bail on this option
 		}
+		else if ( LocalDist_ParseArg( argc, argv, i ) )
+		{
+			// -dist options, handled by localdist.
+		}
 		// NOTE: the -mpi checks must come last here because they allow the previous argument 
 		// to be -mpi as well. If it game before something else like -game, then if the previous
 		// argument was -mpi and the current argument was something valid like -game, it would skip it.
@@ -1065,6 +1092,9 @@ void PrintUsage( int argc, char **argv )
 		}
 	}
 #endif
+
+	Warning( "Local distribution options:\n\n" );
+	LocalDist_PrintUsage();
 }
 
 
@@ -1107,10 +1137,17 @@ int RunVVis( int argc, char **argv )
 		CmdLib_Exit( 1 );
 	}
 
+	if ( g_bUseMPI && LocalDist_IsActive() )
+	{
+		Error( "-mpi and -dist can't be used together." );
+	}
+
+	LocalDist_Init( argc, argv, argv[argc-1] );
+
 	start = Plat_FloatTime();
 
 
-	if (!g_bUseMPI)
+	if ( !g_bUseMPI && !LocalDist_IsWorker() )
 	{
 		// Setup the logfile.
 		char logFile[512];